@@ -0,0 +1,69 @@
+#include "bench.h"
+#include "core/memory.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+
+using namespace std;
+
+uint64_t benchAllocationCount() {
+	return MemoryCounters::heapAllocations();
+}
+
+uint64_t benchAllocatedBytes() {
+	return MemoryCounters::heapAllocatedBytes();
+}
+
+double benchNowSeconds() {
+	return chrono::duration<double>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+BenchRunner::BenchRunner() {
+	this->minSampleSeconds = 0.1;
+	this->samples = 5;
+}
+
+bool BenchRunner::selected(const string& name) const {
+	return this->filter.empty() || name.find(this->filter) != string::npos;
+}
+
+void BenchRunner::report(const string& name, uint64_t iterations, double seconds, uint64_t items, uint64_t bytes,
+                         uint64_t allocations, uint64_t allocated) {
+	BenchResult result;
+	result.name = name;
+	result.iterations = iterations;
+	result.nsPerOp = seconds * 1.0e9 / iterations;
+	result.itemsPerSecond = items > 0 ? items * iterations / seconds : 0.0;
+	result.bytesPerSecond = bytes > 0 ? bytes * iterations / seconds : 0.0;
+	result.allocationsPerOp = (double)allocations / iterations;
+	result.allocatedBytesPerOp = (double)allocated / iterations;
+	this->results.push_back(result);
+	cout << left << setw(44) << name << right << fixed << setprecision(1) << setw(14) << result.nsPerOp << " ns/op";
+	if (result.itemsPerSecond > 0.0) {
+		cout << setw(12) << setprecision(2) << result.itemsPerSecond / 1.0e6 << " Mitem/s";
+	}
+	if (result.bytesPerSecond > 0.0) {
+		cout << setw(12) << setprecision(1) << result.bytesPerSecond / (1024.0 * 1024.0) << " MB/s";
+	}
+	cout << setw(10) << setprecision(1) << result.allocationsPerOp << " allocs/op"
+	     << setw(12) << setprecision(0) << result.allocatedBytesPerOp << " B/op" << endl;
+}
+
+bool BenchRunner::writeCsv(const char* path) const {
+	ofstream file(path, ios::trunc);
+	if (!file) {
+		return false;
+	}
+	file << "name,iterations,ns_per_op,items_per_second,bytes_per_second,allocs_per_op,alloc_bytes_per_op" << endl;
+	file << setprecision(9);
+	for (size_t i = 0; i < this->results.size(); i++) {
+		const BenchResult& r = this->results[i];
+		file << r.name << "," << r.iterations << "," << r.nsPerOp << "," << r.itemsPerSecond << "," << r.bytesPerSecond
+		     << "," << r.allocationsPerOp << "," << r.allocatedBytesPerOp << endl;
+	}
+	return (bool)file;
+}
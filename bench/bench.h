@@ -0,0 +1,97 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <algorithm>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// Minimal CPU benchmark harness. Each case is run in batches until a batch
+// takes long enough to time reliably, then sampled several times; the median
+// sample is reported together with the heap allocations made per operation.
+
+// Keeps the compiler from discarding a computed value
+template <typename T>
+inline void doNotOptimize(const T& value) {
+#if defined(__GNUC__)
+    // The asm may read anything through the pointer, so the value has to be in memory
+    asm volatile("" : : "r"(&value) : "memory");
+#else
+    static const void* volatile sink;
+    sink = &value;
+#endif
+}
+
+struct BenchResult {
+    std::string name;
+    uint64_t iterations;
+    double nsPerOp;
+    double itemsPerSecond;      // 0 if the case did not declare items
+    double bytesPerSecond;      // 0 if the case did not declare bytes
+    double allocationsPerOp;
+    double allocatedBytesPerOp;
+};
+
+class BenchRunner {
+    public:
+    double minSampleSeconds;
+    int samples;
+    std::string filter;
+    std::vector<BenchResult> results;
+
+    BenchRunner();
+    // Run op() repeatedly; items and bytes are the work done by one call
+    template <typename Function>
+    void run(const std::string& name, uint64_t items, uint64_t bytes, Function op);
+    bool writeCsv(const char* path) const;
+
+    private:
+    bool selected(const std::string& name) const;
+    void report(const std::string& name, uint64_t iterations, double seconds, uint64_t items, uint64_t bytes,
+                uint64_t allocations, uint64_t allocatedBytes);
+};
+
+// Global counters fed by the operator new replacement in core/memory.cpp; C
+// code calling malloc directly (stb_image) is not counted
+uint64_t benchAllocationCount();
+uint64_t benchAllocatedBytes();
+double benchNowSeconds();
+
+template <typename Function>
+void BenchRunner::run(const std::string& name, uint64_t items, uint64_t bytes, Function op) {
+    if (!selected(name)) {
+        return;
+    }
+    // Warm up and find a batch size that runs for at least minSampleSeconds
+    op();
+    uint64_t batch = 1;
+    while (true) {
+        double start = benchNowSeconds();
+        for (uint64_t i = 0; i < batch; i++) {
+            op();
+        }
+        double elapsed = benchNowSeconds() - start;
+        if (elapsed >= this->minSampleSeconds || batch >= (1ull << 30)) {
+            break;
+        }
+        batch = elapsed > 0.0 ? (uint64_t)(batch * 1.5 * this->minSampleSeconds / elapsed) + 1 : batch * 10;
+    }
+
+    std::vector<double> times;
+    uint64_t allocations = 0, allocatedBytes = 0;
+    for (int s = 0; s < this->samples; s++) {
+        uint64_t allocationsBefore = benchAllocationCount();
+        uint64_t bytesBefore = benchAllocatedBytes();
+        double start = benchNowSeconds();
+        for (uint64_t i = 0; i < batch; i++) {
+            op();
+        }
+        times.push_back(benchNowSeconds() - start);
+        allocations += benchAllocationCount() - allocationsBefore;
+        allocatedBytes += benchAllocatedBytes() - bytesBefore;
+    }
+    std::sort(times.begin(), times.end());
+    report(name, batch, times[times.size() / 2], items, bytes, allocations / this->samples, allocatedBytes / this->samples);
+}
+
+#endif
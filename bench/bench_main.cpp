@@ -0,0 +1,475 @@
+#include "bench.h"
+#include "static_model.h"
+#include "core/job_system.h"
+#include "core/memory.h"
+#include "core/startup_trace.h"
+#include "scene/animation.h"
+#include "scene/city_streamer.h"
+#include "scene/placement.h"
+#include "scene/scene_query.h"
+#include "scene/scene_file.h"
+#include "scene/traffic.h"
+#include "stb_image.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <thread>
+
+using namespace std;
+
+// Run from the build directory like emerald_isle, so asset paths match the app's
+static const char* modelPaths[] = {
+	"../src/assets/Cube/Cube.gltf",
+	"../src/assets/covered_car/covered_car_1k.gltf",
+	"../src/assets/quiver_tree/quiver_tree_02_1k.gltf",
+	"../src/assets/concrete_road_barrier/concrete_road_barrier_1k.gltf",
+	"../src/assets/airplane/airplane.glb",
+};
+static const char* texturePaths[] = {
+	"../src/assets/textures/building.jpg",
+	"../src/assets/textures/sky.png",
+	"../src/assets/quiver_tree/textures/quiver_tree_02_diff_1k.jpg",
+	"../src/assets/covered_car/textures/covered_car_nor_gl_1k.jpg",
+};
+static const char* scenePath = "../src/scenes/city.scene";
+
+static string baseName(const string& path) {
+	size_t slash = path.find_last_of('/');
+	return slash == string::npos ? path : path.substr(slash + 1);
+}
+
+static string caseName(const char* group, const string& detail) {
+	return string(group) + "/" + detail;
+}
+
+static string caseName(const char* group, size_t count) {
+	stringstream stream;
+	stream << group << "/" << count;
+	return stream.str();
+}
+
+// Mutes the loaders' progress logging while timing them
+class QuietStdout {
+	public:
+	QuietStdout() { this->previous = cout.rdbuf(nullptr); }
+	~QuietStdout() { cout.rdbuf(this->previous); cout.clear(); }
+
+	private:
+	streambuf* previous;
+};
+
+static bool readFile(const char* path, vector<unsigned char>& data) {
+	ifstream file(path, ios::binary | ios::ate);
+	if (!file) {
+		return false;
+	}
+	data.resize((size_t)file.tellg());
+	file.seekg(0);
+	return (bool)file.read((char*)data.data(), data.size());
+}
+
+static void benchModelLoading(BenchRunner& runner) {
+	for (size_t i = 0; i < sizeof(modelPaths) / sizeof(modelPaths[0]); i++) {
+		const char* path = modelPaths[i];
+		uint64_t size = StartupTrace::fileSize(path);
+		if (size == 0) {
+			cout << "skipping " << path << " (not found)" << endl;
+			continue;
+		}
+		runner.run(caseName("loadModel", baseName(path)), 0, size, [path]() {
+			QuietStdout quiet;
+			StaticModel model;
+			model.loadModel(path);
+			doNotOptimize(model.model.nodes.size());
+		});
+	}
+}
+
+static void benchNodeTransforms(BenchRunner& runner) {
+	for (size_t i = 0; i < sizeof(modelPaths) / sizeof(modelPaths[0]); i++) {
+		StaticModel* model = new StaticModel();
+		bool loaded;
+		{
+			QuietStdout quiet;
+			loaded = model->loadModel(modelPaths[i]);
+		}
+		if (!loaded || model->model.nodes.empty()) {
+			delete model;
+			continue;
+		}
+		runner.run(caseName("getNodeTransform", baseName(modelPaths[i])), model->model.nodes.size(), 0, [model]() {
+			for (size_t n = 0; n < model->model.nodes.size(); n++) {
+				glm::mat4 transform = model->getNodeTransform(model->model.nodes[n]);
+				doNotOptimize(transform);
+			}
+		});
+		delete model;
+	}
+}
+
+static void benchPlacement(BenchRunner& runner) {
+	size_t counts[] = { 1000, 10000, 100000, 1000000 };
+	for (size_t c = 0; c < sizeof(counts) / sizeof(counts[0]); c++) {
+		size_t count = counts[c];
+		PlacementStreams* streams = new PlacementStreams();
+		scatterRing(*streams, count, 7, 3000.0f, 1500.0f, 150.0f);
+		vector<glm::mat4>* out = new vector<glm::mat4>(count);
+
+		runner.run(caseName("scatterRing", count), count, 0, [streams, count]() {
+			scatterRing(*streams, count, 7, 3000.0f, 1500.0f, 150.0f, 1);
+		});
+		runner.run(caseName("composeTransforms", count), count, count * sizeof(glm::mat4), [streams, out, count]() {
+			composeTransforms(*streams, 0, count, out->data());
+			doNotOptimize((*out)[count - 1]);
+		});
+		runner.run(caseName("composeTransformsParallel", count), count, count * sizeof(glm::mat4), [streams, out, count]() {
+			composeTransformsParallel(*streams, out->data());
+			doNotOptimize((*out)[count - 1]);
+		});
+		delete out;
+		delete streams;
+	}
+}
+
+// A 32-node tree with a linear rotation and translation channel on every node, 30 keys each
+static void buildSyntheticRig(Animator& animator) {
+	const int nodes = 32, keys = 30;
+	NodeHierarchy& hierarchy = animator.hierarchy;
+	hierarchy.rest.resize(nodes);
+	for (int i = 0; i < nodes; i++) {
+		hierarchy.parent.push_back(i == 0 ? -1 : (i - 1) / 2);
+		hierarchy.mesh.push_back(i);
+		hierarchy.source.push_back(i);
+		hierarchy.flatIndex.push_back(i);
+		hierarchy.matrix.push_back(glm::mat4(1.0f));
+		hierarchy.hasMatrix.push_back(0);
+		hierarchy.rest.tx[i] = hierarchy.rest.ty[i] = hierarchy.rest.tz[i] = 0.0f;
+		hierarchy.rest.rx[i] = hierarchy.rest.ry[i] = hierarchy.rest.rz[i] = 0.0f;
+		hierarchy.rest.rw[i] = 1.0f;
+		hierarchy.rest.sx[i] = hierarchy.rest.sy[i] = hierarchy.rest.sz[i] = 1.0f;
+	}
+	AnimationClip clip;
+	clip.name = "synthetic";
+	clip.duration = (keys - 1) / 30.0f;
+	for (int i = 0; i < nodes; i++) {
+		for (int path = ANIMATION_TRANSLATION; path <= ANIMATION_ROTATION; path++) {
+			AnimationChannel channel;
+			channel.node = i;
+			channel.path = path;
+			channel.interpolation = ANIMATION_LINEAR;
+			for (int k = 0; k < keys; k++) {
+				float angle = 0.1f * k + i;
+				channel.times.push_back(k / 30.0f);
+				if (path == ANIMATION_ROTATION) {
+					float values[4] = { 0.0f, sin(angle * 0.5f), 0.0f, cos(angle * 0.5f) };
+					channel.values.insert(channel.values.end(), values, values + 4);
+				} else {
+					float values[3] = { cos(angle), 1.0f, sin(angle) };
+					channel.values.insert(channel.values.end(), values, values + 3);
+				}
+			}
+			clip.channels.push_back(channel);
+		}
+	}
+	animator.clips.push_back(clip);
+}
+
+static void benchMemory(BenchRunner& runner) {
+	// A frame's working list: a fresh heap vector against one in a reset frame arena
+	int counts[] = { 64, 4096 };
+	for (size_t c = 0; c < sizeof(counts) / sizeof(counts[0]); c++) {
+		int count = counts[c];
+		runner.run(caseName("frameListHeap", (size_t)count), (uint64_t)count, count * sizeof(int), [count]() {
+			vector<int> list;
+			for (int i = 0; i < count; i++) {
+				list.push_back(i);
+			}
+			doNotOptimize(list[count - 1]);
+		});
+		Arena* arena = new Arena(MEMORY_FRAME);
+		runner.run(caseName("frameListArena", (size_t)count), (uint64_t)count, count * sizeof(int), [arena, count]() {
+			arena->reset();
+			vector<int, ArenaAllocator<int> > list((ArenaAllocator<int>(*arena)));
+			for (int i = 0; i < count; i++) {
+				list.push_back(i);
+			}
+			doNotOptimize(list[count - 1]);
+		});
+		delete arena;
+	}
+}
+
+static void benchJobs(BenchRunner& runner) {
+	// Scheduler overhead: jobs with next to no work, so the time is all submitting, stealing and waiting
+	JobSystem* jobs = new JobSystem((int)(max(2u, thread::hardware_concurrency()) - 1));
+	int counts[] = { 64, 1024 };
+	for (size_t c = 0; c < sizeof(counts) / sizeof(counts[0]); c++) {
+		int count = counts[c];
+		vector<float>* values = new vector<float>(count, 1.0f);
+		runner.run(caseName("jobRunWait", (size_t)count), (uint64_t)count, 0, [jobs, values, count]() {
+			vector<JobHandle> handles;
+			for (int i = 0; i < count; i++) {
+				float* value = &(*values)[i];
+				handles.push_back(jobs->run([value]() { *value *= 1.0001f; }));
+			}
+			jobs->wait(handles);
+		});
+		runner.run(caseName("jobParallelFor", (size_t)count), (uint64_t)count, 0, [jobs, values, count]() {
+			jobs->parallelFor(count, 1, [values](int first, int last) {
+				for (int i = first; i < last; i++) {
+					(*values)[i] *= 1.0001f;
+				}
+			});
+		});
+		delete values;
+	}
+	delete jobs;
+}
+
+static void benchAnimation(BenchRunner& runner) {
+	int counts[] = { 64, 1024, 16384 };
+	JobSystem* jobs = new JobSystem((int)(max(2u, thread::hardware_concurrency()) - 1));
+	for (size_t c = 0; c < sizeof(counts) / sizeof(counts[0]); c++) {
+		int count = counts[c];
+		Animator* animator = new Animator();
+		buildSyntheticRig(*animator);
+		animator->resize(count);
+		for (int i = 0; i < count; i++) {
+			animator->play(i, 0, i * 0.01f);
+		}
+		uint64_t nodes = (uint64_t)count * animator->hierarchy.size();
+		runner.run(caseName("animationEvaluate", (size_t)count), nodes, nodes * sizeof(glm::mat4), [animator]() {
+			animator->advance(1.0f / 60.0f);
+			animator->evaluate();
+			doNotOptimize(*animator->globals(0));
+		});
+		runner.run(caseName("animationEvaluateParallel", (size_t)count), nodes, nodes * sizeof(glm::mat4), [animator, jobs]() {
+			animator->advance(1.0f / 60.0f);
+			animator->evaluate(jobs);
+			doNotOptimize(*animator->globals(0));
+		});
+		delete animator;
+	}
+	delete jobs;
+}
+
+static void benchTraffic(BenchRunner& runner) {
+	// The city.scene block grid, with the street grid grown to fit the vehicles
+	vector<glm::mat4> blocks;
+	for (int i = 0; i < 6; i++) {
+		for (int j = 0; j < 6; j++) {
+			blocks.push_back(glm::translate(glm::mat4(1.0f), glm::vec3(-900.0f + 300.0f * i, 0.0f, -900.0f + 300.0f * j)));
+		}
+	}
+	int counts[] = { 1000, 10000, 40000 };
+	JobSystem* jobs = new JobSystem((int)(max(2u, thread::hardware_concurrency()) - 1));
+	for (size_t c = 0; c < sizeof(counts) / sizeof(counts[0]); c++) {
+		int count = counts[c];
+		Traffic* traffic = new Traffic();
+		vector<float> streetsX, streetsZ;
+		RoadNetwork::gridStreets(blocks.data(), (int)blocks.size(), 300.0f + 150.0f * sqrt(count / 12.0f), streetsX, streetsZ);
+		traffic->roads.build(streetsX, streetsZ, nullptr);
+		traffic->populate(count);
+		runner.run(caseName("trafficStep", (size_t)count), (uint64_t)count, 0, [traffic]() {
+			traffic->step(1.0f / 60.0f);
+			doNotOptimize(traffic->placements.x[0]);
+		});
+		runner.run(caseName("trafficStepParallel", (size_t)count), (uint64_t)count, 0, [traffic, jobs]() {
+			traffic->step(1.0f / 60.0f, jobs);
+			doNotOptimize(traffic->placements.x[0]);
+		});
+		delete traffic;
+	}
+	delete jobs;
+}
+
+static void benchSceneQuery(BenchRunner& runner) {
+	// A grid of boxes of random heights, as many as a streamed city keeps resident
+	static const float corners[] = { -1, -1, -1, 1, -1, -1, 1, 1, -1, -1, 1, -1, -1, -1, 1, 1, -1, 1, 1, 1, 1, -1, 1, 1 };
+	static const uint32_t faces[] = { 0, 2, 1, 0, 3, 2, 4, 5, 6, 4, 6, 7, 0, 1, 5, 0, 5, 4,
+	                                  3, 6, 2, 3, 7, 6, 0, 4, 7, 0, 7, 3, 1, 2, 6, 1, 6, 5 };
+	const int side = 100;
+	vector<glm::mat4> boxes;
+	srand(1);
+	for (int i = 0; i < side; i++) {
+		for (int j = 0; j < side; j++) {
+			float height = 10.0f + rand() % 100;
+			glm::mat4 box = glm::translate(glm::mat4(1.0f), glm::vec3(-5000.0f + 100.0f * i, height, -5000.0f + 100.0f * j));
+			boxes.push_back(glm::scale(box, glm::vec3(30.0f, height, 30.0f)));
+		}
+	}
+	SceneQuery* query = new SceneQuery();
+	int mesh = query->addMesh(corners, 8, faces, 36);
+	query->addInstances(mesh, boxes.data(), (int)boxes.size(), 0);
+	query->update();
+
+	// Eye-level rays in all directions, as for line of sight between agents
+	const int rayCount = 4096;
+	vector<QueryRay>* rays = new vector<QueryRay>(rayCount);
+	vector<QueryHit>* hits = new vector<QueryHit>(rayCount);
+	bool* blocked = new bool[rayCount];
+	for (int i = 0; i < rayCount; i++) {
+		QueryRay& ray = (*rays)[i];
+		float angle = 6.2831853f * i / rayCount;
+		ray.origin = glm::vec3(-4950.0f + (rand() % 9900), 2.0f + (rand() % 50), -4950.0f + (rand() % 9900));
+		ray.direction = glm::normalize(glm::vec3(cos(angle), -0.05f, sin(angle)));
+		ray.maxDistance = 2000.0f;
+	}
+	JobSystem* jobs = new JobSystem((int)(max(2u, thread::hardware_concurrency()) - 1));
+	runner.run(caseName("sceneQueryRays", (size_t)rayCount), rayCount, 0, [query, rays, hits]() {
+		query->intersect(rays->data(), rayCount, hits->data());
+		doNotOptimize((*hits)[0].distance);
+	});
+	runner.run(caseName("sceneQueryRaysParallel", (size_t)rayCount), rayCount, 0, [query, rays, hits, jobs]() {
+		query->intersect(rays->data(), rayCount, hits->data(), jobs);
+		doNotOptimize((*hits)[0].distance);
+	});
+	runner.run(caseName("sceneQueryOccluded", (size_t)rayCount), rayCount, 0, [query, rays, blocked]() {
+		query->occluded(rays->data(), rayCount, blocked);
+		doNotOptimize(blocked[0]);
+	});
+
+	const int sphereCount = 1024;
+	vector<QuerySphere>* spheres = new vector<QuerySphere>(sphereCount);
+	vector<QueryContact>* contacts = new vector<QueryContact>(sphereCount);
+	for (int i = 0; i < sphereCount; i++) {
+		(*spheres)[i].center = glm::vec3(-4950.0f + (rand() % 9900), 2.0f + (rand() % 50), -4950.0f + (rand() % 9900));
+		(*spheres)[i].radius = 5.0f;
+	}
+	runner.run(caseName("sceneQuerySpheres", (size_t)sphereCount), sphereCount, 0, [query, spheres, contacts]() {
+		query->contact(spheres->data(), sphereCount, contacts->data());
+		doNotOptimize((*contacts)[0].depth);
+	});
+
+	// Every instance moves a little each frame, like traffic: bounds, refit and publishing
+	int count = (int)boxes.size();
+	vector<glm::mat4>* moved = new vector<glm::mat4>(boxes);
+	runner.run(caseName("sceneQueryUpdate", (size_t)count), count, count * sizeof(glm::mat4), [query, moved, count]() {
+		for (int i = 0; i < count; i++) {
+			(*moved)[i][3].x += (i & 1) ? 0.1f : -0.1f;
+		}
+		query->setTransforms(0, moved->data(), count);
+		query->update();
+	});
+	runner.run(caseName("sceneQueryUpdateParallel", (size_t)count), count, count * sizeof(glm::mat4), [query, moved, count, jobs]() {
+		for (int i = 0; i < count; i++) {
+			(*moved)[i][3].x += (i & 1) ? -0.1f : 0.1f;
+		}
+		query->setTransforms(0, moved->data(), count);
+		query->update(jobs);
+	});
+	delete moved;
+	delete spheres;
+	delete contacts;
+	delete rays;
+	delete hits;
+	delete[] blocked;
+	delete query;
+	delete jobs;
+}
+
+static void benchSceneSetup(BenchRunner& runner) {
+	uint64_t textSize = StartupTrace::fileSize(scenePath);
+	if (textSize == 0) {
+		cout << "skipping scene cases (" << scenePath << " not found)" << endl;
+		return;
+	}
+	runner.run("scene/loadSceneText/city", 0, textSize, []() {
+		SceneDescription scene;
+		loadSceneText(scenePath, scene);
+		doNotOptimize(scene.groups.size());
+	});
+
+	// A million trees, baked once, to time the bulk binary path
+	const char* bigText = "emerald_bench_big.scene";
+	const char* bigBinary = "emerald_bench_big.sceneb";
+	FILE* file = fopen(bigText, "w");
+	if (file != nullptr) {
+		fprintf(file, "group tree model tree.gltf\nring 1000000 7 3000 1500 150\n");
+		fclose(file);
+		SceneDescription big;
+		if (loadSceneText(bigText, big) && saveSceneBinary(bigBinary, big)) {
+			uint64_t size = StartupTrace::fileSize(bigBinary);
+			runner.run("scene/loadSceneBinary/1000000", big.instanceCount(), size, [bigBinary]() {
+				SceneDescription scene;
+				loadSceneBinary(bigBinary, scene);
+				doNotOptimize(scene.groups.size());
+			});
+		}
+		remove(bigText);
+		remove(bigBinary);
+	}
+
+	runner.run("scene/CityStreamer::generate", 1, 0, []() {
+		static int chunk = 0;
+		ChunkCoord coord = { chunk % 64, chunk / 64 };
+		chunk = (chunk + 1) % 4096;
+		ChunkContent content;
+		CityStreamer::generate(1234, 2500.0f, coord, content);
+		doNotOptimize(content.layers[0].size());
+	});
+}
+
+static void benchTextureDecode(BenchRunner& runner) {
+	for (size_t i = 0; i < sizeof(texturePaths) / sizeof(texturePaths[0]); i++) {
+		vector<unsigned char>* encoded = new vector<unsigned char>();
+		if (!readFile(texturePaths[i], *encoded)) {
+			cout << "skipping " << texturePaths[i] << " (not found)" << endl;
+			delete encoded;
+			continue;
+		}
+		int width = 0, height = 0, channels = 0;
+		stbi_info_from_memory(encoded->data(), (int)encoded->size(), &width, &height, &channels);
+		// Throughput is in decoded pixels
+		runner.run(caseName("stbi_load", baseName(texturePaths[i])), (uint64_t)width * height, encoded->size(), [encoded]() {
+			int w, h, c;
+			unsigned char* pixels = stbi_load_from_memory(encoded->data(), (int)encoded->size(), &w, &h, &c, 0);
+			doNotOptimize(pixels);
+			stbi_image_free(pixels);
+		});
+		delete encoded;
+	}
+}
+
+int main(int argc, char* argv[]) {
+	BenchRunner runner;
+	const char* csvPath = nullptr;
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc) {
+			runner.filter = argv[++i];
+		} else if (strcmp(argv[i], "--min-time") == 0 && i + 1 < argc) {
+			runner.minSampleSeconds = atof(argv[++i]);
+		} else if (strcmp(argv[i], "--samples") == 0 && i + 1 < argc) {
+			runner.samples = max(1, atoi(argv[++i]));
+		} else if (strcmp(argv[i], "--csv") == 0 && i + 1 < argc) {
+			csvPath = argv[++i];
+		} else {
+			cout << "Usage: emerald_bench [--filter <substring>] [--min-time <seconds>] [--samples <n>] [--csv <file>]" << endl;
+			return 1;
+		}
+	}
+	// The loaders record startup scopes; nothing here wants them
+	StartupTrace::instance().active = false;
+
+	benchModelLoading(runner);
+	benchNodeTransforms(runner);
+	benchPlacement(runner);
+	benchMemory(runner);
+	benchJobs(runner);
+	benchAnimation(runner);
+	benchTraffic(runner);
+	benchSceneQuery(runner);
+	benchSceneSetup(runner);
+	benchTextureDecode(runner);
+
+	if (csvPath != nullptr && !runner.writeCsv(csvPath)) {
+		cerr << "Could not write " << csvPath << endl;
+		return 1;
+	}
+	return 0;
+}
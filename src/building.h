@@ -10,8 +10,10 @@
 #include "glm/gtx/transform.hpp"
 
 #include "render/shader.h"
+#include "render/instance_set.h"
+#include "render/command_buffer.h"
 
-class Building {
+class Building : public InstanceSet {
 	public:
     GLfloat vertex_buffer_data[72] = {	// Vertex definition for a canonical box
     	// Front face
@@ -138,17 +140,15 @@ class Building {
     GLuint colorBufferID;
 	GLuint normalBufferID;
     GLuint uvBufferID;
-    GLuint textureID;
-	GLuint transformBufferID;
-
-	glm::mat4* modelMatrices;
-	int amount;
+    // The first of the facade materials: tints of the one texture, drawn in the same call
+    int material;
+    int facadeCount;
 
     Building(glm::mat4* modelMatrices, int amount);
-    void render(glm::mat4 cameraMatrix, Shader& shader);
+    // Give every instance slot, drawn or reserved, a facade; after the streamer has reserved its slots
+    void varyFacades();
+    // Record the instanced draw; safe on a worker thread
+    void record(CommandBuffer& commands, GLuint program);
     void cleanup();
-
-    private:
-    GLuint LoadTextureTileBox(const char *texture_file_path);
 };
 #endif
\ No newline at end of file
@@ -0,0 +1,170 @@
+#include "core/benchmark.h"
+#include "core/frame_profiler.h"
+#include "render/program_cache.h"
+#include "render/render_target.h"
+#include "stb_image_write.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+
+using namespace std;
+
+BenchmarkOptions::BenchmarkOptions() {
+	this->enabled = false;
+	this->width = 1280;
+	this->height = 720;
+	this->frames = 600;
+	this->warmupFrames = 30;
+	this->checksumEvery = 0;
+}
+
+BenchmarkReport::BenchmarkReport() {
+	this->mismatches = -1;
+}
+
+void BenchmarkReport::addFrame(double ms, uint64_t allocations) {
+	this->frameMs.push_back(ms);
+	this->allocations.push_back(allocations);
+}
+
+void BenchmarkReport::capture(int frame, RenderTarget& target, const string& imageDirectory) {
+	vector<unsigned char> pixels;
+	target.readPixels(pixels);
+	Checksum checksum;
+	checksum.frame = frame;
+	checksum.hash = ProgramCache::hash(pixels.data(), pixels.size());
+	if (!imageDirectory.empty()) {
+		char name[64];
+		snprintf(name, sizeof(name), "/frame_%05d.png", frame);
+		checksum.image = imageDirectory + name;
+		// GL rows start at the bottom
+		stbi_flip_vertically_on_write(1);
+		if (!stbi_write_png(checksum.image.c_str(), target.width, target.height, 4, pixels.data(), target.width * 4)) {
+			cerr << "WARN: Could not write " << checksum.image << endl;
+			checksum.image.clear();
+		}
+	}
+	this->checksums.push_back(checksum);
+}
+
+double BenchmarkReport::percentile(double p) const {
+	if (this->frameMs.empty()) {
+		return 0.0;
+	}
+	vector<double> sorted(this->frameMs);
+	sort(sorted.begin(), sorted.end());
+	size_t rank = (size_t)ceil(p / 100.0 * sorted.size());
+	return sorted[min(max(rank, (size_t)1), sorted.size()) - 1];
+}
+
+bool BenchmarkReport::compare(const string& expectedReport) {
+	ifstream file(expectedReport.c_str());
+	if (!file) {
+		cerr << "ERROR: Could not read expected benchmark report " << expectedReport << endl;
+		return false;
+	}
+	stringstream contents;
+	contents << file.rdbuf();
+	string text = contents.str();
+	// Only the checksum entries are read, as write() lays them out
+	map<int, string> expected;
+	for (size_t at = text.find("\"frame\":"); at != string::npos; at = text.find("\"frame\":", at + 1)) {
+		int frame = atoi(text.c_str() + at + 8);
+		size_t hash = text.find("\"fnv1a\": \"", at);
+		if (hash != string::npos) {
+			expected[frame] = text.substr(hash + 10, 16);
+		}
+	}
+	this->mismatches = 0;
+	for (size_t i = 0; i < this->checksums.size(); i++) {
+		char hash[20];
+		snprintf(hash, sizeof(hash), "%016llx", (unsigned long long)this->checksums[i].hash);
+		map<int, string>::const_iterator it = expected.find(this->checksums[i].frame);
+		if (it == expected.end() || it->second != hash) {
+			cerr << "ERROR: Frame " << this->checksums[i].frame << " checksum " << hash << " differs from "
+			     << (it == expected.end() ? string("none") : it->second) << " in " << expectedReport << endl;
+			this->mismatches++;
+		}
+	}
+	return this->mismatches == 0;
+}
+
+static string escapeJson(const string& text) {
+	string escaped;
+	for (size_t i = 0; i < text.size(); i++) {
+		char c = text[i];
+		if (c == '"' || c == '\\') {
+			escaped += '\\';
+		}
+		if ((unsigned char)c >= 0x20) {
+			escaped += c;
+		}
+	}
+	return escaped;
+}
+
+bool BenchmarkReport::write(const BenchmarkOptions& options, const string& renderer) const {
+	double total = 0.0;
+	for (size_t i = 0; i < this->frameMs.size(); i++) {
+		total += this->frameMs[i];
+	}
+	double mean = this->frameMs.empty() ? 0.0 : total / this->frameMs.size();
+	uint64_t allocationTotal = 0;
+	uint64_t allocationMax = 0;
+	for (size_t i = 0; i < this->allocations.size(); i++) {
+		allocationTotal += this->allocations[i];
+		allocationMax = max(allocationMax, this->allocations[i]);
+	}
+	double allocationMean = this->allocations.empty() ? 0.0 : (double)allocationTotal / this->allocations.size();
+	FrameProfiler& profiler = FrameProfiler::instance();
+
+	ofstream file;
+	if (!options.output.empty()) {
+		file.open(options.output.c_str(), ios::trunc);
+		if (!file) {
+			cerr << "ERROR: Could not write benchmark report " << options.output << endl;
+			return false;
+		}
+	}
+	ostream& out = options.output.empty() ? cout : file;
+	out << fixed << setprecision(3);
+	out << "{" << endl;
+	out << "  \"renderer\": \"" << escapeJson(renderer) << "\"," << endl;
+	out << "  \"width\": " << options.width << ", \"height\": " << options.height << "," << endl;
+	out << "  \"frames\": " << this->frameMs.size() << ", \"warmupFrames\": " << options.warmupFrames << "," << endl;
+	out << "  \"cameraPath\": \"" << escapeJson(options.cameraPath.empty() ? "default" : options.cameraPath) << "\"," << endl;
+	out << "  \"frameMs\": { \"mean\": " << mean << ", \"p50\": " << percentile(50) << ", \"p95\": " << percentile(95)
+	    << ", \"p99\": " << percentile(99) << ", \"min\": " << percentile(0) << ", \"max\": " << percentile(100) << " }," << endl;
+	// A steady frame should not touch the heap; the window title shows the same count interactively
+	out << "  \"allocationsPerFrame\": { \"mean\": " << allocationMean << ", \"max\": " << allocationMax << " }," << endl;
+	// prepass is 0 when the pre-pass is off; opaque overdraw near 1 means it has little left to save
+	out << "  \"gpuPassMs\": { \"prepass\": " << profiler.averagePassMs("prepass") << ", \"opaque\": " << profiler.averagePassMs("opaque")
+	    << ", \"skybox\": " << profiler.averagePassMs("skybox") << " }," << endl;
+	out << "  \"overdraw\": { \"opaque\": " << profiler.overdraw("opaque") << ", \"measure\": \""
+	    << (profiler.shaderInvocations ? "invocations" : "samples") << "\" }," << endl;
+	out << "  \"checksums\": [";
+	for (size_t i = 0; i < this->checksums.size(); i++) {
+		const Checksum& checksum = this->checksums[i];
+		char hash[20];
+		snprintf(hash, sizeof(hash), "%016llx", (unsigned long long)checksum.hash);
+		out << (i > 0 ? "," : "") << endl << "    { \"frame\": " << checksum.frame << ", \"fnv1a\": \"" << hash << "\"";
+		if (!checksum.image.empty()) {
+			out << ", \"image\": \"" << escapeJson(checksum.image) << "\"";
+		}
+		out << " }";
+	}
+	out << (this->checksums.empty() ? "" : "\n  ") << "]";
+	if (this->mismatches >= 0) {
+		out << "," << endl << "  \"checksumMismatches\": " << this->mismatches;
+	}
+	out << endl;
+	out << "}" << endl;
+	return (bool)out;
+}
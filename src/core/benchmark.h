@@ -0,0 +1,52 @@
+#ifndef BENCHMARK_CLASS_H
+#define BENCHMARK_CLASS_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+class RenderTarget;
+
+struct BenchmarkOptions {
+    bool enabled;
+    int width;
+    int height;
+    int frames;
+    int warmupFrames;           // rendered but left out of the statistics
+    int checksumEvery;          // 0 disables image checksums
+    std::string cameraPath;     // empty uses CameraPath::defaultFlight()
+    std::string output;         // JSON report, stdout if empty
+    std::string imageDirectory; // PNGs of the checksummed frames, none if empty
+    std::string expectedReport; // an earlier report whose checksums this run must reproduce
+
+    BenchmarkOptions();
+};
+
+// Collects frame times and image checksums for a benchmark run and writes
+// them as JSON, so a regression farm can compare runs without parsing logs.
+class BenchmarkReport {
+    public:
+    struct Checksum {
+        int frame;
+        uint64_t hash;
+        std::string image;
+    };
+
+    std::vector<double> frameMs;
+    std::vector<uint64_t> allocations;  // heap allocations of each measured frame
+    std::vector<Checksum> checksums;
+    int mismatches;             // checksums that differ from the expected report's, -1 if not compared
+
+    BenchmarkReport();
+    void addFrame(double ms, uint64_t allocations);
+    // Hash the target's pixels and optionally write them as a PNG
+    void capture(int frame, RenderTarget& target, const std::string& imageDirectory);
+    // Nearest-rank percentile of the recorded frame times
+    double percentile(double p) const;
+    // Compare the checksums with those of the same frames in an earlier report,
+    // e.g. one rendered without the depth pre-pass; false if any differ or it cannot be read
+    bool compare(const std::string& expectedReport);
+    bool write(const BenchmarkOptions& options, const std::string& renderer) const;
+};
+
+#endif
@@ -0,0 +1,95 @@
+#include "core/egl_context.h"
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <cstring>
+#include <iostream>
+
+using namespace std;
+
+EglContext::EglContext() {
+	this->display = EGL_NO_DISPLAY;
+	this->context = EGL_NO_CONTEXT;
+	this->surface = EGL_NO_SURFACE;
+}
+
+GLADapiproc EglContext::load(const char* name) {
+	return (GLADapiproc)eglGetProcAddress(name);
+}
+
+bool EglContext::create() {
+	// Prefer Mesa's surfaceless platform, which needs neither X11 nor a GPU device
+	EGLDisplay display = EGL_NO_DISPLAY;
+	const char* clientExtensions = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+	if (clientExtensions && strstr(clientExtensions, "EGL_MESA_platform_surfaceless")) {
+		PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+			(PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+		if (getPlatformDisplay) {
+			display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+		}
+	}
+	if (display == EGL_NO_DISPLAY) {
+		display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+	}
+	EGLint major = 0, minor = 0;
+	if (display == EGL_NO_DISPLAY || !eglInitialize(display, &major, &minor)) {
+		cerr << "Failed to initialize EGL." << endl;
+		return false;
+	}
+	this->display = display;
+	if (!eglBindAPI(EGL_OPENGL_API)) {
+		cerr << "EGL has no desktop OpenGL support." << endl;
+		return false;
+	}
+
+	const EGLint configAttributes[] = {
+		EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+		EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+		EGL_RED_SIZE, 8, EGL_GREEN_SIZE, 8, EGL_BLUE_SIZE, 8, EGL_DEPTH_SIZE, 24,
+		EGL_NONE
+	};
+	EGLConfig config;
+	EGLint configCount = 0;
+	if (!eglChooseConfig(display, configAttributes, &config, 1, &configCount) || configCount == 0) {
+		cerr << "No suitable EGL config." << endl;
+		return false;
+	}
+	const EGLint contextAttributes[] = {
+		EGL_CONTEXT_MAJOR_VERSION, 3,
+		EGL_CONTEXT_MINOR_VERSION, 3,
+		EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+		EGL_NONE
+	};
+	this->context = eglCreateContext(display, config, EGL_NO_CONTEXT, contextAttributes);
+	if (this->context == EGL_NO_CONTEXT) {
+		cerr << "Failed to create an EGL 3.3 core context." << endl;
+		return false;
+	}
+
+	// Rendering targets an FBO, so a 1x1 pbuffer is enough where surfaceless contexts are missing
+	const char* displayExtensions = eglQueryString(display, EGL_EXTENSIONS);
+	if (!displayExtensions || !strstr(displayExtensions, "EGL_KHR_surfaceless_context")) {
+		const EGLint pbufferAttributes[] = { EGL_WIDTH, 1, EGL_HEIGHT, 1, EGL_NONE };
+		this->surface = eglCreatePbufferSurface(display, config, pbufferAttributes);
+	}
+	if (!eglMakeCurrent(display, this->surface, this->surface, this->context)) {
+		cerr << "Failed to make the EGL context current." << endl;
+		return false;
+	}
+	return true;
+}
+
+void EglContext::destroy() {
+	if (this->display == EGL_NO_DISPLAY) {
+		return;
+	}
+	eglMakeCurrent(this->display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+	if (this->surface != EGL_NO_SURFACE) {
+		eglDestroySurface(this->display, this->surface);
+	}
+	if (this->context != EGL_NO_CONTEXT) {
+		eglDestroyContext(this->display, this->context);
+	}
+	eglTerminate(this->display);
+	this->display = EGL_NO_DISPLAY;
+}
@@ -0,0 +1,22 @@
+#ifndef EGL_CONTEXT_CLASS_H
+#define EGL_CONTEXT_CLASS_H
+
+#include <glad/gl.h>
+
+// Windowless 3.3 core context through EGL, for machines without a display
+// server (e.g. Mesa llvmpipe on a build farm). Only built with EMERALD_EGL;
+// rendering goes to a RenderTarget since there is no default framebuffer.
+class EglContext {
+    public:
+    EglContext();
+    bool create();
+    void destroy();
+    static GLADapiproc load(const char* name);
+
+    private:
+    void* display;
+    void* context;
+    void* surface;
+};
+
+#endif
@@ -0,0 +1,307 @@
+#include "core/frame_capture.h"
+#include "stb_image_write.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <direct.h>
+#define popen _popen
+#define pclose _pclose
+#define PIPE_MODE "wb"
+#else
+#include <csignal>
+#define PIPE_MODE "w"
+#endif
+
+using namespace std;
+
+FrameCapture::FrameCapture() {
+	this->latency = 2;
+	this->paused = false;
+	for (int i = 0; i < RING_SIZE; i++) {
+		this->slots[i].buffer = 0;
+		this->slots[i].fence = 0;
+		this->slots[i].width = this->slots[i].height = 0;
+		this->slots[i].size = 0;
+		this->slots[i].frame = 0;
+	}
+	this->oldest = 0;
+	this->pending = 0;
+	this->frameIndex = 0;
+	this->pipe = nullptr;
+	this->pipeWidth = this->pipeHeight = 0;
+	this->running = false;
+	this->stopping = false;
+	this->written = 0;
+	this->dropped = 0;
+}
+
+FrameCapture::~FrameCapture() {
+	// GL objects need the context, which is gone by now; only the worker is left to stop
+	if (this->worker.joinable()) {
+		{
+			lock_guard<mutex> lock(this->queueMutex);
+			this->stopping = true;
+		}
+		this->queued.notify_all();
+		this->worker.join();
+	}
+}
+
+bool FrameCapture::startPngSequence(const string& directory) {
+	this->directory = directory;
+#ifdef _WIN32
+	_mkdir(directory.c_str());
+#else
+	mkdir(directory.c_str(), 0755);
+#endif
+	// GL rows start at the bottom
+	stbi_flip_vertically_on_write(1);
+	return this->start();
+}
+
+bool FrameCapture::startPipe(const string& command) {
+	this->command = command;
+#ifndef _WIN32
+	// An encoder that exits early should fail the write, not kill the renderer
+	signal(SIGPIPE, SIG_IGN);
+#endif
+	return this->start();
+}
+
+bool FrameCapture::start() {
+	if (this->running) {
+		return false;
+	}
+	this->stopping = false;
+	this->written = this->dropped = 0;
+	this->frameIndex = 0;
+	this->pipeWidth = this->pipeHeight = 0;
+	this->running = true;
+	this->worker = thread(&FrameCapture::workerLoop, this);
+	return true;
+}
+
+bool FrameCapture::active() const {
+	return this->running;
+}
+
+void FrameCapture::capture(GLuint framebuffer, int width, int height) {
+	if (!this->running) {
+		return;
+	}
+	// Hand on read-backs that are old enough and finished; never wait for one unless the ring is full
+	while (this->pending > 0 && this->frameIndex - this->slots[this->oldest].frame >= (uint64_t)max(this->latency, 1)) {
+		if (!this->retire(false)) {
+			break;
+		}
+	}
+	if (this->paused || width <= 0 || height <= 0) {
+		return;
+	}
+	if (this->pending == RING_SIZE) {
+		this->retire(true);
+	}
+
+	Slot& slot = this->slots[(this->oldest + this->pending) % RING_SIZE];
+	size_t size = (size_t)width * height * 4;
+	if (slot.buffer == 0) {
+		glGenBuffers(1, &slot.buffer);
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.buffer);
+	if (slot.size != size) {
+		glBufferData(GL_PIXEL_PACK_BUFFER, size, nullptr, GL_STREAM_READ);
+		slot.size = size;
+	}
+	// With a pack buffer bound glReadPixels only queues the copy and returns
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer);
+	glReadBuffer(framebuffer == 0 ? GL_BACK : GL_COLOR_ATTACHMENT0);
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, (void*)0);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+	slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	slot.width = width;
+	slot.height = height;
+	slot.frame = this->frameIndex++;
+	this->pending++;
+}
+
+bool FrameCapture::retire(bool block) {
+	Slot& slot = this->slots[this->oldest];
+	GLenum status = glClientWaitSync(slot.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+	while (block && status == GL_TIMEOUT_EXPIRED) {
+		status = glClientWaitSync(slot.fence, 0, 100000000);
+	}
+	if (status == GL_TIMEOUT_EXPIRED) {
+		return false;
+	}
+	glDeleteSync(slot.fence);
+	slot.fence = 0;
+	this->oldest = (this->oldest + 1) % RING_SIZE;
+	this->pending--;
+
+	Frame* frame = nullptr;
+	{
+		lock_guard<mutex> lock(this->queueMutex);
+		if (this->frames.size() >= MAX_QUEUED) {
+			// The encoder is behind; dropping keeps the capture from pacing the renderer
+			this->dropped++;
+			return true;
+		}
+		if (!this->freeFrames.empty()) {
+			frame = this->freeFrames.back();
+			this->freeFrames.pop_back();
+		}
+	}
+	if (frame == nullptr) {
+		frame = new Frame();
+	}
+	size_t size = (size_t)slot.width * slot.height * 4;
+	frame->pixels.resize(size);
+	frame->width = slot.width;
+	frame->height = slot.height;
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.buffer);
+	void* mapped = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, size, GL_MAP_READ_BIT);
+	bool copied = mapped != nullptr;
+	if (copied) {
+		memcpy(frame->pixels.data(), mapped, size);
+		glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+	{
+		lock_guard<mutex> lock(this->queueMutex);
+		if (copied) {
+			this->frames.push_back(frame);
+		} else {
+			this->dropped++;
+			this->freeFrames.push_back(frame);
+		}
+	}
+	this->queued.notify_one();
+	return true;
+}
+
+void FrameCapture::stop() {
+	if (!this->running) {
+		return;
+	}
+	while (this->pending > 0) {
+		this->retire(true);
+	}
+	for (int i = 0; i < RING_SIZE; i++) {
+		glDeleteBuffers(1, &this->slots[i].buffer);
+		this->slots[i].buffer = 0;
+		this->slots[i].size = 0;
+	}
+	{
+		lock_guard<mutex> lock(this->queueMutex);
+		this->stopping = true;
+	}
+	this->queued.notify_all();
+	this->worker.join();
+	if (this->pipe != nullptr) {
+		pclose(this->pipe);
+		this->pipe = nullptr;
+	}
+	for (size_t i = 0; i < this->freeFrames.size(); i++) {
+		delete this->freeFrames[i];
+	}
+	this->freeFrames.clear();
+	this->running = false;
+	cout << "Captured " << this->written << " frames";
+	if (this->dropped > 0) {
+		cout << " (" << this->dropped << " dropped)";
+	}
+	cout << endl;
+}
+
+uint64_t FrameCapture::framesWritten() const {
+	lock_guard<mutex> lock(this->queueMutex);
+	return this->written;
+}
+
+uint64_t FrameCapture::framesDropped() const {
+	lock_guard<mutex> lock(this->queueMutex);
+	return this->dropped;
+}
+
+void FrameCapture::workerLoop() {
+	unique_lock<mutex> lock(this->queueMutex);
+	while (true) {
+		while (!this->stopping && this->frames.empty()) {
+			this->queued.wait(lock);
+		}
+		if (this->frames.empty()) {
+			return;
+		}
+		Frame* frame = this->frames.front();
+		this->frames.pop_front();
+		lock.unlock();
+		bool ok = this->write(*frame);
+		lock.lock();
+		if (ok) {
+			this->written++;
+		} else {
+			this->dropped++;
+		}
+		this->freeFrames.push_back(frame);
+	}
+}
+
+static void replaceAll(string& text, const string& token, const string& value) {
+	for (size_t at = text.find(token); at != string::npos; at = text.find(token, at + value.size())) {
+		text.replace(at, token.size(), value);
+	}
+}
+
+bool FrameCapture::write(const Frame& frame) {
+	if (!this->directory.empty()) {
+		// Numbered by the files written, not the frames captured, so drops leave no gaps for the encoder
+		stringstream path;
+		path << this->directory << "/frame_" << setw(6) << setfill('0') << this->written << ".png";
+		if (!stbi_write_png(path.str().c_str(), frame.width, frame.height, 4, frame.pixels.data(), frame.width * 4)) {
+			cerr << "WARN: Could not write " << path.str() << endl;
+			return false;
+		}
+		return true;
+	}
+
+	if (this->pipe == nullptr) {
+		if (this->command.empty() || this->pipeWidth != 0) {
+			return false;   // the encoder failed to start or has gone away
+		}
+		this->pipeWidth = frame.width;
+		this->pipeHeight = frame.height;
+		string command = this->command;
+		stringstream width, height;
+		width << frame.width;
+		height << frame.height;
+		replaceAll(command, "{width}", width.str());
+		replaceAll(command, "{height}", height.str());
+		this->pipe = popen(command.c_str(), PIPE_MODE);
+		if (this->pipe == nullptr) {
+			cerr << "ERROR: Could not start capture encoder: " << command << endl;
+			return false;
+		}
+	}
+	if (frame.width != this->pipeWidth || frame.height != this->pipeHeight) {
+		return false;
+	}
+	// Encoders expect the top row first
+	size_t stride = (size_t)frame.width * 4;
+	for (int y = frame.height - 1; y >= 0; y--) {
+		if (fwrite(&frame.pixels[y * stride], 1, stride, this->pipe) != stride) {
+			cerr << "ERROR: Capture encoder stopped accepting frames" << endl;
+			pclose(this->pipe);
+			this->pipe = nullptr;
+			return false;
+		}
+	}
+	return true;
+}
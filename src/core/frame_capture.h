@@ -0,0 +1,92 @@
+#ifndef FRAME_CAPTURE_CLASS_H
+#define FRAME_CAPTURE_CLASS_H
+
+#include <glad/gl.h>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Records the rendered frames without stalling the pipeline. Each frame is
+// read into one of a ring of pixel pack buffers, which only queues a copy on
+// the GPU; the buffer is mapped a frame or two later, once its fence has
+// signalled, and the pixels go to a worker thread that writes a PNG sequence
+// or pipes raw frames to an external encoder. If the encoder falls behind,
+// frames are dropped and counted rather than letting it hold up rendering.
+class FrameCapture {
+    public:
+    enum { RING_SIZE = 3, MAX_QUEUED = 8 };
+
+    int latency;                // frames between a read-back and mapping it, 1 or 2
+    bool paused;
+
+    FrameCapture();
+    ~FrameCapture();
+
+    // Write frame_000000.png, frame_000001.png, ... into directory, numbered
+    // without gaps even when frames are dropped
+    bool startPngSequence(const std::string& directory);
+    // Pipe top-down RGBA8 frames to command's stdin. {width} and {height} in the
+    // command are replaced with the size of the first captured frame, e.g.
+    //   ffmpeg -f rawvideo -pix_fmt rgba -s {width}x{height} -r 60 -i - flight.mp4
+    bool startPipe(const std::string& command);
+    bool active() const;
+    // Queue a read-back of framebuffer's color buffer and hand on any earlier read-back that is ready.
+    // Must be called with a current context.
+    void capture(GLuint framebuffer, int width, int height);
+    // Drain the ring and the worker; frames still on the GPU are waited for
+    void stop();
+
+    uint64_t framesWritten() const;
+    uint64_t framesDropped() const;
+
+    private:
+    struct Slot {
+        GLuint buffer;
+        GLsync fence;
+        int width;
+        int height;
+        size_t size;            // bytes the buffer was allocated with
+        uint64_t frame;
+    };
+    struct Frame {
+        std::vector<unsigned char> pixels;
+        int width;
+        int height;
+    };
+
+    Slot slots[RING_SIZE];
+    int oldest;
+    int pending;
+    uint64_t frameIndex;
+    std::string directory;
+    std::string command;
+    FILE* pipe;
+    int pipeWidth;              // fixed by the first frame; frames of another size are dropped
+    int pipeHeight;
+    bool running;
+
+    std::thread worker;
+    mutable std::mutex queueMutex;
+    std::condition_variable queued;
+    std::deque<Frame*> frames;
+    std::vector<Frame*> freeFrames;
+    bool stopping;
+    uint64_t written;
+    uint64_t dropped;
+
+    bool start();
+    // Map the oldest slot and queue its pixels; waits for its fence if block is set
+    bool retire(bool block);
+    void workerLoop();
+    bool write(const Frame& frame);
+
+    FrameCapture(const FrameCapture&);
+    FrameCapture& operator=(const FrameCapture&);
+};
+
+#endif
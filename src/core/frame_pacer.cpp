@@ -0,0 +1,83 @@
+#include "core/frame_pacer.h"
+
+#include <algorithm>
+#include <cmath>
+
+using namespace std;
+
+FramePacer::FramePacer() {
+	this->maxFramesInFlight = 2;
+	this->oldest = 0;
+	this->count = 0;
+	this->input = chrono::steady_clock::now();
+	this->latencyNext = 0;
+}
+
+void FramePacer::waitForSlot() {
+	while (this->count > 0 && this->retire(false)) {
+	}
+	int limit = min(max(this->maxFramesInFlight, 1), (int)MAX_FRAMES_IN_FLIGHT);
+	while (this->count >= limit) {
+		this->retire(true);
+	}
+}
+
+void FramePacer::markInput() {
+	this->input = chrono::steady_clock::now();
+}
+
+void FramePacer::endFrame() {
+	if (this->count == MAX_FRAMES_IN_FLIGHT) {
+		this->retire(true);
+	}
+	InFlight& frame = this->frames[(this->oldest + this->count) % MAX_FRAMES_IN_FLIGHT];
+	frame.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	frame.input = this->input;
+	this->count++;
+}
+
+int FramePacer::framesInFlight() const {
+	return this->count;
+}
+
+bool FramePacer::retire(bool block) {
+	InFlight& frame = this->frames[this->oldest];
+	// Flush on the first wait so the fence is guaranteed to reach the GPU
+	GLenum status = glClientWaitSync(frame.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+	while (block && status == GL_TIMEOUT_EXPIRED) {
+		status = glClientWaitSync(frame.fence, 0, 100000000);
+	}
+	if (status == GL_TIMEOUT_EXPIRED) {
+		return false;
+	}
+	double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - frame.input).count();
+	if (this->latencies.size() < HISTORY) {
+		this->latencies.push_back(ms);
+	} else {
+		this->latencies[this->latencyNext] = ms;
+	}
+	this->latencyNext = (this->latencyNext + 1) % HISTORY;
+	glDeleteSync(frame.fence);
+	this->oldest = (this->oldest + 1) % MAX_FRAMES_IN_FLIGHT;
+	this->count--;
+	return true;
+}
+
+double FramePacer::latencyPercentile(double p) const {
+	if (this->latencies.empty()) {
+		return 0.0;
+	}
+	vector<double> sorted(this->latencies);
+	sort(sorted.begin(), sorted.end());
+	// Nearest rank
+	size_t rank = (size_t)ceil(p / 100.0 * sorted.size());
+	return sorted[min(max(rank, (size_t)1), sorted.size()) - 1];
+}
+
+void FramePacer::cleanup() {
+	while (this->count > 0) {
+		glDeleteSync(this->frames[this->oldest].fence);
+		this->oldest = (this->oldest + 1) % MAX_FRAMES_IN_FLIGHT;
+		this->count--;
+	}
+}
@@ -0,0 +1,52 @@
+#ifndef FRAME_PACER_CLASS_H
+#define FRAME_PACER_CLASS_H
+
+#include <glad/gl.h>
+#include <chrono>
+#include <vector>
+
+// Bounds how many frames the CPU may queue ahead of the GPU. Every submitted
+// frame is fenced; before starting the next one the pacer waits until fewer
+// than maxFramesInFlight fences are outstanding. Fewer frames in flight cost
+// throughput (CPU and GPU overlap less) and buy responsiveness.
+//
+// Each fence also carries the time the frame's input was sampled, so
+// retiring it yields the input-to-GPU-completion latency. A fence waited on
+// is timed exactly; one found already signalled is timed when it was
+// noticed, an upper bound at most a frame late.
+class FramePacer {
+    public:
+    enum { MAX_FRAMES_IN_FLIGHT = 4, HISTORY = 256 };
+
+    int maxFramesInFlight;
+
+    FramePacer();
+
+    // Block until another frame may be queued; call before sampling input
+    void waitForSlot();
+    // The frame's input is being sampled now
+    void markInput();
+    // Fence everything submitted for the frame; call after the swap
+    void endFrame();
+    int framesInFlight() const;
+    // Percentile p in [0, 100] of the recent input-to-completion latencies, in ms
+    double latencyPercentile(double p) const;
+    void cleanup();
+
+    private:
+    struct InFlight {
+        GLsync fence;
+        std::chrono::steady_clock::time_point input;
+    };
+    InFlight frames[MAX_FRAMES_IN_FLIGHT];
+    int oldest;
+    int count;
+    std::chrono::steady_clock::time_point input;
+    std::vector<double> latencies;
+    size_t latencyNext;
+
+    // Retire the oldest frame; waits for it if block is set, returns false if it is still running
+    bool retire(bool block);
+};
+
+#endif
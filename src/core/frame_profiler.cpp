@@ -0,0 +1,468 @@
+#include "core/frame_profiler.h"
+#include "render/shader.h"
+#include "render/program_cache.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iomanip>
+#include <sstream>
+
+using namespace std;
+
+// Overlay layout in normalized device coordinates, bottom-left corner
+static const int graphFrames = 128;
+static const float graphLeft = -0.98f, graphBottom = -0.98f, graphWidth = 0.8f, graphHeight = 0.3f;
+static const float graphRangeMs = 33.3f;
+static const float passColors[][3] = {
+	{ 0.90f, 0.35f, 0.25f }, { 0.30f, 0.75f, 0.35f }, { 0.30f, 0.50f, 0.95f }, { 0.95f, 0.80f, 0.25f },
+	{ 0.70f, 0.40f, 0.90f }, { 0.25f, 0.85f, 0.85f }, { 0.95f, 0.55f, 0.75f }, { 0.60f, 0.60f, 0.60f },
+};
+
+FrameProfiler::FrameProfiler() {
+	this->origin = chrono::steady_clock::now();
+	this->overlay = false;
+	this->shaderInvocations = false;
+	this->fragmentTarget = GL_SAMPLES_PASSED;
+	this->current = 0;
+	this->openPass = -1;
+	this->scopeDepth = 0;
+	this->droppedScopes = 0;
+	this->frameIndex = 0;
+	this->initialized = false;
+	this->inFrame = false;
+	this->historyNext = 0;
+	this->overlayShader = nullptr;
+	this->overlayVAO = 0;
+	this->overlayVBO = 0;
+	memset(this->queries, 0, sizeof(this->queries));
+	memset(this->fragmentQueries, 0, sizeof(this->fragmentQueries));
+	for (int i = 0; i < QUERY_FRAMES; i++) {
+		this->pendingUsed[i] = false;
+	}
+}
+
+FrameProfiler& FrameProfiler::instance() {
+	static FrameProfiler profiler;
+	return profiler;
+}
+
+double FrameProfiler::nowMs() const {
+	return chrono::duration<double, milli>(chrono::steady_clock::now() - this->origin).count();
+}
+
+void FrameProfiler::init() {
+	// GL_TIME_ELAPSED queries are core since 3.3
+	glGenQueries(QUERY_FRAMES * MAX_PASSES, &this->queries[0][0]);
+	// Overdraw: shader invocations count every shaded fragment, samples passed only those
+	// that survived the depth test, which undercounts when fragments are shaded then rejected
+	glGenQueries(QUERY_FRAMES * MAX_PASSES, &this->fragmentQueries[0][0]);
+	this->shaderInvocations = ProgramCache::hasExtension("GL_ARB_pipeline_statistics_query");
+	this->fragmentTarget = this->shaderInvocations ? GL_FRAGMENT_SHADER_INVOCATIONS_ARB : GL_SAMPLES_PASSED;
+	this->history.reserve(HISTORY);
+	this->initialized = true;
+}
+
+void FrameProfiler::beginFrame() {
+	if (this->inFrame) {
+		endFrame();
+	}
+	double now = nowMs();
+	if (this->frameIndex > 0) {
+		Frame& previous = this->pending[(this->frameIndex - 1) % QUERY_FRAMES];
+		previous.cpuMs = now - previous.startMs;
+	}
+
+	// Read back every finished frame, oldest first, without waiting on the GPU
+	uint64_t oldest = this->frameIndex > QUERY_FRAMES ? this->frameIndex - QUERY_FRAMES : 0;
+	for (uint64_t index = oldest; index < this->frameIndex; index++) {
+		int slot = (int)(index % QUERY_FRAMES);
+		if (this->pendingUsed[slot] && !collect(slot, false)) {
+			break;
+		}
+	}
+	// The ring is full: give up on the GPU times of the slot about to be reused
+	this->current = (int)(this->frameIndex % QUERY_FRAMES);
+	if (this->pendingUsed[this->current]) {
+		collect(this->current, true);
+	}
+
+	Frame& frame = this->pending[this->current];
+	frame.index = this->frameIndex++;
+	frame.startMs = now;
+	frame.cpuMs = 0.0;
+	frame.pixels = 0;
+	frame.passCount = 0;
+	frame.scopeCount = 0;
+	this->pendingUsed[this->current] = true;
+	this->openPass = -1;
+	this->scopeDepth = 0;
+	this->droppedScopes = 0;
+	this->inFrame = true;
+}
+
+void FrameProfiler::endFrame() {
+	if (!this->inFrame) {
+		return;
+	}
+	if (this->openPass >= 0) {
+		endPass();
+	}
+	this->droppedScopes = 0;
+	while (this->scopeDepth > 0) {
+		endScope();
+	}
+	this->inFrame = false;
+}
+
+void FrameProfiler::beginPass(const char* name) {
+	Frame& frame = this->pending[this->current];
+	if (!this->initialized || !this->inFrame || this->openPass >= 0 || frame.passCount >= MAX_PASSES) {
+		return;
+	}
+	PassStats& pass = frame.passes[frame.passCount];
+	pass.name = name;
+	pass.gpuMs = -1.0;
+	pass.submitMs = nowMs();
+	pass.draws = 0;
+	pass.triangles = 0;
+	pass.instances = 0;
+	pass.fragments = -1;
+	glBeginQuery(GL_TIME_ELAPSED, this->queries[this->current][frame.passCount]);
+	glBeginQuery(this->fragmentTarget, this->fragmentQueries[this->current][frame.passCount]);
+	this->openPass = frame.passCount++;
+}
+
+void FrameProfiler::endPass() {
+	if (this->openPass < 0) {
+		return;
+	}
+	glEndQuery(GL_TIME_ELAPSED);
+	glEndQuery(this->fragmentTarget);
+	this->openPass = -1;
+}
+
+void FrameProfiler::beginScope(const char* name) {
+	Frame& frame = this->pending[this->current];
+	if (!this->inFrame) {
+		return;
+	}
+	if (frame.scopeCount >= MAX_SCOPES) {
+		// Not recorded; the matching endScope must not close the enclosing scope
+		this->droppedScopes++;
+		return;
+	}
+	ScopeStats& scope = frame.scopes[frame.scopeCount];
+	scope.name = name;
+	scope.startMs = nowMs();
+	scope.endMs = scope.startMs;
+	this->scopeStack[this->scopeDepth++] = frame.scopeCount++;
+}
+
+void FrameProfiler::endScope() {
+	if (!this->inFrame) {
+		return;
+	}
+	if (this->droppedScopes > 0) {
+		this->droppedScopes--;
+		return;
+	}
+	if (this->scopeDepth == 0) {
+		return;
+	}
+	this->pending[this->current].scopes[this->scopeStack[--this->scopeDepth]].endMs = nowMs();
+}
+
+void FrameProfiler::setPixelCount(uint64_t pixels) {
+	if (this->inFrame) {
+		this->pending[this->current].pixels = pixels;
+	}
+}
+
+void FrameProfiler::countDraw(uint64_t triangles, uint64_t instances) {
+	if (this->openPass < 0) {
+		return;
+	}
+	PassStats& pass = this->pending[this->current].passes[this->openPass];
+	pass.draws++;
+	pass.triangles += triangles * instances;
+	pass.instances += instances;
+}
+
+bool FrameProfiler::collect(int slot, bool force) {
+	Frame& frame = this->pending[slot];
+	if (!force) {
+		for (int i = 0; i < frame.passCount; i++) {
+			GLint available = GL_FALSE;
+			glGetQueryObjectiv(this->queries[slot][i], GL_QUERY_RESULT_AVAILABLE, &available);
+			if (!available) {
+				return false;
+			}
+			glGetQueryObjectiv(this->fragmentQueries[slot][i], GL_QUERY_RESULT_AVAILABLE, &available);
+			if (!available) {
+				return false;
+			}
+		}
+		for (int i = 0; i < frame.passCount; i++) {
+			GLuint64 elapsed = 0;
+			glGetQueryObjectui64v(this->queries[slot][i], GL_QUERY_RESULT, &elapsed);
+			frame.passes[i].gpuMs = elapsed / 1.0e6;
+			GLuint64 fragments = 0;
+			glGetQueryObjectui64v(this->fragmentQueries[slot][i], GL_QUERY_RESULT, &fragments);
+			frame.passes[i].fragments = (int64_t)fragments;
+		}
+	}
+	record(frame);
+	this->pendingUsed[slot] = false;
+	return true;
+}
+
+void FrameProfiler::record(const Frame& frame) {
+	if (this->history.size() < HISTORY) {
+		this->history.push_back(frame);
+	} else {
+		this->history[this->historyNext] = frame;
+	}
+	this->historyNext = (this->historyNext + 1) % HISTORY;
+	if (this->csv.is_open()) {
+		writeCsv(frame);
+	}
+	if (this->trace.is_open()) {
+		writeTrace(frame);
+	}
+}
+
+double FrameProfiler::frameTimePercentile(double p) const {
+	vector<double> times;
+	for (size_t i = 0; i < this->history.size(); i++) {
+		times.push_back(this->history[i].cpuMs);
+	}
+	if (times.empty()) {
+		return 0.0;
+	}
+	sort(times.begin(), times.end());
+	// Nearest rank
+	size_t rank = (size_t)ceil(p / 100.0 * times.size());
+	return times[min(max(rank, (size_t)1), times.size()) - 1];
+}
+
+double FrameProfiler::latestGpuMs(uint64_t& frame) const {
+	if (this->history.empty()) {
+		return -1.0;
+	}
+	const Frame& last = this->history[(this->historyNext + HISTORY - 1) % HISTORY];
+	frame = last.index;
+	double total = 0.0;
+	for (int i = 0; i < last.passCount; i++) {
+		if (last.passes[i].gpuMs > 0.0) {
+			total += last.passes[i].gpuMs;
+		}
+	}
+	return total;
+}
+
+double FrameProfiler::averagePassMs(const char* name) const {
+	double total = 0.0;
+	int count = 0;
+	for (size_t i = 0; i < this->history.size(); i++) {
+		const Frame& frame = this->history[i];
+		for (int j = 0; j < frame.passCount; j++) {
+			if (strcmp(frame.passes[j].name, name) == 0 && frame.passes[j].gpuMs >= 0.0) {
+				total += frame.passes[j].gpuMs;
+				count++;
+			}
+		}
+	}
+	return count > 0 ? total / count : 0.0;
+}
+
+double FrameProfiler::overdraw(const char* name) const {
+	double total = 0.0;
+	int count = 0;
+	for (size_t i = 0; i < this->history.size(); i++) {
+		const Frame& frame = this->history[i];
+		for (int j = 0; j < frame.passCount; j++) {
+			if (strcmp(frame.passes[j].name, name) == 0 && frame.passes[j].fragments >= 0 && frame.pixels > 0) {
+				total += (double)frame.passes[j].fragments / frame.pixels;
+				count++;
+			}
+		}
+	}
+	return count > 0 ? total / count : 0.0;
+}
+
+string FrameProfiler::summary() const {
+	stringstream stream;
+	stream << fixed << setprecision(2) << "p50 " << frameTimePercentile(50) << " / p95 " << frameTimePercentile(95)
+	       << " / p99 " << frameTimePercentile(99) << " ms";
+	if (this->history.empty()) {
+		return stream.str();
+	}
+	// Pass names and counts from the most recent frame
+	const Frame& last = this->history[(this->historyNext + HISTORY - 1) % HISTORY];
+	int draws = 0;
+	uint64_t triangles = 0;
+	for (int i = 0; i < last.passCount; i++) {
+		stream << " | " << last.passes[i].name << " " << averagePassMs(last.passes[i].name);
+		draws += last.passes[i].draws;
+		triangles += last.passes[i].triangles;
+	}
+	stream << " | " << draws << " draws " << setprecision(1) << triangles / 1.0e6 << "M tris";
+	// Fragments per pixel in the lighting pass; well above 1 means a depth pre-pass would pay off
+	stream << " | overdraw " << setprecision(2) << overdraw("opaque") << (this->shaderInvocations ? "" : " (samples)");
+	return stream.str();
+}
+
+bool FrameProfiler::openCsv(const char* path) {
+	this->csv.open(path, ios::trunc);
+	if (!this->csv) {
+		return false;
+	}
+	// Long format: one row per frame, scope and pass
+	this->csv << "frame,kind,name,ms,draws,triangles,instances,fragments,pixels" << endl;
+	return true;
+}
+
+void FrameProfiler::writeCsv(const Frame& frame) {
+	this->csv << fixed << setprecision(4);
+	this->csv << frame.index << ",frame,total," << frame.cpuMs << ",,,,," << frame.pixels << endl;
+	for (int i = 0; i < frame.scopeCount; i++) {
+		const ScopeStats& scope = frame.scopes[i];
+		this->csv << frame.index << ",cpu," << scope.name << "," << scope.endMs - scope.startMs << ",,,,," << endl;
+	}
+	for (int i = 0; i < frame.passCount; i++) {
+		const PassStats& pass = frame.passes[i];
+		this->csv << frame.index << ",gpu," << pass.name << ",";
+		if (pass.gpuMs >= 0.0) {
+			this->csv << pass.gpuMs;
+		}
+		this->csv << "," << pass.draws << "," << pass.triangles << "," << pass.instances << ",";
+		if (pass.fragments >= 0) {
+			this->csv << pass.fragments;
+		}
+		this->csv << "," << endl;
+	}
+}
+
+bool FrameProfiler::openChromeTrace(const char* path) {
+	this->trace.open(path, ios::trunc);
+	if (!this->trace) {
+		return false;
+	}
+	// Trace Event Format; CPU scopes on thread 1, GPU passes on thread 2
+	this->trace << "{\"traceEvents\":[" << endl;
+	this->trace << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1,\"args\":{\"name\":\"CPU\"}}," << endl;
+	this->trace << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":2,\"args\":{\"name\":\"GPU\"}}";
+	return true;
+}
+
+void FrameProfiler::writeTrace(const Frame& frame) {
+	this->trace << fixed << setprecision(3);
+	this->trace << "," << endl << "{\"name\":\"frame " << frame.index << "\",\"cat\":\"frame\",\"ph\":\"X\",\"pid\":1,\"tid\":1,\"ts\":"
+	            << frame.startMs * 1000.0 << ",\"dur\":" << frame.cpuMs * 1000.0 << "}";
+	for (int i = 0; i < frame.scopeCount; i++) {
+		const ScopeStats& scope = frame.scopes[i];
+		this->trace << "," << endl << "{\"name\":\"" << scope.name << "\",\"cat\":\"cpu\",\"ph\":\"X\",\"pid\":1,\"tid\":1,\"ts\":"
+		            << scope.startMs * 1000.0 << ",\"dur\":" << (scope.endMs - scope.startMs) * 1000.0 << "}";
+	}
+	for (int i = 0; i < frame.passCount; i++) {
+		const PassStats& pass = frame.passes[i];
+		if (pass.gpuMs < 0.0) {
+			continue;
+		}
+		// Elapsed queries carry no start time; the pass is placed at its submission
+		this->trace << "," << endl << "{\"name\":\"" << pass.name << "\",\"cat\":\"gpu\",\"ph\":\"X\",\"pid\":1,\"tid\":2,\"ts\":"
+		            << pass.submitMs * 1000.0 << ",\"dur\":" << pass.gpuMs * 1000.0 << ",\"args\":{\"draws\":" << pass.draws
+		            << ",\"triangles\":" << pass.triangles << ",\"instances\":" << pass.instances << "}}";
+	}
+}
+
+void FrameProfiler::finish() {
+	if (this->csv.is_open()) {
+		this->csv.close();
+	}
+	if (this->trace.is_open()) {
+		this->trace << endl << "],\"displayTimeUnit\":\"ms\"}" << endl;
+		this->trace.close();
+	}
+}
+
+void FrameProfiler::createOverlay() {
+	this->overlayShader = new Shader("../src/shaders/overlay.vert", "../src/shaders/overlay.frag");
+	glGenVertexArrays(1, &this->overlayVAO);
+	glGenBuffers(1, &this->overlayVBO);
+	glBindVertexArray(this->overlayVAO);
+	glBindBuffer(GL_ARRAY_BUFFER, this->overlayVBO);
+	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)0);
+	glEnableVertexAttribArray(1);
+	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)(2 * sizeof(float)));
+	glBindVertexArray(0);
+}
+
+static void addQuad(vector<float>& vertices, float x0, float y0, float x1, float y1, const float* color) {
+	float corners[6][2] = { { x0, y0 }, { x1, y0 }, { x1, y1 }, { x0, y0 }, { x1, y1 }, { x0, y1 } };
+	for (int i = 0; i < 6; i++) {
+		vertices.push_back(corners[i][0]);
+		vertices.push_back(corners[i][1]);
+		vertices.push_back(color[0]);
+		vertices.push_back(color[1]);
+		vertices.push_back(color[2]);
+	}
+}
+
+void FrameProfiler::renderOverlay(int height) {
+	if (!this->overlay || !this->initialized || this->history.empty()) {
+		return;
+	}
+	if (this->overlayShader == nullptr) {
+		createOverlay();
+	}
+	static const float background[3] = { 0.08f, 0.08f, 0.1f };
+	static const float budget[3] = { 0.9f, 0.9f, 0.9f };
+	static const float cpuColor[3] = { 0.55f, 0.55f, 0.6f };
+	vector<float> vertices;
+	addQuad(vertices, graphLeft, graphBottom, graphLeft + graphWidth, graphBottom + graphHeight + 0.06f, background);
+
+	// Frame time history, oldest on the left; each bar is CPU frame time with the GPU passes stacked inside it
+	size_t count = min(this->history.size(), (size_t)graphFrames);
+	float barWidth = graphWidth / graphFrames;
+	for (size_t i = 0; i < count; i++) {
+		const Frame& frame = this->history[(this->historyNext + HISTORY - count + i) % HISTORY];
+		float x = graphLeft + i * barWidth;
+		float top = graphBottom + graphHeight * min(1.0f, (float)frame.cpuMs / graphRangeMs);
+		addQuad(vertices, x, graphBottom, x + barWidth * 0.8f, top, cpuColor);
+		float y = graphBottom;
+		for (int j = 0; j < frame.passCount; j++) {
+			if (frame.passes[j].gpuMs < 0.0) {
+				continue;
+			}
+			float h = graphHeight * min(1.0f, (float)frame.passes[j].gpuMs / graphRangeMs);
+			addQuad(vertices, x, y, x + barWidth * 0.8f, min(y + h, graphBottom + graphHeight), passColors[j]);
+			y += h;
+		}
+	}
+	// 16.6 ms budget line
+	float budgetY = graphBottom + graphHeight * (16.6f / graphRangeMs);
+	addQuad(vertices, graphLeft, budgetY, graphLeft + graphWidth, budgetY + 2.0f / max(height, 1), budget);
+
+	GLboolean depthTest = glIsEnabled(GL_DEPTH_TEST);
+	glDisable(GL_DEPTH_TEST);
+	this->overlayShader->use();
+	glBindVertexArray(this->overlayVAO);
+	glBindBuffer(GL_ARRAY_BUFFER, this->overlayVBO);
+	glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(float), vertices.data(), GL_STREAM_DRAW);
+	glDrawArrays(GL_TRIANGLES, 0, (GLsizei)(vertices.size() / 5));
+	glBindVertexArray(0);
+	if (depthTest) {
+		glEnable(GL_DEPTH_TEST);
+	}
+}
+
+ProfileScope::ProfileScope(const char* name) {
+	FrameProfiler::instance().beginScope(name);
+}
+
+ProfileScope::~ProfileScope() {
+	FrameProfiler::instance().endScope();
+}
@@ -0,0 +1,131 @@
+#ifndef FRAME_PROFILER_CLASS_H
+#define FRAME_PROFILER_CLASS_H
+
+#include <glad/gl.h>
+#include <glm/glm.hpp>
+#include <chrono>
+#include <fstream>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// GL_ARB_pipeline_statistics_query target; the query itself uses the core entry points
+#ifndef GL_FRAGMENT_SHADER_INVOCATIONS_ARB
+#define GL_FRAGMENT_SHADER_INVOCATIONS_ARB 0x82F4
+#endif
+
+class Shader;
+
+// Per-frame CPU and GPU timing. GPU passes are timed with GL_TIME_ELAPSED
+// queries kept in a ring several frames deep; a frame's results are only read
+// once the driver reports them available, so measuring never stalls the
+// pipeline. Finished frames go to a history used for percentiles, the
+// overlay and the optional CSV and Chrome trace exports.
+class FrameProfiler {
+    public:
+    enum { MAX_PASSES = 8, MAX_SCOPES = 8, QUERY_FRAMES = 4, HISTORY = 512 };
+
+    struct PassStats {
+        const char* name;
+        double gpuMs;
+        double submitMs;        // CPU time at glBeginQuery, places the pass in the trace
+        int draws;
+        uint64_t triangles;
+        uint64_t instances;
+        int64_t fragments;      // fragments shaded (or passing the depth test), -1 if unknown
+    };
+    struct ScopeStats {
+        const char* name;
+        double startMs;
+        double endMs;
+    };
+    struct Frame {
+        uint64_t index;
+        double startMs;
+        double cpuMs;           // beginFrame to beginFrame
+        uint64_t pixels;        // scene pixels, the denominator of overdraw
+        int passCount;
+        int scopeCount;
+        PassStats passes[MAX_PASSES];
+        ScopeStats scopes[MAX_SCOPES];
+    };
+
+    bool overlay;
+    // True when fragments are counted as fragment shader invocations rather than samples passed
+    bool shaderInvocations;
+
+    static FrameProfiler& instance();
+
+    // Must be called with a current context
+    void init();
+    void beginFrame();
+    void endFrame();
+    void beginPass(const char* name);
+    void endPass();
+    void beginScope(const char* name);
+    void endScope();
+    // Credit a draw call to the open pass, if any
+    void countDraw(uint64_t triangles, uint64_t instances);
+    // Size of the frame's scene viewport
+    void setPixelCount(uint64_t pixels);
+
+    // Percentile p in [0, 100] of the recent CPU frame times, in ms
+    double frameTimePercentile(double p) const;
+    // Mean GPU time of a pass over the recent history, in ms
+    double averagePassMs(const char* name) const;
+    // Summed GPU pass time of the newest resolved frame and its index; -1 before any
+    double latestGpuMs(uint64_t& frame) const;
+    // Mean fragments per scene pixel of a pass over the recent history; 0 if unknown
+    double overdraw(const char* name) const;
+    // One line of p50/p95/p99 and per-pass GPU times, for the window title
+    std::string summary() const;
+    // Frame time graph with the GPU passes stacked in each bar; no-op unless overlay is set
+    void renderOverlay(int height);
+
+    bool openCsv(const char* path);
+    bool openChromeTrace(const char* path);
+    // Flushes and closes the exports
+    void finish();
+
+    private:
+    std::chrono::steady_clock::time_point origin;
+    GLuint queries[QUERY_FRAMES][MAX_PASSES];
+    GLuint fragmentQueries[QUERY_FRAMES][MAX_PASSES];
+    GLenum fragmentTarget;
+    Frame pending[QUERY_FRAMES];
+    bool pendingUsed[QUERY_FRAMES];
+    int current;
+    int openPass;
+    int scopeStack[MAX_SCOPES];
+    int scopeDepth;
+    int droppedScopes;          // begun past MAX_SCOPES and not yet ended
+    uint64_t frameIndex;
+    bool initialized;
+    bool inFrame;
+    std::vector<Frame> history;
+    size_t historyNext;
+
+    std::ofstream csv;
+    std::ofstream trace;
+
+    Shader* overlayShader;
+    GLuint overlayVAO;
+    GLuint overlayVBO;
+
+    FrameProfiler();
+    double nowMs() const;
+    bool collect(int slot, bool force);
+    void record(const Frame& frame);
+    void writeCsv(const Frame& frame);
+    void writeTrace(const Frame& frame);
+    void createOverlay();
+};
+
+// Times the enclosing block as a CPU scope of the current frame
+class ProfileScope {
+    public:
+    ProfileScope(const char* name);
+    ~ProfileScope();
+};
+
+#endif
@@ -0,0 +1,378 @@
+#include "core/job_system.h"
+
+#include <algorithm>
+
+using namespace std;
+
+// One waiting continuation of a job
+struct JobLink {
+	JobHandle job;
+	JobLink* next;
+};
+
+// Which system and slot the running thread belongs to; -1 for threads a system did not start
+static thread_local const JobSystem* threadSystem = nullptr;
+static thread_local int threadSlot = -1;
+
+// Hands allocate_shared the system's pool; the job and its shared count share one slot
+template <typename T>
+class JobAllocator {
+	public:
+	typedef T value_type;
+
+	JobSystem* jobs;
+
+	JobAllocator(JobSystem* jobs) : jobs(jobs) {}
+	template <typename U>
+	JobAllocator(const JobAllocator<U>& other) : jobs(other.jobs) {}
+
+	T* allocate(size_t count) { return (T*)this->jobs->allocateBlock(count * sizeof(T)); }
+	void deallocate(T* p, size_t count) { this->jobs->freeBlock(p, count * sizeof(T)); }
+	template <typename U>
+	bool operator==(const JobAllocator<U>& other) const { return this->jobs == other.jobs; }
+	template <typename U>
+	bool operator!=(const JobAllocator<U>& other) const { return this->jobs != other.jobs; }
+};
+
+JobSystem::JobRing::JobRing() {
+	this->head = 0;
+	this->count = 0;
+}
+
+void JobSystem::JobRing::pushBack(const JobHandle& job) {
+	if (this->count == this->items.size()) {
+		// Unroll into a ring twice the size
+		vector<JobHandle> grown(max(this->items.size() * 2, (size_t)64));
+		for (size_t i = 0; i < this->count; i++) {
+			grown[i].swap(this->items[(this->head + i) % this->items.size()]);
+		}
+		this->items.swap(grown);
+		this->head = 0;
+	}
+	this->items[(this->head + this->count) % this->items.size()] = job;
+	this->count++;
+}
+
+JobHandle JobSystem::JobRing::popBack() {
+	JobHandle job;
+	if (this->count > 0) {
+		this->count--;
+		job.swap(this->items[(this->head + this->count) % this->items.size()]);
+	}
+	return job;
+}
+
+JobHandle JobSystem::JobRing::popFront() {
+	JobHandle job;
+	if (this->count > 0) {
+		job.swap(this->items[this->head]);
+		this->head = (this->head + 1) % this->items.size();
+		this->count--;
+	}
+	return job;
+}
+
+JobSystem::JobSystem(int workerCount)
+	: blocks(MEMORY_JOBS, sizeof(Job) + 64, 256) {
+	this->queued = 0;
+	this->sleeping = 0;
+	this->stopping = false;
+	this->statsSince = chrono::steady_clock::now();
+	for (int i = 0; i < max(workerCount, 0) + 1; i++) {
+		Slot* slot = new Slot();
+		slot->depth = 0;
+		slot->jobCount = 0;
+		slot->stealCount = 0;
+		slot->busyNs = 0;
+		this->slots.push_back(slot);
+	}
+	threadSystem = this;
+	threadSlot = 0;
+	for (int i = 1; i < (int)this->slots.size(); i++) {
+		this->threads.push_back(thread(&JobSystem::workerLoop, this, i));
+	}
+}
+
+JobSystem::~JobSystem() {
+	{
+		lock_guard<mutex> lock(this->sleepMutex);
+		this->stopping = true;
+	}
+	this->wake.notify_all();
+	for (size_t i = 0; i < this->threads.size(); i++) {
+		this->threads[i].join();
+	}
+	// Jobs never run still hold pool slots; drop them before the pool goes
+	this->mainJobs.clear();
+	for (size_t i = 0; i < this->slots.size(); i++) {
+		delete this->slots[i];
+	}
+	if (threadSystem == this) {
+		threadSystem = nullptr;
+		threadSlot = -1;
+	}
+}
+
+int JobSystem::threadCount() const {
+	return (int)this->slots.size();
+}
+
+int JobSystem::currentSlot() const {
+	return threadSystem == this ? threadSlot : -1;
+}
+
+void* JobSystem::allocateBlock(size_t bytes) {
+	if (bytes > this->blocks.slotBytes()) {
+		return ::operator new(bytes);
+	}
+	lock_guard<mutex> lock(this->poolMutex);
+	return this->blocks.allocate();
+}
+
+void JobSystem::freeBlock(void* block, size_t bytes) {
+	if (bytes > this->blocks.slotBytes()) {
+		::operator delete(block);
+		return;
+	}
+	lock_guard<mutex> lock(this->poolMutex);
+	this->blocks.free(block);
+}
+
+JobHandle JobSystem::run(function<void()> work) {
+	return submit(nullptr, 0, move(work), false);
+}
+
+JobHandle JobSystem::then(const vector<JobHandle>& dependencies, function<void()> work) {
+	return submit(dependencies.data(), dependencies.size(), move(work), false);
+}
+
+JobHandle JobSystem::then(const JobHandle& dependency, function<void()> work) {
+	return submit(&dependency, 1, move(work), false);
+}
+
+JobHandle JobSystem::thenOnMain(const vector<JobHandle>& dependencies, function<void()> work) {
+	return submit(dependencies.data(), dependencies.size(), move(work), true);
+}
+
+JobHandle JobSystem::thenOnMain(const JobHandle& dependency, function<void()> work) {
+	return submit(&dependency, 1, move(work), true);
+}
+
+JobHandle JobSystem::submit(const JobHandle* dependencies, size_t count, function<void()> work, bool mainThread) {
+	JobHandle job = allocate_shared<Job>(JobAllocator<Job>(this));
+	job->work = move(work);
+	job->blockers = 1;
+	job->finished = false;
+	job->mainThread = mainThread;
+	job->continuations = nullptr;
+	for (size_t i = 0; i < count; i++) {
+		Job* dependency = dependencies[i].get();
+		if (dependency == nullptr) {
+			continue;
+		}
+		// A dependency finishing concurrently either sees the continuation or is already marked finished
+		lock_guard<mutex> lock(dependency->continuationMutex);
+		if (!dependency->finished) {
+			job->blockers++;
+			JobLink* link = new (allocateBlock(sizeof(JobLink))) JobLink();
+			link->job = job;
+			link->next = dependency->continuations;
+			dependency->continuations = link;
+		}
+	}
+	if (--job->blockers == 0) {
+		ready(job);
+	}
+	return job;
+}
+
+void JobSystem::ready(const JobHandle& job) {
+	if (job->mainThread) {
+		lock_guard<mutex> lock(this->mainMutex);
+		this->mainJobs.push_back(job);
+		return;
+	}
+	// Foreign threads hand their jobs to the main thread's deque, where the workers steal them
+	int slot = max(currentSlot(), 0);
+	{
+		lock_guard<mutex> lock(this->slots[slot]->dequeMutex);
+		this->slots[slot]->jobs.pushBack(job);
+	}
+	this->queued++;
+	// A worker about to sleep has counted itself before checking queued, so it cannot miss this
+	if (this->sleeping > 0) {
+		lock_guard<mutex> lock(this->sleepMutex);
+		this->wake.notify_one();
+	}
+}
+
+JobHandle JobSystem::take(int slot) {
+	JobHandle job;
+	{
+		Slot& own = *this->slots[slot];
+		lock_guard<mutex> lock(own.dequeMutex);
+		job = own.jobs.popBack();
+	}
+	int count = (int)this->slots.size();
+	for (int i = 1; job == nullptr && i < count; i++) {
+		Slot& victim = *this->slots[(slot + i) % count];
+		lock_guard<mutex> lock(victim.dequeMutex);
+		job = victim.jobs.popFront();
+		if (job != nullptr) {
+			this->slots[slot]->stealCount++;
+		}
+	}
+	if (job != nullptr) {
+		this->queued--;
+	}
+	return job;
+}
+
+bool JobSystem::runOneMainJob() {
+	JobHandle job;
+	{
+		lock_guard<mutex> lock(this->mainMutex);
+		if (this->mainJobs.empty()) {
+			return false;
+		}
+		job = this->mainJobs.front();
+		this->mainJobs.erase(this->mainJobs.begin());
+	}
+	execute(0, job);
+	return true;
+}
+
+bool JobSystem::help(int slot) {
+	if (slot == 0 && runOneMainJob()) {
+		return true;
+	}
+	JobHandle next = slot >= 0 ? take(slot) : JobHandle();
+	if (next == nullptr) {
+		return false;
+	}
+	execute(slot, next);
+	return true;
+}
+
+void JobSystem::execute(int slot, const JobHandle& job) {
+	Slot& s = *this->slots[slot];
+	// Only the outermost job is timed; nested ones run inside its time
+	if (s.depth++ == 0) {
+		s.busySince = chrono::steady_clock::now();
+	}
+	job->work();
+	job->work = nullptr;
+	if (--s.depth == 0) {
+		s.busyNs += (uint64_t)chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - s.busySince).count();
+	}
+	s.jobCount++;
+
+	JobLink* link;
+	{
+		lock_guard<mutex> lock(job->continuationMutex);
+		job->finished = true;
+		link = job->continuations;
+		job->continuations = nullptr;
+	}
+	while (link != nullptr) {
+		JobLink* next = link->next;
+		if (--link->job->blockers == 0) {
+			ready(link->job);
+		}
+		link->~JobLink();
+		freeBlock(link, sizeof(JobLink));
+		link = next;
+	}
+}
+
+void JobSystem::wait(const JobHandle& job) {
+	int slot = currentSlot();
+	while (job != nullptr && !job->finished) {
+		if (!help(slot)) {
+			this_thread::yield();
+		}
+	}
+}
+
+void JobSystem::wait(const vector<JobHandle>& jobs) {
+	for (size_t i = 0; i < jobs.size(); i++) {
+		wait(jobs[i]);
+	}
+}
+
+// What the chunks of one parallelFor share; lives on the caller's stack until they are all done
+struct ParallelForState {
+	const function<void(int, int)>* fn;
+	int count;
+	int chunk;
+	atomic<int> remaining;
+};
+
+void JobSystem::parallelFor(int count, int minChunk, const function<void(int, int)>& fn) {
+	if (count <= 0) {
+		return;
+	}
+	// A few chunks per thread leaves room to balance uneven ones
+	int target = this->threadCount() * 4;
+	int chunk = max(max(minChunk, 1), (count + target - 1) / target);
+	if (chunk >= count) {
+		fn(0, count);
+		return;
+	}
+	ParallelForState state;
+	state.fn = &fn;
+	state.count = count;
+	state.chunk = chunk;
+	state.remaining = (count - 1) / chunk;
+	// The closures hold a pointer and an int, small enough to live inside the std::function
+	ParallelForState* shared = &state;
+	for (int first = chunk; first < count; first += chunk) {
+		run([shared, first]() {
+			(*shared->fn)(first, min(first + shared->chunk, shared->count));
+			shared->remaining--;
+		});
+	}
+	fn(0, chunk);
+	int slot = currentSlot();
+	while (state.remaining > 0) {
+		if (!help(slot)) {
+			this_thread::yield();
+		}
+	}
+}
+
+vector<JobSystem::ThreadStats> JobSystem::takeStats() {
+	chrono::steady_clock::time_point now = chrono::steady_clock::now();
+	double elapsedMs = chrono::duration<double, milli>(now - this->statsSince).count();
+	this->statsSince = now;
+	vector<ThreadStats> stats(this->slots.size());
+	for (size_t i = 0; i < this->slots.size(); i++) {
+		Slot& slot = *this->slots[i];
+		stats[i].jobs = slot.jobCount.exchange(0);
+		stats[i].steals = slot.stealCount.exchange(0);
+		stats[i].busyMs = slot.busyNs.exchange(0) / 1e6;
+		stats[i].utilisation = elapsedMs > 0.0 ? min(stats[i].busyMs / elapsedMs, 1.0) : 0.0;
+	}
+	return stats;
+}
+
+void JobSystem::workerLoop(int slot) {
+	threadSystem = this;
+	threadSlot = slot;
+	while (true) {
+		JobHandle job = take(slot);
+		if (job != nullptr) {
+			execute(slot, job);
+			continue;
+		}
+		unique_lock<mutex> lock(this->sleepMutex);
+		this->sleeping++;
+		while (!this->stopping && this->queued <= 0) {
+			this->wake.wait(lock);
+		}
+		this->sleeping--;
+		if (this->stopping) {
+			return;
+		}
+	}
+}
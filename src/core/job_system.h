@@ -0,0 +1,121 @@
+#ifndef JOB_SYSTEM_CLASS_H
+#define JOB_SYSTEM_CLASS_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <thread>
+#include <vector>
+
+#include "core/memory.h"
+
+struct JobLink;
+
+// A unit of work and the jobs that wait for it
+struct Job {
+    std::function<void()> work;
+    std::atomic<int> blockers;          // unfinished dependencies, plus one while being submitted
+    std::atomic<bool> finished;
+    bool mainThread;                    // runs from the main-thread queue
+    std::mutex continuationMutex;
+    JobLink* continuations;
+};
+typedef std::shared_ptr<Job> JobHandle;
+
+// Work-stealing job scheduler. Each thread, the one that created the system
+// included, owns a deque: it pushes and pops its own jobs at the back, most
+// recent first, and idle threads steal the oldest from the front of the
+// others'. Waiting on a job runs other jobs meanwhile, so jobs may submit and
+// wait on jobs of their own. Jobs that must run on the creating thread, GL
+// calls in particular, go to a separate queue that only that thread drains.
+//
+// Jobs and their bookkeeping come from a pool and the deques are rings that
+// keep their capacity, so once warmed up submitting a job whose function
+// fits std::function's inline storage (two pointers) does not allocate.
+class JobSystem {
+    public:
+    struct ThreadStats {
+        uint64_t jobs;
+        uint64_t steals;
+        double busyMs;          // inside jobs, including jobs waiting on others
+        double utilisation;     // busyMs over the time since the previous takeStats
+    };
+
+    // workerCount threads besides the calling one, which becomes the main thread
+    JobSystem(int workerCount);
+    ~JobSystem();
+
+    int threadCount() const;
+    JobHandle run(std::function<void()> work);
+    // Runs once every dependency has finished; null handles count as finished
+    JobHandle then(const std::vector<JobHandle>& dependencies, std::function<void()> work);
+    JobHandle then(const JobHandle& dependency, std::function<void()> work);
+    // Like then, on the main thread, from its next wait
+    JobHandle thenOnMain(const std::vector<JobHandle>& dependencies, std::function<void()> work);
+    JobHandle thenOnMain(const JobHandle& dependency, std::function<void()> work);
+    // Runs jobs until job has finished; the main thread also runs its queue meanwhile
+    void wait(const JobHandle& job);
+    void wait(const std::vector<JobHandle>& jobs);
+    // fn(first, last) over [0, count) in chunks of at least minChunk, a few per thread; returns when all are done
+    void parallelFor(int count, int minChunk, const std::function<void(int, int)>& fn);
+    // Per-thread counters since the previous call, main thread first
+    std::vector<ThreadStats> takeStats();
+
+    // Pool-backed allocator for the jobs' shared state
+    void* allocateBlock(size_t bytes);
+    void freeBlock(void* block, size_t bytes);
+
+    private:
+    // Double-ended ring; grows by doubling and never shrinks
+    struct JobRing {
+        std::vector<JobHandle> items;
+        size_t head;
+        size_t count;
+
+        JobRing();
+        void pushBack(const JobHandle& job);
+        JobHandle popBack();
+        JobHandle popFront();
+    };
+    struct Slot {
+        std::mutex dequeMutex;
+        JobRing jobs;
+        int depth;                             // jobs running on this thread, nested through wait
+        std::chrono::steady_clock::time_point busySince;
+        std::atomic<uint64_t> jobCount;
+        std::atomic<uint64_t> stealCount;
+        std::atomic<uint64_t> busyNs;
+    };
+
+    std::vector<Slot*> slots;
+    std::vector<std::thread> threads;
+    std::mutex poolMutex;
+    BlockPool blocks;
+    std::mutex mainMutex;
+    std::vector<JobHandle> mainJobs;
+    std::mutex sleepMutex;
+    std::condition_variable wake;
+    std::atomic<int> queued;
+    std::atomic<int> sleeping;
+    std::atomic<bool> stopping;
+    std::chrono::steady_clock::time_point statsSince;
+
+    int currentSlot() const;
+    JobHandle submit(const JobHandle* dependencies, size_t count, std::function<void()> work, bool mainThread);
+    void ready(const JobHandle& job);
+    JobHandle take(int slot);
+    bool runOneMainJob();
+    // Run one main-thread job, own job or stolen job; false if there was none
+    bool help(int slot);
+    void execute(int slot, const JobHandle& job);
+    void workerLoop(int slot);
+
+    JobSystem(const JobSystem&);
+    JobSystem& operator=(const JobSystem&);
+};
+
+#endif
@@ -0,0 +1,264 @@
+#include "core/memory.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <iomanip>
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#elif defined(__APPLE__)
+#include <mach/mach.h>
+#else
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+static atomic<uint64_t> heapAllocationCount(0);
+static atomic<uint64_t> heapAllocatedByteCount(0);
+
+// Counting replacements for the global allocation functions; the array and
+// nothrow forms forward here through the standard library's defaults
+void* operator new(size_t size) {
+	heapAllocationCount.fetch_add(1, memory_order_relaxed);
+	heapAllocatedByteCount.fetch_add(size, memory_order_relaxed);
+	void* p = malloc(size ? size : 1);
+	if (p == nullptr) {
+		throw bad_alloc();
+	}
+	return p;
+}
+
+void operator delete(void* p) noexcept {
+	free(p);
+}
+
+void* operator new[](size_t size) {
+	return operator new(size);
+}
+
+void operator delete[](void* p) noexcept {
+	operator delete(p);
+}
+
+static const char* tagNames[MEMORY_TAG_COUNT] = { "frame", "scene", "streaming", "jobs" };
+
+MemoryCounters::MemoryCounters() {
+	for (int i = 0; i < MEMORY_TAG_COUNT; i++) {
+		this->bytes[i] = 0;
+		this->peakBytes[i] = 0;
+		this->allocations[i] = 0;
+	}
+}
+
+MemoryCounters& MemoryCounters::instance() {
+	static MemoryCounters counters;
+	return counters;
+}
+
+void MemoryCounters::allocated(MemoryTag tag, size_t bytes) {
+	int64_t now = this->bytes[tag].fetch_add((int64_t)bytes) + (int64_t)bytes;
+	int64_t peak = this->peakBytes[tag].load();
+	while (now > peak && !this->peakBytes[tag].compare_exchange_weak(peak, now)) {
+	}
+	this->allocations[tag]++;
+}
+
+void MemoryCounters::freed(MemoryTag tag, size_t bytes) {
+	this->bytes[tag] -= (int64_t)bytes;
+}
+
+MemoryCounters::Usage MemoryCounters::usage(MemoryTag tag) const {
+	Usage usage;
+	usage.name = tagNames[tag];
+	usage.bytes = this->bytes[tag].load();
+	usage.peakBytes = this->peakBytes[tag].load();
+	usage.allocations = this->allocations[tag].load();
+	return usage;
+}
+
+uint64_t MemoryCounters::heapAllocations() {
+	return heapAllocationCount.load(memory_order_relaxed);
+}
+
+uint64_t MemoryCounters::heapAllocatedBytes() {
+	return heapAllocatedByteCount.load(memory_order_relaxed);
+}
+
+long MemoryCounters::residentKb() {
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters;
+	if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+		return (long)(counters.WorkingSetSize / 1024);
+	}
+	return 0;
+#elif defined(__APPLE__)
+	mach_task_basic_info_data_t info;
+	mach_msg_type_number_t count = MACH_TASK_BASIC_INFO_COUNT;
+	if (task_info(mach_task_self(), MACH_TASK_BASIC_INFO, (task_info_t)&info, &count) != KERN_SUCCESS) {
+		return 0;
+	}
+	return (long)(info.resident_size / 1024);
+#else
+	// Second field of statm is the resident set in pages
+	FILE* file = fopen("/proc/self/statm", "r");
+	if (file == nullptr) {
+		return 0;
+	}
+	long pages = 0, resident = 0;
+	int read = fscanf(file, "%ld %ld", &pages, &resident);
+	fclose(file);
+	return read == 2 ? resident * (sysconf(_SC_PAGESIZE) / 1024) : 0;
+#endif
+}
+
+void MemoryCounters::printSummary(ostream& out) const {
+	out << fixed << setprecision(2);
+	out << "Memory: " << residentKb() / 1024.0 << " MB resident, " << heapAllocations() << " heap allocations ("
+	    << heapAllocatedBytes() / (1024.0 * 1024.0) << " MB) so far" << endl;
+	out << setw(12) << "MB" << setw(10) << "peak MB" << setw(9) << "blocks" << "  subsystem" << endl;
+	for (int i = 0; i < MEMORY_TAG_COUNT; i++) {
+		Usage u = usage((MemoryTag)i);
+		out << setw(12) << u.bytes / (1024.0 * 1024.0) << setw(10) << u.peakBytes / (1024.0 * 1024.0)
+		    << setw(9) << u.allocations << "  " << u.name << endl;
+	}
+}
+
+Arena::Arena(MemoryTag tag, size_t blockBytes) {
+	// Constructed first, the counters outlive static arenas
+	MemoryCounters::instance();
+	this->tag = tag;
+	this->blockBytes = max(blockBytes, (size_t)256);
+	this->current = 0;
+	this->offset = 0;
+}
+
+Arena::~Arena() {
+	release();
+}
+
+void* Arena::allocate(size_t bytes, size_t alignment) {
+	// Bump through the current block, then the ones a reset left behind, then a new one
+	while (this->current < this->blocks.size()) {
+		Block& block = this->blocks[this->current];
+		uintptr_t base = (uintptr_t)block.data;
+		size_t start = (size_t)(((base + this->offset + alignment - 1) & ~(uintptr_t)(alignment - 1)) - base);
+		if (start + bytes <= block.size) {
+			this->offset = start + bytes;
+			return block.data + start;
+		}
+		this->current++;
+		this->offset = 0;
+	}
+	Block block;
+	block.size = max(this->blockBytes, bytes + alignment);
+	block.data = (unsigned char*)malloc(block.size);
+	if (block.data == nullptr) {
+		throw bad_alloc();
+	}
+	MemoryCounters::instance().allocated(this->tag, block.size);
+	this->blocks.push_back(block);
+	this->current = this->blocks.size() - 1;
+	uintptr_t base = (uintptr_t)block.data;
+	size_t start = (size_t)(((base + alignment - 1) & ~(uintptr_t)(alignment - 1)) - base);
+	this->offset = start + bytes;
+	return block.data + start;
+}
+
+Arena::Mark Arena::mark() const {
+	Mark mark = { this->current, this->offset };
+	return mark;
+}
+
+void Arena::rewind(const Mark& mark) {
+	this->current = mark.block;
+	this->offset = mark.offset;
+}
+
+void Arena::reset() {
+	this->current = 0;
+	this->offset = 0;
+}
+
+void Arena::release() {
+	for (size_t i = 0; i < this->blocks.size(); i++) {
+		MemoryCounters::instance().freed(this->tag, this->blocks[i].size);
+		free(this->blocks[i].data);
+	}
+	this->blocks.clear();
+	reset();
+}
+
+size_t Arena::used() const {
+	size_t total = this->offset;
+	for (size_t i = 0; i < this->current && i < this->blocks.size(); i++) {
+		total += this->blocks[i].size;
+	}
+	return total;
+}
+
+size_t Arena::reserved() const {
+	size_t total = 0;
+	for (size_t i = 0; i < this->blocks.size(); i++) {
+		total += this->blocks[i].size;
+	}
+	return total;
+}
+
+Arena& Arena::frame() {
+	static Arena arena(MEMORY_FRAME, 256 * 1024);
+	return arena;
+}
+
+BlockPool::BlockPool(MemoryTag tag, size_t slotBytes, int slotsPerBlock) {
+	MemoryCounters::instance();
+	this->tag = tag;
+	// Free slots hold the free list's next pointer
+	this->slotSize = (max(slotBytes, sizeof(void*)) + 15) & ~(size_t)15;
+	this->slotsPerBlock = max(slotsPerBlock, 1);
+	this->freeList = nullptr;
+	this->live = 0;
+}
+
+BlockPool::~BlockPool() {
+	for (size_t i = 0; i < this->blocks.size(); i++) {
+		MemoryCounters::instance().freed(this->tag, this->slotSize * this->slotsPerBlock);
+		::free(this->blocks[i]);
+	}
+}
+
+void* BlockPool::allocate() {
+	if (this->freeList == nullptr) {
+		size_t size = this->slotSize * this->slotsPerBlock;
+		unsigned char* block = (unsigned char*)malloc(size);
+		if (block == nullptr) {
+			throw bad_alloc();
+		}
+		MemoryCounters::instance().allocated(this->tag, size);
+		this->blocks.push_back(block);
+		for (int i = this->slotsPerBlock - 1; i >= 0; i--) {
+			void* slot = block + i * this->slotSize;
+			*(void**)slot = this->freeList;
+			this->freeList = slot;
+		}
+	}
+	void* slot = this->freeList;
+	this->freeList = *(void**)slot;
+	this->live++;
+	return slot;
+}
+
+void BlockPool::free(void* slot) {
+	*(void**)slot = this->freeList;
+	this->freeList = slot;
+	this->live--;
+}
+
+size_t BlockPool::slotBytes() const {
+	return this->slotSize;
+}
+
+int BlockPool::liveSlots() const {
+	return this->live;
+}
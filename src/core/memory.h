@@ -0,0 +1,180 @@
+#ifndef MEMORY_CLASS_H
+#define MEMORY_CLASS_H
+
+#include <atomic>
+#include <cstddef>
+#include <iostream>
+#include <new>
+#include <stdint.h>
+#include <vector>
+
+// Subsystems that account for the memory they hold
+enum MemoryTag {
+    MEMORY_FRAME,           // the per-frame arena
+    MEMORY_SCENE,           // scene description instances
+    MEMORY_STREAMING,       // streamed chunk and tile contents
+    MEMORY_JOBS,
+    MEMORY_TAG_COUNT
+};
+
+// Bytes held per subsystem by arenas and pools, plus every heap allocation
+// made through the global operator new, which memory.cpp replaces. The heap
+// counters make "no allocations this frame" checkable; C code calling malloc
+// directly (stb_image, the drivers) is not counted.
+class MemoryCounters {
+    public:
+    struct Usage {
+        const char* name;
+        int64_t bytes;
+        int64_t peakBytes;
+        uint64_t allocations;   // blocks taken from the heap
+    };
+
+    static MemoryCounters& instance();
+
+    void allocated(MemoryTag tag, size_t bytes);
+    void freed(MemoryTag tag, size_t bytes);
+    Usage usage(MemoryTag tag) const;
+
+    static uint64_t heapAllocations();
+    static uint64_t heapAllocatedBytes();
+    // Current resident set size of the process, 0 if unknown
+    static long residentKb();
+    // Per-subsystem usage and the process totals
+    void printSummary(std::ostream& out) const;
+
+    private:
+    std::atomic<int64_t> bytes[MEMORY_TAG_COUNT];
+    std::atomic<int64_t> peakBytes[MEMORY_TAG_COUNT];
+    std::atomic<uint64_t> allocations[MEMORY_TAG_COUNT];
+
+    MemoryCounters();
+};
+
+// Linear allocator: allocations bump a pointer through a chain of blocks and
+// are released all at once by reset(), which keeps the blocks, or release(),
+// which returns them. Nothing is constructed or destroyed, so it holds plain
+// data. Not thread-safe: an arena belongs to one thread at a time.
+class Arena {
+    public:
+    struct Mark {
+        size_t block;
+        size_t offset;
+    };
+
+    Arena(MemoryTag tag, size_t blockBytes = 64 * 1024);
+    ~Arena();
+
+    // 16-byte aligned unless asked otherwise; requests larger than a block get a block of their own
+    void* allocate(size_t bytes, size_t alignment = 16);
+    template <typename T>
+    T* allocate(size_t count) { return (T*)allocate(count * sizeof(T), alignof(T) > 16 ? alignof(T) : 16); }
+    Mark mark() const;
+    // Release everything allocated since mark
+    void rewind(const Mark& mark);
+    void reset();
+    void release();
+    size_t used() const;
+    size_t reserved() const;
+
+    // Transient data of the current frame on the main thread; main() resets it every frame
+    static Arena& frame();
+
+    private:
+    struct Block {
+        unsigned char* data;
+        size_t size;
+    };
+    MemoryTag tag;
+    size_t blockBytes;
+    std::vector<Block> blocks;
+    size_t current;             // block being bumped through
+    size_t offset;
+
+    Arena(const Arena&);
+    Arena& operator=(const Arena&);
+};
+
+// Standard allocator over an Arena, for containers that live no longer than
+// the arena's next reset; deallocation is a no-op
+template <typename T>
+class ArenaAllocator {
+    public:
+    typedef T value_type;
+
+    Arena* arena;
+
+    ArenaAllocator(Arena& arena) : arena(&arena) {}
+    template <typename U>
+    ArenaAllocator(const ArenaAllocator<U>& other) : arena(other.arena) {}
+
+    T* allocate(size_t count) { return this->arena->template allocate<T>(count); }
+    void deallocate(T*, size_t) {}
+    template <typename U>
+    bool operator==(const ArenaAllocator<U>& other) const { return this->arena == other.arena; }
+    template <typename U>
+    bool operator!=(const ArenaAllocator<U>& other) const { return this->arena != other.arena; }
+};
+
+// Fixed-size slots carved from blocks of slotsPerBlock, recycled through a
+// free list. Blocks go back to the heap only when the pool is destroyed.
+// Not thread-safe.
+class BlockPool {
+    public:
+    BlockPool(MemoryTag tag, size_t slotBytes, int slotsPerBlock = 64);
+    ~BlockPool();
+
+    void* allocate();
+    void free(void* slot);
+    size_t slotBytes() const;
+    int liveSlots() const;
+
+    private:
+    MemoryTag tag;
+    size_t slotSize;
+    int slotsPerBlock;
+    std::vector<unsigned char*> blocks;
+    void* freeList;
+    int live;
+
+    BlockPool(const BlockPool&);
+    BlockPool& operator=(const BlockPool&);
+};
+
+// Recycles objects of one type. A released object is not destroyed, so
+// acquiring it again hands back its containers with their capacity intact;
+// callers reset the contents themselves. Not thread-safe.
+template <typename T>
+class Pool {
+    public:
+    Pool(MemoryTag tag, int perBlock = 64) : slots(tag, sizeof(T) > sizeof(void*) ? sizeof(T) : sizeof(void*), perBlock) {}
+    ~Pool() {
+        for (size_t i = 0; i < this->idle.size(); i++) {
+            this->idle[i]->~T();
+            this->slots.free(this->idle[i]);
+        }
+    }
+
+    T* acquire() {
+        if (!this->idle.empty()) {
+            T* object = this->idle.back();
+            this->idle.pop_back();
+            return object;
+        }
+        return new (this->slots.allocate()) T();
+    }
+    void release(T* object) {
+        this->idle.push_back(object);
+    }
+    // Objects handed out and not released
+    int live() const { return this->slots.liveSlots() - (int)this->idle.size(); }
+
+    private:
+    BlockPool slots;
+    std::vector<T*> idle;
+
+    Pool(const Pool&);
+    Pool& operator=(const Pool&);
+};
+
+#endif
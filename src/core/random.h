@@ -0,0 +1,43 @@
+#ifndef RANDOM_H
+#define RANDOM_H
+
+#include <stdint.h>
+
+// Counter-based random numbers: every value is a pure function of a seed and
+// an index, so results do not depend on call order or on which thread asked.
+
+// SplitMix64 finaliser; a good 64-bit mixer
+inline uint64_t mix64(uint64_t x)
+{
+    x += 0x9E3779B97F4A7C15ULL;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
+}
+
+inline uint64_t hashCombine(uint64_t seed, uint64_t value)
+{
+    return mix64(seed ^ mix64(value));
+}
+
+// Uniform float in [0, 1) from the top 24 bits
+inline float unitFloat(uint64_t bits)
+{
+    return (float)(bits >> 40) * (1.0f / 16777216.0f);
+}
+
+class CounterRandom {
+    public:
+    uint64_t seed;
+    uint64_t counter;
+
+    CounterRandom(uint64_t seed, uint64_t counter = 0) : seed(seed), counter(counter) {}
+
+    uint64_t next() { return hashCombine(seed, counter++); }
+    float uniform() { return unitFloat(next()); }
+    float uniform(float low, float high) { return low + (high - low) * uniform(); }
+    // Integer in [low, high]
+    int range(int low, int high) { return low + (int)(next() % (uint64_t)(high - low + 1)); }
+};
+
+#endif
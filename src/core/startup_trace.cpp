@@ -0,0 +1,197 @@
+#include "core/startup_trace.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+using namespace std;
+
+StartupTrace::StartupTrace() {
+	this->origin = chrono::steady_clock::now();
+	this->active = true;
+}
+
+StartupTrace& StartupTrace::instance() {
+	static StartupTrace trace;
+	return trace;
+}
+
+double StartupTrace::nowMs() const {
+	return chrono::duration<double, milli>(chrono::steady_clock::now() - this->origin).count();
+}
+
+void StartupTrace::begin(const char* name, const char* category) {
+	if (!this->active) {
+		return;
+	}
+	Event event;
+	event.name = name;
+	event.category = category;
+	event.depth = (int)this->open.size();
+	event.startMs = nowMs();
+	event.endMs = event.startMs;
+	event.bytesRead = 0;
+	event.bytesUploaded = 0;
+	event.peakRssKb = 0;
+	this->open.push_back(this->events.size());
+	this->events.push_back(event);
+}
+
+void StartupTrace::end() {
+	if (!this->active || this->open.empty()) {
+		return;
+	}
+	Event& event = this->events[this->open.back()];
+	event.endMs = nowMs();
+	event.peakRssKb = peakResidentKb();
+	this->open.pop_back();
+}
+
+void StartupTrace::addBytesRead(uint64_t bytes) {
+	for (size_t i = 0; i < this->open.size(); i++) {
+		this->events[this->open[i]].bytesRead += bytes;
+	}
+}
+
+void StartupTrace::addBytesUploaded(uint64_t bytes) {
+	for (size_t i = 0; i < this->open.size(); i++) {
+		this->events[this->open[i]].bytesUploaded += bytes;
+	}
+}
+
+void StartupTrace::setChromeTracePath(const char* path) {
+	this->chromeTracePath = path;
+}
+
+void StartupTrace::finish() {
+	if (!this->active) {
+		return;
+	}
+	while (!this->open.empty()) {
+		end();
+	}
+	this->active = false;
+	printSummary(cout);
+	if (!this->chromeTracePath.empty()) {
+		if (writeChromeTrace(this->chromeTracePath.c_str())) {
+			cout << "Startup trace written to " << this->chromeTracePath << endl;
+		} else {
+			cout << "WARN: Could not write startup trace " << this->chromeTracePath << endl;
+		}
+	}
+}
+
+static bool longerFirst(const StartupTrace::Event* a, const StartupTrace::Event* b) {
+	return (a->endMs - a->startMs) > (b->endMs - b->startMs);
+}
+
+void StartupTrace::printSummary(ostream& out) const {
+	vector<const Event*> sorted;
+	for (size_t i = 0; i < this->events.size(); i++) {
+		sorted.push_back(&this->events[i]);
+	}
+	sort(sorted.begin(), sorted.end(), longerFirst);
+
+	double totalMs = nowMs();
+	out << "Startup: " << fixed << setprecision(1) << totalMs << " ms to first frame, peak RSS "
+	    << peakResidentKb() / 1024.0 << " MB" << endl;
+	out << setw(10) << "ms" << setw(8) << "%" << setw(11) << "read MB" << setw(11) << "upload MB"
+	    << setw(10) << "RSS MB" << "  phase" << endl;
+	for (size_t i = 0; i < sorted.size(); i++) {
+		const Event& event = *sorted[i];
+		double ms = event.endMs - event.startMs;
+		out << setw(10) << setprecision(1) << ms
+		    << setw(8) << (totalMs > 0 ? 100.0 * ms / totalMs : 0.0)
+		    << setw(11) << setprecision(2) << event.bytesRead / (1024.0 * 1024.0)
+		    << setw(11) << event.bytesUploaded / (1024.0 * 1024.0)
+		    << setw(10) << setprecision(1) << event.peakRssKb / 1024.0
+		    << "  " << string(event.depth * 2, ' ') << "[" << event.category << "] " << event.name << endl;
+	}
+	out.unsetf(ios::floatfield);
+}
+
+static string escapeJson(const string& text) {
+	string escaped;
+	for (size_t i = 0; i < text.size(); i++) {
+		char c = text[i];
+		if (c == '"' || c == '\\') {
+			escaped += '\\';
+			escaped += c;
+		} else if ((unsigned char)c < 0x20) {
+			char code[8];
+			snprintf(code, sizeof(code), "\\u%04x", c);
+			escaped += code;
+		} else {
+			escaped += c;
+		}
+	}
+	return escaped;
+}
+
+bool StartupTrace::writeChromeTrace(const char* path) const {
+	// Trace Event Format, loadable in chrome://tracing or Perfetto
+	ofstream file(path);
+	if (!file) {
+		return false;
+	}
+	file << "{\"traceEvents\":[" << endl;
+	for (size_t i = 0; i < this->events.size(); i++) {
+		const Event& event = this->events[i];
+		file << fixed << setprecision(3)
+		     << "{\"name\":\"" << escapeJson(event.name) << "\",\"cat\":\"" << escapeJson(event.category)
+		     << "\",\"ph\":\"X\",\"pid\":1,\"tid\":1,\"ts\":" << event.startMs * 1000.0
+		     << ",\"dur\":" << (event.endMs - event.startMs) * 1000.0
+		     << ",\"args\":{\"bytesRead\":" << event.bytesRead << ",\"bytesUploaded\":" << event.bytesUploaded
+		     << ",\"peakRssKb\":" << event.peakRssKb << "}}" << (i + 1 < this->events.size() ? "," : "") << endl;
+	}
+	file << "],\"displayTimeUnit\":\"ms\"}" << endl;
+	return (bool)file;
+}
+
+long StartupTrace::peakResidentKb() {
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters;
+	if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+		return (long)(counters.PeakWorkingSetSize / 1024);
+	}
+	return 0;
+#else
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) != 0) {
+		return 0;
+	}
+#ifdef __APPLE__
+	return usage.ru_maxrss / 1024;	// bytes on macOS
+#else
+	return usage.ru_maxrss;			// kilobytes on Linux
+#endif
+#endif
+}
+
+uint64_t StartupTrace::fileSize(const char* path) {
+	struct stat info;
+	if (stat(path, &info) != 0) {
+		return 0;
+	}
+	return (uint64_t)info.st_size;
+}
+
+StartupScope::StartupScope(const char* name, const char* category) {
+	StartupTrace::instance().begin(name, category);
+}
+
+StartupScope::StartupScope(const string& name, const char* category) {
+	StartupTrace::instance().begin(name.c_str(), category);
+}
+
+StartupScope::~StartupScope() {
+	StartupTrace::instance().end();
+}
@@ -0,0 +1,60 @@
+#ifndef STARTUP_TRACE_CLASS_H
+#define STARTUP_TRACE_CLASS_H
+
+#include <chrono>
+#include <iostream>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// Records where the time before the first frame goes. Phases and assets are
+// opened with StartupScope; bytes read and uploaded are attributed to every
+// scope open at the time, so parents include their children.
+class StartupTrace {
+    public:
+    struct Event {
+        std::string name;
+        std::string category;
+        int depth;
+        double startMs;
+        double endMs;
+        uint64_t bytesRead;
+        uint64_t bytesUploaded;
+        long peakRssKb;
+    };
+
+    std::vector<Event> events;
+    bool active;
+
+    static StartupTrace& instance();
+
+    void begin(const char* name, const char* category);
+    void end();
+    void addBytesRead(uint64_t bytes);
+    void addBytesUploaded(uint64_t bytes);
+    // Stops recording, prints the summary and writes the Chrome trace if requested
+    void finish();
+    void printSummary(std::ostream& out) const;
+    bool writeChromeTrace(const char* path) const;
+    void setChromeTracePath(const char* path);
+
+    static long peakResidentKb();
+    static uint64_t fileSize(const char* path);
+
+    private:
+    std::chrono::steady_clock::time_point origin;
+    std::vector<size_t> open;
+    std::string chromeTracePath;
+
+    StartupTrace();
+    double nowMs() const;
+};
+
+class StartupScope {
+    public:
+    StartupScope(const char* name, const char* category = "phase");
+    StartupScope(const std::string& name, const char* category = "phase");
+    ~StartupScope();
+};
+
+#endif
@@ -0,0 +1,233 @@
+#include "crowd.h"
+#include "stb_image.h"
+#include "core/random.h"
+#include "core/startup_trace.h"
+#include "scene/height_field.h"
+
+#include <glm/gtc/matrix_transform.hpp>
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+using namespace std;
+
+Crowd::Crowd() {
+	// Sized for the city.scene block grid: 300-unit blocks with streets halfway between them
+	this->scale = 10.0f;
+	this->walkSpeed = 14.0f;
+	this->streetSpacing = 300.0f;
+	this->streetOffset = 150.0f;
+	this->sidewalk = 40.0f;
+	this->extent = 900.0f;
+	this->groundHeight = 0.0f;
+	this->ground = nullptr;
+	this->vertexArrayID = 0;
+	this->uvBufferID = 0;
+	this->indexBufferID = 0;
+	this->animationBufferID = 0;
+	this->positionTexture = 0;
+	this->normalTexture = 0;
+	this->colorTexture = 0;
+}
+
+GLuint Crowd::createFrameTexture(const vector<glm::vec3>& samples, GLenum internalFormat, int width, int height) {
+	// The last row is only partly used; pad it so the upload reads whole rows
+	vector<glm::vec3> texels((size_t)width * height, glm::vec3(0.0f));
+	copy(samples.begin(), samples.end(), texels.begin());
+	GLuint texture;
+	glGenTextures(1, &texture);
+	glBindTexture(GL_TEXTURE_2D, texture);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, width, height, 0, GL_RGB, GL_FLOAT, texels.data());
+	return texture;
+}
+
+bool Crowd::load(const string& path) {
+	StartupScope scope(path, "vertex animation");
+	StartupTrace::instance().addBytesRead(StartupTrace::fileSize(path.c_str()));
+	if (!this->vat.read(path)) {
+		return false;
+	}
+	if (this->vat.clips.size() > (size_t)MAX_CLIPS) {
+		cout << "WARN: " << path << " has " << this->vat.clips.size() << " clips, only the first " << MAX_CLIPS << " play" << endl;
+		this->vat.clips.resize(MAX_CLIPS);
+	}
+
+	// Frames are laid out back to back in rows of a fixed width
+	GLint maxSize = 0;
+	glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxSize);
+	int width = min(4096, (int)maxSize);
+	size_t samples = (size_t)this->vat.vertexCount * this->vat.frameCount;
+	int height = (int)((samples + width - 1) / width);
+	if (samples == 0 || height > maxSize) {
+		cerr << "ERROR: " << path << " needs a " << width << "x" << height << " texture, the limit is " << maxSize << endl;
+		return false;
+	}
+	// Half floats hold a person-sized model to well under a millimetre; normals only need 8 bits
+	this->positionTexture = createFrameTexture(this->vat.positions, GL_RGBA16F, width, height);
+	this->normalTexture = createFrameTexture(this->vat.normals, GL_RGBA8_SNORM, width, height);
+	StartupTrace::instance().addBytesUploaded((uint64_t)width * height * (8 + 4));
+
+	string colorPath = path + ".png";
+	int w, h, channels;
+	uint8_t* img = stbi_load(colorPath.c_str(), &w, &h, &channels, 4);
+	uint8_t white[4] = { 255, 255, 255, 255 };
+	glGenTextures(1, &this->colorTexture);
+	glBindTexture(GL_TEXTURE_2D, this->colorTexture);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	if (img) {
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, w, h, 0, GL_RGBA, GL_UNSIGNED_BYTE, img);
+		StartupTrace::instance().addBytesUploaded((uint64_t)w * h * 4);
+	} else {
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, white);
+	}
+	glGenerateMipmap(GL_TEXTURE_2D);
+	stbi_image_free(img);
+
+	// Only uvs are vertex attributes; positions and normals come from the textures
+	glGenVertexArrays(1, &this->vertexArrayID);
+	glBindVertexArray(this->vertexArrayID);
+	glGenBuffers(1, &this->uvBufferID);
+	glBindBuffer(GL_ARRAY_BUFFER, this->uvBufferID);
+	glBufferData(GL_ARRAY_BUFFER, this->vat.uvs.size() * sizeof(glm::vec2), this->vat.uvs.data(), GL_STATIC_DRAW);
+	glEnableVertexAttribArray(2);
+	glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 0, 0);
+	glGenBuffers(1, &this->indexBufferID);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, this->indexBufferID);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, this->vat.indices.size() * sizeof(uint32_t), this->vat.indices.data(), GL_STATIC_DRAW);
+	glBindVertexArray(0);
+	StartupTrace::instance().addBytesUploaded(this->vat.uvs.size() * sizeof(glm::vec2) + this->vat.indices.size() * sizeof(uint32_t));
+
+	this->drawData.model = glm::mat4(1.0f);
+	this->drawData.normalModel = glm::mat4(1.0f);
+	this->drawData.animation = glm::vec4((float)this->vat.vertexCount, (float)width, 0.0f, 0.0f);
+	for (int i = 0; i < MAX_CLIPS; i++) {
+		this->drawData.clips[i] = glm::vec4(0.0f, 1.0f, 1.0f, 0.0f);
+		if (i < (int)this->vat.clips.size()) {
+			const VatClip& clip = this->vat.clips[i];
+			this->drawData.clips[i] = glm::vec4((float)clip.firstFrame, (float)clip.frameCount, clip.fps, clip.loop ? 1.0f : 0.0f);
+		}
+	}
+	// The per-vertex frames are no longer needed on the CPU
+	vector<glm::vec3>().swap(this->vat.positions);
+	vector<glm::vec3>().swap(this->vat.normals);
+	return true;
+}
+
+int Crowd::findClip(const string& name) const {
+	for (size_t i = 0; i < this->vat.clips.size(); i++) {
+		if (this->vat.clips[i].name == name) {
+			return (int)i;
+		}
+	}
+	return -1;
+}
+
+void Crowd::walkerTransform(const Walker& walker, glm::mat4& transform) const {
+	// Out along the line, then back
+	float distance = walker.distance;
+	glm::vec2 direction = walker.direction;
+	if (distance > walker.length) {
+		distance = 2.0f * walker.length - distance;
+		direction = -direction;
+	}
+	glm::vec2 position = walker.start + walker.direction * distance;
+	// glTF models face +z
+	float yaw = atan2(direction.x, direction.y);
+	float height = this->ground != nullptr ? this->ground->height(position.x, position.y) : this->groundHeight;
+	transform = glm::translate(glm::mat4(1.0f), glm::vec3(position.x, height, position.y));
+	transform = glm::rotate(transform, yaw, glm::vec3(0.0f, 1.0f, 0.0f));
+	transform = glm::scale(transform, glm::vec3(this->scale));
+}
+
+void Crowd::populate(int count, const string& walkClip, uint64_t seed) {
+	if (this->vertexArrayID == 0 || count <= 0 || this->vat.clips.empty()) {
+		return;
+	}
+	vector<float> streets;
+	for (int k = (int)ceil((-this->extent - this->streetOffset) / this->streetSpacing); ; k++) {
+		float street = this->streetOffset + k * this->streetSpacing;
+		if (street > this->extent) {
+			break;
+		}
+		streets.push_back(street);
+	}
+	if (streets.empty()) {
+		streets.push_back(0.0f);
+	}
+	int clip = findClip(walkClip);
+
+	CounterRandom random(seed);
+	this->walkers.resize(count);
+	this->transforms.resize(count);
+	vector<glm::vec2> animation(count);
+	for (int i = 0; i < count; i++) {
+		Walker& walker = this->walkers[i];
+		float line = streets[random.range(0, (int)streets.size() - 1)] + (random.uniform() < 0.5f ? -this->sidewalk : this->sidewalk);
+		bool alongX = random.uniform() < 0.5f;
+		walker.start = alongX ? glm::vec2(-this->extent, line) : glm::vec2(line, -this->extent);
+		walker.direction = alongX ? glm::vec2(1.0f, 0.0f) : glm::vec2(0.0f, 1.0f);
+		walker.length = 2.0f * this->extent;
+		walker.distance = random.uniform(0.0f, 2.0f * walker.length);
+		walkerTransform(walker, this->transforms[i]);
+		int walkerClip = clip >= 0 ? clip : random.range(0, (int)this->vat.clips.size() - 1);
+		// The time offset desynchronises walkers that share a clip
+		animation[i] = glm::vec2((float)walkerClip, random.uniform(0.0f, 60.0f));
+	}
+
+	createInstanceBuffer(this->transforms.data(), count);
+	glBindVertexArray(this->vertexArrayID);
+	bindInstanceAttributes();
+	glGenBuffers(1, &this->animationBufferID);
+	glBindBuffer(GL_ARRAY_BUFFER, this->animationBufferID);
+	glBufferData(GL_ARRAY_BUFFER, count * sizeof(glm::vec2), animation.data(), GL_STATIC_DRAW);
+	glEnableVertexAttribArray(6);
+	glVertexAttribPointer(6, 2, GL_FLOAT, GL_FALSE, 0, 0);
+	glVertexAttribDivisor(6, 1);
+	glBindVertexArray(0);
+	StartupTrace::instance().addBytesUploaded(count * sizeof(glm::vec2));
+}
+
+void Crowd::update(float dt) {
+	if (this->walkers.empty()) {
+		return;
+	}
+	for (size_t i = 0; i < this->walkers.size(); i++) {
+		Walker& walker = this->walkers[i];
+		walker.distance = fmod(walker.distance + this->walkSpeed * dt, 2.0f * walker.length);
+		walkerTransform(walker, this->transforms[i]);
+	}
+	updateInstances(0, (int)this->walkers.size(), this->transforms.data());
+}
+
+void Crowd::record(CommandBuffer& commands, GLuint program) {
+	if (program == 0 || this->amount <= 0) {
+		return;
+	}
+	commands.bindProgram(program);
+	commands.bindVertexArray(this->vertexArrayID);
+	commands.bindTexture(0, GL_TEXTURE_2D, this->colorTexture);
+	commands.bindTexture(CROWD_POSITION_UNIT, GL_TEXTURE_2D, this->positionTexture);
+	commands.bindTexture(CROWD_NORMAL_UNIT, GL_TEXTURE_2D, this->normalTexture);
+	commands.setDrawData(&this->drawData, sizeof(this->drawData));
+	commands.drawElementsInstanced((GLsizei)this->vat.indices.size(), GL_UNSIGNED_INT, 0, this->amount);
+}
+
+int Crowd::walkerCount() const {
+	return (int)this->walkers.size();
+}
+
+void Crowd::cleanup() {
+	cleanupInstances();
+	glDeleteBuffers(1, &this->uvBufferID);
+	glDeleteBuffers(1, &this->indexBufferID);
+	glDeleteBuffers(1, &this->animationBufferID);
+	glDeleteTextures(1, &this->positionTexture);
+	glDeleteTextures(1, &this->normalTexture);
+	glDeleteTextures(1, &this->colorTexture);
+	glDeleteVertexArrays(1, &this->vertexArrayID);
+}
@@ -0,0 +1,84 @@
+#ifndef CROWD_CLASS_H
+#define CROWD_CLASS_H
+
+#include <glad/gl.h>
+#include <glm/glm.hpp>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "render/command_buffer.h"
+#include "render/instance_set.h"
+#include "render/vat_file.h"
+
+class HeightField;
+
+// Texture units of the baked positions and normals, next to TERRAIN_HEIGHT_UNIT
+#define CROWD_POSITION_UNIT 3
+#define CROWD_NORMAL_UNIT 4
+
+// Pedestrians drawn from a vertex animation texture baked by emerald_vat_bake.
+// Every vertex's position at every frame is in a texture, so crowd.vert
+// animates a walker from its instance's clip and time offset alone and the
+// whole crowd is one instanced draw with no skinning on the CPU or GPU.
+// Walkers pace up and down the streets of the block grid; only their
+// transforms are updated each frame.
+class Crowd : public InstanceSet {
+    public:
+    static const int MAX_CLIPS = 16;
+    float scale;            // model units to world units
+    float walkSpeed;        // world units per second
+    float streetSpacing;    // streets run along x and z at streetOffset + k * streetSpacing
+    float streetOffset;
+    float sidewalk;         // distance of the walking lines from a street's centre
+    float extent;           // streets span [-extent, extent]
+    float groundHeight;     // used when there is no ground
+    const HeightField* ground;  // walkers stand on it; null for flat ground
+
+    Crowd();
+
+    // Load the baked animation and its "<path>.png" base colour; needs a current context
+    bool load(const std::string& path);
+    // Place count walkers on random streets with random phases of the clip named walkClip, or of any clip
+    void populate(int count, const std::string& walkClip, uint64_t seed = 1234);
+    // Move the walkers and upload their transforms; GL thread
+    void update(float dt);
+    // Record the crowd's draw; safe on a worker thread. The program must read
+    // the baked textures from CROWD_POSITION_UNIT and CROWD_NORMAL_UNIT.
+    void record(CommandBuffer& commands, GLuint program);
+    int findClip(const std::string& name) const;
+    int walkerCount() const;
+    void cleanup();
+
+    private:
+    // std140 DrawData block of crowd.vert
+    struct DrawData {
+        glm::mat4 model;
+        glm::mat4 normalModel;
+        glm::vec4 animation;            // vertex count, texture width
+        glm::vec4 clips[MAX_CLIPS];     // first frame, frame count, fps, loop
+    };
+    struct Walker {
+        glm::vec2 start;
+        glm::vec2 direction;
+        float length;           // of the walked line
+        float distance;         // along it; walkers turn around at either end
+    };
+
+    VatData vat;
+    DrawData drawData;
+    std::vector<Walker> walkers;
+    std::vector<glm::mat4> transforms;
+    GLuint vertexArrayID;
+    GLuint uvBufferID;
+    GLuint indexBufferID;
+    GLuint animationBufferID;   // per instance clip and time offset, attribute 6
+    GLuint positionTexture;
+    GLuint normalTexture;
+    GLuint colorTexture;
+
+    GLuint createFrameTexture(const std::vector<glm::vec3>& samples, GLenum internalFormat, int width, int height);
+    void walkerTransform(const Walker& walker, glm::mat4& transform) const;
+};
+
+#endif
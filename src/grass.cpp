@@ -0,0 +1,154 @@
+#include "grass.h"
+#include "core/random.h"
+#include "core/startup_trace.h"
+
+#include <algorithm>
+#include <cmath>
+
+using namespace std;
+
+Grass::Grass(Terrain* terrain, GLuint groundTexture, float flatHeight, uint64_t seed) {
+	// Sized for the flythrough altitude of 150 to 600 units; about a million blades in view
+	this->tileSize = 64.0f;
+	this->radius = 1500.0f;
+	this->bladesPerTile = 16384;
+	// Inverse-square falloff keeps the blades per pixel roughly constant past this
+	this->fullDensityDistance = 300.0f;
+	this->fadeStart = 900.0f;
+	this->bladeHeight = 12.0f;
+	this->bladeWidth = 1.0f;
+	this->flatHeight = flatHeight;
+	this->seed = seed;
+	this->terrain = terrain;
+	this->groundTexture = groundTexture;
+	this->bladeCount = 0;
+	this->vertexArrayID = 0;
+	this->vertexBufferID = 0;
+	this->indexBufferID = 0;
+	this->indexCount = 0;
+}
+
+bool Grass::init() {
+	// One blade: three tapering segments and a tip; x is the side (-1, 1, or 0 at the tip), y the height along the blade
+	const int segments = 3;
+	vector<glm::vec2> vertices;
+	for (int i = 0; i < segments; i++) {
+		float t = (float)i / segments;
+		vertices.push_back(glm::vec2(-1.0f, t));
+		vertices.push_back(glm::vec2(1.0f, t));
+	}
+	vertices.push_back(glm::vec2(0.0f, 1.0f));
+	vector<GLushort> indices;
+	for (int i = 0; i < segments; i++) {
+		GLushort a = (GLushort)(2 * i);
+		// Counter-clockwise with the blade's side axis to the right and its height up
+		GLushort lower[3] = { a, (GLushort)(a + 1), (GLushort)(a + 2) };
+		indices.insert(indices.end(), lower, lower + 3);
+		if (i + 1 < segments) {
+			GLushort upper[3] = { (GLushort)(a + 2), (GLushort)(a + 1), (GLushort)(a + 3) };
+			indices.insert(indices.end(), upper, upper + 3);
+		}
+	}
+	this->indexCount = (int)indices.size();
+
+	glGenVertexArrays(1, &this->vertexArrayID);
+	glBindVertexArray(this->vertexArrayID);
+	glGenBuffers(1, &this->vertexBufferID);
+	glBindBuffer(GL_ARRAY_BUFFER, this->vertexBufferID);
+	glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(glm::vec2), vertices.data(), GL_STATIC_DRAW);
+	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, 0);
+	glGenBuffers(1, &this->indexBufferID);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, this->indexBufferID);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLushort), indices.data(), GL_STATIC_DRAW);
+	glBindVertexArray(0);
+	StartupTrace::instance().addBytesUploaded(vertices.size() * sizeof(glm::vec2) + indices.size() * sizeof(GLushort));
+	return true;
+}
+
+void Grass::update(const glm::vec3& camera, const glm::mat4& viewProjection) {
+	this->frustum.extract(viewProjection);
+	this->visible.clear();
+	this->bladeCount = 0;
+
+	int first = (int)floor((camera.x - this->radius) / this->tileSize);
+	int last = (int)floor((camera.x + this->radius) / this->tileSize);
+	int firstZ = (int)floor((camera.z - this->radius) / this->tileSize);
+	int lastZ = (int)floor((camera.z + this->radius) / this->tileSize);
+	glm::vec4 heights = this->terrain != nullptr ? this->terrain->heightScale() : glm::vec4(this->flatHeight, 0.0f, 1.0f / 20000.0f, 0.0f);
+	heights.w = this->bladeWidth;
+	for (int tz = firstZ; tz <= lastZ; tz++) {
+		for (int tx = first; tx <= last; tx++) {
+			glm::vec2 corner(tx * this->tileSize, tz * this->tileSize);
+			glm::vec2 center = corner + glm::vec2(this->tileSize * 0.5f);
+			glm::vec2 ground(this->flatHeight);
+			if (this->terrain != nullptr) {
+				ground = this->terrain->groundBounds(center.x, center.y);
+			}
+			// Blades lean and sway, so give the box some room on every side
+			float reach = this->bladeHeight * 1.6f;
+			glm::vec3 low(corner.x - reach, ground.x, corner.y - reach);
+			glm::vec3 high(corner.x + this->tileSize + reach, ground.y + reach, corner.y + this->tileSize + reach);
+			float distance = glm::length(glm::clamp(camera, low, high) - camera);
+			if (distance > this->radius || !this->frustum.intersects(low, high)) {
+				continue;
+			}
+			float density = min(1.0f, this->fullDensityDistance / max(distance, 1.0f));
+			int count = (int)(this->bladesPerTile * density * density);
+			if (count <= 0) {
+				continue;
+			}
+
+			Visible tile;
+			tile.count = count;
+			tile.heightTexture = 0;
+			tile.data.heightTile = glm::vec4(0.0f);
+			if (this->terrain != nullptr) {
+				const TerrainTile* heightTile = this->terrain->heightTile(center.x, center.y, tile.data.heightTile);
+				if (heightTile == nullptr) {
+					continue;
+				}
+				tile.heightTexture = heightTile->texture;
+			}
+			uint64_t tileSeed = hashCombine(hashCombine(this->seed, (uint64_t)(int64_t)tx), (uint64_t)(int64_t)tz);
+			tile.data.tile = glm::vec4(corner.x, corner.y, this->tileSize, (float)(tileSeed & 0xFFFFFF));
+			tile.data.blades = glm::vec4((float)count, this->fadeStart, this->radius, this->bladeHeight);
+			tile.data.heights = heights;
+			this->visible.push_back(tile);
+			this->bladeCount += count;
+		}
+	}
+}
+
+void Grass::record(CommandBuffer& commands, GLuint program) {
+	if (program == 0 || this->visible.empty()) {
+		return;
+	}
+	commands.bindProgram(program);
+	commands.bindVertexArray(this->vertexArrayID);
+	commands.bindTexture(0, GL_TEXTURE_2D, this->groundTexture);
+	// Behind what stands in it, in front of the terrain (see Terrain::record); units only,
+	// as a slope term would push the upright blades far back
+	commands.polygonOffset(0.0f, 2.0f);
+	for (size_t i = 0; i < this->visible.size(); i++) {
+		const Visible& tile = this->visible[i];
+		commands.bindTexture(TERRAIN_HEIGHT_UNIT, GL_TEXTURE_2D, tile.heightTexture);
+		commands.setDrawData(&tile.data, sizeof(tile.data));
+		commands.drawElementsInstanced(this->indexCount, GL_UNSIGNED_SHORT, 0, tile.count);
+	}
+	commands.polygonOffset(0.0f, 0.0f);
+}
+
+uint64_t Grass::visibleBlades() const {
+	return this->bladeCount;
+}
+
+int Grass::visibleTiles() const {
+	return (int)this->visible.size();
+}
+
+void Grass::cleanup() {
+	glDeleteBuffers(1, &this->vertexBufferID);
+	glDeleteBuffers(1, &this->indexBufferID);
+	glDeleteVertexArrays(1, &this->vertexArrayID);
+}
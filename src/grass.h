@@ -0,0 +1,70 @@
+#ifndef GRASS_CLASS_H
+#define GRASS_CLASS_H
+
+#include <glad/gl.h>
+#include <glm/glm.hpp>
+#include <stdint.h>
+#include <vector>
+
+#include "render/command_buffer.h"
+#include "render/frustum.h"
+#include "terrain.h"
+
+// Procedural grass in square tiles around the camera. Nothing is stored
+// per blade: grass.vert places, sizes and bends each blade from
+// gl_InstanceID and the tile's seed, so a tile is one instanced draw of a
+// single blade mesh. Blades are ordered so any prefix covers the tile
+// evenly, which lets far tiles draw fewer of them; past fadeStart they
+// shrink and take on the ground texture's colour until they are gone.
+class Grass {
+    public:
+    float tileSize;
+    float radius;               // no grass beyond this distance
+    int bladesPerTile;          // at full density
+    float fullDensityDistance;  // density falls with the square of the distance beyond this
+    float fadeStart;            // blades start blending into the ground here
+    float bladeHeight;
+    float bladeWidth;
+    float flatHeight;           // ground level when there is no terrain
+    uint64_t seed;
+
+    // A null terrain grows the grass on a flat plane at flatHeight
+    Grass(Terrain* terrain, GLuint groundTexture, float flatHeight, uint64_t seed = 1234);
+
+    // Build the blade mesh; needs a current context
+    bool init();
+    // Cull tiles and pick their blade counts; GL thread, after Terrain::update
+    void update(const glm::vec3& camera, const glm::mat4& viewProjection);
+    // Record one draw per visible tile; safe on a worker thread. The program must
+    // read the terrain height map from TERRAIN_HEIGHT_UNIT and the ground from unit 0.
+    void record(CommandBuffer& commands, GLuint program);
+    uint64_t visibleBlades() const;
+    int visibleTiles() const;
+    void cleanup();
+
+    private:
+    // std140 DrawData block of grass.vert
+    struct TileData {
+        glm::vec4 tile;         // corner x, corner z, size, seed (an integer below 2^24)
+        glm::vec4 blades;       // count, fade start, fade end, blade height
+        glm::vec4 heightTile;   // Terrain::heightTile uv transform
+        glm::vec4 heights;      // Terrain::heightScale (x is the flat height without a terrain); w is the blade width
+    };
+    struct Visible {
+        TileData data;
+        GLuint heightTexture;
+        int count;
+    };
+
+    Terrain* terrain;
+    GLuint groundTexture;
+    std::vector<Visible> visible;
+    uint64_t bladeCount;
+    Frustum frustum;
+    GLuint vertexArrayID;
+    GLuint vertexBufferID;
+    GLuint indexBufferID;
+    int indexCount;
+};
+
+#endif
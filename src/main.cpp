@@ -3,12 +3,42 @@
 #include "skybox.h"
 #include "surface.h"
 #include "building.h"
-
+#include "terrain.h"
+#include "grass.h"
+#include "crowd.h"
+#include "render/shader_permutations.h"
+#include "core/startup_trace.h"
+#include "core/frame_profiler.h"
+#include "scene/city_streamer.h"
+#include "scene/traffic.h"
+#include "scene/scene_file.h"
+#include "scene/camera_path.h"
+#include "scene/simulation.h"
+#include "scene/scene_query.h"
+#include "render/render_target.h"
+#include "render/command_buffer.h"
+#include "render/dynamic_resolution.h"
+#include "render/material_library.h"
+#include "core/benchmark.h"
+#include "core/frame_capture.h"
+#include "core/frame_pacer.h"
+#include "core/job_system.h"
+#include "core/memory.h"
+#ifdef EMERALD_EGL
+#include "core/egl_context.h"
+#endif
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
 #include <iomanip>
-#include <random>
+#include <functional>
 #include <vector>
+#include <thread>
+#include <algorithm>
 #include <iostream>
 #include <sstream>
+#include <cstring>
 #define _USE_MATH_DEFINES
 #include <math.h>
 #include "stb_image_write.h"
@@ -23,18 +53,12 @@ static int shadowHeight = 16384;
 
 static void key_callback(GLFWwindow *window, int key, int scancode, int action, int mode);
 static void mouse_callback(GLFWwindow *window, double xpos, double ypos);
-static void processInput(GLFWwindow *window);
+static void mouse_button_callback(GLFWwindow *window, int button, int action, int mods);
+static void processInput(GLFWwindow *window, Simulation& simulation);
 static void configureDepthMapFBO();
 static void framebuffer_size_callback(GLFWwindow* window, int width, int height);
-static void setupCarModelMatrices(glm::mat4* modelMatrices, int amount);
-static void setupBuildingModelMatrices(glm::mat4* modelMatrices, int amount);
-static void setupTreeModelMatrices(glm::mat4* modelMatrices, int amount);
-static void setupRoadBlockModelMatrices(glm::mat4* modelMatrices, int amount);
-static void setupGrassModelMatrices(glm::mat4* modelMatrices, int amount);
-static void setupAirplaneModelMatrices(glm::mat4* modelMatrices, int amount);
 
 // Camera
-static float cameraSpeed = 1000.0f;
 static glm::vec3 eye_center(0.0f, 150.0f, -800.0f);
 static glm::vec3 lookat(0.0f, 0.0f, -1.0f);
 static glm::vec3 up(0.0f, 1.0f, 0.0f);
@@ -43,6 +67,9 @@ static float pitch = 0.0f;
 static float lastX = windowWidth / 2.0f;
 static float lastY = windowHeight / 2.0f;
 static bool firstMouse = true;
+// Set by a left click; the next frame picks what the view centre points at
+static bool pickRequested = false;
+static string pickedName = "nothing";
 static float sensitivity = 0.1f;
 static float deltaTime = 0.0f;
 static float lastTime = 0.0f;
@@ -67,115 +94,410 @@ GLuint lightingShaderID;
 GLuint depthMapFBO;
 GLuint depthCubemap;
 bool shadows = true;
-
-int main(void)
+// Lay down depth first so the lighting shader runs once per pixel
+static bool depthPrepass = false;
+// Scene resolution follows the GPU frame time; the overlay is drawn at native resolution
+static DynamicResolution dynamicResolution;
+// Flythrough recording; F4 pauses and resumes it
+static FrameCapture frameCapture;
+// Hills around the city; --flat-ground draws the old ground plane instead
+static HeightField heightField;
+static bool flatGround = false;
+static bool drawGrass = true;
+// Pedestrians from a baked vertex animation (tools/vat_bake.cpp), off unless one is given
+static const char* crowdPath = nullptr;
+static int crowdCount = 2000;
+// Vehicles driving the street grid; --traffic 0 leaves only the scene's parked cars
+static int trafficCount = 10000;
+static float trafficExtent = 4500.0f;
+
+int main(int argc, char* argv[])
 {
-	// Initialise GLFW
-	if (!glfwInit())
-	{
-		cerr << "Failed to initialize GLFW." << endl;
-		return -1;
+	StartupTrace& startupTrace = StartupTrace::instance();
+	FrameProfiler& profiler = FrameProfiler::instance();
+	const char* profileCsvPath = nullptr;
+	const char* profileTracePath = nullptr;
+	const char* scenePath = "../src/scenes/city.scene";
+	const char* bakePath = nullptr;
+	const char* recordCameraPath = nullptr;
+	const char* captureDirectory = nullptr;
+	const char* captureCommand = nullptr;
+	BenchmarkOptions benchmark;
+	FramePacer pacer;
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--startup-trace") == 0 && i + 1 < argc) {
+			startupTrace.setChromeTracePath(argv[++i]);
+		} else if (strcmp(argv[i], "--scene") == 0 && i + 1 < argc) {
+			scenePath = argv[++i];
+		} else if (strcmp(argv[i], "--bake-scene") == 0 && i + 1 < argc) {
+			bakePath = argv[++i];
+		} else if (strcmp(argv[i], "--profile-csv") == 0 && i + 1 < argc) {
+			profileCsvPath = argv[++i];
+		} else if (strcmp(argv[i], "--profile-trace") == 0 && i + 1 < argc) {
+			profileTracePath = argv[++i];
+		} else if (strcmp(argv[i], "--record-camera") == 0 && i + 1 < argc) {
+			recordCameraPath = argv[++i];
+		} else if (strcmp(argv[i], "--frame-budget") == 0 && i + 1 < argc) {
+			dynamicResolution.budgetMs = max(1.0f, (float)atof(argv[++i]));
+		} else if (strcmp(argv[i], "--depth-prepass") == 0) {
+			depthPrepass = true;
+		} else if (strcmp(argv[i], "--flat-ground") == 0) {
+			flatGround = true;
+		} else if (strcmp(argv[i], "--no-grass") == 0) {
+			drawGrass = false;
+		} else if (strcmp(argv[i], "--crowd") == 0 && i + 1 < argc) {
+			crowdPath = argv[++i];
+		} else if (strcmp(argv[i], "--crowd-count") == 0 && i + 1 < argc) {
+			crowdCount = max(0, atoi(argv[++i]));
+		} else if (strcmp(argv[i], "--traffic") == 0 && i + 1 < argc) {
+			trafficCount = max(0, atoi(argv[++i]));
+		} else if (strcmp(argv[i], "--traffic-extent") == 0 && i + 1 < argc) {
+			trafficExtent = max(300.0f, (float)atof(argv[++i]));
+		} else if (strcmp(argv[i], "--fixed-resolution") == 0) {
+			dynamicResolution.enabled = false;
+		} else if (strcmp(argv[i], "--capture") == 0 && i + 1 < argc) {
+			captureDirectory = argv[++i];
+		} else if (strcmp(argv[i], "--capture-pipe") == 0 && i + 1 < argc) {
+			captureCommand = argv[++i];
+		} else if (strcmp(argv[i], "--capture-latency") == 0 && i + 1 < argc) {
+			frameCapture.latency = min(max(atoi(argv[++i]), 1), (int)FrameCapture::RING_SIZE - 1);
+		} else if (strcmp(argv[i], "--max-frames-in-flight") == 0 && i + 1 < argc) {
+			pacer.maxFramesInFlight = min(max(atoi(argv[++i]), 1), (int)FramePacer::MAX_FRAMES_IN_FLIGHT);
+		} else if (strcmp(argv[i], "--benchmark") == 0) {
+			benchmark.enabled = true;
+		} else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) {
+			benchmark.frames = max(1, atoi(argv[++i]));
+		} else if (strcmp(argv[i], "--warmup") == 0 && i + 1 < argc) {
+			benchmark.warmupFrames = max(0, atoi(argv[++i]));
+		} else if (strcmp(argv[i], "--resolution") == 0 && i + 1 < argc) {
+			if (sscanf(argv[++i], "%dx%d", &benchmark.width, &benchmark.height) != 2 || benchmark.width <= 0 || benchmark.height <= 0) {
+				cerr << "Expected --resolution <width>x<height>." << endl;
+				return -1;
+			}
+		} else if (strcmp(argv[i], "--camera-path") == 0 && i + 1 < argc) {
+			benchmark.cameraPath = argv[++i];
+		} else if (strcmp(argv[i], "--benchmark-out") == 0 && i + 1 < argc) {
+			benchmark.output = argv[++i];
+		} else if (strcmp(argv[i], "--checksum-every") == 0 && i + 1 < argc) {
+			benchmark.checksumEvery = max(0, atoi(argv[++i]));
+		} else if (strcmp(argv[i], "--checksum-images") == 0 && i + 1 < argc) {
+			benchmark.imageDirectory = argv[++i];
+		} else if (strcmp(argv[i], "--expect-checksums") == 0 && i + 1 < argc) {
+			benchmark.expectedReport = argv[++i];
+		}
 	}
 
-	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
-	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
-	glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE); // For MacOS
-	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
-
-	// Open a window and create its OpenGL context
-	window = glfwCreateWindow(windowWidth, windowHeight, "Emerald Isle", NULL, NULL);
-	if (window == NULL)
-	{
-		cerr << "Failed to open a GLFW window." << endl;
-		glfwTerminate();
+	// Text or binary scene; loading does not need a GL context
+	startupTrace.begin("read scene file", "phase");
+	SceneDescription scene;
+	if (!loadScene(scenePath, scene)) {
 		return -1;
 	}
-	glfwMakeContextCurrent(window);
+	startupTrace.end();
+	if (bakePath != nullptr) {
+		if (!saveSceneBinary(bakePath, scene)) {
+			return -1;
+		}
+		cout << "Baked " << scene.instanceCount() << " instances in " << scene.groups.size() << " groups to " << bakePath << endl;
+		return 0;
+	}
 
-	// Ensure we can capture the escape key being pressed below
-	glfwSetInputMode(window, GLFW_STICKY_KEYS, GL_TRUE);
-	glfwSetKeyCallback(window, key_callback);
-    glfwSetCursorPosCallback(window, mouse_callback);
-    glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
+	startupTrace.begin("GLFW + GL init", "phase");
+	GLADloadfunc loadGL = glfwGetProcAddress;
+	bool headless = false;
+#ifdef EMERALD_EGL
+	// Benchmarks on machines without a display use a windowless EGL context
+	EglContext eglContext;
+	if (benchmark.enabled) {
+		if (!eglContext.create()) {
+			return -1;
+		}
+		loadGL = EglContext::load;
+		headless = true;
+	}
+#endif
+	if (!headless) {
+		// Initialise GLFW
+		if (!glfwInit())
+		{
+			cerr << "Failed to initialize GLFW." << endl;
+			return -1;
+		}
+
+		glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+		glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+		glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE); // For MacOS
+		glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+		// Benchmarks draw offscreen; the window only provides the context
+		glfwWindowHint(GLFW_VISIBLE, benchmark.enabled ? GL_FALSE : GL_TRUE);
+
+		// Open a window and create its OpenGL context
+		window = glfwCreateWindow(windowWidth, windowHeight, "Emerald Isle", NULL, NULL);
+		if (window == NULL)
+		{
+			cerr << "Failed to open a GLFW window." << endl;
+			glfwTerminate();
+			return -1;
+		}
+		glfwMakeContextCurrent(window);
+
+		if (!benchmark.enabled) {
+			// Ensure we can capture the escape key being pressed below
+			glfwSetInputMode(window, GLFW_STICKY_KEYS, GL_TRUE);
+			glfwSetKeyCallback(window, key_callback);
+			glfwSetCursorPosCallback(window, mouse_callback);
+			glfwSetMouseButtonCallback(window, mouse_button_callback);
+			glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
+		}
+	}
 
 	// Load OpenGL functions, gladLoadGL returns the loaded version, 0 on error.
-	int version = gladLoadGL(glfwGetProcAddress);
+	int version = gladLoadGL(loadGL);
 	if (version == 0)
 	{
 		cerr << "Failed to initialize OpenGL context." << endl;
 		return -1;
 	}
 
+	// Linked shader programs are cached on disk between runs where the driver allows it
+	static ProgramCache programCache("shader_cache");
+	programCache.init(loadGL);
+	ProgramCache::setActive(&programCache);
+	profiler.init();
+	if (profileCsvPath != nullptr && !profiler.openCsv(profileCsvPath)) {
+		cerr << "WARN: Could not open profile CSV " << profileCsvPath << endl;
+	}
+	if (profileTracePath != nullptr && !profiler.openChromeTrace(profileTracePath)) {
+		cerr << "WARN: Could not open profile trace " << profileTracePath << endl;
+	}
+	// The benchmark renders into an FBO of the requested size; otherwise framebufferID stays 0
+	RenderTarget offscreen;
+	if (benchmark.enabled) {
+		windowWidth = benchmark.width;
+		windowHeight = benchmark.height;
+		if (!offscreen.create(benchmark.width, benchmark.height)) {
+			return -1;
+		}
+	}
+	startupTrace.end();
+
 	// Background
 	glClearColor(0.2f, 0.2f, 0.25f, 0.0f);
 
 	glEnable(GL_DEPTH_TEST);
 	glEnable(GL_CULL_FACE);
 
+	startupTrace.begin("queue shaders", "phase");
 	Shader depthShader = Shader("../src/shaders/depth.vert", "../src/shaders/depth.frag", "../src/shaders/depth.geom");
-	Shader lightingShader = Shader("../src/shaders/lighting.vert", "../src/shaders/lighting.frag");
+	Shader prepassShader = Shader("../src/shaders/prepass.vert", "../src/shaders/prepass.frag");
+	Shader terrainPrepassShader = Shader("../src/shaders/terrain.vert", "../src/shaders/prepass.frag");
+	vector<string> lightingFeatures;
+	lightingFeatures.push_back("SHADOWS");
+	lightingFeatures.push_back("REVERSE_NORMALS");
+	// Scene draws read their textures and parameters from the material library
+	lightingFeatures.push_back("MATERIALS");
+	ShaderPermutations lightingShaders("../src/shaders/lighting.vert", "../src/shaders/lighting.frag", nullptr, lightingFeatures);
+	lightingShaders.precompile("../src/shaders/lighting.permutations");
+	ShaderPermutations terrainShaders("../src/shaders/terrain.vert", "../src/shaders/lighting.frag", nullptr, lightingFeatures);
+	Shader grassPrepassShader = Shader("../src/shaders/grass.vert", "../src/shaders/prepass.frag");
+	vector<string> shadowFeatures(1, "SHADOWS");
+	ShaderPermutations grassShaders("../src/shaders/grass.vert", "../src/shaders/grass.frag", nullptr, shadowFeatures);
+	Shader crowdPrepassShader = Shader("../src/shaders/crowd.vert", "../src/shaders/prepass.frag");
+	ShaderPermutations crowdShaders("../src/shaders/crowd.vert", "../src/shaders/lighting.frag", nullptr, shadowFeatures);
 	Shader skyboxShader = Shader("../src/shaders/skybox.vert", "../src/shaders/skybox.frag");
+	// All programs are queued above; their statuses are only queried on first use()
+	startupTrace.end();
+	startupTrace.begin("configureDepthMapFBO", "phase");
 	configureDepthMapFBO();
+	startupTrace.end();
+	startupTrace.begin("load scene", "phase");
 
 	// Skybox
 	Skybox skybox = Skybox(glm::vec3(0, 0, 0), glm::vec3(-10000, -10000, -10000), skyboxShader);
 
-	// Surface
-	int amount = 1;
-	glm::mat4* surfaceModelMatrices = new glm::mat4[amount];
-	glm::mat4 surfaceModel = glm::mat4(1.0f);
-	surfaceModel = glm::translate(surfaceModel, glm::vec3(0, 0, 0));
-	surfaceModel = glm::scale(surfaceModel, glm::vec3(10000, 1, 10000));
-	surfaceModelMatrices[0] = surfaceModel;
-	Surface surface = Surface(surfaceModelMatrices, amount);
-
-	// Debug light cube
-	amount = 1;
-	glm::mat4* lightCubeModelMatrices = new glm::mat4[amount];
-	glm::mat4 lightCubeModel = glm::mat4(1.0f);
-	lightCubeModel = glm::translate(lightCubeModel, lightPosition);
-	lightCubeModel = glm::scale(lightCubeModel, glm::vec3(100, 100, 100));
-	lightCubeModelMatrices[0] = lightCubeModel;
-	StaticModel lightCube = StaticModel("../src/assets/cube/Cube.gltf", lightCubeModelMatrices, amount);
-
-	// Cars
-	amount = 28;
-	glm::mat4* carModelMatrices = new glm::mat4[amount];
-	setupCarModelMatrices(carModelMatrices, amount);
-	StaticModel car = StaticModel("../src/assets/covered_car/covered_car_1k.gltf", carModelMatrices, amount);
-
-	// Buildings
-	amount = 36;
-	glm::mat4* buildingModelMatrices = new glm::mat4[amount];
-	setupBuildingModelMatrices(buildingModelMatrices, amount);
-	Building building = Building(buildingModelMatrices, amount);
-
-	// Trees
-	amount = 700;
-	glm::mat4* treeModelMatrices = new glm::mat4[amount];
-	setupTreeModelMatrices(treeModelMatrices, amount);
-	StaticModel tree = StaticModel("../src/assets/quiver_tree/quiver_tree_02_1k.gltf", treeModelMatrices, amount);
-
-	// Road blocks
-	amount = 50;
-	glm::mat4* roadBlockModelMatrices = new glm::mat4[amount];
-	setupRoadBlockModelMatrices(roadBlockModelMatrices, amount);
-	StaticModel roadBlock = StaticModel("../src/assets/concrete_road_barrier/concrete_road_barrier_1k.gltf", roadBlockModelMatrices, amount);
-
-	// Grass
-	// amount = 5000;
-	// glm::mat4* grassModelMatrices = new glm::mat4[amount];
-	// setupGrassModelMatrices(grassModelMatrices, amount);
-	// StaticModel grass = StaticModel("../src/assets/grass/grass_medium_01_1k.gltf", grassModelMatrices, amount);
-
-	// Airplane
-	amount = 1;
-	glm::mat4* airplaneModelMatrices = new glm::mat4[amount];
-	setupAirplaneModelMatrices(airplaneModelMatrices, amount);
-	glm::mat4 airplaneMovementMatrix = glm::mat4(1.0f);
-	glm::vec3 flightRestrictions = glm::vec3(3000, 3000, 3000);
-	int transCount = 0;
-	StaticModel airplane = StaticModel("../src/assets/airplane/airplane.glb", airplaneModelMatrices, amount);
+	// Renderables and their instances come from the scene file; the names are the ones drawn below
+	const char* sceneGroups[] = { "surface", "lightCube", "car", "building", "tree", "roadBlock", "airplane" };
+	for (int i = 0; i < 7; i++) {
+		if (scene.find(sceneGroups[i]) == nullptr) {
+			cerr << "Scene " << scenePath << " has no '" << sceneGroups[i] << "' group." << endl;
+			return -1;
+		}
+	}
+	SceneGroup* group = scene.find("surface");
+	Surface surface = Surface(group->instances, group->count);
+	group = scene.find("lightCube");
+	StaticModel lightCube = StaticModel(group->asset.c_str(), group->instances, group->count);
+	group = scene.find("car");
+	StaticModel car = StaticModel(group->asset.c_str(), group->instances, group->count);
+	group = scene.find("building");
+	Building building = Building(group->instances, group->count);
+	group = scene.find("tree");
+	StaticModel tree = StaticModel(group->asset.c_str(), group->instances, group->count);
+	group = scene.find("roadBlock");
+	StaticModel roadBlock = StaticModel(group->asset.c_str(), group->instances, group->count);
+	group = scene.find("airplane");
+	StaticModel airplane = StaticModel(group->asset.c_str(), group->instances, group->count);
+
+	// Ray and sphere queries over the instances drawn, for picking and camera collision; it
+	// outlives the simulation, whose thread queries it
+	SceneQuery sceneQuery;
+	sceneQuery.ground = flatGround ? nullptr : &heightField;
+	sceneQuery.groundLevel = heightField.baseHeight;
+
+	// Camera movement and the airplane advance at a fixed rate, on their own thread outside benchmarks
+	Simulation simulation(eye_center, 60.0f);
+
+	// Streamed city beyond the hand-placed scene; chunk instances are appended
+	// to the same renderables so no geometry is loaded twice
+	unsigned int streamWorkers = max(1u, thread::hardware_concurrency() / 2);
+	CityStreamer cityStreamer(1234, 2500.0f, 2, 3, 4, (int)streamWorkers);
+	cityStreamer.synchronous = benchmark.enabled;
+	// The terrain covers the streamed chunks' ground; their instances stand on it
+	Terrain terrain(heightField, surface.textureID, "terrain_cache", (int)streamWorkers);
+	if (flatGround) {
+		cityStreamer.attach(CHUNK_GROUND, &surface);
+	} else {
+		cityStreamer.ground = &heightField;
+		terrain.tiles.synchronous = benchmark.enabled;
+		terrain.init();
+	}
+	Grass grass(flatGround ? nullptr : &terrain, surface.textureID, heightField.baseHeight);
+	if (drawGrass) {
+		grass.init();
+	}
+	Crowd crowd;
+	crowd.groundHeight = heightField.baseHeight;
+	crowd.ground = flatGround ? nullptr : &heightField;
+	if (crowdPath != nullptr && crowd.load(crowdPath)) {
+		crowd.populate(crowdCount, "walk");
+	}
+	// Traffic on the streets between the scene's buildings; its vehicles follow the
+	// scene's own cars in the car instance buffer, before the streamed ones
+	Traffic traffic;
+	int trafficFirst = car.amount;
+	if (trafficCount > 0) {
+		vector<float> streetsX, streetsZ;
+		group = scene.find("building");
+		if (RoadNetwork::gridStreets(group->instances, group->count, trafficExtent, streetsX, streetsZ) &&
+		    traffic.roads.build(streetsX, streetsZ, flatGround ? nullptr : &heightField)) {
+			int vehicles = traffic.populate(trafficCount);
+			car.reserveInstances(car.amount + vehicles);
+			car.amount += vehicles;
+			composeTransformsToBuffer(traffic.placements, car.transformBufferID, trafficFirst, 0, car.instanceBase);
+		}
+	}
+	// What the per-frame upload needs, behind one pointer to keep its job's closure small
+	struct TrafficUpload {
+		Traffic* traffic;
+		StaticModel* car;
+		int first;
+		vector<glm::mat4> queryTransforms;  // by vehicle id, so query instances move rather than swap
+	} trafficUpload;
+	trafficUpload.traffic = &traffic;
+	trafficUpload.car = &car;
+	trafficUpload.first = trafficFirst;
+	cityStreamer.attach(CHUNK_BUILDINGS, &building);
+	cityStreamer.attach(CHUNK_TREES, &tree);
+	cityStreamer.attach(CHUNK_CARS, &car);
+	building.varyFacades();
+	// Every renderable has added its textures by now; they go to the GPU as one texture array
+	MaterialLibrary& materials = MaterialLibrary::instance();
+	startupTrace.begin("material upload", "upload");
+	materials.upload();
+	startupTrace.end();
+	cout << "Materials: " << materials.materialCount() << " in " << materials.layerCount() << " texture layers" << endl;
+
+	// The query's users index sceneGroups; animated models collide in their rest pose
+	int queryMeshes[7] = { -1, -1, -1, -1, -1, -1, -1 };
+	queryMeshes[2] = sceneQuery.addMesh(car.model, car.nodes, car.restGlobals.data());
+	queryMeshes[3] = sceneQuery.addMesh(building.vertex_buffer_data, 24, building.index_buffer_data, 36);
+	queryMeshes[4] = sceneQuery.addMesh(tree.model, tree.nodes, tree.restGlobals.data());
+	queryMeshes[5] = sceneQuery.addMesh(roadBlock.model, roadBlock.nodes, roadBlock.restGlobals.data());
+	for (int i = 0; i < 7; i++) {
+		if (queryMeshes[i] >= 0) {
+			group = scene.find(sceneGroups[i]);
+			sceneQuery.addInstances(queryMeshes[i], group->instances, group->count, i);
+		}
+	}
+	const ChunkLayer queryLayers[] = { CHUNK_CARS, CHUNK_BUILDINGS, CHUNK_TREES };
+	const int queryLayerGroups[] = { 2, 3, 4 };
+	for (int i = 0; i < 3; i++) {
+		if (queryMeshes[queryLayerGroups[i]] >= 0) {
+			cityStreamer.attachQuery(queryLayers[i], &sceneQuery, queryMeshes[queryLayerGroups[i]], queryLayerGroups[i]);
+		}
+	}
+	int trafficQueryFirst = 0;
+	if (traffic.vehicleCount() > 0 && queryMeshes[2] >= 0) {
+		trafficQueryFirst = sceneQuery.addInstances(queryMeshes[2], nullptr, traffic.vehicleCount(), 2);
+		trafficUpload.queryTransforms.resize(traffic.vehicleCount());
+	}
+	sceneQuery.update();
+	simulation.collision = &sceneQuery;
+
+	// Each renderable records its draws into its own command buffer on a worker thread;
+	// the GL thread then uploads their per-draw data once and replays them in order
+	CommandQueue commandQueue;
+	commandQueue.init();
+	dynamicResolution.init();
+	// Benchmarks render every frame at full resolution so runs stay comparable
+	if (benchmark.enabled) {
+		dynamicResolution.enabled = false;
+	}
+	// Per-frame CPU work and command recording run as jobs; the streamer and terrain keep their own loader threads
+	JobSystem jobs((int)max(1u, thread::hardware_concurrency() / 2));
+	CommandRecorder commandRecorder(&jobs);
+	// Handles of the frame's update jobs; kept across frames so its capacity is reused
+	vector<JobHandle> updates;
+	updates.reserve(16);
+	const int sceneBufferCount = 9;
+	CommandBuffer sceneCommands[sceneBufferCount];
+	CommandBuffer* sceneBuffers[sceneBufferCount];
+	for (int i = 0; i < sceneBufferCount; i++) {
+		sceneBuffers[i] = &sceneCommands[i];
+	}
+	// Models whose glTF node animations play; all of them, those without clips skip the work
+	StaticModel* animatedModels[] = { &lightCube, &car, &tree, &roadBlock, &airplane };
+	GLuint sceneProgram = 0;
+	GLuint terrainProgram = 0;     // none in the shadow pass; the terrain casts no shadows
+	GLuint grassProgram = 0;       // nor does the grass
+	GLuint crowdProgram = 0;       // nor do the walkers, who move
+	glm::mat4 airplaneTransform(1.0f);
+	vector<function<void()> > recordScene;
+	recordScene.push_back([&]() {
+		sceneCommands[0].clear();
+		if (flatGround) {
+			surface.record(sceneCommands[0], sceneProgram);
+		}
+	});
+	recordScene.push_back([&]() { sceneCommands[1].clear(); car.record(sceneCommands[1], sceneProgram); });
+	recordScene.push_back([&]() { sceneCommands[2].clear(); building.record(sceneCommands[2], sceneProgram); });
+	recordScene.push_back([&]() { sceneCommands[3].clear(); tree.record(sceneCommands[3], sceneProgram); });
+	recordScene.push_back([&]() { sceneCommands[4].clear(); roadBlock.record(sceneCommands[4], sceneProgram); });
+	recordScene.push_back([&]() { sceneCommands[5].clear(); airplane.record(sceneCommands[5], sceneProgram, airplaneTransform); });
+	recordScene.push_back([&]() { sceneCommands[6].clear(); terrain.record(sceneCommands[6], terrainProgram); });
+	recordScene.push_back([&]() { sceneCommands[7].clear(); grass.record(sceneCommands[7], grassProgram); });
+	recordScene.push_back([&]() { sceneCommands[8].clear(); crowd.record(sceneCommands[8], crowdProgram); });
+	startupTrace.end();
+
+	// Wait for the queued programs here, after the asset loads have overlapped them
+	startupTrace.begin("link shaders", "phase");
+	depthShader.finish();
+	prepassShader.finish();
+	skyboxShader.finish();
+	lightingShaders.variant(lightingShaders.mask("MATERIALS") | (shadows ? lightingShaders.mask("SHADOWS") : 0)).finish();
+	if (!flatGround) {
+		terrainPrepassShader.finish();
+		terrainShaders.variant(shadows ? terrainShaders.mask("SHADOWS") : 0).finish();
+	}
+	if (drawGrass) {
+		grassPrepassShader.finish();
+		grassShaders.variant(shadows ? grassShaders.mask("SHADOWS") : 0).finish();
+	}
+	if (crowd.walkerCount() > 0) {
+		crowdPrepassShader.finish();
+		crowdShaders.variant(shadows ? crowdShaders.mask("SHADOWS") : 0).finish();
+	}
+	startupTrace.end();
 
 	// Camera setup
   	glm::mat4 viewMatrix, projectionMatrix, vp;
@@ -195,111 +517,426 @@ int main(void)
     shadowTransforms.push_back(shadowProj * glm::lookAt(lightPosition, lightPosition + glm::vec3( 0.0f,  0.0f, -1.0f), glm::vec3(0.0f, -1.0f,  0.0f)));
 	// 1. render scene to depth cubemap
     // --------------------------------
-	glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
+	startupTrace.begin("shadow map render", "phase");
+	if (window != NULL) {
+		glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
+	}
 	glViewport(0, 0, shadowWidth, shadowHeight);
 	glBindFramebuffer(GL_FRAMEBUFFER, depthMapFBO);
 	glClear(GL_DEPTH_BUFFER_BIT);
 	glCullFace(GL_FRONT);
+	// The shadow map is only rendered once, so it is profiled as frame 0
+	profiler.beginFrame();
+	profiler.beginPass("shadow");
 	depthShader.use();
 	for (unsigned int i = 0; i < 6; ++i) {
 		depthShader.setMat4("shadowMatrices[" + std::to_string(i) + "]", shadowTransforms[i]);
 	}
 	depthShader.setFloat("far_plane", depthFar);
 	depthShader.setVec3("lightPos", lightPosition);
-	surface.render(vp, depthShader);
-	car.render(vp, depthShader);
-	building.render(vp, depthShader);
-	tree.render(vp, depthShader);
-	roadBlock.render(vp, depthShader);
-	airplane.render(vp, depthShader);
-	// grass.render(vp, depthShader);
+	sceneProgram = depthShader.ID;
+	commandRecorder.record(recordScene);
+	commandQueue.submit(sceneBuffers, sceneBufferCount);
+	profiler.endPass();
+	profiler.endFrame();
 	glCullFace(GL_BACK);
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
-
-	// Time and frame rate tracking
-	lastTime = glfwGetTime();
+	glBindFramebuffer(GL_FRAMEBUFFER, offscreen.framebufferID);
+	// Only startup pays for this; it makes the phase include the GPU work
+	glFinish();
+	startupTrace.end();
+	startupTrace.begin("first frame", "phase");
+
+	// Time and frame statistics tracking
+	lastTime = headless ? 0.0f : glfwGetTime();
 	float time = 0.0f;			// Animation time 
-	float fTime = 0.0f;			// Time for measuring fps
-	unsigned long frames = 0;
+	float fTime = 0.0f;			// Time since the title was last updated
+	float recordTime = 0.0f;	// Time since the last recorded camera key
+	CameraPath recordedPath;
+
+	// Benchmarks fly a camera path for a fixed number of frames with a fixed time step
+	CameraPath benchmarkPath = CameraPath::defaultFlight();
+	if (benchmark.enabled && !benchmark.cameraPath.empty() && !benchmarkPath.load(benchmark.cameraPath.c_str())) {
+		return -1;
+	}
+	BenchmarkReport benchmarkReport;
+	int benchmarkFrame = 0;
+	int benchmarkTotal = benchmark.warmupFrames + benchmark.frames;
+	if (!benchmark.enabled) {
+		simulation.start();
+	}
+	if (captureDirectory != nullptr) {
+		frameCapture.startPngSequence(captureDirectory);
+	} else if (captureCommand != nullptr) {
+		frameCapture.startPipe(captureCommand);
+	}
 
 	// Main loop
 	do
 	{
+		profiler.beginFrame();
+		Arena::frame().reset();
+		uint64_t frameAllocations = MemoryCounters::heapAllocations();
+		if (!benchmark.enabled) {
+			// Don't run more than maxFramesInFlight ahead of the GPU; waiting here rather
+			// than in the swap lets input be sampled after the wait, right before it is used
+			ProfileScope pace("pace");
+			pacer.waitForSlot();
+		}
+		profiler.beginScope("update");
 		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
 		// Update states for animation
-        double currentTime = glfwGetTime();
-        deltaTime = float(currentTime - lastTime);
-		lastTime = currentTime;
+		chrono::steady_clock::time_point frameStart = chrono::steady_clock::now();
+		float alpha;
+		if (benchmark.enabled) {
+			deltaTime = 1.0f / 60.0f;
+			simulation.step();
+		} else {
+			double currentTime = glfwGetTime();
+			deltaTime = float(currentTime - lastTime);
+			lastTime = currentTime;
+			glfwPollEvents();
+			pacer.markInput();
+			processInput(window, simulation);
+		}
+		// Blend the two newest ticks so motion stays smooth at any frame rate
+		SimState sim = Simulation::interpolate(simulation.latest(alpha), alpha);
+		if (benchmark.enabled) {
+			glm::vec3 target;
+			benchmarkPath.sample((float)benchmarkFrame / benchmarkTotal, eye_center, target);
+			lookat = glm::normalize(target - eye_center);
+		} else {
+			eye_center = sim.eye;
+		}
 
 		viewMatrix = glm::lookAt(eye_center, eye_center + lookat, up);
 		vp = projectionMatrix * viewMatrix;
+
+		// Bring streamed chunks around the camera in and out
+		cityStreamer.update(eye_center);
+		if (!flatGround) {
+			terrain.update(eye_center, vp);
+		}
+		time += deltaTime;
+		if (drawGrass) {
+			grass.update(eye_center, vp);
+		}
+		// The simulations share no data, so they run as jobs while this thread updates the crowd;
+		// their GL uploads come back here as main-thread jobs, run while waiting. The closures
+		// capture at most two pointers, so they fit std::function without allocating
+		updates.clear();
+		if (traffic.vehicleCount() > 0) {
+			JobHandle step = jobs.run([&traffic, &jobs]() { traffic.step(deltaTime, &jobs); });
+			// One thread: the job threads are busy with the frame, and spawning more would allocate every frame
+			updates.push_back(jobs.thenOnMain(step, [&trafficUpload]() {
+				composeTransformsToBuffer(trafficUpload.traffic->placements, trafficUpload.car->transformBufferID,
+				                          trafficUpload.first, 1, trafficUpload.car->instanceBase);
+			}));
+			if (!trafficUpload.queryTransforms.empty()) {
+				updates.push_back(jobs.then(step, [&trafficUpload]() {
+					const Traffic& moved = *trafficUpload.traffic;
+					for (int i = 0; i < moved.vehicleCount(); i++) {
+						composeTransforms(moved.placements, i, 1, &trafficUpload.queryTransforms[moved.vehicles.id[i]]);
+					}
+				}));
+			}
+		}
+		for (size_t i = 0; i < sizeof(animatedModels) / sizeof(animatedModels[0]); i++) {
+			StaticModel* model = animatedModels[i];
+			if (model->animated) {
+				updates.push_back(jobs.run([&jobs, model]() { model->animate(deltaTime, &jobs); }));
+			}
+		}
+		crowd.update(deltaTime);
+		jobs.wait(updates);
+		if (!trafficUpload.queryTransforms.empty()) {
+			sceneQuery.setTransforms(trafficQueryFirst, trafficUpload.queryTransforms.data(), (int)trafficUpload.queryTransforms.size());
+		}
+		sceneQuery.update(&jobs);
+		// The cursor is captured for mouse look, so picking casts along the view centre
+		if (pickRequested) {
+			pickRequested = false;
+			QueryRay ray = { eye_center, lookat, zFar };
+			QueryHit hit = sceneQuery.intersect(ray);
+			stringstream picked;
+			if (hit.instance >= 0) {
+				picked << sceneGroups[sceneQuery.user(hit.instance)] << " at " << (int)hit.distance;
+			} else if (hit.instance == QUERY_GROUND) {
+				picked << "ground at " << (int)hit.distance;
+			} else {
+				picked << "nothing";
+			}
+			pickedName = picked.str();
+			cout << "Picked " << pickedName << endl;
+		}
+		profiler.endScope();
 		
 		// 2. render scene as normal using the generated depth/shadow map
 		// --------------------------------------------------------------
-		glfwGetFramebufferSize(window, &windowWidth, &windowHeight);
-		glViewport(0, 0, windowWidth, windowHeight);
+		profiler.beginScope("submit");
+		GLuint outputFramebuffer = 0;
+		int outputWidth, outputHeight;
+		if (benchmark.enabled) {
+			outputFramebuffer = offscreen.framebufferID;
+			outputWidth = offscreen.width;
+			outputHeight = offscreen.height;
+		} else {
+			glfwGetFramebufferSize(window, &windowWidth, &windowHeight);
+			outputWidth = windowWidth;
+			outputHeight = windowHeight;
+		}
+		// The newest resolved GPU frame time picks this frame's scene resolution
+		uint64_t gpuFrame = 0;
+		double gpuMs = profiler.latestGpuMs(gpuFrame);
+		dynamicResolution.update(gpuMs, gpuFrame);
+		dynamicResolution.resize(outputWidth, outputHeight);
+		dynamicResolution.bindScene();
 		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+		profiler.setPixelCount((uint64_t)dynamicResolution.sceneWidth() * dynamicResolution.sceneHeight());
+		airplaneTransform = glm::translate(glm::mat4(1.0f), sim.airplaneOffset);
+		if (depthPrepass) {
+			// Depth only, same instance buffers and command buffers as the lighting pass
+			profiler.beginPass("prepass");
+			glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+			prepassShader.use();
+			prepassShader.setMat4("VP", vp);
+			sceneProgram = prepassShader.ID;
+			if (!flatGround) {
+				terrainPrepassShader.use();
+				terrainPrepassShader.setMat4("VP", vp);
+				terrainPrepassShader.setVec3("viewPos", eye_center);
+				terrainPrepassShader.setInt("heightMap", TERRAIN_HEIGHT_UNIT);
+				terrainProgram = terrainPrepassShader.ID;
+			}
+			if (drawGrass) {
+				grassPrepassShader.use();
+				grassPrepassShader.setMat4("VP", vp);
+				grassPrepassShader.setVec3("viewPos", eye_center);
+				grassPrepassShader.setFloat("time", time);
+				grassPrepassShader.setInt("heightMap", TERRAIN_HEIGHT_UNIT);
+				grassProgram = grassPrepassShader.ID;
+			}
+			if (crowd.walkerCount() > 0) {
+				crowdPrepassShader.use();
+				crowdPrepassShader.setMat4("VP", vp);
+				crowdPrepassShader.setFloat("time", time);
+				crowdPrepassShader.setInt("positionMap", CROWD_POSITION_UNIT);
+				crowdPrepassShader.setInt("normalMap", CROWD_NORMAL_UNIT);
+				crowdProgram = crowdPrepassShader.ID;
+			}
+			profiler.beginScope("record");
+			commandRecorder.record(recordScene);
+			profiler.endScope();
+			commandQueue.submit(sceneBuffers, sceneBufferCount);
+			glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+			// Only fragments at the stored depth pass now. Exact ties between objects would go
+			// to the last drawn rather than the first as under GL_LESS; the ground layers carry
+			// a polygon offset so their contacts do not tie
+			glDepthFunc(GL_EQUAL);
+			glDepthMask(GL_FALSE);
+			profiler.endPass();
+		}
+		profiler.beginPass("opaque");
+		// Feature flags select a compiled variant instead of branching in the shader
+		unsigned int lightingFeatureKey = shadows ? lightingShaders.mask("SHADOWS") : 0;
+		Shader& lightingShader = lightingShaders.variant(lightingFeatureKey | lightingShaders.mask("MATERIALS"));
 		lightingShader.use();
 		lightingShader.setMat4("VP", vp);
 		lightingShader.setVec3("viewPos", eye_center);
 		lightingShader.setVec3("lightPos", lightPosition);
 		lightingShader.setVec3("lightIntensity", lightIntensity);
-		lightingShader.setInt("shadows", 1);
 		lightingShader.setFloat("far_plane", depthFar);
-		lightingShader.setInt("reverse_normals", 0);
-		lightingShader.setInt("diffuseTexture", 0);
+		lightingShader.setInt("materialTextures", MATERIAL_ARRAY_UNIT);
+		lightingShader.setInt("materialBuffer", MATERIAL_BUFFER_UNIT);
 		lightingShader.setInt("depthMap", 1);
+		materials.bind();
+		if (!flatGround) {
+			Shader& terrainShader = terrainShaders.variant(lightingFeatureKey);
+			terrainShader.use();
+			terrainShader.setMat4("VP", vp);
+			terrainShader.setVec3("viewPos", eye_center);
+			terrainShader.setVec3("lightPos", lightPosition);
+			terrainShader.setVec3("lightIntensity", lightIntensity);
+			terrainShader.setFloat("far_plane", depthFar);
+			terrainShader.setInt("diffuseTexture", 0);
+			terrainShader.setInt("depthMap", 1);
+			terrainShader.setInt("heightMap", TERRAIN_HEIGHT_UNIT);
+			terrainProgram = terrainShader.ID;
+		}
+		if (drawGrass) {
+			Shader& grassShader = grassShaders.variant(shadows ? grassShaders.mask("SHADOWS") : 0);
+			grassShader.use();
+			grassShader.setMat4("VP", vp);
+			grassShader.setVec3("viewPos", eye_center);
+			grassShader.setFloat("time", time);
+			grassShader.setVec3("lightPos", lightPosition);
+			grassShader.setVec3("lightIntensity", lightIntensity);
+			grassShader.setFloat("far_plane", depthFar);
+			grassShader.setInt("diffuseTexture", 0);
+			grassShader.setInt("depthMap", 1);
+			grassShader.setInt("heightMap", TERRAIN_HEIGHT_UNIT);
+			grassProgram = grassShader.ID;
+		}
+		if (crowd.walkerCount() > 0) {
+			Shader& crowdShader = crowdShaders.variant(shadows ? crowdShaders.mask("SHADOWS") : 0);
+			crowdShader.use();
+			crowdShader.setMat4("VP", vp);
+			crowdShader.setVec3("viewPos", eye_center);
+			crowdShader.setFloat("time", time);
+			crowdShader.setVec3("lightPos", lightPosition);
+			crowdShader.setVec3("lightIntensity", lightIntensity);
+			crowdShader.setFloat("far_plane", depthFar);
+			crowdShader.setInt("diffuseTexture", 0);
+			crowdShader.setInt("depthMap", 1);
+			crowdShader.setInt("positionMap", CROWD_POSITION_UNIT);
+			crowdShader.setInt("normalMap", CROWD_NORMAL_UNIT);
+			crowdProgram = crowdShader.ID;
+		}
 		glActiveTexture(GL_TEXTURE1);
 		glBindTexture(GL_TEXTURE_CUBE_MAP, depthCubemap);
-		surface.render(vp, lightingShader);
-		car.render(vp, lightingShader);
-		building.render(vp, lightingShader);
-		tree.render(vp, lightingShader);
-		roadBlock.render(vp, lightingShader);
-
-		airplaneMovementMatrix = glm::translate(airplaneMovementMatrix, glm::vec3(0, 0, 1));
-		airplane.render(vp, lightingShader, airplaneMovementMatrix);
-		transCount++;
-		if ((transCount >= flightRestrictions.x) || (transCount >= flightRestrictions.y) || (transCount >= flightRestrictions.z)) {
-			airplaneMovementMatrix = glm::mat4(1.0f);
-			transCount = 0;
-		} 
-		// grass.render(vp, lightingShader);
+		sceneProgram = lightingShader.ID;
+		profiler.beginScope("record");
+		commandRecorder.record(recordScene);
+		profiler.endScope();
+		commandQueue.submit(sceneBuffers, sceneBufferCount);
+		if (depthPrepass) {
+			glDepthFunc(GL_LESS);
+			glDepthMask(GL_TRUE);
+		}
+		profiler.endPass();
 
 		// 3. Render the skybox separately from the rest of the scene
 		// --------------------------------------------------------------
+		profiler.beginPass("skybox");
 		skyboxShader.use();
 		skybox.render(vp);
+		profiler.endPass();
+
+		// 4. Scale the scene up to the output and draw the overlay at native resolution
+		// --------------------------------------------------------------
+		glBindFramebuffer(GL_FRAMEBUFFER, outputFramebuffer);
+		glViewport(0, 0, outputWidth, outputHeight);
+		profiler.beginPass("upscale");
+		dynamicResolution.upscale();
+		profiler.endPass();
+		// Before the overlay so recordings show only the scene
+		if (frameCapture.active()) {
+			ProfileScope capture("capture");
+			frameCapture.capture(outputFramebuffer, outputWidth, outputHeight);
+		}
+		profiler.renderOverlay(outputHeight);
+		profiler.endScope();
 		
-		// FPS tracking 
-		// Count number of frames over a few seconds and take average
-		frames++;
-		fTime += deltaTime;
-		if (fTime > 2.0f) {		
-			float fps = frames / fTime;
-			frames = 0;
-			fTime = 0;
-			
-			stringstream stream;
-			stream << fixed << setprecision(2) << "Emerald Isle | " << fps << " FPS";
-			glfwSetWindowTitle(window, stream.str().c_str());
-		}
-		processInput(window);
-		// Swap buffers
-		glfwSwapBuffers(window);
-		glfwPollEvents();
-
-	} // Check if the ESC key was pressed or the window was closed
-	while (!glfwWindowShouldClose(window));
+		if (benchmark.enabled) {
+			// No swap to pace against; wait for the GPU so each frame is timed whole
+			profiler.beginScope("finish");
+			glFinish();
+			profiler.endScope();
+			profiler.endFrame();
+			double frameMs = chrono::duration<double, milli>(chrono::steady_clock::now() - frameStart).count();
+			int measured = benchmarkFrame - benchmark.warmupFrames;
+			if (measured >= 0) {
+				benchmarkReport.addFrame(frameMs, MemoryCounters::heapAllocations() - frameAllocations);
+				if (benchmark.checksumEvery > 0 && measured % benchmark.checksumEvery == 0) {
+					benchmarkReport.capture(measured, offscreen, benchmark.imageDirectory);
+				}
+			}
+			benchmarkFrame++;
+		} else {
+			// Frame time percentiles and per-pass GPU times, refreshed every few seconds
+			fTime += deltaTime;
+			if (fTime > 2.0f) {		
+				fTime = 0;
+				// Heap allocations of this frame, before the title's own
+				uint64_t allocations = MemoryCounters::heapAllocations() - frameAllocations;
+				stringstream title;
+				title << "Emerald Isle | " << profiler.summary() << " | " << (int)(dynamicResolution.scale * 100.0f + 0.5f) << "% res"
+				      << " | latency p50 " << setprecision(1) << fixed << pacer.latencyPercentile(50) << " / p95 " << pacer.latencyPercentile(95)
+				      << " ms, " << pacer.maxFramesInFlight << " in flight"
+				      << " | " << grass.visibleBlades() / 1000 << "k blades";
+				if (crowd.walkerCount() > 0) {
+					title << ", " << crowd.walkerCount() << " walkers";
+				}
+				if (traffic.vehicleCount() > 0) {
+					title << ", " << traffic.vehicleCount() << " vehicles";
+				}
+				// Busy share of the job threads since the last title
+				vector<JobSystem::ThreadStats> jobStats = jobs.takeStats();
+				double busy = 0.0;
+				for (size_t i = 0; i < jobStats.size(); i++) {
+					busy += jobStats[i].utilisation;
+				}
+				title << " | jobs " << (int)(100.0 * busy / jobStats.size() + 0.5) << "% of " << jobStats.size() << " threads";
+				title << " | " << allocations << " allocs/frame, "
+				      << MemoryCounters::residentKb() / 1024 << " MB";
+				title << " | picked " << pickedName;
+				glfwSetWindowTitle(window, title.str().c_str());
+			}
+			if (recordCameraPath != nullptr) {
+				recordTime += deltaTime;
+				if (recordTime > 0.5f) {
+					recordTime = 0.0f;
+					recordedPath.addKey(eye_center, eye_center + lookat * 500.0f);
+				}
+			}
+			// Swap buffers
+			profiler.beginScope("swap");
+			glfwSwapBuffers(window);
+			pacer.endFrame();
+			profiler.endScope();
+			profiler.endFrame();
+		}
+		if (startupTrace.active) {
+			startupTrace.end();
+			startupTrace.finish();
+			MemoryCounters::instance().printSummary(cout);
+		}
+
+	} // Check if the ESC key was pressed or the window was closed, or the benchmark is done
+	while (benchmark.enabled ? benchmarkFrame < benchmarkTotal : !glfwWindowShouldClose(window));
 
 	// Clean up
 	// model.cleanup();
+	simulation.stop();
+	frameCapture.stop();
+	grass.cleanup();
+	crowd.cleanup();
+	terrain.cleanup();
+	commandQueue.cleanup();
+	materials.cleanup();
+	lightingShaders.cleanup();
+	terrainShaders.cleanup();
+	grassShaders.cleanup();
+	crowdShaders.cleanup();
+	dynamicResolution.cleanup();
+	pacer.cleanup();
+	profiler.finish();
+	int status = 0;
+	if (benchmark.enabled) {
+		// e.g. a run with --depth-prepass against the report of one without it
+		if (!benchmark.expectedReport.empty() && !benchmarkReport.compare(benchmark.expectedReport)) {
+			status = 1;
+		}
+		const char* renderer = (const char*)glGetString(GL_RENDERER);
+		if (!benchmarkReport.write(benchmark, renderer ? renderer : "")) {
+			status = 1;
+		}
+		offscreen.cleanup();
+	}
+	if (recordCameraPath != nullptr && !recordedPath.save(recordCameraPath)) {
+		cerr << "WARN: Could not write camera path " << recordCameraPath << endl;
+	}
 
+#ifdef EMERALD_EGL
+	if (headless) {
+		eglContext.destroy();
+		return status;
+	}
+#endif
 	// Close OpenGL window and terminate GLFW
 	glfwTerminate();
 
-	return 0;
+	return status;
 }
 
 static void framebuffer_size_callback(GLFWwindow* window, int width, int height) {
@@ -308,163 +945,6 @@ static void framebuffer_size_callback(GLFWwindow* window, int width, int height)
     glViewport(0, 0, width, height);
 }
 
-static void setupCarModelMatrices(glm::mat4* modelMatrices, int amount) {
-	int count = 0;
-	glm::mat4 identity = glm::mat4(1.0f);
-    glm::mat4 model = glm::translate(identity, glm::vec3(80, 1, 0));\
-	model = glm::scale(model, glm::vec3(10.0f, 10.0f, 10.0f));
-    modelMatrices[count++] = model;
-
-	model = glm::translate(identity, glm::vec3(300, 1, -80));
-	model = glm::scale(model, glm::vec3(10.0f, 10.0f, 10.0f));
-	model = glm::rotate(model, glm::radians(90.0f), glm::vec3(0, 1, 0));
-	modelMatrices[count++] = model;
-	
-	model = glm::translate(identity, glm::vec3(520, 1, 580));
-	model = glm::scale(model, glm::vec3(10.0f, 10.0f, 10.0f));
-	model = glm::rotate(model, glm::radians(180.0f), glm::vec3(0, 1, 0));
-	modelMatrices[count++] = model;
-
-	int car_spacing = 0;
-	for (count = count; count < amount; count++) {
-		// Place cars in the backyard
-		model = glm::translate(identity, glm::vec3(750 - car_spacing, 1, 800));
-		model = glm::scale(model, glm::vec3(10.0f, 10.0f, 10.0f));
-		model = glm::rotate(model, glm::radians(45.0f), glm::vec3(0, 1, 0));
-		modelMatrices[count] = model;
-		car_spacing += 50;
-	}
-}
-
-static void setupBuildingModelMatrices(glm::mat4* modelMatrices, int amount) {
-	float building_spacing = 300.0f;
-	int min_x = 60;
-	int max_x = 70;
-	int min_y = 160;
-	int max_y = 200;
-	std::random_device rd;
-    std::mt19937 engine(rd());
-	vector<glm::mat4> buildings;
-	for (int i = -amount / 12; i < amount / 12; i++) {
-		for (int j = -amount / 12; j < amount / 12; j++) {
-			int x = std::uniform_int_distribution<int>(min_x, max_x)(engine);
-			int y = std::uniform_int_distribution<int>(min_y, max_y)(engine);
-			glm::mat4 model = glm::mat4(1.0f);
-			model = glm::translate(model, glm::vec3(i * building_spacing, y, j * building_spacing));
-			model = glm::scale(model, glm::vec3(x, y, 48));
-			buildings.push_back(model);
-		}
-	}
-
-	for (int i = 0; i < amount; i++) {
-		modelMatrices[i] = buildings[i];
-	}
-}
-
-static void setupTreeModelMatrices(glm::mat4* modelMatrices, int amount) {
-	srand(glfwGetTime()); // initialize random seed	
-	float radius = 3000.0;
-	float offset = 1500.0f;
-	for (int i = 0; i < amount; i++)
-	{
-	    glm::mat4 model = glm::mat4(1.0f);
-	    // 1. translation: displace along circle with 'radius' in range [-offset, offset]
-	    float angle = (float)i / (float)amount * 360.0f;
-	    float displacement = (rand() % (int)(2 * offset * 100)) / 100.0f - offset;
-	    float x = sin(angle) * radius + displacement;
-	    displacement = (rand() % (int)(2 * offset * 100)) / 100.0f - offset;
-	    float z = cos(angle) * radius + displacement;
-	    model = glm::translate(model, glm::vec3(x, 0, z));
-
-	    // 2. scale: scale between 5 and 10
-	    // float scale = (rand() % 5 + 5) / 10.0f;
-		model = glm::scale(model, glm::vec3(150, 150, 150));
-
-	    // 3. rotation: add random rotation around a (semi)randomly picked rotation axis vector
-	    float rotAngle = (rand() % 360);
-	    model = glm::rotate(model, rotAngle, glm::vec3(0.0f, 1.0f, 0.0f));
-
-	    // 4. now add to list of matrices
-	    modelMatrices[i] = model;
-	}  
-}
-
-static void setupRoadBlockModelMatrices(glm::mat4* modelMatrices, int amount) {
-    float cityWidth = 2000.0f;   // Width of the city
-    float cityHeight = 2000.0f;  // Height of the city
-    float spacing = 200.0f;      // Spacing between roadblocks
-    float roadBlockHeight = 10.0f;  // Height of the roadblocks
-
- 	int count = 0;
-    glm::mat4 model;
-    
-    // Place roadblocks along the top edge
-    for (float x = -cityWidth / 2; x <= cityWidth / 2; x += spacing) {
-        if (count >= amount) break;
-        model = glm::mat4(1.0f);
-        model = glm::translate(model, glm::vec3(x, roadBlockHeight, -cityHeight / 2));
-        model = glm::scale(model, glm::vec3(100, 100, 100)); // Adjust scale if needed
-        modelMatrices[count++] = model;
-    }
- 
-    // Place roadblocks along the bottom edge
-    for (float x = -cityWidth / 2; x <= cityWidth / 2; x += spacing) {
-        if (count >= amount) break;
-        model = glm::mat4(1.0f);
-        model = glm::translate(model, glm::vec3(x, roadBlockHeight, cityHeight / 2));
-        model = glm::scale(model, glm::vec3(100, 100, 100)); // Adjust scale if needed
-		model = glm::rotate(model, glm::radians(180.0f), glm::vec3(0.0f, 1.0f, 0.0f));
-        modelMatrices[count++] = model;
-    }
-
-    // Place roadblocks along the left edge
-    for (float z = -cityHeight / 2; z <= cityHeight / 2; z += spacing) {
-        if (count >= amount) break;
-        model = glm::mat4(1.0f);
-        model = glm::translate(model, glm::vec3(-cityWidth / 2, roadBlockHeight, z));
-        model = glm::scale(model, glm::vec3(100, 100, 100)); // Adjust scale if needed
-		model = glm::rotate(model, glm::radians(90.0f), glm::vec3(0.0f, 1.0f, 0.0f));
-        modelMatrices[count++] = model;
-    }
-
-    // Place roadblocks along the right edge
-    for (float z = -cityHeight / 2; z <= cityHeight / 2; z += spacing) {
-        if (count >= amount) break;
-        model = glm::mat4(1.0f);
-        model = glm::translate(model, glm::vec3(cityWidth / 2, roadBlockHeight, z));
-        model = glm::scale(model, glm::vec3(100, 100, 100)); // Adjust scale if needed
-		model = glm::rotate(model, glm::radians(270.0f), glm::vec3(0.0f, 1.0f, 0.0f));
-        modelMatrices[count++] = model;
-    }
-}
-
-static void setupGrassModelMatrices(glm::mat4* modelMatrices, int amount) {
-	float fieldWidth = 2000;
-	float fieldHeight = 2500;
-	float spacing = 35;
-
-	int count = 0;
-	glm::mat4 model;
-	
-	for (int x = 0; x < fieldWidth; x += spacing) {
-		for (int z = 0; z < fieldHeight; z += spacing) {
-			if (count >= amount) break;
-			model = glm::mat4(1.0f);
-			model = glm::translate(model, glm::vec3((-fieldWidth) / 2 + x, 1, (-fieldHeight) / 2 + z));
-			model = glm::scale(model, glm::vec3(50, 50, 50));
-			modelMatrices[count++] = model;
-		}
-	}
-}
-
-static void setupAirplaneModelMatrices(glm::mat4* modelMatrices, int amount) {
-	for (int i = 0; i < amount; i++) {
-		glm::mat4 model = glm::mat4(1.0f);
-		model = glm::translate(model, glm::vec3(200, 500, -10000));
-		model = glm::scale(model, glm::vec3(10, 10, 10));
-		modelMatrices[i] = model;
-	}
-}
  
 static void configureDepthMapFBO() {
     glGenFramebuffers(1, &depthMapFBO);
@@ -496,6 +976,26 @@ static void key_callback(GLFWwindow* window, int key, int scancode, int action,
     if (key == GLFW_KEY_ESCAPE && action == GLFW_PRESS) {
         glfwSetWindowShouldClose(window, true);
     }
+    // Toggle shadows; switches the lighting shader variant
+    if (key == GLFW_KEY_H && action == GLFW_PRESS) {
+        shadows = !shadows;
+    }
+    // Toggle the frame profiler overlay
+    if (key == GLFW_KEY_F1 && action == GLFW_PRESS) {
+        FrameProfiler::instance().overlay = !FrameProfiler::instance().overlay;
+    }
+    // Toggle the depth pre-pass; compare the overdraw figure in the title with it on and off
+    if (key == GLFW_KEY_F3 && action == GLFW_PRESS) {
+        depthPrepass = !depthPrepass;
+    }
+    // Pause or resume --capture / --capture-pipe recording
+    if (key == GLFW_KEY_F4 && action == GLFW_PRESS) {
+        frameCapture.paused = !frameCapture.paused;
+    }
+    // Toggle dynamic resolution; off renders the scene at full resolution
+    if (key == GLFW_KEY_F2 && action == GLFW_PRESS) {
+        dynamicResolution.enabled = !dynamicResolution.enabled;
+    }
 }
 
 static void mouse_callback(GLFWwindow* window, double xpos, double ypos) {
@@ -526,15 +1026,19 @@ static void mouse_callback(GLFWwindow* window, double xpos, double ypos) {
     lookat = glm::normalize(front);
 }
 
-static void processInput(GLFWwindow* window) {
-    float velocity = cameraSpeed * deltaTime;
-
-    if (glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS)
-        eye_center += velocity * lookat;
-    if (glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS)
-        eye_center -= velocity * lookat;
-    if (glfwGetKey(window, GLFW_KEY_A) == GLFW_PRESS)
-        eye_center -= glm::normalize(glm::cross(lookat, up)) * velocity;
-    if (glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS)
-        eye_center += glm::normalize(glm::cross(lookat, up)) * velocity;
+static void mouse_button_callback(GLFWwindow* window, int button, int action, int mods) {
+    if (button == GLFW_MOUSE_BUTTON_LEFT && action == GLFW_PRESS) {
+        pickRequested = true;
+    }
+}
+
+// Movement is integrated by the simulation thread; this only samples the keys
+static void processInput(GLFWwindow* window, Simulation& simulation) {
+    SimInput input;
+    input.forward = glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS;
+    input.back = glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS;
+    input.left = glfwGetKey(window, GLFW_KEY_A) == GLFW_PRESS;
+    input.right = glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS;
+    input.lookat = lookat;
+    simulation.setInput(input);
 }
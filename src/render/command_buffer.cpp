@@ -0,0 +1,200 @@
+#include "render/command_buffer.h"
+#include "core/frame_profiler.h"
+#include "core/job_system.h"
+
+#include <cstring>
+
+using namespace std;
+
+size_t CommandBuffer::uniformAlignment = 256;
+
+DrawData DrawData::fromModel(const glm::mat4& model, int material) {
+	DrawData data;
+	data.model = model;
+	data.material = glm::ivec4(material, 0, 0, 0);
+	// Columns of the cofactor matrix are cross products of the other two columns; no inverse needed
+	glm::vec3 a(model[0]), b(model[1]), c(model[2]);
+	glm::mat3 cofactor(glm::cross(b, c), glm::cross(c, a), glm::cross(a, b));
+	// A mirroring transform has a negative determinant and would flip the normals
+	if (glm::dot(a, cofactor[0]) < 0.0f) {
+		cofactor = -cofactor;
+	}
+	data.normalModel = glm::mat4(cofactor);
+	return data;
+}
+
+void CommandBuffer::clear() {
+	this->commands.clear();
+	this->uniforms.clear();
+}
+
+void CommandBuffer::bindProgram(GLuint program) {
+	DrawCommand command = { DRAW_BIND_PROGRAM, program, 0, 0, 0, 0, 0 };
+	this->commands.push_back(command);
+}
+
+void CommandBuffer::bindVertexArray(GLuint vertexArray) {
+	DrawCommand command = { DRAW_BIND_VERTEX_ARRAY, vertexArray, 0, 0, 0, 0, 0 };
+	this->commands.push_back(command);
+}
+
+void CommandBuffer::bindTexture(GLuint unit, GLenum target, GLuint texture) {
+	DrawCommand command = { DRAW_BIND_TEXTURE, texture, target, unit, 0, 0, 0 };
+	this->commands.push_back(command);
+}
+
+void CommandBuffer::setDrawData(const void* data, size_t size) {
+	// Every range starts on an alignment boundary so the queue can bind it directly
+	size_t offset = (this->uniforms.size() + uniformAlignment - 1) / uniformAlignment * uniformAlignment;
+	this->uniforms.resize(offset + size);
+	memcpy(&this->uniforms[offset], data, size);
+	DrawCommand command = { DRAW_UNIFORM_RANGE, 0, 0, 0, (uint32_t)size, 0, offset };
+	this->commands.push_back(command);
+}
+
+void CommandBuffer::drawElementsInstanced(GLsizei count, GLenum type, size_t offset, GLsizei instances) {
+	DrawCommand command = { DRAW_ELEMENTS_INSTANCED, 0, type, 0, (uint32_t)count, (uint32_t)instances, offset };
+	this->commands.push_back(command);
+}
+
+void CommandBuffer::polygonOffset(GLfloat factor, GLfloat units) {
+	DrawCommand command = { DRAW_POLYGON_OFFSET, 0, 0, 0, 0, 0, 0 };
+	memcpy(&command.count, &factor, sizeof(factor));
+	memcpy(&command.instances, &units, sizeof(units));
+	this->commands.push_back(command);
+}
+
+CommandRecorder::CommandRecorder(JobSystem* jobs) {
+	this->jobs = jobs;
+}
+
+void CommandRecorder::record(const vector<function<void()> >& tasks) {
+	// Tasks differ a lot in size, so chunks may be as small as one
+	this->jobs->parallelFor((int)tasks.size(), 1, [&tasks](int first, int last) {
+		for (int i = first; i < last; i++) {
+			tasks[i]();
+		}
+	});
+}
+
+CommandQueue::CommandQueue() {
+	this->uniformBuffer = 0;
+	this->uniformCapacity = 0;
+}
+
+void CommandQueue::init() {
+	GLint alignment = 256;
+	glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+	CommandBuffer::uniformAlignment = alignment > 0 ? (size_t)alignment : 256;
+	glGenBuffers(1, &this->uniformBuffer);
+}
+
+void CommandQueue::submit(CommandBuffer* const* buffers, int count) {
+	// Pack every buffer's uniform data into the stream buffer, orphaning last frame's copy
+	size_t total = 0;
+	this->baseOffsets.resize(count);
+	for (int i = 0; i < count; i++) {
+		this->baseOffsets[i] = total;
+		size_t size = buffers[i]->uniforms.size();
+		total += (size + CommandBuffer::uniformAlignment - 1) / CommandBuffer::uniformAlignment * CommandBuffer::uniformAlignment;
+	}
+	glBindBuffer(GL_UNIFORM_BUFFER, this->uniformBuffer);
+	if (total > this->uniformCapacity) {
+		this->uniformCapacity = total * 2;
+	}
+	if (total > 0) {
+		glBufferData(GL_UNIFORM_BUFFER, this->uniformCapacity, nullptr, GL_STREAM_DRAW);
+		for (int i = 0; i < count; i++) {
+			if (!buffers[i]->uniforms.empty()) {
+				glBufferSubData(GL_UNIFORM_BUFFER, this->baseOffsets[i], buffers[i]->uniforms.size(), &buffers[i]->uniforms[0]);
+			}
+		}
+	}
+
+	FrameProfiler& profiler = FrameProfiler::instance();
+	GLuint program = 0, vertexArray = 0;
+	bool offsetEnabled = false;
+	GLuint activeUnit = (GLuint)-1;
+	// Units are bound outside the queue too, so nothing is assumed about them until this submit binds them
+	GLuint textures[8];
+	for (int unit = 0; unit < 8; unit++) {
+		textures[unit] = ~0u;
+	}
+	for (int i = 0; i < count; i++) {
+		const vector<DrawCommand>& commands = buffers[i]->commands;
+		for (size_t c = 0; c < commands.size(); c++) {
+			const DrawCommand& command = commands[c];
+			switch (command.op) {
+			case DRAW_BIND_PROGRAM:
+				if (command.object != program) {
+					program = command.object;
+					glUseProgram(program);
+					// GLSL 3.30 has no layout(binding), so the block is bound the first time a program is seen
+					if (this->preparedPrograms.insert(program).second) {
+						GLuint block = glGetUniformBlockIndex(program, "DrawData");
+						if (block != GL_INVALID_INDEX) {
+							glUniformBlockBinding(program, block, DRAW_DATA_BINDING);
+						}
+					}
+				}
+				break;
+			case DRAW_BIND_VERTEX_ARRAY:
+				if (command.object != vertexArray) {
+					vertexArray = command.object;
+					glBindVertexArray(vertexArray);
+				}
+				break;
+			case DRAW_BIND_TEXTURE:
+				if (command.unit >= 8 || textures[command.unit] != command.object) {
+					if (command.unit != activeUnit) {
+						activeUnit = command.unit;
+						glActiveTexture(GL_TEXTURE0 + activeUnit);
+					}
+					glBindTexture(command.target, command.object);
+					if (command.unit < 8) {
+						textures[command.unit] = command.object;
+					}
+				}
+				break;
+			case DRAW_UNIFORM_RANGE:
+				glBindBufferRange(GL_UNIFORM_BUFFER, DRAW_DATA_BINDING, this->uniformBuffer,
+				                  this->baseOffsets[i] + command.offset, command.count);
+				break;
+			case DRAW_ELEMENTS_INSTANCED:
+				glDrawElementsInstanced(GL_TRIANGLES, command.count, command.target, (void*)(uintptr_t)command.offset, command.instances);
+				profiler.countDraw(command.count / 3, command.instances);
+				break;
+			case DRAW_POLYGON_OFFSET: {
+				GLfloat factor, units;
+				memcpy(&factor, &command.count, sizeof(factor));
+				memcpy(&units, &command.instances, sizeof(units));
+				bool enable = factor != 0.0f || units != 0.0f;
+				if (enable) {
+					glPolygonOffset(factor, units);
+				}
+				if (enable != offsetEnabled) {
+					offsetEnabled = enable;
+					if (enable) {
+						glEnable(GL_POLYGON_OFFSET_FILL);
+					} else {
+						glDisable(GL_POLYGON_OFFSET_FILL);
+					}
+				}
+				break;
+			}
+			}
+		}
+	}
+	if (offsetEnabled) {
+		glDisable(GL_POLYGON_OFFSET_FILL);
+	}
+	glBindVertexArray(0);
+	glActiveTexture(GL_TEXTURE0);
+}
+
+void CommandQueue::cleanup() {
+	glDeleteBuffers(1, &this->uniformBuffer);
+	this->uniformBuffer = 0;
+	this->uniformCapacity = 0;
+	this->preparedPrograms.clear();
+}
@@ -0,0 +1,102 @@
+#ifndef COMMAND_BUFFER_CLASS_H
+#define COMMAND_BUFFER_CLASS_H
+
+#include <functional>
+#include <glad/gl.h>
+#include <glm/glm.hpp>
+#include <set>
+#include <stdint.h>
+#include <vector>
+
+class JobSystem;
+
+// Uniform block binding point of the per-draw DrawData block in the scene shaders
+#define DRAW_DATA_BINDING 0
+
+// CPU copy of the std140 DrawData block in shaders/include/instance.glsl
+struct DrawData {
+    glm::mat4 model;
+    glm::mat4 normalModel;      // cofactor of model's 3x3 (inverse transpose up to a positive scale)
+    glm::ivec4 material;        // x: first material, which the instances' material attribute is added to
+
+    static DrawData fromModel(const glm::mat4& model, int material = 0);
+};
+
+enum DrawOp {
+    DRAW_BIND_PROGRAM,
+    DRAW_BIND_VERTEX_ARRAY,
+    DRAW_BIND_TEXTURE,
+    DRAW_UNIFORM_RANGE,         // bind a range of the recorded uniform data to DRAW_DATA_BINDING
+    DRAW_ELEMENTS_INSTANCED,
+    DRAW_POLYGON_OFFSET         // factor and units as float bits in count and instances
+};
+
+// One recorded operation; plain data so recording needs no GL context
+struct DrawCommand {
+    uint32_t op;
+    uint32_t object;            // program, vertex array or texture name
+    uint32_t target;            // texture target or index type
+    uint32_t unit;              // texture unit
+    uint32_t count;             // index count, or uniform range size in bytes
+    uint32_t instances;
+    uint64_t offset;            // index buffer offset, or offset into the buffer's uniform data
+};
+
+// A list of draw commands and the per-draw uniform data they reference,
+// recorded by one thread for one pass and scene partition. Recording only
+// touches CPU memory; CommandQueue uploads and replays it on the GL thread.
+class CommandBuffer {
+    public:
+    std::vector<DrawCommand> commands;
+    std::vector<unsigned char> uniforms;
+
+    // Offset granularity of uniform ranges; set from the driver by CommandQueue::init
+    static size_t uniformAlignment;
+
+    void clear();
+    void bindProgram(GLuint program);
+    void bindVertexArray(GLuint vertexArray);
+    void bindTexture(GLuint unit, GLenum target, GLuint texture);
+    // Copy per-draw data into the buffer and bind it for the draws that follow
+    void setDrawData(const void* data, size_t size);
+    void drawElementsInstanced(GLsizei count, GLenum type, size_t offset, GLsizei instances);
+    // Offset the depth of the draws that follow; 0, 0 turns it off again. Submits end with it off.
+    void polygonOffset(GLfloat factor, GLfloat units);
+};
+
+// Records command buffers in parallel on a JobSystem. The calling thread
+// works through the tasks too and record() returns once all of them are
+// done; it may be called from inside other jobs.
+class CommandRecorder {
+    public:
+    CommandRecorder(JobSystem* jobs);
+
+    void record(const std::vector<std::function<void()> >& tasks);
+
+    private:
+    JobSystem* jobs;
+
+    CommandRecorder(const CommandRecorder&);
+    CommandRecorder& operator=(const CommandRecorder&);
+};
+
+// Replays command buffers on the GL thread. All of a submit's uniform data
+// goes to the GPU in one streamed uniform buffer, then the commands run in a
+// single loop that skips binds of state that is already current.
+class CommandQueue {
+    public:
+    CommandQueue();
+
+    // Must be called with a current context
+    void init();
+    void submit(CommandBuffer* const* buffers, int count);
+    void cleanup();
+
+    private:
+    GLuint uniformBuffer;
+    size_t uniformCapacity;
+    std::set<GLuint> preparedPrograms;  // programs whose DrawData block is bound to DRAW_DATA_BINDING
+    std::vector<size_t> baseOffsets;
+};
+
+#endif
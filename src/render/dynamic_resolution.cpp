@@ -0,0 +1,117 @@
+#include "render/dynamic_resolution.h"
+#include "render/shader.h"
+
+#include <algorithm>
+#include <cmath>
+
+using namespace std;
+
+// Frames between scale changes, so each change is measured before the next
+static const int settleFrames = 8;
+// Only scale up when this far under budget, to avoid oscillating around it
+static const float headroom = 0.85f;
+static const float scaleStep = 1.0f / 64.0f;
+
+DynamicResolution::DynamicResolution() {
+	this->enabled = true;
+	this->minScale = 0.5f;
+	this->maxScale = 1.0f;
+	this->budgetMs = 16.0f;
+	this->sharpness = 0.6f;
+	this->scale = 1.0f;
+	this->shader = nullptr;
+	this->vertexArrayID = 0;
+	this->filteredMs = 0.0;
+	this->lastFrame = 0;
+	this->framesSinceChange = 0;
+}
+
+void DynamicResolution::init() {
+	this->shader = new Shader("../src/shaders/upscale.vert", "../src/shaders/upscale.frag");
+	// The full-screen triangle comes from gl_VertexID; core profile still wants a vertex array bound
+	glGenVertexArrays(1, &this->vertexArrayID);
+}
+
+bool DynamicResolution::resize(int width, int height) {
+	if (width == this->target.width && height == this->target.height) {
+		return true;
+	}
+	if (this->target.framebufferID != 0) {
+		this->target.cleanup();
+	}
+	return this->target.create(max(width, 1), max(height, 1), true);
+}
+
+void DynamicResolution::update(double gpuMs, uint64_t frame) {
+	if (!this->enabled) {
+		this->scale = this->maxScale;
+		return;
+	}
+	if (gpuMs <= 0.0 || frame == this->lastFrame) {
+		return;
+	}
+	this->lastFrame = frame;
+	this->filteredMs = this->filteredMs > 0.0 ? this->filteredMs * 0.8 + gpuMs * 0.2 : gpuMs;
+	if (++this->framesSinceChange < settleFrames) {
+		return;
+	}
+
+	// Pixel cost goes with the area, so the axis scale moves with the square root of the ratio
+	float ratio = (float)(this->budgetMs / this->filteredMs);
+	float wanted = this->scale;
+	if (ratio < 1.0f) {
+		wanted = this->scale * sqrt(ratio);
+	} else if (ratio > 1.0f / headroom) {
+		wanted = this->scale * min(sqrt(ratio), 1.05f);
+	}
+	wanted = floor(wanted / scaleStep + 0.5f) * scaleStep;
+	wanted = min(max(wanted, this->minScale), this->maxScale);
+	if (wanted != this->scale) {
+		this->scale = wanted;
+		this->framesSinceChange = 0;
+	}
+}
+
+int DynamicResolution::sceneWidth() const {
+	return max(1, (int)(this->target.width * this->scale + 0.5f));
+}
+
+int DynamicResolution::sceneHeight() const {
+	return max(1, (int)(this->target.height * this->scale + 0.5f));
+}
+
+void DynamicResolution::bindScene() {
+	glBindFramebuffer(GL_FRAMEBUFFER, this->target.framebufferID);
+	glViewport(0, 0, this->sceneWidth(), this->sceneHeight());
+}
+
+void DynamicResolution::upscale() {
+	float width = (float)this->target.width;
+	float height = (float)this->target.height;
+	// No sharpening at full scale, so the composite is an exact copy there
+	float range = max(this->maxScale - this->minScale, 0.001f);
+	float amount = this->sharpness * min(max((this->maxScale - this->scale) / range, 0.0f), 1.0f);
+
+	GLboolean depthTest = glIsEnabled(GL_DEPTH_TEST);
+	glDisable(GL_DEPTH_TEST);
+	this->shader->use();
+	this->shader->setInt("sceneTexture", 0);
+	this->shader->setVec2("uvScale", this->sceneWidth() / width, this->sceneHeight() / height);
+	this->shader->setVec2("texelSize", 1.0f / width, 1.0f / height);
+	this->shader->setFloat("sharpness", amount);
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, this->target.colorBufferID);
+	glBindVertexArray(this->vertexArrayID);
+	glDrawArrays(GL_TRIANGLES, 0, 3);
+	glBindVertexArray(0);
+	if (depthTest) {
+		glEnable(GL_DEPTH_TEST);
+	}
+}
+
+void DynamicResolution::cleanup() {
+	this->target.cleanup();
+	glDeleteVertexArrays(1, &this->vertexArrayID);
+	delete this->shader;
+	this->shader = nullptr;
+}
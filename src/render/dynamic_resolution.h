@@ -0,0 +1,50 @@
+#ifndef DYNAMIC_RESOLUTION_CLASS_H
+#define DYNAMIC_RESOLUTION_CLASS_H
+
+#include <glad/gl.h>
+#include <stdint.h>
+
+#include "render/render_target.h"
+
+class Shader;
+
+// Renders the scene into an offscreen target at a fraction of the output
+// size and scales it back up with a sharpening bilinear filter. The target is
+// allocated at full output size and the scene only uses its lower-left
+// corner, so changing the scale never reallocates. The scale follows the
+// measured GPU frame time: it drops as soon as frames go over budget and
+// creeps back up once there is clear headroom.
+class DynamicResolution {
+    public:
+    bool enabled;           // false pins the scale at maxScale
+    float minScale;
+    float maxScale;
+    float budgetMs;         // GPU time per frame to aim for
+    float sharpness;        // sharpening strength at minScale; none at full scale
+    float scale;            // current fraction of the output size on each axis
+    RenderTarget target;
+
+    DynamicResolution();
+    // Must be called with a current context
+    void init();
+    // Match the output size; reallocates the target only when it changes
+    bool resize(int width, int height);
+    // Feed the GPU time of a resolved frame; a frame is only counted once
+    void update(double gpuMs, uint64_t frame);
+    // Bind the target and set the viewport to the scaled scene size
+    void bindScene();
+    int sceneWidth() const;
+    int sceneHeight() const;
+    // Draw the scene to the bound framebuffer at the full output size
+    void upscale();
+    void cleanup();
+
+    private:
+    Shader* shader;
+    GLuint vertexArrayID;
+    double filteredMs;
+    uint64_t lastFrame;
+    int framesSinceChange;
+};
+
+#endif
@@ -0,0 +1,38 @@
+#ifndef FRUSTUM_H
+#define FRUSTUM_H
+
+#include <glm/glm.hpp>
+
+// View frustum as six inward-facing planes, for culling axis-aligned boxes
+struct Frustum {
+    glm::vec4 planes[6];
+
+    // Planes straight from the view-projection rows (Gribb-Hartmann)
+    void extract(const glm::mat4& viewProjection)
+    {
+        glm::vec4 rows[4];
+        for (int r = 0; r < 4; r++) {
+            rows[r] = glm::vec4(viewProjection[0][r], viewProjection[1][r], viewProjection[2][r], viewProjection[3][r]);
+        }
+        for (int p = 0; p < 3; p++) {
+            planes[2 * p] = rows[3] + rows[p];
+            planes[2 * p + 1] = rows[3] - rows[p];
+        }
+    }
+
+    // False only if the box is fully outside one plane; may accept boxes near the corners
+    bool intersects(const glm::vec3& low, const glm::vec3& high) const
+    {
+        for (int p = 0; p < 6; p++) {
+            const glm::vec4& plane = planes[p];
+            // The box corner furthest along the plane normal
+            glm::vec3 corner(plane.x >= 0.0f ? high.x : low.x, plane.y >= 0.0f ? high.y : low.y, plane.z >= 0.0f ? high.z : low.z);
+            if (glm::dot(glm::vec3(plane), corner) + plane.w < 0.0f) {
+                return false;
+            }
+        }
+        return true;
+    }
+};
+
+#endif
@@ -0,0 +1,125 @@
+#include "render/instance_set.h"
+#include "core/startup_trace.h"
+
+InstanceTransform InstanceTransform::pack(const glm::mat4& transform) {
+	// glm is column-major; row r of the affine part is column r's element across the columns
+	InstanceTransform packed;
+	for (int r = 0; r < 3; r++) {
+		packed.rows[r] = glm::vec4(transform[0][r], transform[1][r], transform[2][r], transform[3][r]);
+	}
+	return packed;
+}
+
+InstanceSet::InstanceSet() {
+	this->modelMatrices = nullptr;
+	this->amount = 0;
+	this->capacity = 0;
+	this->transformBufferID = 0;
+	this->materialBufferID = 0;
+	this->instanceBase = glm::mat4(1.0f);
+}
+
+void InstanceSet::packInstances(int count, const glm::mat4* matrices) {
+	this->packed.resize(count);
+	bool identity = this->instanceBase == glm::mat4(1.0f);
+	for (int i = 0; i < count; i++) {
+		this->packed[i] = InstanceTransform::pack(identity ? matrices[i] : matrices[i] * this->instanceBase);
+	}
+}
+
+void InstanceSet::createInstanceBuffer(glm::mat4* modelMatrices, int amount) {
+	this->modelMatrices = modelMatrices;
+	this->amount = amount;
+	this->capacity = amount;
+	packInstances(amount, modelMatrices);
+	// Create a transform buffer object to store the packed instance transforms
+	glGenBuffers(1, &this->transformBufferID);
+	glBindBuffer(GL_ARRAY_BUFFER, this->transformBufferID);
+	glBufferData(GL_ARRAY_BUFFER, this->amount * sizeof(InstanceTransform), this->packed.data(), GL_STATIC_DRAW);
+	StartupTrace::instance().addBytesUploaded(this->amount * sizeof(InstanceTransform));
+	std::vector<uint32_t> materials(this->amount, 0);
+	glGenBuffers(1, &this->materialBufferID);
+	glBindBuffer(GL_ARRAY_BUFFER, this->materialBufferID);
+	glBufferData(GL_ARRAY_BUFFER, materials.size() * sizeof(uint32_t), materials.data(), GL_STATIC_DRAW);
+}
+
+void InstanceSet::reserveInstances(int capacity) {
+	if (capacity <= this->capacity) {
+		return;
+	}
+	GLuint buffer;
+	glGenBuffers(1, &buffer);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+	glBufferData(GL_COPY_WRITE_BUFFER, capacity * sizeof(InstanceTransform), nullptr, GL_DYNAMIC_DRAW);
+	if (this->amount > 0) {
+		glBindBuffer(GL_COPY_READ_BUFFER, this->transformBufferID);
+		glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, this->amount * sizeof(InstanceTransform));
+	}
+	glDeleteBuffers(1, &this->transformBufferID);
+	this->transformBufferID = buffer;
+	// Material ids are kept for the whole old capacity; they may be set before instances are drawn
+	std::vector<uint32_t> materials(capacity, 0);
+	glGenBuffers(1, &buffer);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+	glBufferData(GL_COPY_WRITE_BUFFER, capacity * sizeof(uint32_t), materials.data(), GL_DYNAMIC_DRAW);
+	if (this->capacity > 0) {
+		glBindBuffer(GL_COPY_READ_BUFFER, this->materialBufferID);
+		glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, this->capacity * sizeof(uint32_t));
+	}
+	glDeleteBuffers(1, &this->materialBufferID);
+	this->materialBufferID = buffer;
+	this->capacity = capacity;
+	for (size_t i = 0; i < this->vertexArrays.size(); i++) {
+		glBindVertexArray(this->vertexArrays[i]);
+		bindInstanceAttributes();
+	}
+	glBindVertexArray(0);
+}
+
+void InstanceSet::updateInstances(int first, int count, const glm::mat4* matrices) {
+	if (count <= 0 || first + count > this->capacity) {
+		return;
+	}
+	packInstances(count, matrices);
+	glBindBuffer(GL_ARRAY_BUFFER, this->transformBufferID);
+	glBufferSubData(GL_ARRAY_BUFFER, first * sizeof(InstanceTransform), count * sizeof(InstanceTransform), this->packed.data());
+}
+
+void InstanceSet::updateMaterials(int first, int count, const uint32_t* materials) {
+	if (count <= 0 || first + count > this->capacity) {
+		return;
+	}
+	glBindBuffer(GL_ARRAY_BUFFER, this->materialBufferID);
+	glBufferSubData(GL_ARRAY_BUFFER, first * sizeof(uint32_t), count * sizeof(uint32_t), materials);
+}
+
+void InstanceSet::bindInstanceAttributes() {
+	glBindBuffer(GL_ARRAY_BUFFER, this->transformBufferID);
+	for (GLuint row = 0; row < 3; row++) {
+		glEnableVertexAttribArray(3 + row);
+		glVertexAttribPointer(3 + row, 4, GL_FLOAT, GL_FALSE, sizeof(InstanceTransform), (void*)(row * sizeof(glm::vec4)));
+		glVertexAttribDivisor(3 + row, 1);
+	}
+	glBindBuffer(GL_ARRAY_BUFFER, this->materialBufferID);
+	glEnableVertexAttribArray(7);
+	glVertexAttribIPointer(7, 1, GL_UNSIGNED_INT, sizeof(uint32_t), (void*)0);
+	glVertexAttribDivisor(7, 1);
+}
+
+void InstanceSet::attachVertexArray(GLuint vertexArray) {
+	glBindVertexArray(vertexArray);
+	bindInstanceAttributes();
+	this->vertexArrays.push_back(vertexArray);
+}
+
+void InstanceSet::cleanupInstances() {
+	glDeleteBuffers(1, &this->transformBufferID);
+	glDeleteBuffers(1, &this->materialBufferID);
+	this->transformBufferID = 0;
+	this->materialBufferID = 0;
+	this->capacity = 0;
+	this->amount = 0;
+	this->vertexArrays.clear();
+	this->packed.clear();
+	this->packed.shrink_to_fit();
+}
@@ -0,0 +1,54 @@
+#ifndef INSTANCE_SET_CLASS_H
+#define INSTANCE_SET_CLASS_H
+
+#include <glad/gl.h>
+#include <glm/glm.hpp>
+#include <stdint.h>
+#include <vector>
+
+// GPU layout of one instance: the top three rows of an affine transform,
+// translation in the w lanes. Attributes 3-5, 48 bytes instead of a mat4's 64.
+struct InstanceTransform {
+    glm::vec4 rows[3];
+
+    static InstanceTransform pack(const glm::mat4& transform);
+};
+
+// Per-instance transform stream shared by the instanced renderables. The GPU
+// buffer can hold more instances than are drawn so that streamed content can
+// be appended and rewritten in place without reallocating every frame. Next
+// to it a stream of per-instance material ids, attribute 7, all 0 until set.
+class InstanceSet {
+    public:
+    glm::mat4* modelMatrices;
+    int amount;         // instances drawn
+    int capacity;       // instances the transform buffer can hold
+    GLuint transformBufferID;
+    GLuint materialBufferID;
+    std::vector<GLuint> vertexArrays;
+    // Multiplied into every instance on upload, e.g. a model's only node transform
+    glm::mat4 instanceBase;
+
+    InstanceSet();
+    // Upload the initial instances
+    void createInstanceBuffer(glm::mat4* modelMatrices, int amount);
+    // Grow the transform buffer, preserving the first amount instances
+    void reserveInstances(int capacity);
+    // Overwrite instances [first, first + count) of the GPU buffer
+    void updateInstances(int first, int count, const glm::mat4* matrices);
+    // Overwrite the material ids, added to the draw's first material, of instances [first, first + count)
+    void updateMaterials(int first, int count, const uint32_t* materials);
+    // Point attributes 3-5 of the bound vertex array at the transform buffer, one InstanceTransform
+    // per instance, and attribute 7 at the material ids
+    void bindInstanceAttributes();
+    // Same for a vertex array that is set up once; it is re-pointed whenever the buffer grows
+    void attachVertexArray(GLuint vertexArray);
+    void cleanupInstances();
+
+    private:
+    std::vector<InstanceTransform> packed;
+
+    void packInstances(int count, const glm::mat4* matrices);
+};
+
+#endif
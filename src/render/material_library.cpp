@@ -0,0 +1,220 @@
+#include "render/material_library.h"
+#include "core/startup_trace.h"
+#include "stb_image.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+using namespace std;
+
+MaterialLibrary& MaterialLibrary::instance() {
+	static MaterialLibrary library;
+	return library;
+}
+
+MaterialLibrary::MaterialLibrary() {
+	// The glTF assets ship 1k textures; larger ones are filtered down
+	this->layerSize = 1024;
+	this->layers = 0;
+	this->uploaded = false;
+	this->arrayTexture = 0;
+	this->materialBuffer = 0;
+	this->materialTexture = 0;
+}
+
+// Source texels and weights of every destination texel along one axis: a box
+// over the texels it covers when shrinking, linear between the nearest two when growing
+struct AxisTaps {
+	vector<int> first;          // per destination texel, into index and weight
+	vector<int> index;
+	vector<float> weight;
+};
+
+static void axisTaps(int sourceSize, int destSize, AxisTaps& taps) {
+	float scale = (float)sourceSize / destSize;
+	taps.first.resize(destSize + 1);
+	taps.index.clear();
+	taps.weight.clear();
+	for (int i = 0; i < destSize; i++) {
+		taps.first[i] = (int)taps.index.size();
+		if (scale >= 1.0f) {
+			float low = i * scale, high = (i + 1) * scale;
+			for (int j = (int)low; j < sourceSize && j < high; j++) {
+				float covered = min(high, (float)(j + 1)) - max(low, (float)j);
+				if (covered > 0.0f) {
+					taps.index.push_back(j);
+					taps.weight.push_back(covered / scale);
+				}
+			}
+		} else {
+			float center = (i + 0.5f) * scale - 0.5f;
+			int j = (int)floor(center);
+			float t = center - j;
+			taps.index.push_back(max(j, 0));
+			taps.weight.push_back(1.0f - t);
+			taps.index.push_back(min(j + 1, sourceSize - 1));
+			taps.weight.push_back(t);
+		}
+	}
+	taps.first[destSize] = (int)taps.index.size();
+}
+
+int MaterialLibrary::addTexture(const unsigned char* pixels, int width, int height, int components, int bits) {
+	if (this->uploaded) {
+		cerr << "WARN: texture added after the materials were uploaded; its materials draw their factor only" << endl;
+		return -1;
+	}
+	if (pixels == nullptr || width <= 0 || height <= 0 || components < 1 || components > 4 || (bits != 8 && bits != 16)) {
+		cerr << "WARN: unsupported texture (" << width << "x" << height << ", " << components << " components, " << bits << " bits)" << endl;
+		return -1;
+	}
+	// Expand to RGBA; grey replicates into the colour channels, a second component is alpha
+	int bytes = bits / 8;
+	vector<float> rgba((size_t)width * height * 4);
+	for (size_t p = 0; p < (size_t)width * height; p++) {
+		float c[4] = { 0.0f, 0.0f, 0.0f, 255.0f };
+		for (int k = 0; k < components; k++) {
+			// 16-bit samples keep their high byte
+			c[k] = pixels[(p * components + k) * bytes + bytes - 1];
+		}
+		float* out = &rgba[p * 4];
+		if (components <= 2) {
+			out[0] = out[1] = out[2] = c[0];
+			out[3] = components == 2 ? c[1] : 255.0f;
+		} else {
+			out[0] = c[0];
+			out[1] = c[1];
+			out[2] = c[2];
+			out[3] = c[3];
+		}
+	}
+
+	int size = this->layerSize;
+	size_t layerBytes = (size_t)size * size * 4;
+	size_t offset = this->staged.size();
+	this->staged.resize(offset + layerBytes);
+	unsigned char* layer = &this->staged[offset];
+	if (width == size && height == size) {
+		for (size_t i = 0; i < layerBytes; i++) {
+			layer[i] = (unsigned char)rgba[i];
+		}
+		return this->layers++;
+	}
+
+	// Separable resample: rows to the layer width, then columns to its height
+	AxisTaps taps;
+	axisTaps(width, size, taps);
+	vector<float> rows((size_t)height * size * 4, 0.0f);
+	for (int y = 0; y < height; y++) {
+		const float* source = &rgba[(size_t)y * width * 4];
+		float* dest = &rows[(size_t)y * size * 4];
+		for (int x = 0; x < size; x++) {
+			for (int t = taps.first[x]; t < taps.first[x + 1]; t++) {
+				const float* texel = source + taps.index[t] * 4;
+				for (int k = 0; k < 4; k++) {
+					dest[x * 4 + k] += taps.weight[t] * texel[k];
+				}
+			}
+		}
+	}
+	axisTaps(height, size, taps);
+	for (int y = 0; y < size; y++) {
+		for (int x = 0; x < size * 4; x++) {
+			float value = 0.0f;
+			for (int t = taps.first[y]; t < taps.first[y + 1]; t++) {
+				value += taps.weight[t] * rows[(size_t)taps.index[t] * size * 4 + x];
+			}
+			layer[(size_t)y * size * 4 + x] = (unsigned char)min(max(value + 0.5f, 0.0f), 255.0f);
+		}
+	}
+	return this->layers++;
+}
+
+int MaterialLibrary::loadTexture(const char* path) {
+	StartupScope scope(path, "texture");
+	StartupTrace::instance().addBytesRead(StartupTrace::fileSize(path));
+	int width, height, channels;
+	unsigned char* pixels = stbi_load(path, &width, &height, &channels, 0);
+	if (pixels == nullptr) {
+		cout << "Failed to load texture " << path << endl;
+		return -1;
+	}
+	int layer = addTexture(pixels, width, height, channels);
+	stbi_image_free(pixels);
+	return layer;
+}
+
+int MaterialLibrary::addMaterial(const glm::vec4& baseColorFactor, int layer, float roughness) {
+	MaterialData material;
+	material.baseColorFactor = baseColorFactor;
+	material.params = glm::vec4((float)layer, roughness, 0.0f, 0.0f);
+	this->materials.push_back(material);
+	return (int)this->materials.size() - 1;
+}
+
+int MaterialLibrary::materialCount() const {
+	return (int)this->materials.size();
+}
+
+int MaterialLibrary::layerCount() const {
+	return this->layers;
+}
+
+void MaterialLibrary::upload() {
+	if (!this->uploaded) {
+		this->uploaded = true;
+		// Without layers a white one keeps the sampler complete
+		int size = this->layerSize;
+		int depth = this->layers;
+		if (depth == 0) {
+			size = 1;
+			depth = 1;
+			this->staged.assign(4, 255);
+		}
+		glGenTextures(1, &this->arrayTexture);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, this->arrayTexture);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA8, size, size, depth, 0, GL_RGBA, GL_UNSIGNED_BYTE, &this->staged[0]);
+		StartupTrace::instance().addBytesUploaded(this->staged.size());
+		glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+		this->staged.clear();
+		this->staged.shrink_to_fit();
+	}
+
+	if (this->materials.empty()) {
+		addMaterial(glm::vec4(1.0f), -1, 1.0f);
+	}
+	if (this->materialBuffer == 0) {
+		glGenBuffers(1, &this->materialBuffer);
+		glGenTextures(1, &this->materialTexture);
+	}
+	glBindBuffer(GL_TEXTURE_BUFFER, this->materialBuffer);
+	glBufferData(GL_TEXTURE_BUFFER, this->materials.size() * sizeof(MaterialData), &this->materials[0], GL_STATIC_DRAW);
+	glBindTexture(GL_TEXTURE_BUFFER, this->materialTexture);
+	glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, this->materialBuffer);
+	glBindTexture(GL_TEXTURE_BUFFER, 0);
+	glBindBuffer(GL_TEXTURE_BUFFER, 0);
+}
+
+void MaterialLibrary::bind() {
+	glActiveTexture(GL_TEXTURE0 + MATERIAL_ARRAY_UNIT);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, this->arrayTexture);
+	glActiveTexture(GL_TEXTURE0 + MATERIAL_BUFFER_UNIT);
+	glBindTexture(GL_TEXTURE_BUFFER, this->materialTexture);
+	glActiveTexture(GL_TEXTURE0);
+}
+
+void MaterialLibrary::cleanup() {
+	glDeleteTextures(1, &this->arrayTexture);
+	glDeleteTextures(1, &this->materialTexture);
+	glDeleteBuffers(1, &this->materialBuffer);
+	this->arrayTexture = 0;
+	this->materialTexture = 0;
+	this->materialBuffer = 0;
+}
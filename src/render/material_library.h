@@ -0,0 +1,65 @@
+#ifndef MATERIAL_LIBRARY_CLASS_H
+#define MATERIAL_LIBRARY_CLASS_H
+
+#include <glad/gl.h>
+#include <glm/glm.hpp>
+#include <stdint.h>
+#include <vector>
+
+// Texture units of the base colour layers and the material parameters, after CROWD_NORMAL_UNIT
+#define MATERIAL_ARRAY_UNIT 5
+#define MATERIAL_BUFFER_UNIT 6
+
+// GPU layout of one material: two RGBA32F texels of the material buffer,
+// read by shaders/include/material.glsl
+struct MaterialData {
+    glm::vec4 baseColorFactor;
+    glm::vec4 params;           // x: texture layer, -1 for the factor alone; y: roughness
+};
+
+// Base colour textures of the renderables, resampled to one size and packed
+// into the layers of a single GL_TEXTURE_2D_ARRAY, and the materials'
+// parameters in a texture buffer. A draw's material is its DrawData base
+// plus the instance's material attribute, so the renderables bind no
+// textures of their own: instances of one mesh draw with any mix of
+// materials in one call, and draws of different models only differ in
+// vertex array and draw data. Textures and materials are added while the
+// assets load, without a context; upload() then creates the GL objects.
+class MaterialLibrary {
+    public:
+    int layerSize;              // width and height of every layer
+
+    static MaterialLibrary& instance();
+
+    // Resample 8 or 16 bit pixels of 1 to 4 components into a new layer; -1 if the
+    // format is not supported or the layers were already uploaded
+    int addTexture(const unsigned char* pixels, int width, int height, int components, int bits = 8);
+    // Decode an image file into a new layer; -1 if it cannot be read
+    int loadTexture(const char* path);
+    // Returns the material's id; materials added together get consecutive ids
+    int addMaterial(const glm::vec4& baseColorFactor, int layer, float roughness);
+    int materialCount() const;
+    int layerCount() const;
+
+    // Create the texture array from the staged layers, once, and upload the
+    // material buffer, again whenever materials were added; needs a current context
+    void upload();
+    // Bind both to MATERIAL_ARRAY_UNIT and MATERIAL_BUFFER_UNIT
+    void bind();
+    void cleanup();
+
+    private:
+    std::vector<MaterialData> materials;
+    std::vector<unsigned char> staged;  // RGBA8 layers until upload
+    int layers;
+    bool uploaded;
+    GLuint arrayTexture;
+    GLuint materialBuffer;
+    GLuint materialTexture;
+
+    MaterialLibrary();
+    MaterialLibrary(const MaterialLibrary&);
+    MaterialLibrary& operator=(const MaterialLibrary&);
+};
+
+#endif
@@ -0,0 +1,194 @@
+#include "render/program_cache.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <direct.h>
+#endif
+
+using namespace std;
+
+static ProgramCache* activeCache = nullptr;
+
+// On-disk layout: header followed by the driver's opaque program binary
+struct ProgramBinaryHeader {
+	char magic[4];
+	uint32_t version;
+	uint64_t key;
+	uint32_t format;
+	uint32_t length;
+};
+static const char programBinaryMagic[4] = { 'E', 'I', 'P', 'B' };
+static const uint32_t programBinaryVersion = 1;
+
+ProgramCache::ProgramCache(const char* directory) {
+	this->directory = directory;
+	this->binarySupported = false;
+	this->parallelSupported = false;
+	this->hits = 0;
+	this->misses = 0;
+	this->getProgramBinary = nullptr;
+	this->programBinary = nullptr;
+	this->programParameteri = nullptr;
+	this->maxShaderCompilerThreads = nullptr;
+}
+
+void ProgramCache::init(GLADloadfunc load) {
+	const char* vendor = (const char*)glGetString(GL_VENDOR);
+	const char* renderer = (const char*)glGetString(GL_RENDERER);
+	const char* version = (const char*)glGetString(GL_VERSION);
+	this->driver = string(vendor ? vendor : "") + " | " + (renderer ? renderer : "") + " | " + (version ? version : "");
+
+	// Program binaries are core in 4.1, otherwise require the ARB extension
+	GLint major = 0, minor = 0;
+	glGetIntegerv(GL_MAJOR_VERSION, &major);
+	glGetIntegerv(GL_MINOR_VERSION, &minor);
+	bool binaryCore = major > 4 || (major == 4 && minor >= 1);
+	if (binaryCore || hasExtension("GL_ARB_get_program_binary")) {
+		this->getProgramBinary = (GetProgramBinaryProc)load("glGetProgramBinary");
+		this->programBinary = (ProgramBinaryProc)load("glProgramBinary");
+		this->programParameteri = (ProgramParameteriProc)load("glProgramParameteri");
+		GLint formats = 0;
+		glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+		this->binarySupported = this->getProgramBinary && this->programBinary && this->programParameteri && formats > 0;
+	}
+
+	// Let the driver use as many compiler threads as it likes
+	if (hasExtension("GL_KHR_parallel_shader_compile")) {
+		this->maxShaderCompilerThreads = (MaxShaderCompilerThreadsProc)load("glMaxShaderCompilerThreadsKHR");
+	} else if (hasExtension("GL_ARB_parallel_shader_compile")) {
+		this->maxShaderCompilerThreads = (MaxShaderCompilerThreadsProc)load("glMaxShaderCompilerThreadsARB");
+	}
+	if (this->maxShaderCompilerThreads) {
+		this->maxShaderCompilerThreads(0xFFFFFFFFu);
+		this->parallelSupported = true;
+	}
+
+	if (this->binarySupported) {
+#ifdef _WIN32
+		_mkdir(this->directory.c_str());
+#else
+		mkdir(this->directory.c_str(), 0755);
+#endif
+	}
+	cout << "Shader cache: binaries " << (this->binarySupported ? "on" : "off")
+	     << ", parallel compile " << (this->parallelSupported ? "on" : "off") << endl;
+}
+
+uint64_t ProgramCache::hash(const void* data, size_t size, uint64_t seed) {
+	// 64-bit FNV-1a
+	const unsigned char* bytes = (const unsigned char*)data;
+	uint64_t h = seed;
+	for (size_t i = 0; i < size; i++) {
+		h ^= bytes[i];
+		h *= 1099511628211ULL;
+	}
+	return h;
+}
+
+uint64_t ProgramCache::key(const vector<string>& sources, const string& defines) const {
+	uint64_t h = hash(this->driver.data(), this->driver.size());
+	h = hash(defines.data(), defines.size(), h);
+	for (size_t i = 0; i < sources.size(); i++) {
+		// Include the length so that moving text between stages changes the key
+		uint64_t length = sources[i].size();
+		h = hash(&length, sizeof(length), h);
+		h = hash(sources[i].data(), sources[i].size(), h);
+	}
+	return h;
+}
+
+string ProgramCache::pathFor(uint64_t key) const {
+	char name[32];
+	snprintf(name, sizeof(name), "%016llx.bin", (unsigned long long)key);
+	return this->directory + "/" + name;
+}
+
+void ProgramCache::prepare(GLuint program) {
+	if (this->binarySupported) {
+		this->programParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+	}
+}
+
+bool ProgramCache::load(uint64_t key, GLuint program) {
+	if (!this->binarySupported) {
+		return false;
+	}
+	ifstream file(pathFor(key).c_str(), ios::binary);
+	ProgramBinaryHeader header;
+	if (!file || !file.read((char*)&header, sizeof(header))) {
+		this->misses++;
+		return false;
+	}
+	if (memcmp(header.magic, programBinaryMagic, 4) != 0 || header.version != programBinaryVersion || header.key != key) {
+		this->misses++;
+		return false;
+	}
+	vector<char> binary(header.length);
+	if (!file.read(binary.data(), binary.size())) {
+		this->misses++;
+		return false;
+	}
+	// The driver rejects binaries from a different build; treat that as a miss
+	this->programBinary(program, header.format, binary.data(), (GLsizei)binary.size());
+	GLint success = GL_FALSE;
+	glGetProgramiv(program, GL_LINK_STATUS, &success);
+	if (!success) {
+		remove(pathFor(key).c_str());
+		this->misses++;
+		return false;
+	}
+	this->hits++;
+	return true;
+}
+
+void ProgramCache::store(uint64_t key, GLuint program) {
+	if (!this->binarySupported) {
+		return;
+	}
+	GLint length = 0;
+	glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+	if (length <= 0) {
+		return;
+	}
+	vector<char> binary(length);
+	GLenum format = 0;
+	this->getProgramBinary(program, length, nullptr, &format, binary.data());
+
+	ProgramBinaryHeader header;
+	memcpy(header.magic, programBinaryMagic, 4);
+	header.version = programBinaryVersion;
+	header.key = key;
+	header.format = format;
+	header.length = (uint32_t)length;
+	ofstream file(pathFor(key).c_str(), ios::binary | ios::trunc);
+	if (!file) {
+		cout << "WARN: Could not write shader cache entry " << pathFor(key) << endl;
+		return;
+	}
+	file.write((const char*)&header, sizeof(header));
+	file.write(binary.data(), binary.size());
+}
+
+bool ProgramCache::hasExtension(const char* name) {
+	GLint count = 0;
+	glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+	for (GLint i = 0; i < count; i++) {
+		const char* extension = (const char*)glGetStringi(GL_EXTENSIONS, i);
+		if (extension && strcmp(extension, name) == 0) {
+			return true;
+		}
+	}
+	return false;
+}
+
+ProgramCache* ProgramCache::active() {
+	return activeCache;
+}
+
+void ProgramCache::setActive(ProgramCache* cache) {
+	activeCache = cache;
+}
@@ -0,0 +1,61 @@
+#ifndef PROGRAM_CACHE_CLASS_H
+#define PROGRAM_CACHE_CLASS_H
+
+#include <glad/gl.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// GL_ARB_get_program_binary and GL_KHR_parallel_shader_compile are not part of the
+// generated 3.3 core loader, so their enums and entry points are resolved here.
+#ifndef GL_PROGRAM_BINARY_RETRIEVABLE_HINT
+#define GL_PROGRAM_BINARY_RETRIEVABLE_HINT 0x8257
+#endif
+#ifndef GL_PROGRAM_BINARY_LENGTH
+#define GL_PROGRAM_BINARY_LENGTH 0x8741
+#endif
+#ifndef GL_NUM_PROGRAM_BINARY_FORMATS
+#define GL_NUM_PROGRAM_BINARY_FORMATS 0x87FE
+#endif
+
+class ProgramCache {
+    public:
+    typedef void (GLAD_API_PTR *GetProgramBinaryProc)(GLuint program, GLsizei bufSize, GLsizei *length, GLenum *binaryFormat, void *binary);
+    typedef void (GLAD_API_PTR *ProgramBinaryProc)(GLuint program, GLenum binaryFormat, const void *binary, GLsizei length);
+    typedef void (GLAD_API_PTR *ProgramParameteriProc)(GLuint program, GLenum pname, GLint value);
+    typedef void (GLAD_API_PTR *MaxShaderCompilerThreadsProc)(GLuint count);
+
+    std::string directory;
+    std::string driver;         // vendor | renderer | version, part of every key
+    bool binarySupported;
+    bool parallelSupported;
+    int hits;
+    int misses;
+
+    ProgramCache(const char* directory);
+    // Must be called with a current context; probes the extensions and loads the entry points
+    void init(GLADloadfunc load);
+    // Key over all stage sources, the define preamble and the driver string
+    uint64_t key(const std::vector<std::string>& sources, const std::string& defines) const;
+    // Mark a program as retrievable; call before glLinkProgram
+    void prepare(GLuint program);
+    // Returns true if a matching binary was found and linked successfully into program
+    bool load(uint64_t key, GLuint program);
+    void store(uint64_t key, GLuint program);
+
+    static uint64_t hash(const void* data, size_t size, uint64_t seed = 14695981039346656037ULL);
+    static ProgramCache* active();
+    static void setActive(ProgramCache* cache);
+    // Needs a current context
+    static bool hasExtension(const char* name);
+
+    private:
+    GetProgramBinaryProc getProgramBinary;
+    ProgramBinaryProc programBinary;
+    ProgramParameteriProc programParameteri;
+    MaxShaderCompilerThreadsProc maxShaderCompilerThreads;
+
+    std::string pathFor(uint64_t key) const;
+};
+
+#endif
@@ -0,0 +1,74 @@
+#include "render/render_target.h"
+
+#include <iostream>
+
+using namespace std;
+
+RenderTarget::RenderTarget() {
+	this->framebufferID = 0;
+	this->colorBufferID = 0;
+	this->depthBufferID = 0;
+	this->width = 0;
+	this->height = 0;
+	this->sampled = false;
+}
+
+bool RenderTarget::create(int width, int height, bool sampled) {
+	this->width = width;
+	this->height = height;
+	this->sampled = sampled;
+	glGenFramebuffers(1, &this->framebufferID);
+	glBindFramebuffer(GL_FRAMEBUFFER, this->framebufferID);
+	if (sampled) {
+		glGenTextures(1, &this->colorBufferID);
+		glBindTexture(GL_TEXTURE_2D, this->colorBufferID);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, this->colorBufferID, 0);
+		glBindTexture(GL_TEXTURE_2D, 0);
+	} else {
+		glGenRenderbuffers(1, &this->colorBufferID);
+		glBindRenderbuffer(GL_RENDERBUFFER, this->colorBufferID);
+		glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, this->colorBufferID);
+	}
+	glGenRenderbuffers(1, &this->depthBufferID);
+	glBindRenderbuffer(GL_RENDERBUFFER, this->depthBufferID);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, this->depthBufferID);
+	bool complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+	if (!complete) {
+		cerr << "Offscreen framebuffer is not complete!" << endl;
+	}
+	glBindRenderbuffer(GL_RENDERBUFFER, 0);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	return complete;
+}
+
+void RenderTarget::bind() {
+	glBindFramebuffer(GL_FRAMEBUFFER, this->framebufferID);
+	glViewport(0, 0, this->width, this->height);
+}
+
+void RenderTarget::readPixels(vector<unsigned char>& pixels) {
+	pixels.resize((size_t)this->width * this->height * 4);
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, this->framebufferID);
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	glReadPixels(0, 0, this->width, this->height, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+}
+
+void RenderTarget::cleanup() {
+	if (this->sampled) {
+		glDeleteTextures(1, &this->colorBufferID);
+	} else {
+		glDeleteRenderbuffers(1, &this->colorBufferID);
+	}
+	glDeleteRenderbuffers(1, &this->depthBufferID);
+	glDeleteFramebuffers(1, &this->framebufferID);
+	this->framebufferID = this->colorBufferID = this->depthBufferID = 0;
+	this->width = this->height = 0;
+}
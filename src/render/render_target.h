@@ -0,0 +1,26 @@
+#ifndef RENDER_TARGET_CLASS_H
+#define RENDER_TARGET_CLASS_H
+
+#include <glad/gl.h>
+#include <vector>
+
+// Offscreen colour + depth framebuffer, used where there is no window to draw into
+class RenderTarget {
+    public:
+    GLuint framebufferID;
+    GLuint colorBufferID;   // a texture when sampled, otherwise a renderbuffer
+    GLuint depthBufferID;
+    int width;
+    int height;
+    bool sampled;
+
+    RenderTarget();
+    // A sampled target's colour can be read by a later pass through colorBufferID
+    bool create(int width, int height, bool sampled = false);
+    void bind();
+    // Tightly packed RGBA8 rows, bottom row first
+    void readPixels(std::vector<unsigned char>& pixels);
+    void cleanup();
+};
+
+#endif
@@ -8,6 +8,11 @@
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <set>
+#include <vector>
+
+#include "core/startup_trace.h"
+#include "render/program_cache.h"
 
 class Shader
 {
@@ -16,90 +21,96 @@ public:
     // constructor generates the shader on the fly
     // ------------------------------------------------------------------------
     Shader(const char* vertexPath, const char* fragmentPath, const char* geometryPath = nullptr)
+        : Shader(vertexPath, fragmentPath, geometryPath, std::vector<std::string>())
+    {
+    }
+    // permutation constructor: each entry of defines is emitted as a #define
+    // right after the #version directive of every stage
+    // ------------------------------------------------------------------------
+    Shader(const char* vertexPath, const char* fragmentPath, const char* geometryPath, const std::vector<std::string>& defines)
     {
-        // 1. retrieve the vertex/fragment source code from filePath
-        std::string vertexCode;
-        std::string fragmentCode;
+        // 1. retrieve the vertex/fragment source code from filePath, expanding #include
+        std::string preamble;
+        for (size_t i = 0; i < defines.size(); i++)
+            preamble += "#define " + defines[i] + "\n";
+        std::string vertexCode = loadSource(vertexPath, preamble);
+        std::string fragmentCode = loadSource(fragmentPath, preamble);
         std::string geometryCode;
-        std::ifstream vShaderFile;
-        std::ifstream fShaderFile;
-        std::ifstream gShaderFile;
-        // ensure ifstream objects can throw exceptions:
-        vShaderFile.exceptions (std::ifstream::failbit | std::ifstream::badbit);
-        fShaderFile.exceptions (std::ifstream::failbit | std::ifstream::badbit);
-        gShaderFile.exceptions (std::ifstream::failbit | std::ifstream::badbit);
-        try 
-        {
-            // open files
-            vShaderFile.open(vertexPath);
-            fShaderFile.open(fragmentPath);
-            std::stringstream vShaderStream, fShaderStream;
-            // read file's buffer contents into streams
-            vShaderStream << vShaderFile.rdbuf();
-            fShaderStream << fShaderFile.rdbuf();		
-            // close file handlers
-            vShaderFile.close();
-            fShaderFile.close();
-            // convert stream into string
-            vertexCode = vShaderStream.str();
-            fragmentCode = fShaderStream.str();			
-            // if geometry shader path is present, also load a geometry shader
-            if(geometryPath != nullptr)
-            {
-                gShaderFile.open(geometryPath);
-                std::stringstream gShaderStream;
-                gShaderStream << gShaderFile.rdbuf();
-                gShaderFile.close();
-                geometryCode = gShaderStream.str();
-            }
-        }
-        catch (std::ifstream::failure& e)
+        // if geometry shader path is present, also load a geometry shader
+        if(geometryPath != nullptr)
+            geometryCode = loadSource(geometryPath, preamble);
+        // 2. try the program binary cache before touching the compiler
+        ID = glCreateProgram();
+        vertex = fragment = geometry = 0;
+        pending = false;
+        cacheKey = 0;
+        ProgramCache* cache = ProgramCache::active();
+        if (cache != nullptr)
         {
-            std::cout << "ERROR::SHADER::FILE_NOT_SUCCESSFULLY_READ: " << e.what() << std::endl;
+            std::vector<std::string> sources;
+            sources.push_back(vertexCode);
+            sources.push_back(fragmentCode);
+            sources.push_back(geometryCode);
+            cacheKey = cache->key(sources, preamble);
+            if (cache->load(cacheKey, ID))
+                return;
         }
         const char* vShaderCode = vertexCode.c_str();
         const char * fShaderCode = fragmentCode.c_str();
-        // 2. compile shaders
-        unsigned int vertex, fragment;
+        // 3. queue compilation; statuses are not queried until finish() so drivers that
+        // compile in parallel can work on every program created before the first use()
         // vertex shader
         vertex = glCreateShader(GL_VERTEX_SHADER);
         glShaderSource(vertex, 1, &vShaderCode, NULL);
         glCompileShader(vertex);
-        checkCompileErrors(vertex, "VERTEX");
         // fragment Shader
         fragment = glCreateShader(GL_FRAGMENT_SHADER);
         glShaderSource(fragment, 1, &fShaderCode, NULL);
         glCompileShader(fragment);
-        checkCompileErrors(fragment, "FRAGMENT");
         // if geometry shader is given, compile geometry shader
-        unsigned int geometry;
         if(geometryPath != nullptr)
         {
             const char * gShaderCode = geometryCode.c_str();
             geometry = glCreateShader(GL_GEOMETRY_SHADER);
             glShaderSource(geometry, 1, &gShaderCode, NULL);
             glCompileShader(geometry);
-            checkCompileErrors(geometry, "GEOMETRY");
         }
         // shader Program
-        ID = glCreateProgram();
         glAttachShader(ID, vertex);
         glAttachShader(ID, fragment);
-        if(geometryPath != nullptr)
+        if(geometry != 0)
             glAttachShader(ID, geometry);
+        if (cache != nullptr)
+            cache->prepare(ID);
         glLinkProgram(ID);
-        checkCompileErrors(ID, "PROGRAM");
+        pending = true;
+    }
+    // wait for compilation, report errors and store the binary in the cache
+    // ------------------------------------------------------------------------
+    void finish()
+    {
+        if (!pending)
+            return;
+        pending = false;
+        bool success = checkCompileErrors(vertex, "VERTEX");
+        success = checkCompileErrors(fragment, "FRAGMENT") && success;
+        if(geometry != 0)
+            success = checkCompileErrors(geometry, "GEOMETRY") && success;
+        success = checkCompileErrors(ID, "PROGRAM") && success;
+        ProgramCache* cache = ProgramCache::active();
+        if (success && cache != nullptr)
+            cache->store(cacheKey, ID);
         // delete the shaders as they're linked into our program now and no longer necessary
         glDeleteShader(vertex);
         glDeleteShader(fragment);
-        if(geometryPath != nullptr)
+        if(geometry != 0)
             glDeleteShader(geometry);
-
     }
     // activate the shader
     // ------------------------------------------------------------------------
     void use() 
     { 
+        finish();
         glUseProgram(ID); 
     }
     // utility uniform functions
@@ -162,9 +173,83 @@ public:
     }
 
 private:
+    unsigned int vertex, fragment, geometry;
+    uint64_t cacheKey;
+    bool pending;
+
+    // read a stage and insert the define preamble after its #version line
+    // ------------------------------------------------------------------------
+    static std::string loadSource(const char* path, const std::string& preamble)
+    {
+        std::set<std::string> included;
+        std::string code = readSource(path, included);
+        if (!preamble.empty())
+        {
+            size_t insertAt = 0;
+            size_t version = code.find("#version");
+            if (version != std::string::npos)
+            {
+                size_t lineEnd = code.find('\n', version);
+                insertAt = lineEnd == std::string::npos ? code.size() : lineEnd + 1;
+            }
+            code.insert(insertAt, preamble);
+        }
+        return code;
+    }
+    // read a file, expanding #include "file" relative to the including file;
+    // every file is pasted at most once so shared snippets need no guards
+    // ------------------------------------------------------------------------
+    static std::string readSource(const std::string& path, std::set<std::string>& included)
+    {
+        std::string code;
+        std::ifstream shaderFile;
+        // ensure ifstream objects can throw exceptions:
+        shaderFile.exceptions (std::ifstream::failbit | std::ifstream::badbit);
+        try 
+        {
+            shaderFile.open(path.c_str());
+            std::stringstream shaderStream;
+            shaderStream << shaderFile.rdbuf();
+            shaderFile.close();
+            code = shaderStream.str();
+            StartupTrace::instance().addBytesRead(code.size());
+        }
+        catch (std::ifstream::failure& e)
+        {
+            std::cout << "ERROR::SHADER::FILE_NOT_SUCCESSFULLY_READ: " << path << " " << e.what() << std::endl;
+            return "";
+        }
+        included.insert(path);
+
+        size_t slash = path.find_last_of("/\\");
+        std::string directory = slash == std::string::npos ? "" : path.substr(0, slash + 1);
+        std::stringstream lines(code);
+        std::string line;
+        std::string expanded;
+        while (std::getline(lines, line))
+        {
+            size_t start = line.find_first_not_of(" \t");
+            if (start != std::string::npos && line.compare(start, 8, "#include") == 0)
+            {
+                size_t open = line.find('"', start);
+                size_t close = open == std::string::npos ? open : line.find('"', open + 1);
+                if (close != std::string::npos)
+                {
+                    std::string includePath = directory + line.substr(open + 1, close - open - 1);
+                    if (included.count(includePath) == 0)
+                        expanded += readSource(includePath, included);
+                    continue;
+                }
+            }
+            expanded += line;
+            expanded += '\n';
+        }
+        return expanded;
+    }
+
     // utility function for checking shader compilation/linking errors.
     // ------------------------------------------------------------------------
-    void checkCompileErrors(GLuint shader, std::string type)
+    bool checkCompileErrors(GLuint shader, std::string type)
     {
         GLint success;
         GLchar infoLog[1024];
@@ -186,6 +271,7 @@ private:
                 std::cout << "ERROR::PROGRAM_LINKING_ERROR of type: " << type << "\n" << infoLog << "\n -- --------------------------------------------------- -- " << std::endl;
             }
         }
+        return success == GL_TRUE;
     }
 };
 #endif
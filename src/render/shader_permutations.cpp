@@ -0,0 +1,95 @@
+#include "render/shader_permutations.h"
+
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+using namespace std;
+
+ShaderPermutations::ShaderPermutations(const char* vertexPath, const char* fragmentPath, const char* geometryPath, const vector<string>& features) {
+	this->vertexPath = vertexPath;
+	this->fragmentPath = fragmentPath;
+	this->geometryPath = geometryPath != nullptr ? geometryPath : "";
+	this->features = features;
+}
+
+ShaderPermutations::~ShaderPermutations() {
+	// The programs go with cleanup(), while a context is still current
+	for (map<unsigned int, Shader*>::iterator it = variants.begin(); it != variants.end(); ++it) {
+		delete it->second;
+	}
+}
+
+void ShaderPermutations::cleanup() {
+	for (map<unsigned int, Shader*>::iterator it = variants.begin(); it != variants.end(); ++it) {
+		glDeleteProgram(it->second->ID);
+		delete it->second;
+	}
+	variants.clear();
+}
+
+unsigned int ShaderPermutations::mask(const string& feature) const {
+	for (size_t i = 0; i < features.size(); i++) {
+		if (features[i] == feature) {
+			return 1u << i;
+		}
+	}
+	return 0;
+}
+
+Shader& ShaderPermutations::variant(unsigned int key) {
+	map<unsigned int, Shader*>::iterator it = variants.find(key);
+	if (it != variants.end()) {
+		return *it->second;
+	}
+	vector<string> defines;
+	for (size_t i = 0; i < features.size(); i++) {
+		if (key & (1u << i)) {
+			defines.push_back(features[i]);
+		}
+	}
+	const char* geometry = geometryPath.empty() ? nullptr : geometryPath.c_str();
+	Shader* shader = new Shader(vertexPath.c_str(), fragmentPath.c_str(), geometry, defines);
+	variants[key] = shader;
+	return *shader;
+}
+
+int ShaderPermutations::precompile(const char* manifestPath) {
+	ifstream manifest(manifestPath);
+	if (!manifest) {
+		cout << "WARN: Missing shader manifest " << manifestPath << endl;
+		return 0;
+	}
+	int queued = 0;
+	string line;
+	while (getline(manifest, line)) {
+		size_t comment = line.find('#');
+		if (comment != string::npos) {
+			line = line.substr(0, comment);
+		}
+		stringstream names(line);
+		string name;
+		unsigned int key = 0;
+		bool empty = true;
+		while (names >> name) {
+			empty = false;
+			if (name == "-") {
+				continue;
+			}
+			unsigned int bit = mask(name);
+			if (bit == 0) {
+				cout << "WARN: Unknown shader feature " << name << " in " << manifestPath << endl;
+			}
+			key |= bit;
+		}
+		if (!empty) {
+			variant(key);
+			queued++;
+		}
+	}
+	return queued;
+}
+
+size_t ShaderPermutations::size() const {
+	return variants.size();
+}
@@ -0,0 +1,40 @@
+#ifndef SHADER_PERMUTATIONS_CLASS_H
+#define SHADER_PERMUTATIONS_CLASS_H
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "render/shader.h"
+
+// A set of compile-time variants of one shader. Each feature flag is a bit in
+// the variant key and becomes a #define in the compiled source, so disabled
+// features are removed by the compiler instead of branched over at runtime.
+class ShaderPermutations {
+    public:
+    ShaderPermutations(const char* vertexPath, const char* fragmentPath, const char* geometryPath, const std::vector<std::string>& features);
+    ~ShaderPermutations();
+
+    // Bit for a feature name, 0 if the name is unknown
+    unsigned int mask(const std::string& feature) const;
+    // Returns the variant for a feature key, compiling it on first request
+    Shader& variant(unsigned int key);
+    // Queue every variant listed in a manifest, one per line as feature names
+    // separated by spaces ("-" for none); returns the number of variants queued
+    int precompile(const char* manifestPath);
+    size_t size() const;
+    // Delete every compiled variant's program; needs a current context
+    void cleanup();
+
+    private:
+    std::string vertexPath;
+    std::string fragmentPath;
+    std::string geometryPath;
+    std::vector<std::string> features;
+    std::map<unsigned int, Shader*> variants;
+
+    ShaderPermutations(const ShaderPermutations&);
+    ShaderPermutations& operator=(const ShaderPermutations&);
+};
+
+#endif
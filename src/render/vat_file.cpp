@@ -0,0 +1,122 @@
+#include "render/vat_file.h"
+
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+using namespace std;
+
+// On-disk layout: header, clip table, uvs, indices, then positions and normals frame by frame
+struct VatHeader {
+    char magic[4];
+    uint32_t vertexCount;
+    uint32_t indexCount;
+    uint32_t frameCount;
+    uint32_t clipCount;
+};
+
+struct VatClipRecord {
+    char name[48];
+    uint32_t firstFrame;
+    uint32_t frameCount;
+    float fps;
+    uint32_t loop;
+};
+
+VatData::VatData() {
+	this->vertexCount = 0;
+	this->frameCount = 0;
+}
+
+template <typename T>
+static bool readArray(FILE* file, vector<T>& values, size_t count) {
+	values.resize(count);
+	return count == 0 || fread(values.data(), sizeof(T), count, file) == count;
+}
+
+bool VatData::read(const string& path) {
+	FILE* file = fopen(path.c_str(), "rb");
+	if (file == nullptr) {
+		cerr << "ERROR: Could not open vertex animation " << path << endl;
+		return false;
+	}
+	fseek(file, 0, SEEK_END);
+	long fileSize = ftell(file);
+	fseek(file, 0, SEEK_SET);
+	VatHeader header;
+	bool ok = fileSize > 0 && fread(&header, sizeof(header), 1, file) == 1 && memcmp(header.magic, "EVA1", 4) == 0;
+	if (ok) {
+		// The counts are untrusted: bound each by the file before allocating, then require the file to hold exactly what they describe
+		uint64_t size = (uint64_t)fileSize;
+		ok = header.clipCount <= size / sizeof(VatClipRecord) && header.vertexCount <= size / sizeof(glm::vec2) &&
+		     header.indexCount <= size / sizeof(uint32_t) && header.frameCount <= size / (2 * sizeof(glm::vec3));
+		uint64_t samples = (uint64_t)header.vertexCount * header.frameCount;
+		ok = ok && sizeof(header) + header.clipCount * sizeof(VatClipRecord) + header.vertexCount * sizeof(glm::vec2) +
+		     header.indexCount * sizeof(uint32_t) + samples * 2 * sizeof(glm::vec3) == size;
+		ok = ok && header.indexCount % 3 == 0;
+	}
+	if (ok) {
+		this->vertexCount = header.vertexCount;
+		this->frameCount = header.frameCount;
+		this->clips.resize(header.clipCount);
+		for (uint32_t i = 0; ok && i < header.clipCount; i++) {
+			VatClipRecord record;
+			ok = fread(&record, sizeof(record), 1, file) == 1;
+			record.name[sizeof(record.name) - 1] = '\0';
+			this->clips[i].name = record.name;
+			this->clips[i].firstFrame = record.firstFrame;
+			this->clips[i].frameCount = record.frameCount;
+			this->clips[i].fps = record.fps;
+			this->clips[i].loop = record.loop != 0;
+			ok = ok && record.frameCount > 0 && (uint64_t)record.firstFrame + record.frameCount <= header.frameCount;
+		}
+		size_t samples = (size_t)header.vertexCount * header.frameCount;
+		ok = ok && readArray(file, this->uvs, header.vertexCount) && readArray(file, this->indices, header.indexCount) &&
+		     readArray(file, this->positions, samples) && readArray(file, this->normals, samples);
+		// An index past the vertices would read outside the baked textures on the GPU
+		for (size_t i = 0; ok && i < this->indices.size(); i++) {
+			ok = this->indices[i] < header.vertexCount;
+		}
+	}
+	fclose(file);
+	if (!ok) {
+		cerr << "ERROR: " << path << " is not a valid vertex animation" << endl;
+		*this = VatData();
+	}
+	return ok;
+}
+
+bool VatData::write(const string& path) const {
+	FILE* file = fopen(path.c_str(), "wb");
+	if (file == nullptr) {
+		cerr << "ERROR: Could not write " << path << endl;
+		return false;
+	}
+	VatHeader header;
+	memcpy(header.magic, "EVA1", 4);
+	header.vertexCount = this->vertexCount;
+	header.indexCount = (uint32_t)this->indices.size();
+	header.frameCount = this->frameCount;
+	header.clipCount = (uint32_t)this->clips.size();
+	bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+	for (size_t i = 0; ok && i < this->clips.size(); i++) {
+		VatClipRecord record;
+		memset(&record, 0, sizeof(record));
+		strncpy(record.name, this->clips[i].name.c_str(), sizeof(record.name) - 1);
+		record.firstFrame = this->clips[i].firstFrame;
+		record.frameCount = this->clips[i].frameCount;
+		record.fps = this->clips[i].fps;
+		record.loop = this->clips[i].loop ? 1 : 0;
+		ok = fwrite(&record, sizeof(record), 1, file) == 1;
+	}
+	ok = ok && fwrite(this->uvs.data(), sizeof(glm::vec2), this->uvs.size(), file) == this->uvs.size();
+	ok = ok && fwrite(this->indices.data(), sizeof(uint32_t), this->indices.size(), file) == this->indices.size();
+	ok = ok && fwrite(this->positions.data(), sizeof(glm::vec3), this->positions.size(), file) == this->positions.size();
+	ok = ok && fwrite(this->normals.data(), sizeof(glm::vec3), this->normals.size(), file) == this->normals.size();
+	fclose(file);
+	if (!ok) {
+		cerr << "ERROR: Could not write " << path << endl;
+		remove(path.c_str());
+	}
+	return ok;
+}
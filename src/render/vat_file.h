@@ -0,0 +1,35 @@
+#ifndef VAT_FILE_H
+#define VAT_FILE_H
+
+#include <glm/glm.hpp>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// One baked animation: frames [firstFrame, firstFrame + frameCount) sampled at fps
+struct VatClip {
+    std::string name;
+    uint32_t firstFrame;
+    uint32_t frameCount;
+    float fps;
+    bool loop;
+};
+
+// A vertex animation: a mesh whose positions and normals are stored for
+// every vertex at every baked frame, so drawing it needs no skeleton.
+// Written by emerald_vat_bake, drawn by Crowd.
+struct VatData {
+    uint32_t vertexCount;
+    uint32_t frameCount;
+    std::vector<glm::vec2> uvs;         // per vertex
+    std::vector<uint32_t> indices;
+    std::vector<glm::vec3> positions;   // frame f, vertex v at f * vertexCount + v
+    std::vector<glm::vec3> normals;
+    std::vector<VatClip> clips;
+
+    VatData();
+    bool read(const std::string& path);
+    bool write(const std::string& path) const;
+};
+
+#endif
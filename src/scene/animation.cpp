@@ -0,0 +1,331 @@
+#include "scene/animation.h"
+#include "core/job_system.h"
+#include "tiny_gltf.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <glm/gtc/type_ptr.hpp>
+
+using namespace std;
+
+void PoseStreams::resize(size_t count) {
+	tx.resize(count); ty.resize(count); tz.resize(count);
+	rx.resize(count); ry.resize(count); rz.resize(count); rw.resize(count);
+	sx.resize(count); sy.resize(count); sz.resize(count);
+}
+
+size_t PoseStreams::size() const {
+	return tx.size();
+}
+
+void NodeHierarchy::load(const tinygltf::Model& model) {
+	this->parent.clear();
+	this->mesh.clear();
+	this->source.clear();
+	this->matrix.clear();
+	this->hasMatrix.clear();
+	this->flatIndex.assign(model.nodes.size(), -1);
+	this->rest.resize(0);
+	if (model.scenes.empty()) {
+		return;
+	}
+	const tinygltf::Scene& scene = model.scenes[max(model.defaultScene, 0)];
+
+	// Depth first with an explicit stack, so parents are always flattened before their children
+	vector<pair<int, int> > stack;
+	for (size_t i = scene.nodes.size(); i-- > 0;) {
+		stack.push_back(make_pair(scene.nodes[i], -1));
+	}
+	while (!stack.empty()) {
+		int node = stack.back().first;
+		int parentIndex = stack.back().second;
+		stack.pop_back();
+		if (node < 0 || node >= (int)model.nodes.size() || this->flatIndex[node] >= 0) {
+			continue;
+		}
+		const tinygltf::Node& gltfNode = model.nodes[node];
+		int index = (int)this->parent.size();
+		this->flatIndex[node] = index;
+		this->parent.push_back(parentIndex);
+		this->mesh.push_back(gltfNode.mesh >= 0 && gltfNode.mesh < (int)model.meshes.size() ? gltfNode.mesh : -1);
+		this->source.push_back(node);
+		this->hasMatrix.push_back(gltfNode.matrix.size() == 16);
+		this->matrix.push_back(gltfNode.matrix.size() == 16 ? glm::mat4(glm::make_mat4(gltfNode.matrix.data())) : glm::mat4(1.0f));
+
+		this->rest.resize(index + 1);
+		const vector<double>& t = gltfNode.translation;
+		const vector<double>& r = gltfNode.rotation;
+		const vector<double>& s = gltfNode.scale;
+		this->rest.tx[index] = t.size() == 3 ? (float)t[0] : 0.0f;
+		this->rest.ty[index] = t.size() == 3 ? (float)t[1] : 0.0f;
+		this->rest.tz[index] = t.size() == 3 ? (float)t[2] : 0.0f;
+		this->rest.rx[index] = r.size() == 4 ? (float)r[0] : 0.0f;
+		this->rest.ry[index] = r.size() == 4 ? (float)r[1] : 0.0f;
+		this->rest.rz[index] = r.size() == 4 ? (float)r[2] : 0.0f;
+		this->rest.rw[index] = r.size() == 4 ? (float)r[3] : 1.0f;
+		this->rest.sx[index] = s.size() == 3 ? (float)s[0] : 1.0f;
+		this->rest.sy[index] = s.size() == 3 ? (float)s[1] : 1.0f;
+		this->rest.sz[index] = s.size() == 3 ? (float)s[2] : 1.0f;
+
+		for (size_t i = gltfNode.children.size(); i-- > 0;) {
+			stack.push_back(make_pair(gltfNode.children[i], index));
+		}
+	}
+}
+
+size_t NodeHierarchy::size() const {
+	return this->parent.size();
+}
+
+void NodeHierarchy::computeGlobals(const PoseStreams& pose, size_t first, glm::mat4* globals) const {
+	for (size_t i = 0; i < this->parent.size(); i++) {
+		glm::mat4 local;
+		if (this->hasMatrix[i]) {
+			local = this->matrix[i];
+		} else {
+			size_t p = first + i;
+			float x = pose.rx[p], y = pose.ry[p], z = pose.rz[p], w = pose.rw[p];
+			// translate * rotate * scale, written out
+			local[0] = glm::vec4((1.0f - 2.0f * (y * y + z * z)) * pose.sx[p], 2.0f * (x * y + w * z) * pose.sx[p], 2.0f * (x * z - w * y) * pose.sx[p], 0.0f);
+			local[1] = glm::vec4(2.0f * (x * y - w * z) * pose.sy[p], (1.0f - 2.0f * (x * x + z * z)) * pose.sy[p], 2.0f * (y * z + w * x) * pose.sy[p], 0.0f);
+			local[2] = glm::vec4(2.0f * (x * z + w * y) * pose.sz[p], 2.0f * (y * z - w * x) * pose.sz[p], (1.0f - 2.0f * (x * x + y * y)) * pose.sz[p], 0.0f);
+			local[3] = glm::vec4(pose.tx[p], pose.ty[p], pose.tz[p], 1.0f);
+		}
+		globals[i] = this->parent[i] < 0 ? local : globals[this->parent[i]] * local;
+	}
+}
+
+void AnimationClip::sample(float time, PoseStreams& pose, size_t first) const {
+	for (size_t c = 0; c < this->channels.size(); c++) {
+		const AnimationChannel& channel = this->channels[c];
+		int components = channel.path == ANIMATION_ROTATION ? 4 : 3;
+		const vector<float>& times = channel.times;
+		const float* values = channel.values.data();
+		int stride = channel.interpolation == ANIMATION_CUBIC ? 3 * components : components;
+		int valueOffset = channel.interpolation == ANIMATION_CUBIC ? components : 0;
+		float out[4];
+
+		size_t key = upper_bound(times.begin(), times.end(), time) - times.begin();
+		if (key == 0 || key == times.size()) {
+			// Before the first or after the last key the value holds
+			const float* v = values + (key == 0 ? 0 : key - 1) * stride + valueOffset;
+			memcpy(out, v, components * sizeof(float));
+		} else {
+			size_t k = key - 1;
+			float dt = times[k + 1] - times[k];
+			float u = dt > 0.0f ? (time - times[k]) / dt : 0.0f;
+			const float* a = values + k * stride + valueOffset;
+			const float* b = values + (k + 1) * stride + valueOffset;
+			if (channel.interpolation == ANIMATION_STEP) {
+				memcpy(out, a, components * sizeof(float));
+			} else if (channel.interpolation == ANIMATION_CUBIC) {
+				// Hermite spline; tangents are per second, so they scale by the key interval
+				const float* outTangent = a + components;
+				const float* inTangent = b - components;
+				float u2 = u * u, u3 = u2 * u;
+				float h00 = 2.0f * u3 - 3.0f * u2 + 1.0f, h10 = (u3 - 2.0f * u2 + u) * dt;
+				float h01 = -2.0f * u3 + 3.0f * u2, h11 = (u3 - u2) * dt;
+				for (int i = 0; i < components; i++) {
+					out[i] = h00 * a[i] + h10 * outTangent[i] + h01 * b[i] + h11 * inTangent[i];
+				}
+			} else if (channel.path == ANIMATION_ROTATION) {
+				// Spherical interpolation along the shorter arc
+				float cosine = a[0] * b[0] + a[1] * b[1] + a[2] * b[2] + a[3] * b[3];
+				float sign = cosine < 0.0f ? -1.0f : 1.0f;
+				cosine *= sign;
+				float wa = 1.0f - u, wb = u;
+				if (cosine < 0.9995f) {
+					float angle = acos(cosine);
+					float inverseSine = 1.0f / sin(angle);
+					wa = sin((1.0f - u) * angle) * inverseSine;
+					wb = sin(u * angle) * inverseSine;
+				}
+				for (int i = 0; i < 4; i++) {
+					out[i] = wa * a[i] + wb * sign * b[i];
+				}
+			} else {
+				for (int i = 0; i < components; i++) {
+					out[i] = a[i] + (b[i] - a[i]) * u;
+				}
+			}
+		}
+
+		size_t p = first + channel.node;
+		if (channel.path == ANIMATION_TRANSLATION) {
+			pose.tx[p] = out[0]; pose.ty[p] = out[1]; pose.tz[p] = out[2];
+		} else if (channel.path == ANIMATION_SCALE) {
+			pose.sx[p] = out[0]; pose.sy[p] = out[1]; pose.sz[p] = out[2];
+		} else {
+			float length = sqrt(out[0] * out[0] + out[1] * out[1] + out[2] * out[2] + out[3] * out[3]);
+			float scale = length > 0.0f ? 1.0f / length : 0.0f;
+			pose.rx[p] = out[0] * scale; pose.ry[p] = out[1] * scale; pose.rz[p] = out[2] * scale;
+			pose.rw[p] = length > 0.0f ? out[3] * scale : 1.0f;
+		}
+	}
+}
+
+bool readGltfAccessor(const tinygltf::Model& model, int accessorIndex, int components, vector<float>& out) {
+	if (accessorIndex < 0 || accessorIndex >= (int)model.accessors.size()) {
+		return false;
+	}
+	const tinygltf::Accessor& accessor = model.accessors[accessorIndex];
+	if (tinygltf::GetNumComponentsInType(accessor.type) != components || accessor.bufferView < 0) {
+		return false;
+	}
+	const tinygltf::BufferView& view = model.bufferViews[accessor.bufferView];
+	const tinygltf::Buffer& buffer = model.buffers[view.buffer];
+	int componentSize = tinygltf::GetComponentSizeInBytes(accessor.componentType);
+	size_t stride = view.byteStride > 0 ? view.byteStride : (size_t)componentSize * components;
+	size_t start = view.byteOffset + accessor.byteOffset;
+	if (componentSize <= 0 || accessor.count == 0 || start + stride * (accessor.count - 1) + (size_t)componentSize * components > buffer.data.size()) {
+		return false;
+	}
+	out.resize(accessor.count * components);
+	for (size_t i = 0; i < accessor.count; i++) {
+		const unsigned char* element = &buffer.data[start + i * stride];
+		for (int c = 0; c < components; c++) {
+			const unsigned char* data = element + c * componentSize;
+			float value;
+			bool normalized = accessor.normalized;
+			switch (accessor.componentType) {
+				case TINYGLTF_COMPONENT_TYPE_FLOAT: memcpy(&value, data, sizeof(float)); break;
+				case TINYGLTF_COMPONENT_TYPE_BYTE: value = normalized ? max(*(const int8_t*)data / 127.0f, -1.0f) : *(const int8_t*)data; break;
+				case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE: value = normalized ? *data / 255.0f : *data; break;
+				case TINYGLTF_COMPONENT_TYPE_SHORT: { int16_t v; memcpy(&v, data, 2); value = normalized ? max(v / 32767.0f, -1.0f) : v; break; }
+				case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT: { uint16_t v; memcpy(&v, data, 2); value = normalized ? v / 65535.0f : v; break; }
+				case TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT: { uint32_t v; memcpy(&v, data, 4); value = (float)v; break; }
+				default: return false;
+			}
+			out[i * components + c] = value;
+		}
+	}
+	return true;
+}
+
+Animator::Animator() {
+	this->instancesPerTask = 64;
+}
+
+bool Animator::load(const tinygltf::Model& model) {
+	this->hierarchy.load(model);
+	this->clips.clear();
+	for (size_t a = 0; a < model.animations.size(); a++) {
+		const tinygltf::Animation& animation = model.animations[a];
+		AnimationClip clip;
+		clip.name = animation.name;
+		clip.duration = 0.0f;
+		for (size_t c = 0; c < animation.channels.size(); c++) {
+			const tinygltf::AnimationChannel& gltfChannel = animation.channels[c];
+			AnimationChannel channel;
+			if (gltfChannel.target_path == "translation") {
+				channel.path = ANIMATION_TRANSLATION;
+			} else if (gltfChannel.target_path == "rotation") {
+				channel.path = ANIMATION_ROTATION;
+			} else if (gltfChannel.target_path == "scale") {
+				channel.path = ANIMATION_SCALE;
+			} else {
+				continue;   // morph target weights are not drawn
+			}
+			if (gltfChannel.target_node < 0 || gltfChannel.target_node >= (int)this->hierarchy.flatIndex.size() ||
+			    this->hierarchy.flatIndex[gltfChannel.target_node] < 0 || gltfChannel.sampler < 0 ||
+			    gltfChannel.sampler >= (int)animation.samplers.size()) {
+				continue;
+			}
+			channel.node = this->hierarchy.flatIndex[gltfChannel.target_node];
+			const tinygltf::AnimationSampler& sampler = animation.samplers[gltfChannel.sampler];
+			channel.interpolation = sampler.interpolation == "STEP" ? ANIMATION_STEP : sampler.interpolation == "CUBICSPLINE" ? ANIMATION_CUBIC : ANIMATION_LINEAR;
+			int components = channel.path == ANIMATION_ROTATION ? 4 : 3;
+			size_t perKey = channel.interpolation == ANIMATION_CUBIC ? 3 * components : components;
+			if (!readGltfAccessor(model, sampler.input, 1, channel.times) || !readGltfAccessor(model, sampler.output, components, channel.values) ||
+			    channel.values.size() != channel.times.size() * perKey) {
+				cout << "WARN: Skipping malformed channel " << c << " of animation '" << animation.name << "'" << endl;
+				continue;
+			}
+			clip.duration = max(clip.duration, channel.times.back());
+			clip.channels.push_back(channel);
+		}
+		this->clips.push_back(clip);
+	}
+	resize((int)this->clip.size());
+	return !this->clips.empty();
+}
+
+void Animator::resize(int instances) {
+	instances = max(instances, 0);
+	this->clip.resize(instances, -1);
+	this->time.resize(instances, 0.0f);
+	this->speed.resize(instances, 1.0f);
+	this->loop.resize(instances, 1);
+	this->pose.resize((size_t)instances * this->hierarchy.size());
+	this->global.resize((size_t)instances * this->hierarchy.size());
+}
+
+int Animator::instanceCount() const {
+	return (int)this->clip.size();
+}
+
+void Animator::play(int instance, int clip, float time, float speed, bool loop) {
+	if (instance < 0 || instance >= instanceCount()) {
+		return;
+	}
+	this->clip[instance] = clip >= 0 && clip < (int)this->clips.size() ? clip : -1;
+	this->time[instance] = time;
+	this->speed[instance] = speed;
+	this->loop[instance] = loop;
+}
+
+void Animator::advance(float dt) {
+	for (size_t i = 0; i < this->clip.size(); i++) {
+		if (this->clip[i] < 0) {
+			continue;
+		}
+		float duration = this->clips[this->clip[i]].duration;
+		float t = this->time[i] + dt * this->speed[i];
+		if (this->loop[i] && duration > 0.0f) {
+			t = fmod(t, duration);
+			t = t < 0.0f ? t + duration : t;
+		}
+		this->time[i] = t;
+	}
+}
+
+void Animator::evaluateRange(int first, int last) {
+	size_t nodes = this->hierarchy.size();
+	const PoseStreams& rest = this->hierarchy.rest;
+	for (int i = first; i < last; i++) {
+		size_t base = (size_t)i * nodes;
+		// Start from the rest pose so channels a clip leaves out keep their node's own value
+		copy(rest.tx.begin(), rest.tx.end(), this->pose.tx.begin() + base);
+		copy(rest.ty.begin(), rest.ty.end(), this->pose.ty.begin() + base);
+		copy(rest.tz.begin(), rest.tz.end(), this->pose.tz.begin() + base);
+		copy(rest.rx.begin(), rest.rx.end(), this->pose.rx.begin() + base);
+		copy(rest.ry.begin(), rest.ry.end(), this->pose.ry.begin() + base);
+		copy(rest.rz.begin(), rest.rz.end(), this->pose.rz.begin() + base);
+		copy(rest.rw.begin(), rest.rw.end(), this->pose.rw.begin() + base);
+		copy(rest.sx.begin(), rest.sx.end(), this->pose.sx.begin() + base);
+		copy(rest.sy.begin(), rest.sy.end(), this->pose.sy.begin() + base);
+		copy(rest.sz.begin(), rest.sz.end(), this->pose.sz.begin() + base);
+		if (this->clip[i] >= 0) {
+			this->clips[this->clip[i]].sample(this->time[i], this->pose, base);
+		}
+		this->hierarchy.computeGlobals(this->pose, base, &this->global[base]);
+	}
+}
+
+void Animator::evaluate(JobSystem* jobs) {
+	int instances = instanceCount();
+	int perTask = max(this->instancesPerTask, 1);
+	if (jobs == nullptr || instances <= perTask) {
+		evaluateRange(0, instances);
+		return;
+	}
+	// Instances write disjoint ranges of the pose and global buffers, so chunks share nothing
+	jobs->parallelFor(instances, perTask, [this](int first, int last) { this->evaluateRange(first, last); });
+}
+
+const glm::mat4* Animator::globals(int instance) const {
+	return &this->global[(size_t)instance * this->hierarchy.size()];
+}
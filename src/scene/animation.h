@@ -0,0 +1,109 @@
+#ifndef ANIMATION_H
+#define ANIMATION_H
+
+#include <glm/glm.hpp>
+#include <string>
+#include <vector>
+
+namespace tinygltf {
+class Model;
+}
+class JobSystem;
+
+enum AnimationPath {
+    ANIMATION_TRANSLATION,
+    ANIMATION_ROTATION,
+    ANIMATION_SCALE
+};
+
+enum AnimationInterpolation {
+    ANIMATION_STEP,
+    ANIMATION_LINEAR,
+    ANIMATION_CUBIC
+};
+
+// Local node transforms as structure-of-arrays streams, one entry per node
+// (and per instance when several poses are stored back to back).
+struct PoseStreams {
+    std::vector<float> tx, ty, tz;
+    std::vector<float> rx, ry, rz, rw;  // unit quaternion
+    std::vector<float> sx, sy, sz;
+
+    void resize(size_t count);
+    size_t size() const;
+};
+
+// A glTF node tree flattened so every parent comes before its children;
+// global transforms are then one pass over the arrays, no recursion.
+struct NodeHierarchy {
+    std::vector<int> parent;            // flattened index, -1 for roots
+    std::vector<int> mesh;              // -1 for nodes that draw nothing
+    std::vector<int> source;            // glTF node index
+    std::vector<int> flatIndex;         // glTF node index to flattened index, -1 if not in the scene
+    std::vector<glm::mat4> matrix;      // nodes given as a matrix, which glTF never animates
+    std::vector<char> hasMatrix;
+    PoseStreams rest;
+
+    // Flatten the default scene
+    void load(const tinygltf::Model& model);
+    size_t size() const;
+    // Globals of the given local pose, which starts at pose index first
+    void computeGlobals(const PoseStreams& pose, size_t first, glm::mat4* globals) const;
+};
+
+struct AnimationChannel {
+    int node;                   // flattened node index
+    int path;                   // AnimationPath
+    int interpolation;          // AnimationInterpolation
+    std::vector<float> times;
+    std::vector<float> values;  // 3 or 4 floats per key; cubic keys hold in-tangent, value, out-tangent
+};
+
+struct AnimationClip {
+    std::string name;
+    float duration;
+    std::vector<AnimationChannel> channels;
+
+    // Overwrite the animated entries of the pose at index first with the clip at time
+    void sample(float time, PoseStreams& pose, size_t first) const;
+};
+
+// Accessor contents as floats; normalized integers are scaled to [0, 1] or [-1, 1], others kept as is
+bool readGltfAccessor(const tinygltf::Model& model, int accessorIndex, int components, std::vector<float>& out);
+
+// Plays glTF animations on any number of instances of one node hierarchy.
+// Each instance has its own clip, time and speed; evaluate() samples every
+// instance into a shared pose buffer and resolves global node transforms,
+// splitting the instances across worker threads.
+class Animator {
+    public:
+    NodeHierarchy hierarchy;
+    std::vector<AnimationClip> clips;
+    int instancesPerTask;
+
+    Animator();
+
+    // Flatten the hierarchy and read the clips; false if the model has no animations
+    bool load(const tinygltf::Model& model);
+    void resize(int instances);
+    int instanceCount() const;
+    // A clip of -1 holds the rest pose
+    void play(int instance, int clip, float time = 0.0f, float speed = 1.0f, bool loop = true);
+    void advance(float dt);
+    // Sample and resolve every instance; with jobs the instances are split into chunks of at least instancesPerTask
+    void evaluate(JobSystem* jobs = nullptr);
+    // The instance's global node transforms, in flattened order, as of the last evaluate()
+    const glm::mat4* globals(int instance) const;
+
+    private:
+    std::vector<int> clip;
+    std::vector<float> time;
+    std::vector<float> speed;
+    std::vector<char> loop;
+    PoseStreams pose;                   // instance i's nodes at [i * nodes, (i + 1) * nodes)
+    std::vector<glm::mat4> global;
+
+    void evaluateRange(int first, int last);
+};
+
+#endif
@@ -0,0 +1,92 @@
+#include "scene/camera_path.h"
+
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+using namespace std;
+
+bool CameraPath::load(const char* path) {
+	ifstream file(path);
+	if (!file) {
+		cerr << "ERROR: Could not open camera path " << path << endl;
+		return false;
+	}
+	this->keys.clear();
+	string line;
+	while (getline(file, line)) {
+		size_t comment = line.find('#');
+		if (comment != string::npos) {
+			line.erase(comment);
+		}
+		istringstream words(line);
+		Key key;
+		if (words >> key.eye.x >> key.eye.y >> key.eye.z >> key.target.x >> key.target.y >> key.target.z) {
+			this->keys.push_back(key);
+		}
+	}
+	if (this->keys.size() < 2) {
+		cerr << "ERROR: Camera path " << path << " needs at least two keys" << endl;
+		return false;
+	}
+	return true;
+}
+
+bool CameraPath::save(const char* path) const {
+	ofstream file(path, ios::trunc);
+	if (!file) {
+		return false;
+	}
+	file << "# eye.x eye.y eye.z target.x target.y target.z" << endl;
+	for (size_t i = 0; i < this->keys.size(); i++) {
+		const Key& key = this->keys[i];
+		file << key.eye.x << " " << key.eye.y << " " << key.eye.z << " "
+		     << key.target.x << " " << key.target.y << " " << key.target.z << endl;
+	}
+	return (bool)file;
+}
+
+void CameraPath::addKey(const glm::vec3& eye, const glm::vec3& target) {
+	Key key;
+	key.eye = eye;
+	key.target = target;
+	this->keys.push_back(key);
+}
+
+static glm::vec3 catmullRom(const glm::vec3& p0, const glm::vec3& p1, const glm::vec3& p2, const glm::vec3& p3, float t) {
+	float t2 = t * t;
+	float t3 = t2 * t;
+	return 0.5f * ((2.0f * p1) + (p2 - p0) * t + (2.0f * p0 - 5.0f * p1 + 4.0f * p2 - p3) * t2 +
+	               (3.0f * p1 - p0 - 3.0f * p2 + p3) * t3);
+}
+
+void CameraPath::sample(float t, glm::vec3& eye, glm::vec3& target) const {
+	int count = (int)this->keys.size();
+	if (count == 0) {
+		return;
+	}
+	float position = (t - floorf(t)) * count;
+	int segment = (int)position % count;
+	float local = position - floorf(position);
+	const Key& k0 = this->keys[(segment + count - 1) % count];
+	const Key& k1 = this->keys[segment];
+	const Key& k2 = this->keys[(segment + 1) % count];
+	const Key& k3 = this->keys[(segment + 2) % count];
+	eye = catmullRom(k0.eye, k1.eye, k2.eye, k3.eye, local);
+	target = catmullRom(k0.target, k1.target, k2.target, k3.target, local);
+}
+
+CameraPath CameraPath::defaultFlight() {
+	CameraPath path;
+	path.addKey(glm::vec3(0.0f, 150.0f, -800.0f), glm::vec3(0.0f, 150.0f, -1800.0f));
+	path.addKey(glm::vec3(-1200.0f, 250.0f, -1200.0f), glm::vec3(0.0f, 100.0f, 0.0f));
+	path.addKey(glm::vec3(-1600.0f, 400.0f, 600.0f), glm::vec3(0.0f, 100.0f, 0.0f));
+	path.addKey(glm::vec3(-400.0f, 180.0f, 1400.0f), glm::vec3(400.0f, 150.0f, 0.0f));
+	path.addKey(glm::vec3(1500.0f, 600.0f, 2500.0f), glm::vec3(6000.0f, 100.0f, 6000.0f));
+	path.addKey(glm::vec3(4500.0f, 350.0f, 3000.0f), glm::vec3(8000.0f, 100.0f, -2000.0f));
+	path.addKey(glm::vec3(3000.0f, 300.0f, -2500.0f), glm::vec3(0.0f, 100.0f, 0.0f));
+	path.addKey(glm::vec3(1000.0f, 200.0f, -1800.0f), glm::vec3(0.0f, 150.0f, -800.0f));
+	return path;
+}
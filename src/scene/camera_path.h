@@ -0,0 +1,28 @@
+#ifndef CAMERA_PATH_CLASS_H
+#define CAMERA_PATH_CLASS_H
+
+#include <glm/glm.hpp>
+#include <vector>
+
+// Closed Catmull-Rom spline through camera keys, sampled by normalised time.
+// The text form is one key per line, "eye.x eye.y eye.z target.x target.y target.z",
+// with # comments; it is what recording a flight writes.
+class CameraPath {
+    public:
+    struct Key {
+        glm::vec3 eye;
+        glm::vec3 target;
+    };
+    std::vector<Key> keys;
+
+    bool load(const char* path);
+    bool save(const char* path) const;
+    void addKey(const glm::vec3& eye, const glm::vec3& target);
+    // t in [0, 1) covers the whole loop; keys are spaced evenly in t
+    void sample(float t, glm::vec3& eye, glm::vec3& target) const;
+
+    // Scripted loop over the hand-placed city and out over the streamed chunks
+    static CameraPath defaultFlight();
+};
+
+#endif
@@ -0,0 +1,341 @@
+#include "scene/city_streamer.h"
+#include "core/random.h"
+#include "scene/scene_query.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <glm/gtc/matrix_transform.hpp>
+
+using namespace std;
+
+// Fixed instance budget of every chunk, per layer
+static const int chunkBlocks = 6;	// city blocks per chunk side, one building each
+static const int chunkTrees = 24;
+static const int chunkCars = 16;
+
+CityStreamer::CityStreamer(uint64_t seed, float chunkSize, int loadRadius, int unloadRadius, int reservedRadius, int workerCount)
+	: contents(MEMORY_STREAMING, 16) {
+	this->seed = seed;
+	this->chunkSize = chunkSize;
+	this->loadRadius = loadRadius;
+	this->unloadRadius = max(unloadRadius, loadRadius);
+	this->reservedRadius = reservedRadius;
+	this->maxUploadsPerFrame = 2;
+	this->synchronous = false;
+	this->ground = nullptr;
+	this->maxChunks = (2 * this->unloadRadius + 1) * (2 * this->unloadRadius + 1);
+	this->stopping = false;
+	for (int i = 0; i < CHUNK_LAYER_COUNT; i++) {
+		this->targets[i].set = nullptr;
+		this->targets[i].base = 0;
+		this->queries[i].query = nullptr;
+		this->queries[i].base = 0;
+	}
+	this->querySlots = 0;
+	for (int i = 0; i < max(workerCount, 1); i++) {
+		this->workers.push_back(thread(&CityStreamer::workerLoop, this));
+	}
+}
+
+CityStreamer::~CityStreamer() {
+	{
+		lock_guard<mutex> lock(this->queueMutex);
+		this->stopping = true;
+		this->queue.clear();
+	}
+	this->wake.notify_all();
+	for (size_t i = 0; i < this->workers.size(); i++) {
+		this->workers[i].join();
+	}
+	for (size_t i = 0; i < this->completed.size(); i++) {
+		this->contents.release(this->completed[i]);
+	}
+	for (size_t i = 0; i < this->slots.size(); i++) {
+		this->contents.release(this->slots[i]);
+	}
+}
+
+void CityStreamer::attach(ChunkLayer layer, InstanceSet* target) {
+	this->targets[layer].set = target;
+	this->targets[layer].base = target->amount;
+	// Reserve every slot up front so streaming never reallocates
+	target->reserveInstances(target->amount + this->maxChunks * perChunk(layer));
+}
+
+void CityStreamer::attachQuery(ChunkLayer layer, SceneQuery* query, int mesh, uint32_t user) {
+	this->queries[layer].query = query;
+	this->queries[layer].base = query->addInstances(mesh, nullptr, this->maxChunks * perChunk(layer), user);
+}
+
+int CityStreamer::perChunk(ChunkLayer layer) {
+	switch (layer) {
+		case CHUNK_GROUND: return 1;
+		case CHUNK_BUILDINGS: return chunkBlocks * chunkBlocks;
+		case CHUNK_TREES: return chunkTrees;
+		case CHUNK_CARS: return chunkCars;
+		default: return 0;
+	}
+}
+
+int64_t CityStreamer::key(ChunkCoord coord) {
+	return (int64_t)((uint64_t)(uint32_t)coord.x << 32 | (uint32_t)coord.z);
+}
+
+int CityStreamer::distance(ChunkCoord a, ChunkCoord b) {
+	return max(abs(a.x - b.x), abs(a.z - b.z));
+}
+
+bool CityStreamer::isReserved(ChunkCoord coord) const {
+	return coord.x >= -this->reservedRadius && coord.x < this->reservedRadius &&
+	       coord.z >= -this->reservedRadius && coord.z < this->reservedRadius;
+}
+
+int CityStreamer::residentChunks() const {
+	return (int)this->slots.size();
+}
+
+int CityStreamer::pendingChunks() {
+	lock_guard<mutex> lock(this->queueMutex);
+	return (int)this->requested.size();
+}
+
+void CityStreamer::workerLoop() {
+	while (true) {
+		ChunkCoord coord;
+		ChunkContent* content;
+		{
+			unique_lock<mutex> lock(this->queueMutex);
+			while (!this->stopping && this->queue.empty()) {
+				this->wake.wait(lock);
+			}
+			if (this->stopping) {
+				return;
+			}
+			coord = this->queue.front();
+			this->queue.pop_front();
+			content = this->contents.acquire();
+		}
+		generate(this->seed, this->chunkSize, coord, *content, this->ground);
+		lock_guard<mutex> lock(this->queueMutex);
+		this->completed.push_back(content);
+		this->generated.notify_all();
+	}
+}
+
+static bool byCoord(const ChunkContent* a, const ChunkContent* b) {
+	return a->coord.x != b->coord.x ? a->coord.x < b->coord.x : a->coord.z < b->coord.z;
+}
+
+struct ChunkRequest {
+	ChunkCoord coord;
+	int distance;
+	bool operator<(const ChunkRequest& other) const { return distance < other.distance; }
+};
+
+void CityStreamer::update(const glm::vec3& camera) {
+	ChunkCoord center = { (int)floor(camera.x / this->chunkSize), (int)floor(camera.z / this->chunkSize) };
+
+	// 1. Evict chunks beyond the unload radius, keeping the slots dense by moving the last one down
+	bool evicted = false;
+	for (int i = (int)this->slots.size() - 1; i >= 0; i--) {
+		if (distance(this->slots[i]->coord, center) > this->unloadRadius) {
+			{
+				lock_guard<mutex> lock(this->queueMutex);
+				this->contents.release(this->slots[i]);
+			}
+			int last = (int)this->slots.size() - 1;
+			if (i != last) {
+				this->slots[i] = this->slots[last];
+				uploadSlot(i);
+			}
+			this->slots.pop_back();
+			evicted = true;
+		}
+	}
+
+	// Sorted keys of the resident chunks, and the other working lists, only last the frame
+	Arena& frame = Arena::frame();
+	vector<int64_t, ArenaAllocator<int64_t> > resident((ArenaAllocator<int64_t>(frame)));
+	resident.reserve(this->maxChunks);
+	for (size_t i = 0; i < this->slots.size(); i++) {
+		resident.push_back(key(this->slots[i]->coord));
+	}
+	sort(resident.begin(), resident.end());
+
+	vector<ChunkContent*, ArenaAllocator<ChunkContent*> > finished((ArenaAllocator<ChunkContent*>(frame)));
+	{
+		unique_lock<mutex> lock(this->queueMutex);
+		// 2. Queue missing chunks in the load radius, nearest first, and drop stale queue entries
+		vector<ChunkRequest, ArenaAllocator<ChunkRequest> > wanted((ArenaAllocator<ChunkRequest>(frame)));
+		wanted.reserve((2 * this->loadRadius + 1) * (2 * this->loadRadius + 1));
+		for (int dz = -this->loadRadius; dz <= this->loadRadius; dz++) {
+			for (int dx = -this->loadRadius; dx <= this->loadRadius; dx++) {
+				ChunkRequest request;
+				request.coord.x = center.x + dx;
+				request.coord.z = center.z + dz;
+				request.distance = dx * dx + dz * dz;
+				int64_t k = key(request.coord);
+				if (!isReserved(request.coord) && !binary_search(resident.begin(), resident.end(), k) && this->requested.count(k) == 0) {
+					wanted.push_back(request);
+				}
+			}
+		}
+		sort(wanted.begin(), wanted.end());
+		for (deque<ChunkCoord>::iterator it = this->queue.begin(); it != this->queue.end();) {
+			if (distance(*it, center) > this->unloadRadius) {
+				this->requested.erase(key(*it));
+				it = this->queue.erase(it);
+			} else {
+				++it;
+			}
+		}
+		for (size_t i = 0; i < wanted.size(); i++) {
+			this->requested.insert(key(wanted[i].coord));
+			this->queue.push_back(wanted[i].coord);
+		}
+		if (!wanted.empty()) {
+			this->wake.notify_all();
+		}
+
+		// 3. Take a bounded number of finished chunks so a burst never stalls a frame.
+		// Synchronous mode instead waits for all of them, so the result does not depend on thread timing.
+		size_t take = min(this->completed.size(), (size_t)this->maxUploadsPerFrame);
+		if (this->synchronous) {
+			while (this->completed.size() < this->requested.size()) {
+				this->generated.wait(lock);
+			}
+			take = this->completed.size();
+			sort(this->completed.begin(), this->completed.end(), byCoord);
+		}
+		finished.reserve(take);
+		finished.assign(this->completed.begin(), this->completed.begin() + take);
+		this->completed.erase(this->completed.begin(), this->completed.begin() + take);
+		for (size_t i = 0; i < finished.size(); i++) {
+			this->requested.erase(key(finished[i]->coord));
+		}
+	}
+
+	bool committed = false;
+	for (size_t i = 0; i < finished.size(); i++) {
+		ChunkContent* content = finished[i];
+		int64_t k = key(content->coord);
+		vector<int64_t, ArenaAllocator<int64_t> >::iterator at = lower_bound(resident.begin(), resident.end(), k);
+		if (distance(content->coord, center) > this->unloadRadius || (int)this->slots.size() >= this->maxChunks ||
+		    (at != resident.end() && *at == k)) {
+			lock_guard<mutex> lock(this->queueMutex);
+			this->contents.release(content);
+			continue;
+		}
+		this->slots.push_back(content);
+		resident.insert(at, k);
+		uploadSlot((int)this->slots.size() - 1);
+		committed = true;
+	}
+
+	if (evicted || committed) {
+		updateDrawCounts();
+	}
+}
+
+void CityStreamer::uploadSlot(int slot) {
+	for (int layer = 0; layer < CHUNK_LAYER_COUNT; layer++) {
+		int count = perChunk((ChunkLayer)layer);
+		const vector<glm::mat4>& matrices = this->slots[slot]->layers[layer];
+		Target& target = this->targets[layer];
+		if (target.set != nullptr) {
+			target.set->updateInstances(target.base + slot * count, count, &matrices[0]);
+		}
+		// Unused entries are zero matrices, which the query leaves out as well
+		QueryTarget& query = this->queries[layer];
+		if (query.query != nullptr) {
+			query.query->setTransforms(query.base + slot * count, &matrices[0], count);
+		}
+	}
+}
+
+void CityStreamer::updateDrawCounts() {
+	for (int layer = 0; layer < CHUNK_LAYER_COUNT; layer++) {
+		Target& target = this->targets[layer];
+		if (target.set != nullptr) {
+			target.set->amount = target.base + (int)this->slots.size() * perChunk((ChunkLayer)layer);
+		}
+	}
+	int resident = (int)this->slots.size();
+	if (resident < this->querySlots) {
+		for (int layer = 0; layer < CHUNK_LAYER_COUNT; layer++) {
+			QueryTarget& target = this->queries[layer];
+			if (target.query != nullptr) {
+				int count = perChunk((ChunkLayer)layer);
+				target.query->disable(target.base + resident * count, (this->querySlots - resident) * count);
+			}
+		}
+	}
+	this->querySlots = resident;
+}
+
+// Rise of the terrain above the flat ground plane
+static float groundOffset(const HeightField* field, float x, float z) {
+	return field != nullptr ? field->height(x, z) - field->baseHeight : 0.0f;
+}
+
+void CityStreamer::generate(uint64_t seed, float chunkSize, ChunkCoord coord, ChunkContent& content, const HeightField* field) {
+	content.coord = coord;
+	for (int layer = 0; layer < CHUNK_LAYER_COUNT; layer++) {
+		// Unused entries stay zero matrices, which rasterise nothing
+		content.layers[layer].assign(perChunk((ChunkLayer)layer), glm::mat4(0.0f));
+	}
+	uint64_t chunkSeed = hashCombine(hashCombine(seed, (uint64_t)(int64_t)coord.x), (uint64_t)(int64_t)coord.z);
+	CounterRandom random(chunkSeed);
+	glm::vec3 origin(coord.x * chunkSize, 0.0f, coord.z * chunkSize);
+	glm::mat4 identity(1.0f);
+
+	// Ground tile covering the chunk
+	glm::mat4 ground = glm::translate(identity, origin + glm::vec3(chunkSize * 0.5f, 0.0f, chunkSize * 0.5f));
+	content.layers[CHUNK_GROUND][0] = glm::scale(ground, glm::vec3(chunkSize * 0.5f, 1.0f, chunkSize * 0.5f));
+
+	// Buildings: one per block, denser districts are taller and have fewer parks
+	float block = chunkSize / chunkBlocks;
+	float density = random.uniform();
+	float parkChance = 0.35f - 0.3f * density;
+	int count = 0;
+	for (int i = 0; i < chunkBlocks; i++) {
+		for (int j = 0; j < chunkBlocks; j++) {
+			glm::mat4& model = content.layers[CHUNK_BUILDINGS][count++];
+			if (random.uniform() < parkChance) {
+				continue;
+			}
+			float width = random.uniform(0.12f, 0.3f) * block;
+			float depth = random.uniform(0.1f, 0.25f) * block;
+			float height = random.uniform(80.0f, 160.0f + 340.0f * density);
+			glm::vec3 position = origin + glm::vec3((i + 0.5f) * block, height, (j + 0.5f) * block);
+			// Sink into slopes from the lowest footprint corner so no side floats
+			position.y += min(min(groundOffset(field, position.x - width, position.z - depth), groundOffset(field, position.x + width, position.z - depth)),
+			                  min(groundOffset(field, position.x - width, position.z + depth), groundOffset(field, position.x + width, position.z + depth)));
+			model = glm::translate(identity, position);
+			model = glm::scale(model, glm::vec3(width, height, depth));
+		}
+	}
+
+	// Trees and parked cars along the streets between blocks
+	for (int i = 0; i < chunkTrees; i++) {
+		bool alongX = random.uniform() < 0.5f;
+		float street = random.range(0, chunkBlocks - 1) * block;
+		float along = random.uniform(0.0f, chunkSize);
+		glm::vec3 position = origin + (alongX ? glm::vec3(along, 0.0f, street + 30.0f) : glm::vec3(street + 30.0f, 0.0f, along));
+		position.y += groundOffset(field, position.x, position.z);
+		glm::mat4 model = glm::translate(identity, position);
+		model = glm::scale(model, glm::vec3(150, 150, 150));
+		content.layers[CHUNK_TREES][i] = glm::rotate(model, random.uniform(0.0f, 6.2831853f), glm::vec3(0.0f, 1.0f, 0.0f));
+	}
+	for (int i = 0; i < chunkCars; i++) {
+		bool alongX = random.uniform() < 0.5f;
+		float street = random.range(0, chunkBlocks - 1) * block;
+		float along = random.uniform(0.0f, chunkSize);
+		glm::vec3 position = origin + (alongX ? glm::vec3(along, 1.0f, street - 20.0f) : glm::vec3(street - 20.0f, 1.0f, along));
+		position.y += groundOffset(field, position.x, position.z);
+		glm::mat4 model = glm::translate(identity, position);
+		model = glm::scale(model, glm::vec3(10.0f, 10.0f, 10.0f));
+		content.layers[CHUNK_CARS][i] = glm::rotate(model, glm::radians(alongX ? 90.0f : 0.0f), glm::vec3(0, 1, 0));
+	}
+}
@@ -0,0 +1,107 @@
+#ifndef CITY_STREAMER_CLASS_H
+#define CITY_STREAMER_CLASS_H
+
+#include <condition_variable>
+#include <deque>
+#include <glm/glm.hpp>
+#include <mutex>
+#include <set>
+#include <stdint.h>
+#include <thread>
+#include <vector>
+
+#include "core/memory.h"
+#include "render/instance_set.h"
+#include "scene/height_field.h"
+
+class SceneQuery;
+
+enum ChunkLayer {
+    CHUNK_GROUND,
+    CHUNK_BUILDINGS,
+    CHUNK_TREES,
+    CHUNK_CARS,
+    CHUNK_LAYER_COUNT
+};
+
+struct ChunkCoord {
+    int x;
+    int z;
+};
+
+struct ChunkContent {
+    ChunkCoord coord;
+    std::vector<glm::mat4> layers[CHUNK_LAYER_COUNT];
+};
+
+// Streams an unbounded procedural city in square chunks around the camera.
+// Chunk content is a pure function of (seed, chunk coordinate) and is built
+// on worker threads; the GL thread only copies finished chunks into fixed
+// slots appended to each layer's instance buffer, a few chunks per frame.
+// Resident chunks are bounded by the unload radius, so memory and per-frame
+// cost do not grow with the distance travelled. Chunk contents are recycled
+// through a pool, so once the radius has filled streaming does not allocate.
+class CityStreamer {
+    public:
+    uint64_t seed;
+    float chunkSize;
+    int loadRadius;         // chunks requested around the camera chunk
+    int unloadRadius;       // chunks further than this are evicted; > loadRadius gives hysteresis
+    int reservedRadius;     // chunks in [-r, r) on both axes are left to the hand-placed scene
+    int maxUploadsPerFrame;
+    bool synchronous;       // update() waits for every requested chunk and commits them in coordinate order
+    const HeightField* ground;  // instances stand on this terrain; null keeps them on the flat ground plane
+
+    CityStreamer(uint64_t seed, float chunkSize, int loadRadius, int unloadRadius, int reservedRadius, int workerCount);
+    ~CityStreamer();
+
+    // Bind a layer to the renderable drawing it; streamed instances go after its own
+    void attach(ChunkLayer layer, InstanceSet* target);
+    // Mirror a layer into query instances of mesh, left out until their chunk is resident
+    void attachQuery(ChunkLayer layer, SceneQuery* query, int mesh, uint32_t user);
+    // Evict, request and commit chunks; call once per frame on the GL thread.
+    // Its working lists come from Arena::frame().
+    void update(const glm::vec3& camera);
+    int residentChunks() const;
+    int pendingChunks();
+
+    static int perChunk(ChunkLayer layer);
+    // Deterministic content of one chunk; safe to call from any thread
+    static void generate(uint64_t seed, float chunkSize, ChunkCoord coord, ChunkContent& content, const HeightField* field = nullptr);
+
+    private:
+    struct Target {
+        InstanceSet* set;
+        int base;
+    };
+    struct QueryTarget {
+        SceneQuery* query;
+        int base;
+    };
+    Target targets[CHUNK_LAYER_COUNT];
+    QueryTarget queries[CHUNK_LAYER_COUNT];
+    int querySlots;                     // slots the query instances were last enabled for
+    int maxChunks;
+    std::vector<ChunkContent*> slots;   // dense; slot i owns instances [base + i * perChunk, +perChunk)
+    Pool<ChunkContent> contents;        // guarded by queueMutex
+    std::set<int64_t> requested;        // queued or being generated
+    std::deque<ChunkCoord> queue;
+    std::vector<ChunkContent*> completed;
+    std::vector<std::thread> workers;
+    std::mutex queueMutex;
+    std::condition_variable wake;
+    std::condition_variable generated;
+    bool stopping;
+
+    void workerLoop();
+    void uploadSlot(int slot);
+    void updateDrawCounts();
+    bool isReserved(ChunkCoord coord) const;
+    static int64_t key(ChunkCoord coord);
+    static int distance(ChunkCoord a, ChunkCoord b);
+
+    CityStreamer(const CityStreamer&);
+    CityStreamer& operator=(const CityStreamer&);
+};
+
+#endif
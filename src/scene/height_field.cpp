@@ -0,0 +1,73 @@
+#include "scene/height_field.h"
+#include "core/random.h"
+
+#include <algorithm>
+#include <cmath>
+
+using namespace std;
+
+HeightField::HeightField(uint64_t seed) {
+	this->seed = seed;
+	// The Surface quad the terrain replaces sat at y = 1
+	this->baseHeight = 1.0f;
+	this->amplitude = 900.0f;
+	this->featureSize = 6000.0f;
+	this->octaves = 6;
+	this->flatHalfExtent = 10000.0f;
+	this->rampWidth = 4000.0f;
+}
+
+static float smootherstep(float t) {
+	return t * t * t * (t * (t * 6.0f - 15.0f) + 10.0f);
+}
+
+float HeightField::maxSlope() const {
+	// smootherstep's steepest is 15/8, so each octave's noise changes by at most
+	// 15/8 * frequency per unit along an axis; squaring the [0, 1] sum at most
+	// doubles that, and the ramp's mask adds its own. Both axes together: sqrt(2).
+	const float steepest = 1.875f;
+	float noise = 0.0f, weight = 0.5f, total = 0.0f;
+	float frequency = 1.0f / this->featureSize;
+	for (int octave = 0; octave < this->octaves; octave++) {
+		noise += weight * steepest * frequency;
+		total += weight;
+		weight *= 0.5f;
+		frequency *= 2.0f;
+	}
+	float perAxis = this->amplitude * (total > 0.0f ? 2.0f * noise / total : 0.0f) + this->amplitude * steepest / max(this->rampWidth, 1.0f);
+	return perAxis * 1.41421356f;
+}
+
+float HeightField::valueNoise(float x, float z, uint64_t octaveSeed) const {
+	float fx = floor(x), fz = floor(z);
+	int64_t ix = (int64_t)fx, iz = (int64_t)fz;
+	float tx = smootherstep(x - fx), tz = smootherstep(z - fz);
+	float corners[4];
+	for (int c = 0; c < 4; c++) {
+		uint64_t h = hashCombine(hashCombine(octaveSeed, (uint64_t)(ix + (c & 1))), (uint64_t)(iz + (c >> 1)));
+		corners[c] = unitFloat(h);
+	}
+	float bottom = corners[0] + (corners[1] - corners[0]) * tx;
+	float top = corners[2] + (corners[3] - corners[2]) * tx;
+	return bottom + (top - bottom) * tz;
+}
+
+float HeightField::height(float x, float z) const {
+	float edge = max(fabs(x), fabs(z)) - this->flatHalfExtent;
+	if (edge <= 0.0f || this->amplitude <= 0.0f) {
+		return this->baseHeight;
+	}
+	float mask = smootherstep(min(edge / max(this->rampWidth, 1.0f), 1.0f));
+
+	// Fractal sum in [0, 1]; squared so valleys are wide and peaks sharp
+	float sum = 0.0f, weight = 0.5f, total = 0.0f;
+	float frequency = 1.0f / this->featureSize;
+	for (int octave = 0; octave < this->octaves; octave++) {
+		sum += weight * valueNoise(x * frequency, z * frequency, hashCombine(this->seed, (uint64_t)octave));
+		total += weight;
+		weight *= 0.5f;
+		frequency *= 2.0f;
+	}
+	float n = sum / total;
+	return this->baseHeight + this->amplitude * mask * n * n;
+}
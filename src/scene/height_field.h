@@ -0,0 +1,33 @@
+#ifndef HEIGHT_FIELD_H
+#define HEIGHT_FIELD_H
+
+#include <stdint.h>
+
+// Procedural terrain elevation: fractal value noise that only rises above
+// baseHeight, flattened to baseHeight over the hand-placed city square so
+// the scene file's ground level still holds there. A pure function of the
+// seed and position, so it is safe to sample from any thread and terrain
+// tiles baked from it on one run match the next.
+class HeightField {
+    public:
+    uint64_t seed;
+    float baseHeight;           // ground level of the flat city square
+    float amplitude;            // tallest possible hill above baseHeight
+    float featureSize;          // wavelength of the lowest octave, in units
+    int octaves;
+    float flatHalfExtent;       // flat for |x| and |z| below this
+    float rampWidth;            // hills blend in over this distance
+
+    HeightField(uint64_t seed = 1234);
+
+    float height(float x, float z) const;
+    float minHeight() const { return this->baseHeight; }
+    float maxHeight() const { return this->baseHeight + this->amplitude; }
+    // Bound on the gradient's length, for ray marching that must not step through a hill
+    float maxSlope() const;
+
+    private:
+    float valueNoise(float x, float z, uint64_t octaveSeed) const;
+};
+
+#endif
@@ -0,0 +1,289 @@
+#include "scene/placement.h"
+#include "core/random.h"
+#include "render/instance_set.h"
+
+#include <algorithm>
+#include <cmath>
+#include <thread>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define PLACEMENT_SSE 1
+#include <emmintrin.h>
+#endif
+#if defined(__AVX__)
+#define PLACEMENT_AVX 1
+#include <immintrin.h>
+#endif
+
+using namespace std;
+
+static const float pi = 3.14159265359f;
+static const float halfPi = 1.57079632679f;
+static const float twoPi = 6.28318530718f;
+static const float invTwoPi = 0.159154943092f;
+
+// Taylor coefficients; after folding to [-pi/2, pi/2] the error is below 1e-7
+static const float sin3 = -1.0f / 6.0f, sin5 = 1.0f / 120.0f, sin7 = -1.0f / 5040.0f;
+static const float sin9 = 1.0f / 362880.0f, sin11 = -1.0f / 39916800.0f;
+static const float cos2 = -0.5f, cos4 = 1.0f / 24.0f, cos6 = -1.0f / 720.0f, cos8 = 1.0f / 40320.0f;
+static const float cos10 = -1.0f / 3628800.0f, cos12 = 1.0f / 479001600.0f;
+
+void PlacementStreams::resize(size_t count) {
+	x.resize(count);
+	y.resize(count);
+	z.resize(count);
+	yaw.resize(count);
+	sx.resize(count);
+	sy.resize(count);
+	sz.resize(count);
+}
+
+size_t PlacementStreams::size() const {
+	return x.size();
+}
+
+// Scalar twin of the vector sin/cos below, so tail instances match the SIMD lanes
+static inline void sinCos(float angle, float& s, float& c) {
+	float r = angle - nearbyintf(angle * invTwoPi) * twoPi;
+	float rs = r > halfPi ? pi - r : (r < -halfPi ? -pi - r : r);
+	float a = fabsf(r);
+	float rc = a > halfPi ? pi - a : a;
+	float s2 = rs * rs;
+	float c2 = rc * rc;
+	s = rs * (1.0f + s2 * (sin3 + s2 * (sin5 + s2 * (sin7 + s2 * (sin9 + s2 * sin11)))));
+	c = 1.0f + c2 * (cos2 + c2 * (cos4 + c2 * (cos6 + c2 * (cos8 + c2 * (cos10 + c2 * cos12)))));
+	if (a > halfPi) {
+		c = -c;
+	}
+}
+
+static inline void composeOne(const PlacementStreams& streams, size_t i, glm::mat4& out) {
+	float s, c;
+	sinCos(streams.yaw[i], s, c);
+	out[0] = glm::vec4(streams.sx[i] * c, 0.0f, -streams.sz[i] * s, 0.0f);
+	out[1] = glm::vec4(0.0f, streams.sy[i], 0.0f, 0.0f);
+	out[2] = glm::vec4(streams.sx[i] * s, 0.0f, streams.sz[i] * c, 0.0f);
+	out[3] = glm::vec4(streams.x[i], streams.y[i], streams.z[i], 1.0f);
+}
+
+#ifdef PLACEMENT_SSE
+static inline __m128 select4(__m128 mask, __m128 a, __m128 b) {
+	return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+
+static inline void sinCos4(__m128 angle, __m128& s, __m128& c) {
+	__m128 k = _mm_cvtepi32_ps(_mm_cvtps_epi32(_mm_mul_ps(angle, _mm_set1_ps(invTwoPi))));
+	__m128 r = _mm_sub_ps(angle, _mm_mul_ps(k, _mm_set1_ps(twoPi)));
+	__m128 vpi = _mm_set1_ps(pi);
+	__m128 vhalf = _mm_set1_ps(halfPi);
+	__m128 rs = select4(_mm_cmpgt_ps(r, vhalf), _mm_sub_ps(vpi, r),
+	                    select4(_mm_cmplt_ps(r, _mm_set1_ps(-halfPi)), _mm_sub_ps(_mm_set1_ps(-pi), r), r));
+	__m128 a = _mm_andnot_ps(_mm_set1_ps(-0.0f), r);
+	__m128 flip = _mm_cmpgt_ps(a, vhalf);
+	__m128 rc = select4(flip, _mm_sub_ps(vpi, a), a);
+	__m128 s2 = _mm_mul_ps(rs, rs);
+	__m128 c2 = _mm_mul_ps(rc, rc);
+	__m128 ps = _mm_add_ps(_mm_set1_ps(sin9), _mm_mul_ps(s2, _mm_set1_ps(sin11)));
+	ps = _mm_add_ps(_mm_set1_ps(sin7), _mm_mul_ps(s2, ps));
+	ps = _mm_add_ps(_mm_set1_ps(sin5), _mm_mul_ps(s2, ps));
+	ps = _mm_add_ps(_mm_set1_ps(sin3), _mm_mul_ps(s2, ps));
+	ps = _mm_add_ps(_mm_set1_ps(1.0f), _mm_mul_ps(s2, ps));
+	s = _mm_mul_ps(rs, ps);
+	__m128 pc = _mm_add_ps(_mm_set1_ps(cos10), _mm_mul_ps(c2, _mm_set1_ps(cos12)));
+	pc = _mm_add_ps(_mm_set1_ps(cos8), _mm_mul_ps(c2, pc));
+	pc = _mm_add_ps(_mm_set1_ps(cos6), _mm_mul_ps(c2, pc));
+	pc = _mm_add_ps(_mm_set1_ps(cos4), _mm_mul_ps(c2, pc));
+	pc = _mm_add_ps(_mm_set1_ps(cos2), _mm_mul_ps(c2, pc));
+	pc = _mm_add_ps(_mm_set1_ps(1.0f), _mm_mul_ps(c2, pc));
+	c = _mm_xor_ps(pc, _mm_and_ps(flip, _mm_set1_ps(-0.0f)));
+}
+
+// Transpose one column of four matrices from SoA registers and store it
+static inline void storeColumn(float* out, int column, __m128 e0, __m128 e1, __m128 e2, __m128 e3) {
+	_MM_TRANSPOSE4_PS(e0, e1, e2, e3);
+	_mm_storeu_ps(out + column * 4, e0);
+	_mm_storeu_ps(out + 16 + column * 4, e1);
+	_mm_storeu_ps(out + 32 + column * 4, e2);
+	_mm_storeu_ps(out + 48 + column * 4, e3);
+}
+
+static inline void storeFour(float* out, __m128 x, __m128 y, __m128 z, __m128 sy, __m128 a, __m128 b, __m128 cc, __m128 d) {
+	__m128 zero = _mm_setzero_ps();
+	storeColumn(out, 0, a, zero, b, zero);
+	storeColumn(out, 1, zero, sy, zero, zero);
+	storeColumn(out, 2, cc, zero, d, zero);
+	storeColumn(out, 3, x, y, z, _mm_set1_ps(1.0f));
+}
+
+static inline void composeFour(const PlacementStreams& streams, size_t i, float* out) {
+	__m128 s, c;
+	sinCos4(_mm_loadu_ps(&streams.yaw[i]), s, c);
+	__m128 sx = _mm_loadu_ps(&streams.sx[i]);
+	__m128 sz = _mm_loadu_ps(&streams.sz[i]);
+	__m128 a = _mm_mul_ps(sx, c);
+	__m128 b = _mm_xor_ps(_mm_mul_ps(sz, s), _mm_set1_ps(-0.0f));
+	__m128 cc = _mm_mul_ps(sx, s);
+	__m128 d = _mm_mul_ps(sz, c);
+	storeFour(out, _mm_loadu_ps(&streams.x[i]), _mm_loadu_ps(&streams.y[i]), _mm_loadu_ps(&streams.z[i]),
+	          _mm_loadu_ps(&streams.sy[i]), a, b, cc, d);
+}
+#endif
+
+#ifdef PLACEMENT_AVX
+static inline void sinCos8(__m256 angle, __m256& s, __m256& c) {
+	__m256 k = _mm256_round_ps(_mm256_mul_ps(angle, _mm256_set1_ps(invTwoPi)), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+	__m256 r = _mm256_sub_ps(angle, _mm256_mul_ps(k, _mm256_set1_ps(twoPi)));
+	__m256 vpi = _mm256_set1_ps(pi);
+	__m256 vhalf = _mm256_set1_ps(halfPi);
+	__m256 rs = _mm256_blendv_ps(r, _mm256_sub_ps(_mm256_set1_ps(-pi), r), _mm256_cmp_ps(r, _mm256_set1_ps(-halfPi), _CMP_LT_OQ));
+	rs = _mm256_blendv_ps(rs, _mm256_sub_ps(vpi, r), _mm256_cmp_ps(r, vhalf, _CMP_GT_OQ));
+	__m256 a = _mm256_andnot_ps(_mm256_set1_ps(-0.0f), r);
+	__m256 flip = _mm256_cmp_ps(a, vhalf, _CMP_GT_OQ);
+	__m256 rc = _mm256_blendv_ps(a, _mm256_sub_ps(vpi, a), flip);
+	__m256 s2 = _mm256_mul_ps(rs, rs);
+	__m256 c2 = _mm256_mul_ps(rc, rc);
+	__m256 ps = _mm256_add_ps(_mm256_set1_ps(sin9), _mm256_mul_ps(s2, _mm256_set1_ps(sin11)));
+	ps = _mm256_add_ps(_mm256_set1_ps(sin7), _mm256_mul_ps(s2, ps));
+	ps = _mm256_add_ps(_mm256_set1_ps(sin5), _mm256_mul_ps(s2, ps));
+	ps = _mm256_add_ps(_mm256_set1_ps(sin3), _mm256_mul_ps(s2, ps));
+	ps = _mm256_add_ps(_mm256_set1_ps(1.0f), _mm256_mul_ps(s2, ps));
+	s = _mm256_mul_ps(rs, ps);
+	__m256 pc = _mm256_add_ps(_mm256_set1_ps(cos10), _mm256_mul_ps(c2, _mm256_set1_ps(cos12)));
+	pc = _mm256_add_ps(_mm256_set1_ps(cos8), _mm256_mul_ps(c2, pc));
+	pc = _mm256_add_ps(_mm256_set1_ps(cos6), _mm256_mul_ps(c2, pc));
+	pc = _mm256_add_ps(_mm256_set1_ps(cos4), _mm256_mul_ps(c2, pc));
+	pc = _mm256_add_ps(_mm256_set1_ps(cos2), _mm256_mul_ps(c2, pc));
+	pc = _mm256_add_ps(_mm256_set1_ps(1.0f), _mm256_mul_ps(c2, pc));
+	c = _mm256_xor_ps(pc, _mm256_and_ps(flip, _mm256_set1_ps(-0.0f)));
+}
+
+static inline void composeEight(const PlacementStreams& streams, size_t i, float* out) {
+	__m256 s, c;
+	sinCos8(_mm256_loadu_ps(&streams.yaw[i]), s, c);
+	__m256 sx = _mm256_loadu_ps(&streams.sx[i]);
+	__m256 sz = _mm256_loadu_ps(&streams.sz[i]);
+	__m256 a = _mm256_mul_ps(sx, c);
+	__m256 b = _mm256_xor_ps(_mm256_mul_ps(sz, s), _mm256_set1_ps(-0.0f));
+	__m256 cc = _mm256_mul_ps(sx, s);
+	__m256 d = _mm256_mul_ps(sz, c);
+	__m256 x = _mm256_loadu_ps(&streams.x[i]);
+	__m256 y = _mm256_loadu_ps(&streams.y[i]);
+	__m256 z = _mm256_loadu_ps(&streams.z[i]);
+	__m256 sy = _mm256_loadu_ps(&streams.sy[i]);
+	// The AoS scatter is done per 128-bit half
+	storeFour(out, _mm256_castps256_ps128(x), _mm256_castps256_ps128(y), _mm256_castps256_ps128(z), _mm256_castps256_ps128(sy),
+	          _mm256_castps256_ps128(a), _mm256_castps256_ps128(b), _mm256_castps256_ps128(cc), _mm256_castps256_ps128(d));
+	storeFour(out + 64, _mm256_extractf128_ps(x, 1), _mm256_extractf128_ps(y, 1), _mm256_extractf128_ps(z, 1), _mm256_extractf128_ps(sy, 1),
+	          _mm256_extractf128_ps(a, 1), _mm256_extractf128_ps(b, 1), _mm256_extractf128_ps(cc, 1), _mm256_extractf128_ps(d, 1));
+}
+#endif
+
+void composeTransforms(const PlacementStreams& streams, size_t first, size_t count, glm::mat4* out) {
+	size_t i = 0;
+#ifdef PLACEMENT_AVX
+	for (; i + 8 <= count; i += 8) {
+		composeEight(streams, first + i, &out[i][0][0]);
+	}
+#endif
+#ifdef PLACEMENT_SSE
+	for (; i + 4 <= count; i += 4) {
+		composeFour(streams, first + i, &out[i][0][0]);
+	}
+#endif
+	for (; i < count; i++) {
+		composeOne(streams, first + i, out[i]);
+	}
+}
+
+// Run fn(begin, end) over [0, count) on up to threads threads, in ranges aligned to 8
+template <typename Function>
+static void parallelRanges(size_t count, int threads, size_t minPerThread, Function fn) {
+	if (threads <= 0) {
+		threads = max(1u, thread::hardware_concurrency());
+	}
+	size_t workers = min((size_t)threads, max((size_t)1, count / minPerThread));
+	if (workers <= 1) {
+		fn((size_t)0, count);
+		return;
+	}
+	size_t step = ((count / workers) + 7) & ~(size_t)7;
+	vector<thread> pool;
+	for (size_t begin = step; begin < count; begin += step) {
+		pool.push_back(thread(fn, begin, min(begin + step, count)));
+	}
+	fn((size_t)0, min(step, count));
+	for (size_t i = 0; i < pool.size(); i++) {
+		pool[i].join();
+	}
+}
+
+struct ComposeRange {
+	const PlacementStreams* streams;
+	glm::mat4* out;
+	void operator()(size_t begin, size_t end) const {
+		composeTransforms(*streams, begin, end - begin, out + begin);
+	}
+};
+
+void composeTransformsParallel(const PlacementStreams& streams, glm::mat4* out, int threads) {
+	ComposeRange range = { &streams, out };
+	parallelRanges(streams.size(), threads, 16384, range);
+}
+
+struct ComposePackedRange {
+	const PlacementStreams* streams;
+	InstanceTransform* out;
+	const glm::mat4* base;      // null for identity
+	void operator()(size_t begin, size_t end) const {
+		// Compose a block at a time on the stack, then pack it into the mapped buffer
+		glm::mat4 block[256];
+		for (size_t first = begin; first < end; first += 256) {
+			size_t count = min((size_t)256, end - first);
+			composeTransforms(*streams, first, count, block);
+			for (size_t i = 0; i < count; i++) {
+				out[first + i] = InstanceTransform::pack(base != nullptr ? block[i] * *base : block[i]);
+			}
+		}
+	}
+};
+
+bool composeTransformsToBuffer(const PlacementStreams& streams, GLuint buffer, size_t firstInstance, int threads, const glm::mat4& base) {
+	if (streams.size() == 0) {
+		return true;
+	}
+	glBindBuffer(GL_ARRAY_BUFFER, buffer);
+	void* mapped = glMapBufferRange(GL_ARRAY_BUFFER, firstInstance * sizeof(InstanceTransform), streams.size() * sizeof(InstanceTransform),
+	                                GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT);
+	if (mapped == nullptr) {
+		return false;
+	}
+	ComposePackedRange range = { &streams, (InstanceTransform*)mapped, base == glm::mat4(1.0f) ? nullptr : &base };
+	parallelRanges(streams.size(), threads, 16384, range);
+	return glUnmapBuffer(GL_ARRAY_BUFFER) == GL_TRUE;
+}
+
+struct RingRange {
+	PlacementStreams* streams;
+	size_t count;
+	uint64_t seed;
+	float radius, offset, scale;
+	void operator()(size_t begin, size_t end) const {
+		PlacementStreams& s = *streams;
+		for (size_t i = begin; i < end; i++) {
+			// Four draws per instance, so instance i never depends on any other
+			CounterRandom random(seed, i * 4);
+			float angle = (float)i / (float)count * twoPi;
+			s.x[i] = sinf(angle) * radius + random.uniform(-offset, offset);
+			s.y[i] = 0.0f;
+			s.z[i] = cosf(angle) * radius + random.uniform(-offset, offset);
+			s.yaw[i] = random.uniform(0.0f, twoPi);
+			s.sx[i] = s.sy[i] = s.sz[i] = scale;
+		}
+	}
+};
+
+void scatterRing(PlacementStreams& streams, size_t count, uint64_t seed, float radius, float offset, float scale, int threads) {
+	streams.resize(count);
+	RingRange range = { &streams, count, seed, radius, offset, scale };
+	parallelRanges(count, threads, 16384, range);
+}
@@ -0,0 +1,35 @@
+#ifndef PLACEMENT_H
+#define PLACEMENT_H
+
+#include <glad/gl.h>
+#include <glm/glm.hpp>
+#include <stdint.h>
+#include <vector>
+
+// Structure-of-arrays placement streams. Instance i becomes
+//   translate(x, y, z) * scale(sx, sy, sz) * rotate(yaw, +Y)
+// which is the order the setup*ModelMatrices functions build by hand.
+struct PlacementStreams {
+    std::vector<float> x, y, z;
+    std::vector<float> yaw;         // radians about +Y
+    std::vector<float> sx, sy, sz;
+
+    void resize(size_t count);
+    size_t size() const;
+};
+
+// Compose instances [first, first + count) into out[0, count) on the calling thread
+void composeTransforms(const PlacementStreams& streams, size_t first, size_t count, glm::mat4* out);
+// Compose every instance, split across threads (0 picks the hardware thread count)
+void composeTransformsParallel(const PlacementStreams& streams, glm::mat4* out, int threads = 0);
+// Compose straight into a mapped InstanceSet transform buffer, packed, starting at instance
+// firstInstance; the buffer must already hold firstInstance + streams.size() instances.
+// base is multiplied in on the right, like InstanceSet::instanceBase.
+bool composeTransformsToBuffer(const PlacementStreams& streams, GLuint buffer, size_t firstInstance, int threads = 0,
+                               const glm::mat4& base = glm::mat4(1.0f));
+
+// Scatter count instances around a ring of radius, displaced by up to offset on x and z,
+// with uniform scale and random yaw. Fully determined by seed and instance index.
+void scatterRing(PlacementStreams& streams, size_t count, uint64_t seed, float radius, float offset, float scale, int threads = 0);
+
+#endif
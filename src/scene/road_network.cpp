@@ -0,0 +1,187 @@
+#include "scene/road_network.h"
+#include "core/random.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+using namespace std;
+
+RoadNetwork::RoadNetwork() {
+	// Street widths for the city.scene grid: 300-unit blocks around 130-unit buildings
+	this->lanesPerDirection = 2;
+	this->laneWidth = 20.0f;
+	this->stopDistance = 50.0f;
+	this->signalCycle = 30.0f;
+	this->amberTime = 2.0f;
+	this->clearanceTime = 1.0f;
+	this->heightSpacing = 25.0f;
+}
+
+bool RoadNetwork::gridStreets(const glm::mat4* buildings, int count, float extent, vector<float>& streetsX, vector<float>& streetsZ) {
+	streetsX.clear();
+	streetsZ.clear();
+	for (int axis = 0; axis < 2; axis++) {
+		vector<float> centres;
+		for (int i = 0; i < count; i++) {
+			centres.push_back(floor(buildings[i][3][axis == 0 ? 0 : 2] + 0.5f));
+		}
+		sort(centres.begin(), centres.end());
+		centres.erase(unique(centres.begin(), centres.end()), centres.end());
+		float spacing = 0.0f;
+		for (size_t i = 1; i < centres.size(); i++) {
+			float gap = centres[i] - centres[i - 1];
+			spacing = spacing == 0.0f ? gap : min(spacing, gap);
+		}
+		if (spacing < 1.0f) {
+			cerr << "ERROR: The buildings do not form a grid to lay streets between" << endl;
+			return false;
+		}
+		// Halfway between neighbouring blocks, then out to the extent at the same spacing
+		vector<float>& streets = axis == 0 ? streetsX : streetsZ;
+		float offset = centres[0] + spacing * 0.5f;
+		for (int k = (int)ceil((-extent - offset) / spacing); offset + k * spacing <= extent; k++) {
+			streets.push_back(offset + k * spacing);
+		}
+	}
+	return streetsX.size() >= 2 && streetsZ.size() >= 2;
+}
+
+bool RoadNetwork::build(const vector<float>& streetsX, const vector<float>& streetsZ, const HeightField* field, uint64_t seed) {
+	int columns = (int)streetsX.size();
+	int rows = (int)streetsZ.size();
+	if (columns < 2 || rows < 2 || this->lanesPerDirection < 1) {
+		cerr << "ERROR: A road network needs at least two streets on each axis" << endl;
+		return false;
+	}
+	this->streetsX = streetsX;
+	this->streetsZ = streetsZ;
+	int lanes = this->lanesPerDirection;
+
+	// Lane index of (axis, street, segment, direction, k); axis 0 streets are rows, their segments run between columns
+	int axisLanes = rows * (columns - 1) * 2 * lanes;
+	struct LaneIndex {
+		int columns, rows, lanes, axisLanes;
+		int operator()(int axis, int street, int segment, int direction, int k) const {
+			int segments = axis == 0 ? columns - 1 : rows - 1;
+			return (axis == 0 ? 0 : axisLanes) + ((street * segments + segment) * 2 + direction) * lanes + k;
+		}
+	} index = { columns, rows, lanes, axisLanes };
+	int count = axisLanes + columns * (rows - 1) * 2 * lanes;
+
+	this->laneStart.resize(count);
+	this->laneDirection.resize(count);
+	this->laneLength.resize(count);
+	this->laneEnd.resize(count);
+	this->laneAxis.resize(count);
+	this->successorFirst.assign(count + 1, 0);
+	this->successors.clear();
+	this->heightFirst.assign(count + 1, 0);
+	this->heights.clear();
+
+	for (int axis = 0; axis < 2; axis++) {
+		int streets = axis == 0 ? rows : columns;
+		int segments = axis == 0 ? columns - 1 : rows - 1;
+		for (int street = 0; street < streets; street++) {
+			for (int segment = 0; segment < segments; segment++) {
+				for (int direction = 0; direction < 2; direction++) {
+					// Direction 0 runs towards +x or +z
+					int from = direction == 0 ? segment : segment + 1;
+					int to = direction == 0 ? segment + 1 : segment;
+					glm::vec2 a = axis == 0 ? glm::vec2(streetsX[from], streetsZ[street]) : glm::vec2(streetsX[street], streetsZ[from]);
+					glm::vec2 b = axis == 0 ? glm::vec2(streetsX[to], streetsZ[street]) : glm::vec2(streetsX[street], streetsZ[to]);
+					glm::vec2 forward = glm::normalize(b - a);
+					glm::vec2 right(-forward.y, forward.x);
+					for (int k = 0; k < lanes; k++) {
+						int lane = index(axis, street, segment, direction, k);
+						this->laneStart[lane] = a + right * ((lanes - k - 0.5f) * this->laneWidth);
+						this->laneDirection[lane] = forward;
+						this->laneLength[lane] = glm::length(b - a);
+						this->laneEnd[lane] = axis == 0 ? street * columns + to : to * columns + street;
+						this->laneAxis[lane] = (char)axis;
+					}
+				}
+			}
+		}
+	}
+
+	// Where each lane can go at the intersection it ends in
+	for (int lane = 0; lane < count; lane++) {
+		int axis = this->laneAxis[lane];
+		int node = this->laneEnd[lane];
+		int column = node % columns;
+		int row = node / columns;
+		glm::vec2 forward = this->laneDirection[lane];
+		glm::vec2 right(-forward.y, forward.x);
+		int k = lane % lanes;
+		int first = (int)this->successors.size();
+		// Leaving node (column, row) along a unit direction; -1 past the grid's edge
+		for (int turn = 0; turn < 3; turn++) {
+			glm::vec2 out = turn == 0 ? forward : (turn == 1 ? right : -right);
+			if ((turn == 1 && k != 0) || (turn == 2 && k != lanes - 1)) {
+				continue;
+			}
+			int outAxis = fabs(out.x) > 0.5f ? 0 : 1;
+			int step = (outAxis == 0 ? out.x : out.y) > 0.0f ? 1 : -1;
+			int position = outAxis == 0 ? column : row;
+			int limit = outAxis == 0 ? columns : rows;
+			if (position + step < 0 || position + step >= limit) {
+				continue;
+			}
+			int street = outAxis == 0 ? row : column;
+			int segment = step > 0 ? position : position - 1;
+			this->successors.push_back(index(outAxis, street, segment, step > 0 ? 0 : 1, k));
+		}
+		if ((int)this->successors.size() == first) {
+			// Dead end at the grid's edge: come back the way it came
+			int street = axis == 0 ? row : column;
+			int position = axis == 0 ? column : row;
+			int step = (axis == 0 ? forward.x : forward.y) > 0.0f ? 1 : -1;
+			this->successors.push_back(index(axis, street, step > 0 ? position - 1 : position, step > 0 ? 1 : 0, k));
+		}
+		this->successorFirst[lane + 1] = (int)this->successors.size();
+	}
+
+	// Ground under the lanes, sampled once so vehicles only interpolate
+	for (int lane = 0; lane < count; lane++) {
+		int samples = (int)ceil(this->laneLength[lane] / this->heightSpacing) + 1;
+		for (int s = 0; s < samples; s++) {
+			glm::vec2 point = this->laneStart[lane] + this->laneDirection[lane] * min(s * this->heightSpacing, this->laneLength[lane]);
+			this->heights.push_back(field != nullptr ? field->height(point.x, point.y) - field->baseHeight : 0.0f);
+		}
+		this->heightFirst[lane + 1] = (int)this->heights.size();
+	}
+
+	// Random offsets so neighbouring signals do not switch together
+	CounterRandom random(seed);
+	this->signalOffset.resize(columns * rows);
+	for (int i = 0; i < columns * rows; i++) {
+		this->signalOffset[i] = random.uniform(0.0f, this->signalCycle);
+	}
+	return true;
+}
+
+int RoadNetwork::laneCount() const {
+	return (int)this->laneLength.size();
+}
+
+int RoadNetwork::intersectionCount() const {
+	return (int)this->signalOffset.size();
+}
+
+SignalState RoadNetwork::signal(int intersection, int axis, float time) const {
+	float half = this->signalCycle * 0.5f;
+	float phase = fmod(time + this->signalOffset[intersection] + (axis == 0 ? 0.0f : half), this->signalCycle);
+	float green = half - this->amberTime - this->clearanceTime;
+	return phase < green ? SIGNAL_GREEN : (phase < green + this->amberTime ? SIGNAL_AMBER : SIGNAL_RED);
+}
+
+float RoadNetwork::laneHeight(int lane, float distance) const {
+	float t = max(distance, 0.0f) / this->heightSpacing;
+	int first = this->heightFirst[lane];
+	int last = this->heightFirst[lane + 1] - 1;
+	int i = min(first + (int)t, last);
+	int j = min(i + 1, last);
+	float f = t - floor(t);
+	return this->heights[i] + (this->heights[j] - this->heights[i]) * f;
+}
@@ -0,0 +1,60 @@
+#ifndef ROAD_NETWORK_H
+#define ROAD_NETWORK_H
+
+#include <glm/glm.hpp>
+#include <stdint.h>
+#include <vector>
+
+#include "scene/height_field.h"
+
+enum SignalState {
+    SIGNAL_GREEN,
+    SIGNAL_AMBER,
+    SIGNAL_RED
+};
+
+// Directed lanes of a grid of streets, right-hand drive, with a traffic
+// signal at every intersection. Lanes run from one intersection's centre
+// to the next and are stored as structure-of-arrays; lane k = 0 is the
+// kerbside lane, which alone turns right, and the innermost lane alone
+// turns left. Lanes at the edge of the grid U-turn.
+class RoadNetwork {
+    public:
+    int lanesPerDirection;
+    float laneWidth;
+    float stopDistance;         // stop lines are this far before an intersection's centre
+    float signalCycle;          // seconds; each axis is green for about half of it
+    float amberTime;
+    float clearanceTime;        // all red between the phases
+    float heightSpacing;        // terrain samples along each lane
+
+    std::vector<float> streetsX;        // x of the streets running along z
+    std::vector<float> streetsZ;        // z of the streets running along x
+    std::vector<float> signalOffset;    // per intersection, seconds into the cycle
+
+    std::vector<glm::vec2> laneStart;   // xz
+    std::vector<glm::vec2> laneDirection;
+    std::vector<float> laneLength;
+    std::vector<int> laneEnd;           // intersection at the end of the lane
+    std::vector<char> laneAxis;         // 0 along x, 1 along z
+    std::vector<int> successorFirst;    // successors of lane l are successors[successorFirst[l], successorFirst[l + 1])
+    std::vector<int> successors;
+    std::vector<int> heightFirst;       // lane l's ground heights start at heights[heightFirst[l]]
+    std::vector<float> heights;         // above the flat ground plane
+
+    RoadNetwork();
+
+    // Street lines halfway between the columns and rows of a building grid,
+    // repeated at the grid's spacing to cover [-extent, extent] on both axes
+    static bool gridStreets(const glm::mat4* buildings, int count, float extent, std::vector<float>& streetsX, std::vector<float>& streetsZ);
+    // Lanes, successors and signals of the given streets; a null field keeps the roads flat
+    bool build(const std::vector<float>& streetsX, const std::vector<float>& streetsZ, const HeightField* field, uint64_t seed = 1234);
+
+    int laneCount() const;
+    int intersectionCount() const;
+    SignalState signal(int intersection, int axis, float time) const;
+    // Ground height under a point of a lane
+    float laneHeight(int lane, float distance) const;
+};
+
+#endif
@@ -0,0 +1,322 @@
+#include "scene/scene_file.h"
+#include "scene/placement.h"
+#include "core/startup_trace.h"
+
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+using namespace std;
+
+// Binary layout, native (little-endian) byte order:
+//   SceneFileHeader
+//   SceneGroupRecord x groupCount
+//   name and asset strings, back to back, padded to 64 bytes
+//   mat4 arrays, each starting on a 64-byte boundary
+struct SceneFileHeader {
+	char magic[4];
+	uint32_t version;
+	uint32_t groupCount;
+	uint32_t stringBytes;
+};
+struct SceneGroupRecord {
+	uint32_t kind;
+	uint32_t nameLength;
+	uint32_t assetLength;
+	uint32_t instanceCount;
+	uint64_t instanceOffset;
+};
+static const char sceneBinaryMagic[4] = { 'E', 'I', 'S', 'B' };
+static const uint32_t sceneBinaryVersion = 1;
+
+SceneDescription::SceneDescription() : storage(MEMORY_SCENE) {
+}
+
+SceneGroup* SceneDescription::find(const char* name) {
+	for (size_t i = 0; i < this->groups.size(); i++) {
+		if (this->groups[i].name == name) {
+			return &this->groups[i];
+		}
+	}
+	return nullptr;
+}
+
+int SceneDescription::instanceCount() const {
+	int count = 0;
+	for (size_t i = 0; i < this->groups.size(); i++) {
+		count += this->groups[i].count;
+	}
+	return count;
+}
+
+bool loadScene(const char* path, SceneDescription& scene) {
+	ifstream file(path, ios::binary);
+	char magic[4] = { 0 };
+	if (!file || !file.read(magic, 4)) {
+		cerr << "ERROR: Could not read scene " << path << endl;
+		return false;
+	}
+	file.close();
+	if (memcmp(magic, sceneBinaryMagic, 4) == 0) {
+		return loadSceneBinary(path, scene);
+	}
+	return loadSceneText(path, scene);
+}
+
+static void appendPlacement(vector<glm::mat4>& out, const PlacementStreams& streams) {
+	size_t first = out.size();
+	out.resize(first + streams.size());
+	composeTransformsParallel(streams, &out[first]);
+}
+
+static bool parseKind(const string& word, SceneGroupKind& kind) {
+	if (word == "model") {
+		kind = SCENE_MODEL;
+	} else if (word == "building") {
+		kind = SCENE_BUILDING;
+	} else if (word == "surface") {
+		kind = SCENE_SURFACE;
+	} else {
+		return false;
+	}
+	return true;
+}
+
+bool loadSceneText(const char* path, SceneDescription& scene) {
+	StartupScope scope("parse scene text", "parse");
+	ifstream file(path);
+	if (!file) {
+		cerr << "ERROR: Could not open scene " << path << endl;
+		return false;
+	}
+	StartupTrace::instance().addBytesRead(StartupTrace::fileSize(path));
+
+	// Instances are gathered per group, then packed into one storage block
+	vector<vector<glm::mat4> > instances;
+	scene.groups.clear();
+	string line;
+	int lineNumber = 0;
+	while (getline(file, line)) {
+		lineNumber++;
+		size_t comment = line.find('#');
+		if (comment != string::npos) {
+			line.erase(comment);
+		}
+		istringstream words(line);
+		string directive;
+		if (!(words >> directive)) {
+			continue;
+		}
+
+		if (directive == "group") {
+			SceneGroup group;
+			string kind;
+			if (!(words >> group.name >> kind) || !parseKind(kind, group.kind)) {
+				cerr << "ERROR: " << path << ":" << lineNumber << ": expected 'group <name> model|building|surface'" << endl;
+				return false;
+			}
+			if (group.kind == SCENE_MODEL && !(words >> group.asset)) {
+				cerr << "ERROR: " << path << ":" << lineNumber << ": model group needs an asset path" << endl;
+				return false;
+			}
+			group.instances = nullptr;
+			group.count = 0;
+			scene.groups.push_back(group);
+			instances.push_back(vector<glm::mat4>());
+			continue;
+		}
+		if (scene.groups.empty()) {
+			cerr << "ERROR: " << path << ":" << lineNumber << ": '" << directive << "' before any group" << endl;
+			return false;
+		}
+		vector<glm::mat4>& out = instances.back();
+
+		bool parsed = false;
+		if (directive == "place") {
+			PlacementStreams streams;
+			streams.resize(1);
+			parsed = (bool)(words >> streams.x[0] >> streams.y[0] >> streams.z[0] >> streams.yaw[0]
+			                      >> streams.sx[0] >> streams.sy[0] >> streams.sz[0]);
+			streams.yaw[0] = glm::radians(streams.yaw[0]);
+			if (parsed) {
+				appendPlacement(out, streams);
+			}
+		} else if (directive == "row") {
+			int count;
+			glm::vec3 start, step, scale;
+			float yaw;
+			parsed = (bool)(words >> count >> start.x >> start.y >> start.z >> step.x >> step.y >> step.z
+			                      >> yaw >> scale.x >> scale.y >> scale.z) && count >= 0;
+			if (parsed) {
+				PlacementStreams streams;
+				streams.resize(count);
+				for (int i = 0; i < count; i++) {
+					glm::vec3 position = start + step * (float)i;
+					streams.x[i] = position.x;
+					streams.y[i] = position.y;
+					streams.z[i] = position.z;
+					streams.yaw[i] = glm::radians(yaw);
+					streams.sx[i] = scale.x;
+					streams.sy[i] = scale.y;
+					streams.sz[i] = scale.z;
+				}
+				appendPlacement(out, streams);
+			}
+		} else if (directive == "ring") {
+			int count;
+			unsigned long long seed;
+			float radius, offset, scale;
+			parsed = (bool)(words >> count >> seed >> radius >> offset >> scale) && count >= 0;
+			if (parsed) {
+				PlacementStreams streams;
+				scatterRing(streams, count, seed, radius, offset, scale);
+				appendPlacement(out, streams);
+			}
+		} else if (directive == "matrix") {
+			glm::mat4 model;
+			parsed = true;
+			for (int i = 0; i < 16 && parsed; i++) {
+				parsed = (bool)(words >> model[i / 4][i % 4]);
+			}
+			if (parsed) {
+				out.push_back(model);
+			}
+		} else {
+			cerr << "ERROR: " << path << ":" << lineNumber << ": unknown directive '" << directive << "'" << endl;
+			return false;
+		}
+		if (!parsed) {
+			cerr << "ERROR: " << path << ":" << lineNumber << ": malformed '" << directive << "'" << endl;
+			return false;
+		}
+	}
+
+	size_t total = 0;
+	for (size_t i = 0; i < instances.size(); i++) {
+		total += instances[i].size();
+	}
+	scene.storage.release();
+	glm::mat4* storage = scene.storage.allocate<glm::mat4>(total);
+	size_t offset = 0;
+	for (size_t i = 0; i < scene.groups.size(); i++) {
+		if (!instances[i].empty()) {
+			memcpy(&storage[offset], &instances[i][0], instances[i].size() * sizeof(glm::mat4));
+		}
+		scene.groups[i].instances = storage + offset;
+		scene.groups[i].count = (int)instances[i].size();
+		offset += instances[i].size();
+	}
+	return true;
+}
+
+bool loadSceneBinary(const char* path, SceneDescription& scene) {
+	StartupScope scope("read scene binary", "io");
+	ifstream file(path, ios::binary | ios::ate);
+	if (!file) {
+		cerr << "ERROR: Could not open scene " << path << endl;
+		return false;
+	}
+	size_t size = (size_t)file.tellg();
+	file.seekg(0);
+	if (size < sizeof(SceneFileHeader)) {
+		cerr << "ERROR: Scene " << path << " is truncated" << endl;
+		return false;
+	}
+
+	// The whole file lands in storage in one read; the groups then point into it
+	scene.storage.release();
+	glm::mat4* storage = scene.storage.allocate<glm::mat4>((size + sizeof(glm::mat4) - 1) / sizeof(glm::mat4));
+	char* data = (char*)storage;
+	if (!file.read(data, size)) {
+		cerr << "ERROR: Could not read scene " << path << endl;
+		return false;
+	}
+	StartupTrace::instance().addBytesRead(size);
+
+	SceneFileHeader header;
+	memcpy(&header, data, sizeof(header));
+	if (memcmp(header.magic, sceneBinaryMagic, 4) != 0 || header.version != sceneBinaryVersion) {
+		cerr << "ERROR: " << path << " is not a version " << sceneBinaryVersion << " binary scene" << endl;
+		return false;
+	}
+	size_t stringsAt = sizeof(SceneFileHeader) + (size_t)header.groupCount * sizeof(SceneGroupRecord);
+	if (stringsAt + header.stringBytes > size) {
+		cerr << "ERROR: Scene " << path << " is truncated" << endl;
+		return false;
+	}
+
+	scene.groups.clear();
+	size_t stringOffset = stringsAt;
+	for (uint32_t i = 0; i < header.groupCount; i++) {
+		SceneGroupRecord record;
+		memcpy(&record, data + sizeof(SceneFileHeader) + i * sizeof(SceneGroupRecord), sizeof(record));
+		uint64_t instanceBytes = (uint64_t)record.instanceCount * sizeof(glm::mat4);
+		if (stringOffset + record.nameLength + record.assetLength > stringsAt + header.stringBytes ||
+		    record.kind > SCENE_SURFACE || record.instanceOffset % sizeof(glm::mat4) != 0 ||
+		    record.instanceOffset + instanceBytes > size) {
+			cerr << "ERROR: Scene " << path << " has a corrupt group record" << endl;
+			return false;
+		}
+		SceneGroup group;
+		group.kind = (SceneGroupKind)record.kind;
+		group.name.assign(data + stringOffset, record.nameLength);
+		stringOffset += record.nameLength;
+		group.asset.assign(data + stringOffset, record.assetLength);
+		stringOffset += record.assetLength;
+		group.instances = storage + record.instanceOffset / sizeof(glm::mat4);
+		group.count = (int)record.instanceCount;
+		scene.groups.push_back(group);
+	}
+	return true;
+}
+
+bool saveSceneBinary(const char* path, const SceneDescription& scene) {
+	SceneFileHeader header;
+	memcpy(header.magic, sceneBinaryMagic, 4);
+	header.version = sceneBinaryVersion;
+	header.groupCount = (uint32_t)scene.groups.size();
+	header.stringBytes = 0;
+	for (size_t i = 0; i < scene.groups.size(); i++) {
+		header.stringBytes += (uint32_t)(scene.groups[i].name.size() + scene.groups[i].asset.size());
+	}
+
+	// Instance arrays start on mat4 boundaries so the loader can index storage directly
+	size_t headerBytes = sizeof(SceneFileHeader) + scene.groups.size() * sizeof(SceneGroupRecord) + header.stringBytes;
+	size_t padding = (sizeof(glm::mat4) - headerBytes % sizeof(glm::mat4)) % sizeof(glm::mat4);
+	uint64_t instanceOffset = headerBytes + padding;
+
+	ofstream file(path, ios::binary | ios::trunc);
+	if (!file) {
+		cerr << "ERROR: Could not write scene " << path << endl;
+		return false;
+	}
+	file.write((const char*)&header, sizeof(header));
+	for (size_t i = 0; i < scene.groups.size(); i++) {
+		const SceneGroup& group = scene.groups[i];
+		SceneGroupRecord record;
+		record.kind = (uint32_t)group.kind;
+		record.nameLength = (uint32_t)group.name.size();
+		record.assetLength = (uint32_t)group.asset.size();
+		record.instanceCount = (uint32_t)group.count;
+		record.instanceOffset = instanceOffset;
+		instanceOffset += (uint64_t)group.count * sizeof(glm::mat4);
+		file.write((const char*)&record, sizeof(record));
+	}
+	for (size_t i = 0; i < scene.groups.size(); i++) {
+		file.write(scene.groups[i].name.data(), scene.groups[i].name.size());
+		file.write(scene.groups[i].asset.data(), scene.groups[i].asset.size());
+	}
+	const char zeros[sizeof(glm::mat4)] = { 0 };
+	file.write(zeros, padding);
+	for (size_t i = 0; i < scene.groups.size(); i++) {
+		if (scene.groups[i].count > 0) {
+			file.write((const char*)scene.groups[i].instances, scene.groups[i].count * sizeof(glm::mat4));
+		}
+	}
+	if (!file) {
+		cerr << "ERROR: Failed while writing scene " << path << endl;
+		return false;
+	}
+	return true;
+}
@@ -0,0 +1,59 @@
+#ifndef SCENE_FILE_H
+#define SCENE_FILE_H
+
+#include <glm/glm.hpp>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "core/memory.h"
+
+enum SceneGroupKind {
+    SCENE_MODEL,        // glTF asset drawn by StaticModel
+    SCENE_BUILDING,     // procedural box drawn by Building
+    SCENE_SURFACE       // ground quad drawn by Surface
+};
+
+// One renderable and all of its instances. instances points into the
+// owning SceneDescription's storage, ready to hand to an instance buffer.
+struct SceneGroup {
+    std::string name;
+    SceneGroupKind kind;
+    std::string asset;
+    glm::mat4* instances;
+    int count;
+};
+
+// A scene comes in two forms. The text form is for authoring:
+//
+//   # comment
+//   group <name> model <asset path>      (or: group <name> building | surface)
+//   place x y z yaw sx sy sz             translate * scale * rotate(yaw degrees, +Y)
+//   row count x y z dx dy dz yaw sx sy sz    count placements stepping by (dx, dy, dz)
+//   ring count seed radius offset scale  scatterRing() placement
+//   matrix m0 ... m15                    column-major
+//
+// The binary form (written by saveSceneBinary) is a header, one record per
+// group, a string table and the packed mat4 arrays. It is read with a single
+// read into storage and the groups point straight at their instance ranges.
+// Storage is a level arena: it holds the scene's instances until the next
+// load or the description's destruction.
+class SceneDescription {
+    public:
+    std::vector<SceneGroup> groups;
+    Arena storage;
+
+    SceneDescription();
+
+    // Null if the scene has no group of that name
+    SceneGroup* find(const char* name);
+    int instanceCount() const;
+};
+
+// Picks the form from the file's magic bytes
+bool loadScene(const char* path, SceneDescription& scene);
+bool loadSceneText(const char* path, SceneDescription& scene);
+bool loadSceneBinary(const char* path, SceneDescription& scene);
+bool saveSceneBinary(const char* path, const SceneDescription& scene);
+
+#endif
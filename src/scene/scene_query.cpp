@@ -0,0 +1,998 @@
+#include "scene/scene_query.h"
+#include "core/job_system.h"
+#include "scene/animation.h"
+#include "scene/height_field.h"
+#include "tiny_gltf.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cfloat>
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define QUERY_SSE 1
+#include <emmintrin.h>
+#endif
+
+using namespace std;
+
+static const int leafSize = 4;
+// Deep enough for any tree median splits produce from an int count of items
+static const int stackSize = 128;
+// Ground marching: how close counts as a hit, the smallest step and the most steps per ray
+static const float groundTolerance = 0.01f;
+static const float minGroundStep = 0.05f;
+static const int maxGroundSteps = 512;
+
+// Children of a node the ray enters within [0, tMax], as a bit mask; entry[c] is where it enters child c
+static inline int rayChildren(const QueryNode& node, const glm::vec3& origin, const glm::vec3& inverse, float tMax, float* entry) {
+#ifdef QUERY_SSE
+	__m128 ox = _mm_set1_ps(origin.x), oy = _mm_set1_ps(origin.y), oz = _mm_set1_ps(origin.z);
+	__m128 ix = _mm_set1_ps(inverse.x), iy = _mm_set1_ps(inverse.y), iz = _mm_set1_ps(inverse.z);
+	__m128 x1 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.lowX), ox), ix);
+	__m128 x2 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.highX), ox), ix);
+	__m128 y1 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.lowY), oy), iy);
+	__m128 y2 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.highY), oy), iy);
+	__m128 z1 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.lowZ), oz), iz);
+	__m128 z2 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.highZ), oz), iz);
+	__m128 enter = _mm_max_ps(_mm_max_ps(_mm_min_ps(x1, x2), _mm_min_ps(y1, y2)), _mm_max_ps(_mm_min_ps(z1, z2), _mm_setzero_ps()));
+	__m128 leave = _mm_min_ps(_mm_min_ps(_mm_max_ps(x1, x2), _mm_max_ps(y1, y2)), _mm_min_ps(_mm_max_ps(z1, z2), _mm_set1_ps(tMax)));
+	_mm_storeu_ps(entry, enter);
+	__m128i present = _mm_cmpgt_epi32(_mm_loadu_si128((const __m128i*)node.count), _mm_set1_epi32(-1));
+	return _mm_movemask_ps(_mm_and_ps(_mm_cmple_ps(enter, leave), _mm_castsi128_ps(present)));
+#else
+	int mask = 0;
+	for (int c = 0; c < 4; c++) {
+		float x1 = (node.lowX[c] - origin.x) * inverse.x, x2 = (node.highX[c] - origin.x) * inverse.x;
+		float y1 = (node.lowY[c] - origin.y) * inverse.y, y2 = (node.highY[c] - origin.y) * inverse.y;
+		float z1 = (node.lowZ[c] - origin.z) * inverse.z, z2 = (node.highZ[c] - origin.z) * inverse.z;
+		float enter = max(max(min(x1, x2), min(y1, y2)), max(min(z1, z2), 0.0f));
+		float leave = min(min(max(x1, x2), max(y1, y2)), min(max(z1, z2), tMax));
+		entry[c] = enter;
+		if (node.count[c] >= 0 && enter <= leave) {
+			mask |= 1 << c;
+		}
+	}
+	return mask;
+#endif
+}
+
+// Children of a node whose bounds overlap the box, as a bit mask
+static inline int boxChildren(const QueryNode& node, const glm::vec3& low, const glm::vec3& high) {
+#ifdef QUERY_SSE
+	__m128 overlap = _mm_and_ps(_mm_and_ps(_mm_cmple_ps(_mm_loadu_ps(node.lowX), _mm_set1_ps(high.x)),
+	                                       _mm_cmpge_ps(_mm_loadu_ps(node.highX), _mm_set1_ps(low.x))),
+	                            _mm_and_ps(_mm_cmple_ps(_mm_loadu_ps(node.lowY), _mm_set1_ps(high.y)),
+	                                       _mm_cmpge_ps(_mm_loadu_ps(node.highY), _mm_set1_ps(low.y))));
+	overlap = _mm_and_ps(overlap, _mm_and_ps(_mm_cmple_ps(_mm_loadu_ps(node.lowZ), _mm_set1_ps(high.z)),
+	                                         _mm_cmpge_ps(_mm_loadu_ps(node.highZ), _mm_set1_ps(low.z))));
+	__m128i present = _mm_cmpgt_epi32(_mm_loadu_si128((const __m128i*)node.count), _mm_set1_epi32(-1));
+	return _mm_movemask_ps(_mm_and_ps(overlap, _mm_castsi128_ps(present)));
+#else
+	int mask = 0;
+	for (int c = 0; c < 4; c++) {
+		if (node.count[c] >= 0 && node.lowX[c] <= high.x && node.highX[c] >= low.x && node.lowY[c] <= high.y &&
+		    node.highY[c] >= low.y && node.lowZ[c] <= high.z && node.highZ[c] >= low.z) {
+			mask |= 1 << c;
+		}
+	}
+	return mask;
+#endif
+}
+
+// Visit the leaves of tree the ray enters before tMax, nearest first.
+// visit(first, count, tMax) may shorten tMax and returns true to stop.
+template <typename Visit>
+static void traverseRay(const QueryTree& tree, const glm::vec3& origin, const glm::vec3& inverse, float& tMax, Visit& visit) {
+	if (tree.nodes.empty()) {
+		return;
+	}
+	struct Entry {
+		int first;
+		int count;
+		float distance;
+	};
+	Entry stack[stackSize];
+	int top = 0;
+	Entry root = { 0, 0, 0.0f };
+	stack[top++] = root;
+	while (top > 0) {
+		Entry entry = stack[--top];
+		if (entry.distance > tMax) {
+			continue;
+		}
+		if (entry.count > 0) {
+			if (visit(entry.first, entry.count, tMax)) {
+				return;
+			}
+			continue;
+		}
+		const QueryNode& node = tree.nodes[entry.first];
+		float distances[4];
+		int mask = rayChildren(node, origin, inverse, tMax, distances);
+		// Push the hit children furthest first, so the nearest is popped next
+		int order[4];
+		int hits = 0;
+		for (int c = 0; c < 4; c++) {
+			if (mask & (1 << c)) {
+				int i = hits++;
+				while (i > 0 && distances[order[i - 1]] < distances[c]) {
+					order[i] = order[i - 1];
+					i--;
+				}
+				order[i] = c;
+			}
+		}
+		for (int i = 0; i < hits && top < stackSize; i++) {
+			int c = order[i];
+			Entry child = { node.first[c], node.count[c], distances[c] };
+			stack[top++] = child;
+		}
+	}
+}
+
+// Visit the leaves of tree whose bounds overlap the box; visit(first, count) returns true to stop
+template <typename Visit>
+static void traverseBox(const QueryTree& tree, const glm::vec3& low, const glm::vec3& high, Visit& visit) {
+	if (tree.nodes.empty()) {
+		return;
+	}
+	int stack[stackSize];
+	int top = 0;
+	stack[top++] = 0;
+	while (top > 0) {
+		const QueryNode& node = tree.nodes[stack[--top]];
+		int mask = boxChildren(node, low, high);
+		for (int c = 0; c < 4; c++) {
+			if (!(mask & (1 << c))) {
+				continue;
+			}
+			if (node.count[c] > 0) {
+				if (visit(node.first[c], node.count[c])) {
+					return;
+				}
+			} else if (top < stackSize) {
+				stack[top++] = node.first[c];
+			}
+		}
+	}
+}
+
+static inline bool emptyBounds(const glm::vec3& low, const glm::vec3& high) {
+	return low.x > high.x || low.y > high.y || low.z > high.z;
+}
+
+static inline void setChild(QueryNode& node, int c, const glm::vec3& low, const glm::vec3& high) {
+	node.lowX[c] = low.x;
+	node.lowY[c] = low.y;
+	node.lowZ[c] = low.z;
+	node.highX[c] = high.x;
+	node.highY[c] = high.y;
+	node.highZ[c] = high.z;
+}
+
+static inline glm::vec3 childLow(const QueryNode& node, int c) {
+	return glm::vec3(node.lowX[c], node.lowY[c], node.lowZ[c]);
+}
+
+static inline glm::vec3 childHigh(const QueryNode& node, int c) {
+	return glm::vec3(node.highX[c], node.highY[c], node.highZ[c]);
+}
+
+struct ByCenter {
+	const glm::vec3* low;
+	const glm::vec3* high;
+	int axis;
+
+	bool operator()(int a, int b) const {
+		return this->low[a][this->axis] + this->high[a][this->axis] < this->low[b][this->axis] + this->high[b][this->axis];
+	}
+};
+
+void QueryTree::build(const glm::vec3* low, const glm::vec3* high, int count, int leafSize) {
+	this->nodes.clear();
+	this->items.clear();
+	for (int i = 0; i < count; i++) {
+		if (!emptyBounds(low[i], high[i])) {
+			this->items.push_back(i);
+		}
+	}
+	if (!this->items.empty()) {
+		buildNode(0, (int)this->items.size(), max(leafSize, 1), low, high);
+	}
+}
+
+int QueryTree::buildNode(int first, int count, int leafSize, const glm::vec3* low, const glm::vec3* high) {
+	int index = (int)this->nodes.size();
+	this->nodes.push_back(QueryNode());
+
+	// Up to four children, halving the largest range each time at the median
+	// centre along the widest axis of its centres
+	int rangeFirst[4] = { first, 0, 0, 0 };
+	int rangeCount[4] = { count, 0, 0, 0 };
+	int children = 1;
+	while (children < 4) {
+		int largest = 0;
+		for (int c = 1; c < children; c++) {
+			if (rangeCount[c] > rangeCount[largest]) {
+				largest = c;
+			}
+		}
+		if (rangeCount[largest] <= leafSize) {
+			break;
+		}
+		vector<int>::iterator begin = this->items.begin() + rangeFirst[largest];
+		glm::vec3 centerLow(FLT_MAX), centerHigh(-FLT_MAX);
+		for (int i = 0; i < rangeCount[largest]; i++) {
+			glm::vec3 center = low[begin[i]] + high[begin[i]];
+			centerLow = glm::min(centerLow, center);
+			centerHigh = glm::max(centerHigh, center);
+		}
+		glm::vec3 extent = centerHigh - centerLow;
+		ByCenter byCenter = { low, high, extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2) };
+		int half = rangeCount[largest] / 2;
+		nth_element(begin, begin + half, begin + rangeCount[largest], byCenter);
+		rangeFirst[children] = rangeFirst[largest] + half;
+		rangeCount[children] = rangeCount[largest] - half;
+		rangeCount[largest] = half;
+		children++;
+	}
+
+	for (int c = 0; c < 4; c++) {
+		glm::vec3 boundsLow(FLT_MAX), boundsHigh(-FLT_MAX);
+		int childFirst = -1, childCount = -1;
+		if (c < children && rangeCount[c] <= leafSize) {
+			for (int i = rangeFirst[c]; i < rangeFirst[c] + rangeCount[c]; i++) {
+				boundsLow = glm::min(boundsLow, low[this->items[i]]);
+				boundsHigh = glm::max(boundsHigh, high[this->items[i]]);
+			}
+			childFirst = rangeFirst[c];
+			childCount = rangeCount[c];
+		} else if (c < children) {
+			childFirst = buildNode(rangeFirst[c], rangeCount[c], leafSize, low, high);
+			childCount = 0;
+			const QueryNode& child = this->nodes[childFirst];
+			for (int g = 0; g < 4; g++) {
+				boundsLow = glm::min(boundsLow, childLow(child, g));
+				boundsHigh = glm::max(boundsHigh, childHigh(child, g));
+			}
+		}
+		// Recursion may have moved the nodes
+		QueryNode& node = this->nodes[index];
+		setChild(node, c, boundsLow, boundsHigh);
+		node.first[c] = childFirst;
+		node.count[c] = childCount;
+	}
+	return index;
+}
+
+void QueryTree::refit(const glm::vec3* low, const glm::vec3* high) {
+	// Children come after their parents, so one backwards pass sees every child first
+	for (int n = (int)this->nodes.size() - 1; n >= 0; n--) {
+		QueryNode& node = this->nodes[n];
+		for (int c = 0; c < 4; c++) {
+			if (node.count[c] < 0) {
+				continue;
+			}
+			glm::vec3 boundsLow(FLT_MAX), boundsHigh(-FLT_MAX);
+			if (node.count[c] > 0) {
+				for (int i = node.first[c]; i < node.first[c] + node.count[c]; i++) {
+					boundsLow = glm::min(boundsLow, low[this->items[i]]);
+					boundsHigh = glm::max(boundsHigh, high[this->items[i]]);
+				}
+			} else {
+				const QueryNode& child = this->nodes[node.first[c]];
+				for (int g = 0; g < 4; g++) {
+					boundsLow = glm::min(boundsLow, childLow(child, g));
+					boundsHigh = glm::max(boundsHigh, childHigh(child, g));
+				}
+			}
+			setChild(node, c, boundsLow, boundsHigh);
+		}
+	}
+}
+
+float QueryTree::area() const {
+	float total = 0.0f;
+	for (size_t n = 0; n < this->nodes.size(); n++) {
+		for (int c = 0; c < 4; c++) {
+			glm::vec3 low = childLow(this->nodes[n], c), high = childHigh(this->nodes[n], c);
+			if (this->nodes[n].count[c] >= 0 && !emptyBounds(low, high)) {
+				glm::vec3 size = high - low;
+				total += 2.0f * (size.x * size.y + size.y * size.z + size.z * size.x);
+			}
+		}
+	}
+	return total;
+}
+
+bool QueryTree::empty() const {
+	return this->nodes.empty();
+}
+
+// Stays finite for axis-parallel rays, so the slab tests never compute 0 * inf
+static inline glm::vec3 inverseDirection(const glm::vec3& direction) {
+	glm::vec3 inverse;
+	for (int i = 0; i < 3; i++) {
+		float d = direction[i];
+		inverse[i] = 1.0f / (fabs(d) > 1e-20f ? d : (d < 0.0f ? -1e-20f : 1e-20f));
+	}
+	return inverse;
+}
+
+static inline bool rayBox(const glm::vec3& origin, const glm::vec3& inverse, const glm::vec3& low, const glm::vec3& high, float tMax) {
+	glm::vec3 t1 = (low - origin) * inverse, t2 = (high - origin) * inverse;
+	glm::vec3 a = glm::min(t1, t2), b = glm::max(t1, t2);
+	return max(max(a.x, a.y), max(a.z, 0.0f)) <= min(min(b.x, b.y), min(b.z, tMax));
+}
+
+static inline bool boxesOverlap(const glm::vec3& lowA, const glm::vec3& highA, const glm::vec3& lowB, const glm::vec3& highB) {
+	return lowA.x <= highB.x && highA.x >= lowB.x && lowA.y <= highB.y && highA.y >= lowB.y && lowA.z <= highB.z && highA.z >= lowB.z;
+}
+
+// Möller-Trumbore; shortens t when the triangle is hit before it
+static inline bool rayTriangle(const glm::vec3& origin, const glm::vec3& direction, const glm::vec3* corners, float& t) {
+	glm::vec3 e1 = corners[1] - corners[0], e2 = corners[2] - corners[0];
+	glm::vec3 p = glm::cross(direction, e2);
+	float det = glm::dot(e1, p);
+	if (fabs(det) < 1e-20f) {
+		return false;
+	}
+	float inverseDet = 1.0f / det;
+	glm::vec3 s = origin - corners[0];
+	float u = glm::dot(s, p) * inverseDet;
+	if (u < 0.0f || u > 1.0f) {
+		return false;
+	}
+	glm::vec3 q = glm::cross(s, e1);
+	float v = glm::dot(direction, q) * inverseDet;
+	if (v < 0.0f || u + v > 1.0f) {
+		return false;
+	}
+	float hit = glm::dot(e2, q) * inverseDet;
+	if (hit < 0.0f || hit > t) {
+		return false;
+	}
+	t = hit;
+	return true;
+}
+
+// Real-Time Collision Detection 5.1.5
+static glm::vec3 closestOnTriangle(const glm::vec3& p, const glm::vec3& a, const glm::vec3& b, const glm::vec3& c) {
+	glm::vec3 ab = b - a, ac = c - a, ap = p - a;
+	float d1 = glm::dot(ab, ap), d2 = glm::dot(ac, ap);
+	if (d1 <= 0.0f && d2 <= 0.0f) {
+		return a;
+	}
+	glm::vec3 bp = p - b;
+	float d3 = glm::dot(ab, bp), d4 = glm::dot(ac, bp);
+	if (d3 >= 0.0f && d4 <= d3) {
+		return b;
+	}
+	float vc = d1 * d4 - d3 * d2;
+	if (vc <= 0.0f && d1 >= 0.0f && d3 <= 0.0f) {
+		return a + ab * (d1 / (d1 - d3));
+	}
+	glm::vec3 cp = p - c;
+	float d5 = glm::dot(ab, cp), d6 = glm::dot(ac, cp);
+	if (d6 >= 0.0f && d5 <= d6) {
+		return c;
+	}
+	float vb = d5 * d2 - d1 * d6;
+	if (vb <= 0.0f && d2 >= 0.0f && d6 <= 0.0f) {
+		return a + ac * (d2 / (d2 - d6));
+	}
+	float va = d3 * d6 - d5 * d4;
+	if (va <= 0.0f && d4 - d3 >= 0.0f && d5 - d6 >= 0.0f) {
+		return b + (c - b) * ((d4 - d3) / ((d4 - d3) + (d5 - d6)));
+	}
+	float scale = 1.0f / (va + vb + vc);
+	return a + ab * (vb * scale) + ac * (vc * scale);
+}
+
+static inline void transformBounds(const glm::mat4& m, const glm::vec3& low, const glm::vec3& high, glm::vec3& outLow, glm::vec3& outHigh) {
+	glm::vec3 center = (low + high) * 0.5f, extent = (high - low) * 0.5f;
+	for (int r = 0; r < 3; r++) {
+		float c = m[0][r] * center.x + m[1][r] * center.y + m[2][r] * center.z + m[3][r];
+		float e = fabs(m[0][r]) * extent.x + fabs(m[1][r]) * extent.y + fabs(m[2][r]) * extent.z;
+		outLow[r] = c - e;
+		outHigh[r] = c + e;
+	}
+}
+
+// Inverse of the upper 3x3 by cofactors, and the translation undone
+static inline glm::mat4 affineInverse(const glm::mat4& m) {
+	float c00 = m[1][1] * m[2][2] - m[2][1] * m[1][2];
+	float c01 = m[2][1] * m[0][2] - m[0][1] * m[2][2];
+	float c02 = m[0][1] * m[1][2] - m[1][1] * m[0][2];
+	float det = m[0][0] * c00 + m[1][0] * c01 + m[2][0] * c02;
+	float s = det != 0.0f ? 1.0f / det : 0.0f;
+	glm::mat4 inverse(1.0f);
+	inverse[0][0] = c00 * s;
+	inverse[0][1] = c01 * s;
+	inverse[0][2] = c02 * s;
+	inverse[1][0] = (m[2][0] * m[1][2] - m[1][0] * m[2][2]) * s;
+	inverse[1][1] = (m[0][0] * m[2][2] - m[2][0] * m[0][2]) * s;
+	inverse[1][2] = (m[1][0] * m[0][2] - m[0][0] * m[1][2]) * s;
+	inverse[2][0] = (m[1][0] * m[2][1] - m[2][0] * m[1][1]) * s;
+	inverse[2][1] = (m[2][0] * m[0][1] - m[0][0] * m[2][1]) * s;
+	inverse[2][2] = (m[0][0] * m[1][1] - m[1][0] * m[0][1]) * s;
+	for (int r = 0; r < 3; r++) {
+		inverse[3][r] = -(inverse[0][r] * m[3][0] + inverse[1][r] * m[3][1] + inverse[2][r] * m[3][2]);
+	}
+	return inverse;
+}
+
+// fn(first, last) over [0, count), split over the jobs when there are enough queries
+template <typename Fn>
+static void runQueries(int count, int perTask, JobSystem* jobs, const Fn& fn) {
+	if (jobs == nullptr || count <= perTask) {
+		fn(0, count);
+		return;
+	}
+	jobs->parallelFor(count, perTask, fn);
+}
+
+SceneQuery::SceneQuery() {
+	this->ground = nullptr;
+	this->groundLevel = 0.0f;
+	this->queriesPerTask = 64;
+	this->dirtyFirst = 0;
+	this->dirtyEnd = 0;
+	this->rebuild = false;
+	this->builtArea = 0.0f;
+}
+
+SceneQuery::~SceneQuery() {
+	for (size_t i = 0; i < this->meshes.size(); i++) {
+		delete this->meshes[i];
+	}
+}
+
+int SceneQuery::addMesh(const float* positions, int vertexCount, const uint32_t* indices, int indexCount) {
+	int triangles = indexCount / 3;
+	vector<glm::vec3> low(triangles), high(triangles);
+	for (int t = 0; t < triangles; t++) {
+		low[t] = glm::vec3(FLT_MAX);
+		high[t] = glm::vec3(-FLT_MAX);
+		for (int k = 0; k < 3; k++) {
+			uint32_t index = indices[t * 3 + k];
+			if (index >= (uint32_t)vertexCount) {
+				// Out of range triangles are left out of the tree
+				low[t] = glm::vec3(FLT_MAX);
+				high[t] = glm::vec3(-FLT_MAX);
+				break;
+			}
+			glm::vec3 p(positions[index * 3], positions[index * 3 + 1], positions[index * 3 + 2]);
+			low[t] = glm::min(low[t], p);
+			high[t] = glm::max(high[t], p);
+		}
+	}
+	Mesh* mesh = new Mesh();
+	mesh->tree.build(low.data(), high.data(), triangles, leafSize);
+	mesh->corners.resize(mesh->tree.items.size() * 3);
+	mesh->low = glm::vec3(FLT_MAX);
+	mesh->high = glm::vec3(-FLT_MAX);
+	for (size_t i = 0; i < mesh->tree.items.size(); i++) {
+		int t = mesh->tree.items[i];
+		for (int k = 0; k < 3; k++) {
+			const float* p = &positions[indices[t * 3 + k] * 3];
+			mesh->corners[i * 3 + k] = glm::vec3(p[0], p[1], p[2]);
+		}
+		mesh->low = glm::min(mesh->low, low[t]);
+		mesh->high = glm::max(mesh->high, high[t]);
+	}
+	this->meshes.push_back(mesh);
+	this->current.meshes.push_back(mesh);
+	return (int)this->meshes.size() - 1;
+}
+
+int SceneQuery::addMesh(const tinygltf::Model& model, const NodeHierarchy& nodes, const glm::mat4* globals) {
+	vector<float> positions;
+	vector<uint32_t> indices;
+	vector<float> values;
+	for (size_t n = 0; n < nodes.size(); n++) {
+		int meshIndex = nodes.mesh[n];
+		if (meshIndex < 0 || meshIndex >= (int)model.meshes.size()) {
+			continue;
+		}
+		const vector<tinygltf::Primitive>& primitives = model.meshes[meshIndex].primitives;
+		for (size_t p = 0; p < primitives.size(); p++) {
+			const tinygltf::Primitive& primitive = primitives[p];
+			map<string, int>::const_iterator position = primitive.attributes.find("POSITION");
+			if ((primitive.mode != TINYGLTF_MODE_TRIANGLES && primitive.mode != -1) || position == primitive.attributes.end() ||
+			    !readGltfAccessor(model, position->second, 3, values)) {
+				continue;
+			}
+			uint32_t first = (uint32_t)(positions.size() / 3);
+			size_t count = values.size() / 3;
+			for (size_t i = 0; i < count; i++) {
+				glm::vec4 p = globals[n] * glm::vec4(values[i * 3], values[i * 3 + 1], values[i * 3 + 2], 1.0f);
+				positions.push_back(p.x);
+				positions.push_back(p.y);
+				positions.push_back(p.z);
+			}
+			if (primitive.indices >= 0) {
+				if (!readGltfAccessor(model, primitive.indices, 1, values)) {
+					continue;
+				}
+				for (size_t i = 0; i + 2 < values.size(); i += 3) {
+					for (int k = 0; k < 3; k++) {
+						indices.push_back(first + (uint32_t)values[i + k]);
+					}
+				}
+			} else {
+				for (size_t i = 0; i + 2 < count; i += 3) {
+					for (int k = 0; k < 3; k++) {
+						indices.push_back(first + (uint32_t)(i + k));
+					}
+				}
+			}
+		}
+	}
+	if (indices.empty()) {
+		return -1;
+	}
+	return addMesh(positions.data(), (int)(positions.size() / 3), indices.data(), (int)indices.size());
+}
+
+int SceneQuery::addInstances(int mesh, const glm::mat4* transforms, int count, uint32_t user) {
+	int first = (int)this->instanceMesh.size();
+	int total = first + count;
+	this->instanceMesh.resize(total, mesh);
+	this->users.resize(total, user);
+	this->current.mesh.resize(total, -1);
+	this->current.transforms.resize(total, glm::mat4(0.0f));
+	this->current.inverses.resize(total);
+	this->current.low.resize(total, glm::vec3(FLT_MAX));
+	this->current.high.resize(total, glm::vec3(-FLT_MAX));
+	if (transforms != nullptr) {
+		setTransforms(first, transforms, count);
+	}
+	return first;
+}
+
+void SceneQuery::setTransforms(int first, const glm::mat4* transforms, int count) {
+	for (int i = 0; i < count; i++) {
+		glm::mat4& transform = this->current.transforms[first + i];
+		// Instances left out of the last build are not in the tree, so bringing one in needs a new one
+		if (transform[3][3] == 0.0f && transforms[i][3][3] != 0.0f) {
+			this->rebuild = true;
+		}
+		transform = transforms[i];
+	}
+	if (count > 0) {
+		this->dirtyFirst = this->dirtyFirst < this->dirtyEnd ? min(this->dirtyFirst, first) : first;
+		this->dirtyEnd = max(this->dirtyEnd, first + count);
+	}
+}
+
+void SceneQuery::disable(int first, int count) {
+	for (int i = first; i < first + count; i++) {
+		if (this->current.transforms[i][3][3] != 0.0f) {
+			glm::mat4 zero(0.0f);
+			setTransforms(i, &zero, 1);
+		}
+	}
+}
+
+int SceneQuery::instanceCount() const {
+	return (int)this->instanceMesh.size();
+}
+
+uint32_t SceneQuery::user(int instance) const {
+	return instance >= 0 && instance < (int)this->users.size() ? this->users[instance] : 0;
+}
+
+void SceneQuery::updateInstances(int first, int last) {
+	Snapshot& next = this->current;
+	for (int i = first; i < last; i++) {
+		const glm::mat4& transform = next.transforms[i];
+		int mesh = this->instanceMesh[i];
+		if (transform[3][3] == 0.0f || mesh < 0 || mesh >= (int)this->meshes.size()) {
+			next.mesh[i] = -1;
+			next.low[i] = glm::vec3(FLT_MAX);
+			next.high[i] = glm::vec3(-FLT_MAX);
+			continue;
+		}
+		next.mesh[i] = mesh;
+		next.inverses[i] = affineInverse(transform);
+		transformBounds(transform, this->meshes[mesh]->low, this->meshes[mesh]->high, next.low[i], next.high[i]);
+	}
+}
+
+void SceneQuery::update(JobSystem* jobs) {
+	if (this->dirtyFirst >= this->dirtyEnd && !this->rebuild) {
+		return;
+	}
+	struct Batch {
+		SceneQuery* query;
+		int first;
+	} batch = { this, this->dirtyFirst };
+	runQueries(this->dirtyEnd - this->dirtyFirst, 1024, jobs, [&batch](int first, int last) {
+		batch.query->updateInstances(batch.first + first, batch.first + last);
+	});
+	int changedFirst = this->dirtyFirst;
+	int changedEnd = this->dirtyEnd;
+	this->dirtyFirst = this->dirtyEnd = 0;
+
+	Snapshot& next = this->current;
+	// Refitting keeps moving instances cheap until they have drifted far enough to make the tree loose
+	if (!this->rebuild && !next.tree.empty()) {
+		next.tree.refit(next.low.data(), next.high.data());
+		this->rebuild = next.tree.area() > 2.0f * this->builtArea;
+	}
+	if (this->rebuild || next.tree.empty()) {
+		next.tree.build(next.low.data(), next.high.data(), (int)next.mesh.size(), leafSize);
+		this->builtArea = next.tree.area();
+		this->rebuild = false;
+	}
+
+	// Every earlier copy now misses these instances
+	if (changedFirst < changedEnd) {
+		for (size_t i = 0; i < this->snapshots.size(); i++) {
+			Copy& copy = this->snapshots[i];
+			copy.staleFirst = copy.staleFirst < copy.staleEnd ? min(copy.staleFirst, changedFirst) : changedFirst;
+			copy.staleEnd = max(copy.staleEnd, changedEnd);
+		}
+	}
+
+	// Publish a copy no query holds any more. Only the instances it misses and the
+	// tree are copied into it, so a few moving instances do not copy the whole scene.
+	Copy* spare = nullptr;
+	for (size_t i = 0; i < this->snapshots.size(); i++) {
+		if (this->snapshots[i].snapshot.use_count() == 1) {
+			spare = &this->snapshots[i];
+			break;
+		}
+	}
+	if (spare == nullptr) {
+		Copy copy = { make_shared<Snapshot>(), 0, 0 };
+		this->snapshots.push_back(copy);
+		spare = &this->snapshots.back();
+	}
+	atomic_thread_fence(memory_order_acquire);
+	Snapshot& copy = *spare->snapshot;
+	if (copy.mesh.size() != next.mesh.size()) {
+		copy = next;
+	} else {
+		copy.meshes = next.meshes;
+		for (int i = spare->staleFirst; i < spare->staleEnd; i++) {
+			copy.mesh[i] = next.mesh[i];
+			copy.transforms[i] = next.transforms[i];
+			copy.inverses[i] = next.inverses[i];
+			copy.low[i] = next.low[i];
+			copy.high[i] = next.high[i];
+		}
+		copy.tree = next.tree;
+	}
+	spare->staleFirst = spare->staleEnd = 0;
+	atomic_store(&this->published, shared_ptr<const Snapshot>(spare->snapshot));
+}
+
+shared_ptr<const SceneQuery::Snapshot> SceneQuery::latest() const {
+	return atomic_load(&this->published);
+}
+
+static glm::vec3 groundNormal(const HeightField& field, float x, float z) {
+	const float e = 0.5f;
+	return glm::normalize(glm::vec3(field.height(x - e, z) - field.height(x + e, z), 2.0f * e, field.height(x, z - e) - field.height(x, z + e)));
+}
+
+bool SceneQuery::intersectGround(const glm::vec3& origin, const glm::vec3& direction, float maxDistance, float& distance, glm::vec3& normal) const {
+	glm::vec3 up(0.0f, 1.0f, 0.0f);
+	if (this->ground == nullptr) {
+		float t = origin.y <= this->groundLevel ? 0.0f : (direction.y < 0.0f ? (this->groundLevel - origin.y) / direction.y : FLT_MAX);
+		if (t > maxDistance) {
+			return false;
+		}
+		distance = t;
+		normal = up;
+		return true;
+	}
+
+	// Only the slab below the highest hill can hold a hit
+	const HeightField& field = *this->ground;
+	float top = field.maxHeight();
+	float t = 0.0f, end = maxDistance;
+	if (origin.y > top) {
+		if (direction.y >= 0.0f) {
+			return false;
+		}
+		t = (top - origin.y) / direction.y;
+	} else if (direction.y > 0.0f) {
+		end = min(end, (top - origin.y) / direction.y);
+	}
+	// Sphere tracing: the ground cannot rise faster than maxSlope, so a point
+	// gap above it can advance gap / rate without passing through it
+	float rate = field.maxSlope() * sqrt(direction.x * direction.x + direction.z * direction.z) + fabs(direction.y);
+	float flat = field.flatHalfExtent;
+	for (int i = 0; i < maxGroundSteps && t <= end; i++) {
+		glm::vec3 p = origin + direction * t;
+		float gap = p.y - field.height(p.x, p.z);
+		if (gap <= groundTolerance) {
+			distance = t;
+			normal = groundNormal(field, p.x, p.z);
+			return true;
+		}
+		float step = gap / rate;
+		// The flat square is a plane at baseHeight: cross it in one step or hit the plane
+		if (fabs(p.x) < flat && fabs(p.z) < flat) {
+			float exitX = direction.x > 0.0f ? (flat - p.x) / direction.x : (direction.x < 0.0f ? (-flat - p.x) / direction.x : FLT_MAX);
+			float exitZ = direction.z > 0.0f ? (flat - p.z) / direction.z : (direction.z < 0.0f ? (-flat - p.z) / direction.z : FLT_MAX);
+			float exit = min(exitX, exitZ);
+			if (direction.y < 0.0f && (field.baseHeight - p.y) / direction.y <= exit) {
+				distance = t + (field.baseHeight - p.y) / direction.y;
+				normal = up;
+				return distance <= end;
+			}
+			step = max(step, exit);
+		}
+		t += max(step, minGroundStep);
+	}
+	return false;
+}
+
+QueryHit SceneQuery::intersectOne(const Snapshot* snapshot, const QueryRay& ray, bool anyHit) const {
+	QueryHit hit;
+	hit.distance = ray.maxDistance;
+	hit.instance = QUERY_MISS;
+	hit.triangle = -1;
+	hit.normal = glm::vec3(0.0f);
+	float tMax = ray.maxDistance;
+	int leafTriangle = -1;
+
+	if (snapshot != nullptr) {
+		glm::vec3 inverse = inverseDirection(ray.direction);
+		// Instances in the leaf: their own bounds first, then the ray in the mesh's space, where t is unchanged
+		auto visitInstances = [&](int first, int count, float& limit) -> bool {
+			for (int k = first; k < first + count; k++) {
+				int instance = snapshot->tree.items[k];
+				int meshIndex = snapshot->mesh[instance];
+				if (meshIndex < 0 || !rayBox(ray.origin, inverse, snapshot->low[instance], snapshot->high[instance], limit)) {
+					continue;
+				}
+				const Mesh& mesh = *snapshot->meshes[meshIndex];
+				const glm::mat4& toLocal = snapshot->inverses[instance];
+				glm::vec3 origin = glm::vec3(toLocal * glm::vec4(ray.origin, 1.0f));
+				glm::vec3 direction = glm::mat3(toLocal) * ray.direction;
+				glm::vec3 localInverse = inverseDirection(direction);
+				bool found = false;
+				auto visitTriangles = [&](int firstTriangle, int triangles, float& triangleLimit) -> bool {
+					for (int t = firstTriangle; t < firstTriangle + triangles; t++) {
+						if (rayTriangle(origin, direction, &mesh.corners[t * 3], triangleLimit)) {
+							found = true;
+							leafTriangle = t;
+							if (anyHit) {
+								return true;
+							}
+						}
+					}
+					return false;
+				};
+				traverseRay(mesh.tree, origin, localInverse, limit, visitTriangles);
+				if (found) {
+					hit.instance = instance;
+					if (anyHit) {
+						return true;
+					}
+				}
+			}
+			return false;
+		};
+		traverseRay(snapshot->tree, ray.origin, inverse, tMax, visitInstances);
+	}
+
+	if (hit.instance >= 0) {
+		const Mesh& mesh = *snapshot->meshes[snapshot->mesh[hit.instance]];
+		const glm::vec3* corners = &mesh.corners[leafTriangle * 3];
+		// Normals go to world space by the inverse transpose
+		glm::vec3 normal = glm::transpose(glm::mat3(snapshot->inverses[hit.instance])) * glm::cross(corners[1] - corners[0], corners[2] - corners[0]);
+		hit.normal = glm::normalize(normal);
+		hit.triangle = mesh.tree.items[leafTriangle];
+		hit.distance = tMax;
+		if (anyHit) {
+			return hit;
+		}
+	}
+	float distance;
+	glm::vec3 normal;
+	if (intersectGround(ray.origin, ray.direction, tMax, distance, normal)) {
+		hit.instance = QUERY_GROUND;
+		hit.triangle = -1;
+		hit.distance = distance;
+		hit.normal = normal;
+	}
+	if (glm::dot(hit.normal, ray.direction) > 0.0f) {
+		hit.normal = -hit.normal;
+	}
+	return hit;
+}
+
+QueryContact SceneQuery::contactOne(const Snapshot* snapshot, const QuerySphere& sphere) const {
+	QueryContact contact;
+	contact.depth = 0.0f;
+	contact.instance = QUERY_MISS;
+	contact.normal = glm::vec3(0.0f);
+	glm::vec3 reach(sphere.radius);
+	glm::vec3 low = sphere.center - reach, high = sphere.center + reach;
+	float radius2 = sphere.radius * sphere.radius;
+
+	if (snapshot != nullptr) {
+		auto visitInstances = [&](int first, int count) -> bool {
+			for (int k = first; k < first + count; k++) {
+				int instance = snapshot->tree.items[k];
+				int meshIndex = snapshot->mesh[instance];
+				if (meshIndex < 0 || !boxesOverlap(low, high, snapshot->low[instance], snapshot->high[instance])) {
+					continue;
+				}
+				// The sphere's box taken into the mesh's space finds the triangles; they are
+				// measured in world space, where the sphere is still a sphere
+				const Mesh& mesh = *snapshot->meshes[meshIndex];
+				const glm::mat4& toWorld = snapshot->transforms[instance];
+				glm::vec3 localLow, localHigh;
+				transformBounds(snapshot->inverses[instance], low, high, localLow, localHigh);
+				auto visitTriangles = [&](int firstTriangle, int triangles) -> bool {
+					for (int t = firstTriangle; t < firstTriangle + triangles; t++) {
+						const glm::vec3* corners = &mesh.corners[t * 3];
+						glm::vec3 a = glm::vec3(toWorld * glm::vec4(corners[0], 1.0f));
+						glm::vec3 b = glm::vec3(toWorld * glm::vec4(corners[1], 1.0f));
+						glm::vec3 c = glm::vec3(toWorld * glm::vec4(corners[2], 1.0f));
+						glm::vec3 away = sphere.center - closestOnTriangle(sphere.center, a, b, c);
+						float distance2 = glm::dot(away, away);
+						if (distance2 >= radius2) {
+							continue;
+						}
+						float distance = sqrt(distance2);
+						float depth = sphere.radius - distance;
+						if (depth > contact.depth) {
+							contact.depth = depth;
+							contact.instance = instance;
+							contact.normal = distance > 1e-6f ? away / distance : glm::normalize(glm::cross(b - a, c - a));
+						}
+					}
+					return false;
+				};
+				traverseBox(mesh.tree, localLow, localHigh, visitTriangles);
+			}
+			return false;
+		};
+		traverseBox(snapshot->tree, low, high, visitInstances);
+	}
+
+	// The gap to the ground is measured vertically and scaled by the slope to approximate the perpendicular one
+	glm::vec3 normal(0.0f, 1.0f, 0.0f);
+	float gap = sphere.center.y - this->groundLevel;
+	if (this->ground != nullptr) {
+		normal = groundNormal(*this->ground, sphere.center.x, sphere.center.z);
+		gap = (sphere.center.y - this->ground->height(sphere.center.x, sphere.center.z)) * normal.y;
+	}
+	if (sphere.radius - gap > contact.depth) {
+		contact.depth = sphere.radius - gap;
+		contact.instance = QUERY_GROUND;
+		contact.normal = normal;
+	}
+	return contact;
+}
+
+void SceneQuery::intersect(const QueryRay* rays, int count, QueryHit* hits, JobSystem* jobs) const {
+	shared_ptr<const Snapshot> snapshot = latest();
+	// Behind one pointer so the chunk function fits std::function without allocating
+	struct Batch {
+		const SceneQuery* query;
+		const Snapshot* snapshot;
+		const QueryRay* rays;
+		QueryHit* hits;
+	} batch = { this, snapshot.get(), rays, hits };
+	runQueries(count, this->queriesPerTask, jobs, [&batch](int first, int last) {
+		for (int i = first; i < last; i++) {
+			batch.hits[i] = batch.query->intersectOne(batch.snapshot, batch.rays[i], false);
+		}
+	});
+}
+
+QueryHit SceneQuery::intersect(const QueryRay& ray) const {
+	shared_ptr<const Snapshot> snapshot = latest();
+	return intersectOne(snapshot.get(), ray, false);
+}
+
+void SceneQuery::occluded(const QueryRay* rays, int count, bool* blocked, JobSystem* jobs) const {
+	shared_ptr<const Snapshot> snapshot = latest();
+	struct Batch {
+		const SceneQuery* query;
+		const Snapshot* snapshot;
+		const QueryRay* rays;
+		bool* blocked;
+	} batch = { this, snapshot.get(), rays, blocked };
+	runQueries(count, this->queriesPerTask, jobs, [&batch](int first, int last) {
+		for (int i = first; i < last; i++) {
+			batch.blocked[i] = batch.query->intersectOne(batch.snapshot, batch.rays[i], true).instance != QUERY_MISS;
+		}
+	});
+}
+
+void SceneQuery::contact(const QuerySphere* spheres, int count, QueryContact* contacts, JobSystem* jobs) const {
+	shared_ptr<const Snapshot> snapshot = latest();
+	struct Batch {
+		const SceneQuery* query;
+		const Snapshot* snapshot;
+		const QuerySphere* spheres;
+		QueryContact* contacts;
+	} batch = { this, snapshot.get(), spheres, contacts };
+	runQueries(count, this->queriesPerTask, jobs, [&batch](int first, int last) {
+		for (int i = first; i < last; i++) {
+			batch.contacts[i] = batch.query->contactOne(batch.snapshot, batch.spheres[i]);
+		}
+	});
+}
+
+QueryContact SceneQuery::contact(const QuerySphere& sphere) const {
+	shared_ptr<const Snapshot> snapshot = latest();
+	return contactOne(snapshot.get(), sphere);
+}
+
+void SceneQuery::overlap(QueryBox* boxes, int count, JobSystem* jobs) const {
+	shared_ptr<const Snapshot> snapshot = latest();
+	struct Batch {
+		const Snapshot* snapshot;
+		QueryBox* boxes;
+	} batch = { snapshot.get(), boxes };
+	runQueries(count, this->queriesPerTask, jobs, [&batch](int first, int last) {
+		for (int i = first; i < last; i++) {
+			QueryBox& box = batch.boxes[i];
+			box.count = 0;
+			if (batch.snapshot == nullptr) {
+				continue;
+			}
+			const Snapshot& snapshot = *batch.snapshot;
+			auto visit = [&](int firstItem, int items) -> bool {
+				for (int k = firstItem; k < firstItem + items; k++) {
+					int instance = snapshot.tree.items[k];
+					if (snapshot.mesh[instance] >= 0 && boxesOverlap(box.low, box.high, snapshot.low[instance], snapshot.high[instance])) {
+						if (box.count < box.capacity) {
+							box.instances[box.count] = instance;
+						}
+						box.count++;
+					}
+				}
+				return false;
+			};
+			traverseBox(snapshot.tree, box.low, box.high, visit);
+		}
+	});
+}
+
+glm::vec3 SceneQuery::moveSphere(const glm::vec3& from, const glm::vec3& to, float radius) const {
+	shared_ptr<const Snapshot> snapshot = latest();
+	glm::vec3 position = from;
+	glm::vec3 remaining = to - from;
+	// Sweep the centre, stopping radius short of what it hits, then slide the rest along the surface
+	for (int i = 0; i < 3; i++) {
+		float length = glm::length(remaining);
+		if (length < 1e-4f) {
+			break;
+		}
+		QueryRay ray = { position, remaining / length, length + radius };
+		QueryHit hit = intersectOne(snapshot.get(), ray, false);
+		if (hit.instance == QUERY_MISS) {
+			position += remaining;
+			break;
+		}
+		// Along the ray, radius from the surface is further back the more glancing the hit
+		float facing = max(-glm::dot(ray.direction, hit.normal), 0.2f);
+		float travel = min(max(hit.distance - radius / facing, 0.0f), length);
+		position += ray.direction * travel;
+		remaining = ray.direction * (length - travel);
+		remaining -= hit.normal * glm::dot(remaining, hit.normal);
+	}
+	// Push out of anything the centre line missed, such as an edge
+	for (int i = 0; i < 2; i++) {
+		QuerySphere sphere = { position, radius };
+		QueryContact contact = contactOne(snapshot.get(), sphere);
+		if (contact.instance == QUERY_MISS) {
+			break;
+		}
+		position += contact.normal * contact.depth;
+	}
+	return position;
+}
@@ -0,0 +1,177 @@
+#ifndef SCENE_QUERY_H
+#define SCENE_QUERY_H
+
+#include <glm/glm.hpp>
+#include <memory>
+#include <stdint.h>
+#include <vector>
+
+namespace tinygltf {
+class Model;
+}
+struct NodeHierarchy;
+class HeightField;
+class JobSystem;
+
+// Instance reported by a hit or contact that is not a scene instance
+enum {
+    QUERY_MISS = -1,
+    QUERY_GROUND = -2
+};
+
+struct QueryRay {
+    glm::vec3 origin;
+    glm::vec3 direction;        // unit length
+    float maxDistance;
+};
+
+struct QueryHit {
+    float distance;             // maxDistance on a miss
+    int instance;               // or QUERY_MISS / QUERY_GROUND
+    int triangle;               // of the instance's mesh, -1 for the ground
+    glm::vec3 normal;           // world space, facing the ray
+};
+
+struct QuerySphere {
+    glm::vec3 center;
+    float radius;
+};
+
+// Deepest penetration of a sphere; moving it depth along normal separates them
+struct QueryContact {
+    float depth;                // 0 when the sphere touches nothing
+    int instance;               // or QUERY_MISS / QUERY_GROUND
+    glm::vec3 normal;
+};
+
+struct QueryBox {
+    glm::vec3 low;
+    glm::vec3 high;
+    int* instances;             // receives up to capacity instances
+    int capacity;
+    int count;                  // overlapping instances, which may exceed capacity
+};
+
+// Four children's bounds side by side, so one SIMD test covers all of them.
+// A child with count 0 is the inner node first, one with count > 0 a leaf
+// of count items from first, one with count -1 absent.
+struct QueryNode {
+    float lowX[4], lowY[4], lowZ[4];
+    float highX[4], highY[4], highZ[4];
+    int32_t first[4];
+    int32_t count[4];
+};
+
+// Four-wide bounding volume hierarchy over items given by their bounds;
+// parents come before their children.
+struct QueryTree {
+    std::vector<QueryNode> nodes;
+    std::vector<int> items;     // item ids in leaf order
+
+    // Median splits along the widest axis; items with empty bounds (low > high) are left out
+    void build(const glm::vec3* low, const glm::vec3* high, int count, int leafSize);
+    // Recompute the bounds of the same items after they moved, keeping the topology
+    void refit(const glm::vec3* low, const glm::vec3* high);
+    // Surface area summed over all children; refits loosen the tree as it grows
+    float area() const;
+    bool empty() const;
+
+    private:
+    int buildNode(int first, int count, int leafSize, const glm::vec3* low, const glm::vec3* high);
+};
+
+// Ray, sphere and box queries over scene instances and the ground, for
+// picking, camera collision and line of sight. Two levels: every mesh has
+// a tree over its triangles in its own space, built once by addMesh, and
+// the top level is a tree over the instances' world bounds. update()
+// refits it after instances moved and rebuilds it when instances were
+// added or the refits have loosened it too far, then publishes the result
+// as an immutable snapshot. Queries run against the latest snapshot, so
+// any thread may query while the owning thread changes instances; the
+// batched forms split their queries over a JobSystem.
+class SceneQuery {
+    public:
+    const HeightField* ground;  // null: a flat plane at groundLevel
+    float groundLevel;
+    int queriesPerTask;
+
+    SceneQuery();
+    ~SceneQuery();
+
+    // Triangles in instance space; returns the mesh's id
+    int addMesh(const float* positions, int vertexCount, const uint32_t* indices, int indexCount);
+    // The triangles of every drawn node of a glTF model at the given globals; -1 if there are none
+    int addMesh(const tinygltf::Model& model, const NodeHierarchy& nodes, const glm::mat4* globals);
+    // Appends count instances of mesh and returns the first one's index; null transforms
+    // leave them out until setTransforms. user is handed back by user() for hits.
+    int addInstances(int mesh, const glm::mat4* transforms, int count, uint32_t user);
+    // A zero matrix, as streamed layers use for unused entries, leaves the instance out
+    void setTransforms(int first, const glm::mat4* transforms, int count);
+    void disable(int first, int count);
+    int instanceCount() const;
+    uint32_t user(int instance) const;
+    // Publish the changes since the last update to the queries; instances are
+    // changed and updated from one thread at a time. With jobs the changed
+    // instances' bounds are computed in parallel.
+    void update(JobSystem* jobs = nullptr);
+
+    // Closest hit along each ray
+    void intersect(const QueryRay* rays, int count, QueryHit* hits, JobSystem* jobs = nullptr) const;
+    QueryHit intersect(const QueryRay& ray) const;
+    // Whether anything lies along each ray within its maxDistance; stops at the first hit
+    void occluded(const QueryRay* rays, int count, bool* blocked, JobSystem* jobs = nullptr) const;
+    void contact(const QuerySphere* spheres, int count, QueryContact* contacts, JobSystem* jobs = nullptr) const;
+    QueryContact contact(const QuerySphere& sphere) const;
+    // Instances whose world bounds overlap each box
+    void overlap(QueryBox* boxes, int count, JobSystem* jobs = nullptr) const;
+    // Where a sphere moving from from towards to ends up: it stops at what it
+    // hits, slides along it, and is pushed out of anything it still touches
+    glm::vec3 moveSphere(const glm::vec3& from, const glm::vec3& to, float radius) const;
+
+    private:
+    struct Mesh {
+        QueryTree tree;
+        std::vector<glm::vec3> corners;     // three per triangle, in leaf order
+        glm::vec3 low;
+        glm::vec3 high;
+    };
+    // Everything a query reads; never changed once published
+    struct Snapshot {
+        std::vector<const Mesh*> meshes;
+        std::vector<int> mesh;              // per instance, -1 when left out
+        std::vector<glm::mat4> transforms;
+        std::vector<glm::mat4> inverses;
+        std::vector<glm::vec3> low;         // world bounds
+        std::vector<glm::vec3> high;
+        QueryTree tree;
+    };
+
+    std::vector<Mesh*> meshes;
+    std::vector<int> instanceMesh;
+    std::vector<uint32_t> users;
+    Snapshot current;                       // the next snapshot, being changed
+    int dirtyFirst;
+    int dirtyEnd;
+    bool rebuild;
+    float builtArea;
+    // A snapshot this has published, and the instances changed since it was last brought up to date
+    struct Copy {
+        std::shared_ptr<Snapshot> snapshot;
+        int staleFirst;
+        int staleEnd;
+    };
+    // Published first; a copy is reused once no query holds it
+    std::shared_ptr<const Snapshot> published;
+    std::vector<Copy> snapshots;
+
+    std::shared_ptr<const Snapshot> latest() const;
+    void updateInstances(int first, int last);
+    QueryHit intersectOne(const Snapshot* snapshot, const QueryRay& ray, bool anyHit) const;
+    QueryContact contactOne(const Snapshot* snapshot, const QuerySphere& sphere) const;
+    bool intersectGround(const glm::vec3& origin, const glm::vec3& direction, float maxDistance, float& distance, glm::vec3& normal) const;
+
+    SceneQuery(const SceneQuery&);
+    SceneQuery& operator=(const SceneQuery&);
+};
+
+#endif
@@ -0,0 +1,148 @@
+#include "scene/simulation.h"
+
+#include "scene/scene_query.h"
+
+#include <algorithm>
+
+using namespace std;
+
+Simulation::Simulation(const glm::vec3& eye, float tickRate) {
+	this->tickRate = tickRate;
+	this->cameraSpeed = 1000.0f;
+	// The airplane used to move one unit per rendered frame, tuned at about 60 fps
+	this->airplaneSpeed = 60.0f;
+	this->airplaneRange = 3000.0f;
+	this->collision = nullptr;
+	this->cameraRadius = 2.0f;
+
+	this->state.tick = 0;
+	this->state.eye = eye;
+	this->state.airplaneOffset = glm::vec3(0.0f);
+	this->input.forward = this->input.back = this->input.left = this->input.right = false;
+	this->input.lookat = glm::vec3(0.0f, 0.0f, -1.0f);
+
+	for (int i = 0; i < 3; i++) {
+		this->slots[i].previous = this->state;
+		this->slots[i].current = this->state;
+		this->slots[i].publishedAt = chrono::steady_clock::now();
+	}
+	this->back = 0;
+	this->front = 1;
+	this->middle = 2;
+	this->running = false;
+}
+
+Simulation::~Simulation() {
+	this->stop();
+}
+
+void Simulation::start() {
+	if (this->running) {
+		return;
+	}
+	this->running = true;
+	this->worker = thread(&Simulation::threadLoop, this);
+}
+
+void Simulation::stop() {
+	if (!this->running) {
+		return;
+	}
+	this->running = false;
+	this->worker.join();
+}
+
+void Simulation::setInput(const SimInput& input) {
+	lock_guard<mutex> lock(this->inputMutex);
+	this->input = input;
+}
+
+void Simulation::step() {
+	SimState previous = this->state;
+	this->advance(1.0f / this->tickRate);
+	// Don't let the renderer sweep the airplane back across the scene when it restarts
+	if (this->state.airplaneOffset.z < previous.airplaneOffset.z) {
+		previous.airplaneOffset = this->state.airplaneOffset;
+	}
+	this->publish(previous);
+}
+
+const SimFrame& Simulation::latest(float& alpha) {
+	if (this->middle.load() & DIRTY) {
+		this->front = this->middle.exchange(this->front) & ~DIRTY;
+	}
+	if (!this->running) {
+		alpha = 1.0f;
+		return this->slots[this->front];
+	}
+	// Rendering runs up to one tick behind the simulation so there is always a pair to blend
+	const SimFrame& frame = this->slots[this->front];
+	alpha = (float)(chrono::duration<double>(chrono::steady_clock::now() - frame.publishedAt).count() * this->tickRate);
+	alpha = min(max(alpha, 0.0f), 1.0f);
+	return frame;
+}
+
+SimState Simulation::interpolate(const SimFrame& frame, float alpha) {
+	SimState state = frame.current;
+	state.eye = glm::mix(frame.previous.eye, frame.current.eye, alpha);
+	state.airplaneOffset = glm::mix(frame.previous.airplaneOffset, frame.current.airplaneOffset, alpha);
+	return state;
+}
+
+void Simulation::advance(float dt) {
+	SimInput input;
+	{
+		lock_guard<mutex> lock(this->inputMutex);
+		input = this->input;
+	}
+	glm::vec3 up(0.0f, 1.0f, 0.0f);
+	glm::vec3 right = glm::normalize(glm::cross(input.lookat, up));
+	float velocity = this->cameraSpeed * dt;
+	glm::vec3 target = this->state.eye;
+	if (input.forward) {
+		target += velocity * input.lookat;
+	}
+	if (input.back) {
+		target -= velocity * input.lookat;
+	}
+	if (input.left) {
+		target -= right * velocity;
+	}
+	if (input.right) {
+		target += right * velocity;
+	}
+	// The query reads its latest snapshot, so the main thread may update it meanwhile
+	if (this->collision && target != this->state.eye) {
+		this->state.eye = this->collision->moveSphere(this->state.eye, target, this->cameraRadius);
+	} else {
+		this->state.eye = target;
+	}
+
+	this->state.airplaneOffset.z += this->airplaneSpeed * dt;
+	if (this->state.airplaneOffset.z >= this->airplaneRange) {
+		this->state.airplaneOffset = glm::vec3(0.0f);
+	}
+	this->state.tick++;
+}
+
+void Simulation::publish(const SimState& previous) {
+	this->slots[this->back].previous = previous;
+	this->slots[this->back].current = this->state;
+	this->slots[this->back].publishedAt = chrono::steady_clock::now();
+	this->back = this->middle.exchange(this->back | DIRTY) & ~DIRTY;
+}
+
+void Simulation::threadLoop() {
+	chrono::steady_clock::duration period = chrono::duration_cast<chrono::steady_clock::duration>(
+		chrono::duration<double>(1.0 / this->tickRate));
+	chrono::steady_clock::time_point next = chrono::steady_clock::now();
+	while (this->running) {
+		next += period;
+		this_thread::sleep_until(next);
+		this->step();
+		// After a long stall (debugger, window drag) resume from now rather than replaying the backlog
+		if (chrono::steady_clock::now() - next > period * 8) {
+			next = chrono::steady_clock::now();
+		}
+	}
+}
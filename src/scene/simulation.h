@@ -0,0 +1,85 @@
+#ifndef SIMULATION_CLASS_H
+#define SIMULATION_CLASS_H
+
+#include <atomic>
+#include <chrono>
+#include <glm/glm.hpp>
+#include <mutex>
+#include <stdint.h>
+#include <thread>
+
+class SceneQuery;
+
+// Input sampled on the main thread (GLFW may only be polled there) and
+// consumed by the next simulation tick
+struct SimInput {
+    bool forward;
+    bool back;
+    bool left;
+    bool right;
+    glm::vec3 lookat;
+};
+
+// Everything the simulation owns at one tick
+struct SimState {
+    uint64_t tick;
+    glm::vec3 eye;
+    glm::vec3 airplaneOffset;   // translation applied to every airplane instance
+};
+
+// Two consecutive ticks; the renderer interpolates between them
+struct SimFrame {
+    SimState previous;
+    SimState current;
+    std::chrono::steady_clock::time_point publishedAt;
+};
+
+// Fixed-timestep simulation of the camera and the airplane. With start() it
+// runs on its own thread at tickRate, independent of the frame rate, and
+// publishes each tick through a triple buffer: the writer never waits for
+// the renderer and the renderer always gets the newest complete pair of
+// ticks. Without a thread, step() advances one tick on the caller's thread,
+// which keeps --benchmark runs deterministic.
+class Simulation {
+    public:
+    float tickRate;             // ticks per second
+    float cameraSpeed;          // units per second
+    float airplaneSpeed;        // units per second along +Z
+    float airplaneRange;        // the airplane restarts after flying this far
+    const SceneQuery* collision; // null: the camera flies through everything
+    float cameraRadius;
+
+    Simulation(const glm::vec3& eye, float tickRate);
+    ~Simulation();
+
+    void start();
+    void stop();
+    void setInput(const SimInput& input);
+    // Advance one tick and publish it; only when the thread is not running
+    void step();
+    // Newest published pair and how far the render time is between them, in [0, 1]
+    const SimFrame& latest(float& alpha);
+
+    static SimState interpolate(const SimFrame& frame, float alpha);
+
+    private:
+    enum { DIRTY = 4 };
+    SimFrame slots[3];
+    int back;                   // written by the simulation only
+    int front;                  // read by the renderer only
+    std::atomic<int> middle;    // slot index, | DIRTY when the renderer has not taken it yet
+    SimState state;
+    SimInput input;
+    std::mutex inputMutex;
+    std::thread worker;
+    std::atomic<bool> running;
+
+    void advance(float dt);
+    void publish(const SimState& previous);
+    void threadLoop();
+
+    Simulation(const Simulation&);
+    Simulation& operator=(const Simulation&);
+};
+
+#endif
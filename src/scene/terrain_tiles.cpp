@@ -0,0 +1,361 @@
+#include "scene/terrain_tiles.h"
+#include "core/random.h"
+#include "core/startup_trace.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <direct.h>
+#endif
+
+using namespace std;
+
+// On-disk layout: header followed by SAMPLES * SAMPLES 16-bit heights, rows along +Z
+struct TerrainTileHeader {
+	char magic[4];
+	uint32_t samples;
+	uint64_t fieldKey;
+};
+
+static uint64_t floatBits(float value) {
+	uint32_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+	return bits;
+}
+
+TerrainTiles::TerrainTiles(const HeightField& field, const string& directory, float worldMin, float worldSize, int levels, int workerCount)
+	: field(field), tiles(MEMORY_STREAMING, 32), loads(MEMORY_STREAMING, 8) {
+	this->capacity = 128;
+	this->maxUploadsPerFrame = 2;
+	this->synchronous = false;
+	this->directory = directory;
+	this->worldMin = worldMin;
+	this->worldSize = worldSize;
+	this->levels = max(levels, 1);
+	this->frame = 0;
+	this->stopping = false;
+	// Room for a full cache plus a frame of requests up front; the vectors only grow past this once
+	this->resident.reserve(this->capacity + 16);
+	this->wanted.reserve(256);
+	this->requested.reserve(256);
+	this->queue.reserve(256);
+
+	uint64_t key = hashCombine(field.seed, (uint64_t)field.octaves);
+	float parameters[] = { field.baseHeight, field.amplitude, field.featureSize, field.flatHalfExtent, field.rampWidth, worldMin, worldSize };
+	for (size_t i = 0; i < sizeof(parameters) / sizeof(parameters[0]); i++) {
+		key = hashCombine(key, floatBits(parameters[i]));
+	}
+	this->fieldKey = hashCombine(key, (uint64_t)this->levels);
+
+#ifdef _WIN32
+	_mkdir(directory.c_str());
+#else
+	mkdir(directory.c_str(), 0755);
+#endif
+	for (int i = 0; i < max(workerCount, 1); i++) {
+		this->workers.push_back(thread(&TerrainTiles::workerLoop, this));
+	}
+}
+
+TerrainTiles::~TerrainTiles() {
+	{
+		lock_guard<mutex> lock(this->queueMutex);
+		this->stopping = true;
+		this->queue.clear();
+	}
+	this->wake.notify_all();
+	for (size_t i = 0; i < this->workers.size(); i++) {
+		this->workers[i].join();
+	}
+	for (size_t i = 0; i < this->completed.size(); i++) {
+		this->loads.release(this->completed[i]);
+	}
+}
+
+int64_t TerrainTiles::key(int level, int x, int z) {
+	return ((int64_t)level << 48) ^ ((int64_t)x << 24) ^ (int64_t)z;
+}
+
+int64_t TerrainTiles::key(const TerrainTile* tile) {
+	return key(tile->level, tile->x, tile->z);
+}
+
+bool TerrainTiles::keyLess(const TerrainTile* tile, int64_t k) {
+	return key(tile) < k;
+}
+
+TerrainTile* TerrainTiles::find(int64_t k) {
+	vector<TerrainTile*>::iterator it = lower_bound(this->resident.begin(), this->resident.end(), k, keyLess);
+	return it != this->resident.end() && key(*it) == k ? *it : nullptr;
+}
+
+// Insert into or remove from a sorted key list; returns false if nothing changed
+static bool insertKey(vector<int64_t>& keys, int64_t k) {
+	vector<int64_t>::iterator it = lower_bound(keys.begin(), keys.end(), k);
+	if (it != keys.end() && *it == k) {
+		return false;
+	}
+	keys.insert(it, k);
+	return true;
+}
+
+static void eraseKey(vector<int64_t>& keys, int64_t k) {
+	vector<int64_t>::iterator it = lower_bound(keys.begin(), keys.end(), k);
+	if (it != keys.end() && *it == k) {
+		keys.erase(it);
+	}
+}
+
+float TerrainTiles::tileSize(int level) const {
+	return this->worldSize / (float)(1 << (this->levels - 1 - level));
+}
+
+int TerrainTiles::topLevel() const {
+	return this->levels - 1;
+}
+
+int TerrainTiles::residentTiles() const {
+	return (int)this->resident.size();
+}
+
+int TerrainTiles::pendingTiles() {
+	lock_guard<mutex> lock(this->queueMutex);
+	return (int)this->requested.size();
+}
+
+bool TerrainTiles::init() {
+	StartupScope scope("terrain top tile", "asset");
+	Loaded top;
+	top.level = this->topLevel();
+	top.x = top.z = 0;
+	this->produce(top);
+	this->upload(top);
+	return true;
+}
+
+const TerrainTile* TerrainTiles::acquire(int level, int x, int z, float priority) {
+	TerrainTile* tile = this->find(key(level, x, z));
+	if (tile != nullptr) {
+		tile->lastUsed = this->frame;
+		return tile;
+	}
+	Request request = { level, x, z, priority };
+	this->wanted.push_back(request);
+	// Fall back to the nearest resident ancestor; the top tile always is
+	while (level < this->topLevel()) {
+		level++;
+		x >>= 1;
+		z >>= 1;
+		tile = this->find(key(level, x, z));
+		if (tile != nullptr) {
+			tile->lastUsed = this->frame;
+			return tile;
+		}
+	}
+	return nullptr;
+}
+
+bool TerrainTiles::update() {
+	vector<Loaded*, ArenaAllocator<Loaded*> > finished((ArenaAllocator<Loaded*>(Arena::frame())));
+	{
+		unique_lock<mutex> lock(this->queueMutex);
+		// Rebuild the queue from what was wanted since the last update, nearest first;
+		// tiles nobody asks for any more are not loaded
+		vector<Request>& requests = this->wanted;
+		sort(requests.begin(), requests.end(), Request::byTile);
+		requests.erase(unique(requests.begin(), requests.end(), Request::sameTile), requests.end());
+		sort(requests.begin(), requests.end());
+		for (size_t i = 0; i < this->queue.size(); i++) {
+			eraseKey(this->requested, key(this->queue[i].level, this->queue[i].x, this->queue[i].z));
+		}
+		this->queue.clear();
+		// Workers take from the back, so walk the requests least urgent first
+		for (size_t i = requests.size(); i-- > 0;) {
+			if (insertKey(this->requested, key(requests[i].level, requests[i].x, requests[i].z))) {
+				this->queue.push_back(requests[i]);
+			}
+		}
+		this->wanted.clear();
+		if (!this->queue.empty()) {
+			this->wake.notify_all();
+		}
+
+		size_t take = min(this->completed.size(), (size_t)this->maxUploadsPerFrame);
+		if (this->synchronous) {
+			while (this->completed.size() < this->requested.size()) {
+				this->loaded.wait(lock);
+			}
+			take = this->completed.size();
+		}
+		finished.reserve(take);
+		finished.assign(this->completed.begin(), this->completed.begin() + take);
+		this->completed.erase(this->completed.begin(), this->completed.begin() + take);
+		for (size_t i = 0; i < finished.size(); i++) {
+			eraseKey(this->requested, key(finished[i]->level, finished[i]->x, finished[i]->z));
+		}
+	}
+
+	for (size_t i = 0; i < finished.size(); i++) {
+		this->upload(*finished[i]);
+	}
+	if (!finished.empty()) {
+		lock_guard<mutex> lock(this->queueMutex);
+		for (size_t i = 0; i < finished.size(); i++) {
+			this->loads.release(finished[i]);
+		}
+	}
+	this->evict();
+	this->frame++;
+	return !finished.empty();
+}
+
+void TerrainTiles::upload(const Loaded& tile) {
+	int64_t k = key(tile.level, tile.x, tile.z);
+	vector<TerrainTile*>::iterator at = lower_bound(this->resident.begin(), this->resident.end(), k, keyLess);
+	if (at != this->resident.end() && key(*at) == k) {
+		return;
+	}
+	TerrainTile& resident = **this->resident.insert(at, this->tiles.acquire());
+	float size = this->tileSize(tile.level);
+	resident.level = tile.level;
+	resident.x = tile.x;
+	resident.z = tile.z;
+	resident.originX = this->worldMin + tile.x * size;
+	resident.originZ = this->worldMin + tile.z * size;
+	resident.spacing = size / RESOLUTION;
+	resident.lastUsed = this->frame;
+
+	glGenTextures(1, &resident.texture);
+	glBindTexture(GL_TEXTURE_2D, resident.texture);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 2);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_R16, SAMPLES, SAMPLES, 0, GL_RED, GL_UNSIGNED_SHORT, tile.samples.data());
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	// No mipmaps: each node samples the level whose spacing matches its vertices, which keeps shared edges exact
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	StartupTrace::instance().addBytesUploaded(tile.samples.size() * sizeof(uint16_t));
+}
+
+void TerrainTiles::evict() {
+	// Tiles used since the last update and the top tile stay, even if that means going over capacity
+	while ((int)this->resident.size() > this->capacity) {
+		vector<TerrainTile*>::iterator oldest = this->resident.end();
+		for (vector<TerrainTile*>::iterator it = this->resident.begin(); it != this->resident.end(); ++it) {
+			if ((*it)->level == this->topLevel() || (*it)->lastUsed + 1 >= this->frame) {
+				continue;
+			}
+			if (oldest == this->resident.end() || (*it)->lastUsed < (*oldest)->lastUsed) {
+				oldest = it;
+			}
+		}
+		if (oldest == this->resident.end()) {
+			return;
+		}
+		glDeleteTextures(1, &(*oldest)->texture);
+		this->tiles.release(*oldest);
+		this->resident.erase(oldest);
+	}
+}
+
+void TerrainTiles::workerLoop() {
+	while (true) {
+		Request request;
+		Loaded* tile;
+		{
+			unique_lock<mutex> lock(this->queueMutex);
+			while (!this->stopping && this->queue.empty()) {
+				this->wake.wait(lock);
+			}
+			if (this->stopping) {
+				return;
+			}
+			request = this->queue.back();
+			this->queue.pop_back();
+			tile = this->loads.acquire();
+		}
+		tile->level = request.level;
+		tile->x = request.x;
+		tile->z = request.z;
+		this->produce(*tile);
+		lock_guard<mutex> lock(this->queueMutex);
+		this->completed.push_back(tile);
+		this->loaded.notify_all();
+	}
+}
+
+string TerrainTiles::tilePath(int level, int x, int z) const {
+	stringstream path;
+	path << this->directory << "/" << level << "_" << x << "_" << z << ".height";
+	return path.str();
+}
+
+void TerrainTiles::produce(Loaded& tile) {
+	string path = this->tilePath(tile.level, tile.x, tile.z);
+	if (this->readTile(path, tile.samples)) {
+		return;
+	}
+	float size = this->tileSize(tile.level);
+	float spacing = size / RESOLUTION;
+	float originX = this->worldMin + tile.x * size - spacing;
+	float originZ = this->worldMin + tile.z * size - spacing;
+	float low = this->field.minHeight();
+	float scale = 65535.0f / max(this->field.maxHeight() - low, 1.0f);
+	tile.samples.resize(SAMPLES * SAMPLES);
+	for (int j = 0; j < SAMPLES; j++) {
+		for (int i = 0; i < SAMPLES; i++) {
+			float h = this->field.height(originX + i * spacing, originZ + j * spacing);
+			tile.samples[j * SAMPLES + i] = (uint16_t)min(max((h - low) * scale + 0.5f, 0.0f), 65535.0f);
+		}
+	}
+	this->writeTile(path, tile.samples);
+}
+
+bool TerrainTiles::readTile(const string& path, vector<uint16_t>& samples) const {
+	FILE* file = fopen(path.c_str(), "rb");
+	if (file == nullptr) {
+		return false;
+	}
+	TerrainTileHeader header;
+	bool valid = fread(&header, sizeof(header), 1, file) == 1 && memcmp(header.magic, "EHT1", 4) == 0 &&
+	             header.samples == SAMPLES && header.fieldKey == this->fieldKey;
+	if (valid) {
+		samples.resize(SAMPLES * SAMPLES);
+		valid = fread(samples.data(), sizeof(uint16_t), samples.size(), file) == samples.size();
+	}
+	fclose(file);
+	return valid;
+}
+
+void TerrainTiles::writeTile(const string& path, const vector<uint16_t>& samples) const {
+	FILE* file = fopen(path.c_str(), "wb");
+	if (file == nullptr) {
+		return;
+	}
+	TerrainTileHeader header;
+	memcpy(header.magic, "EHT1", 4);
+	header.samples = SAMPLES;
+	header.fieldKey = this->fieldKey;
+	bool ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+	          fwrite(samples.data(), sizeof(uint16_t), samples.size(), file) == samples.size();
+	fclose(file);
+	if (!ok) {
+		cerr << "WARN: Could not write terrain tile " << path << endl;
+		remove(path.c_str());
+	}
+}
+
+void TerrainTiles::cleanup() {
+	for (size_t i = 0; i < this->resident.size(); i++) {
+		glDeleteTextures(1, &this->resident[i]->texture);
+		this->tiles.release(this->resident[i]);
+	}
+	this->resident.clear();
+}
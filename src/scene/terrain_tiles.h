@@ -0,0 +1,121 @@
+#ifndef TERRAIN_TILES_CLASS_H
+#define TERRAIN_TILES_CLASS_H
+
+#include <glad/gl.h>
+#include <condition_variable>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "core/memory.h"
+#include "scene/height_field.h"
+
+// One resident heightmap tile. Level 0 tiles are the finest; each level up
+// covers twice the distance with the same sample count.
+struct TerrainTile {
+    int level;
+    int x;
+    int z;
+    float originX;              // corner of the covered area, apron excluded
+    float originZ;
+    float spacing;              // distance between samples
+    GLuint texture;             // GL_R16, heights normalised to the field's range
+    uint64_t lastUsed;
+};
+
+// Streams heightmap tiles from disk into textures. Tiles form a quadtree
+// over the terrain; the top level is a single tile covering everything,
+// loaded up front so any request can fall back to a coarser resident tile
+// while the wanted one loads. Missing files are baked from the HeightField
+// by the worker that wanted them, so later runs only read. At most capacity
+// tiles stay resident, least recently used first out. Loaded and resident
+// tiles are recycled through pools and the bookkeeping is kept in sorted
+// vectors that keep their capacity, so a steady frame does not allocate.
+class TerrainTiles {
+    public:
+    // 256 intervals, plus the far edge sample and a one-sample apron on each side for normals
+    enum { RESOLUTION = 256, SAMPLES = RESOLUTION + 3 };
+
+    int capacity;
+    int maxUploadsPerFrame;
+    bool synchronous;           // update() waits for every requested tile
+
+    TerrainTiles(const HeightField& field, const std::string& directory, float worldMin, float worldSize, int levels, int workerCount);
+    ~TerrainTiles();
+
+    // Load the top tile on the calling thread; needs a current context
+    bool init();
+    // The tile, or its nearest resident ancestor; a missing tile is requested with the given priority (lower first)
+    const TerrainTile* acquire(int level, int x, int z, float priority);
+    // Queue this frame's requests, upload finished tiles and evict; returns true if any tile was added
+    bool update();
+    float tileSize(int level) const;
+    int topLevel() const;
+    int residentTiles() const;
+    int pendingTiles();
+    void cleanup();
+
+    private:
+    struct Request {
+        int level;
+        int x;
+        int z;
+        float priority;
+        bool operator<(const Request& other) const { return priority < other.priority; }
+        // Requests for the same tile together, most urgent first
+        static bool byTile(const Request& a, const Request& b) {
+            if (a.level != b.level || a.x != b.x || a.z != b.z) {
+                return a.level != b.level ? a.level < b.level : (a.x != b.x ? a.x < b.x : a.z < b.z);
+            }
+            return a.priority < b.priority;
+        }
+        static bool sameTile(const Request& a, const Request& b) { return a.level == b.level && a.x == b.x && a.z == b.z; }
+    };
+    struct Loaded {
+        int level;
+        int x;
+        int z;
+        std::vector<uint16_t> samples;
+    };
+
+    const HeightField& field;
+    uint64_t fieldKey;          // baked files from different field parameters are rebuilt
+    std::string directory;
+    float worldMin;
+    float worldSize;
+    int levels;
+    uint64_t frame;
+    std::vector<TerrainTile*> resident; // sorted by key
+    Pool<TerrainTile> tiles;
+    std::vector<Request> wanted;        // missing tiles asked for since the last update, repeats included
+    std::vector<int64_t> requested;     // sorted; queued or being loaded, guarded by queueMutex
+    std::vector<Request> queue;         // most urgent last, guarded by queueMutex
+    std::vector<Loaded*> completed;
+    Pool<Loaded> loads;                 // guarded by queueMutex
+    std::vector<std::thread> workers;
+    std::mutex queueMutex;
+    std::condition_variable wake;
+    std::condition_variable loaded;
+    bool stopping;
+
+    void workerLoop();
+    // Read the tile's file, or bake it from the field and write it
+    void produce(Loaded& tile);
+    bool readTile(const std::string& path, std::vector<uint16_t>& samples) const;
+    void writeTile(const std::string& path, const std::vector<uint16_t>& samples) const;
+    std::string tilePath(int level, int x, int z) const;
+    void upload(const Loaded& tile);
+    void evict();
+    // Resident tile with the given key, or nullptr
+    TerrainTile* find(int64_t k);
+    static int64_t key(int level, int x, int z);
+    static int64_t key(const TerrainTile* tile);
+    static bool keyLess(const TerrainTile* tile, int64_t k);
+
+    TerrainTiles(const TerrainTiles&);
+    TerrainTiles& operator=(const TerrainTiles&);
+};
+
+#endif
@@ -0,0 +1,293 @@
+#include "scene/traffic.h"
+#include "core/random.h"
+#include "core/job_system.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+using namespace std;
+
+void VehicleStreams::resize(size_t count) {
+	lane.resize(count);
+	nextLane.resize(count);
+	position.resize(count);
+	speed.resize(count);
+	desiredSpeed.resize(count);
+	desiredGap.resize(count);
+	id.resize(count);
+	trips.resize(count);
+}
+
+size_t VehicleStreams::size() const {
+	return lane.size();
+}
+
+// Run fn(first, last) over [0, count) in chunks of at least perTask, as jobs when there is more than one
+template <typename Function>
+static void runChunks(int count, int perTask, JobSystem* jobs, Function fn) {
+	if (jobs == nullptr || count <= perTask) {
+		fn(0, count);
+		return;
+	}
+	jobs->parallelFor(count, perTask, fn);
+}
+
+Traffic::Traffic(uint64_t seed) {
+	// World units are decimetres for the car model at scale 10
+	this->vehicleLength = 46.0f;
+	this->maxAcceleration = 20.0f;
+	this->comfortDeceleration = 30.0f;
+	this->timeHeadway = 1.0f;
+	this->maxStep = 1.0f / 20.0f;
+	this->scale = 10.0f;
+	this->groundClearance = 1.0f;
+	this->lanesPerTask = 256;
+	this->vehiclesPerTask = 2048;
+	this->seed = seed;
+	this->clock = 0.0f;
+}
+
+int Traffic::chooseNext(int lane, uint32_t id, uint32_t trip) const {
+	int first = this->roads.successorFirst[lane];
+	int count = this->roads.successorFirst[lane + 1] - first;
+	uint64_t bits = hashCombine(hashCombine(this->seed, id), trip);
+	return this->roads.successors[first + (int)(bits % (uint64_t)count)];
+}
+
+int Traffic::populate(int count) {
+	int lanes = this->roads.laneCount();
+	if (lanes == 0 || count <= 0) {
+		this->vehicles.resize(0);
+		this->placements.resize(0);
+		this->laneFirst.assign(lanes + 1, 0);
+		return 0;
+	}
+	// Even spacing, at least a stopped vehicle's length and gap apart
+	CounterRandom random(this->seed);
+	VehicleStreams& v = this->vehicles;
+	v.resize(0);
+	for (int lane = 0; lane < lanes; lane++) {
+		int perLane = count / lanes + (lane < count % lanes ? 1 : 0);
+		float length = this->roads.laneLength[lane];
+		int fits = (int)(length / (this->vehicleLength * 2.0f));
+		if (perLane > fits) {
+			perLane = fits;
+		}
+		for (int i = 0; i < perLane; i++) {
+			v.lane.push_back(lane);
+			v.position.push_back((i + 0.5f) * length / perLane);
+			v.desiredSpeed.push_back(random.uniform(70.0f, 120.0f));
+			v.speed.push_back(v.desiredSpeed.back() * 0.5f);
+			v.desiredGap.push_back(random.uniform(15.0f, 35.0f));
+			v.id.push_back((uint32_t)v.id.size());
+			v.trips.push_back(0);
+			v.nextLane.push_back(chooseNext(lane, v.id.back(), 0));
+		}
+	}
+	if ((int)v.size() < count) {
+		cout << "WARN: The road network only has room for " << v.size() << " of " << count << " vehicles" << endl;
+	}
+	this->acceleration.assign(v.size(), 0.0f);
+	this->laneFirst.assign(lanes + 1, 0);
+	sortByLane();
+
+	this->placements.resize(v.size());
+	fill(this->placements.sx.begin(), this->placements.sx.end(), this->scale);
+	fill(this->placements.sy.begin(), this->placements.sy.end(), this->scale);
+	fill(this->placements.sz.begin(), this->placements.sz.end(), this->scale);
+	place(0, (int)v.size());
+	return (int)v.size();
+}
+
+float Traffic::entryRoom(int lane) const {
+	int rear = this->laneFirst[lane];
+	if (rear == this->laneFirst[lane + 1]) {
+		return this->roads.laneLength[lane];
+	}
+	return this->vehicles.position[rear] - this->vehicleLength * 0.5f;
+}
+
+void Traffic::accelerate(int firstLane, int lastLane) {
+	const RoadNetwork& roads = this->roads;
+	const VehicleStreams& v = this->vehicles;
+	float a = this->maxAcceleration;
+	float b = this->comfortDeceleration;
+	float brakingTerm = 1.0f / (2.0f * sqrt(a * b));
+	float halfLength = this->vehicleLength * 0.5f;
+	for (int lane = firstLane; lane < lastLane; lane++) {
+		int first = this->laneFirst[lane];
+		int last = this->laneFirst[lane + 1];
+		if (first == last) {
+			continue;
+		}
+		float laneLength = roads.laneLength[lane];
+		float stopLine = laneLength - roads.stopDistance;
+		SignalState signal = roads.signal(roads.laneEnd[lane], roads.laneAxis[lane], this->clock);
+		for (int i = first; i < last; i++) {
+			float speed = v.speed[i];
+			float gap = 1e9f;
+			float approach = 0.0f;
+			if (i + 1 < last) {
+				gap = v.position[i + 1] - v.position[i] - this->vehicleLength;
+				approach = speed - v.speed[i + 1];
+			}
+			float toStop = stopLine - (v.position[i] + halfLength);
+			bool blocked = false;
+			if (i + 1 == last) {
+				// The front vehicle follows the last one on the lane it turns into. Before the stop line
+				// it turns elsewhere if that lane is backed up, and waits if every way out is; without
+				// that, queues around a block end up waiting on each other for good.
+				float needed = this->vehicleLength + v.desiredGap[i];
+				int next = v.nextLane[i];
+				if (toStop >= 0.0f && entryRoom(next) < needed) {
+					for (int s = roads.successorFirst[lane]; s < roads.successorFirst[lane + 1]; s++) {
+						if (entryRoom(roads.successors[s]) > entryRoom(next)) {
+							next = roads.successors[s];
+						}
+					}
+					this->vehicles.nextLane[i] = next;
+					blocked = entryRoom(next) < needed;
+				}
+				int rear = this->laneFirst[next];
+				if (rear < this->laneFirst[next + 1]) {
+					gap = laneLength - v.position[i] + v.position[rear] - this->vehicleLength;
+					approach = speed - v.speed[rear];
+				}
+			}
+			// Stop for red, for amber when there is room to stop comfortably, and when the way out is blocked
+			if ((signal != SIGNAL_GREEN || blocked) && toStop >= 0.0f && toStop < gap &&
+			    (signal == SIGNAL_RED || blocked || toStop > speed * speed / (2.0f * b))) {
+				gap = toStop;
+				approach = speed;
+			}
+			float ratio = speed / v.desiredSpeed[i];
+			float desired = v.desiredGap[i] + max(0.0f, speed * this->timeHeadway + speed * approach * brakingTerm);
+			float interaction = desired / max(gap, 0.1f);
+			float acceleration = a * (1.0f - ratio * ratio * ratio * ratio - interaction * interaction);
+			// The model brakes arbitrarily hard when something appears close ahead; tyres do not
+			this->acceleration[i] = max(acceleration, -4.0f * b);
+		}
+	}
+}
+
+void Traffic::integrate(int first, int last, float dt) {
+	const RoadNetwork& roads = this->roads;
+	VehicleStreams& v = this->vehicles;
+	for (int i = first; i < last; i++) {
+		float acceleration = this->acceleration[i];
+		float speed = v.speed[i] + acceleration * dt;
+		if (speed < 0.0f) {
+			// Stops within the step
+			v.position[i] -= 0.5f * v.speed[i] * v.speed[i] / acceleration;
+			speed = 0.0f;
+		} else {
+			v.position[i] += (v.speed[i] + 0.5f * acceleration * dt) * dt;
+		}
+		v.speed[i] = speed;
+		while (v.position[i] >= roads.laneLength[v.lane[i]]) {
+			v.position[i] -= roads.laneLength[v.lane[i]];
+			v.lane[i] = v.nextLane[i];
+			v.trips[i]++;
+			v.nextLane[i] = chooseNext(v.lane[i], v.id[i], v.trips[i]);
+		}
+	}
+}
+
+void Traffic::sortByLane() {
+	VehicleStreams& v = this->vehicles;
+	int lanes = this->roads.laneCount();
+	int count = (int)v.size();
+	vector<int>& first = this->laneFirst;
+	fill(first.begin(), first.end(), 0);
+	for (int i = 0; i < count; i++) {
+		first[v.lane[i] + 1]++;
+	}
+	for (int lane = 0; lane < lanes; lane++) {
+		first[lane + 1] += first[lane];
+	}
+	// Stable scatter keeps the vehicles that stayed on a lane in order
+	VehicleStreams& out = this->sorted;
+	out.resize(count);
+	vector<int>& cursor = this->cursor;
+	cursor.assign(first.begin(), first.end() - 1);
+	for (int i = 0; i < count; i++) {
+		int j = cursor[v.lane[i]]++;
+		out.lane[j] = v.lane[i];
+		out.nextLane[j] = v.nextLane[i];
+		out.position[j] = v.position[i];
+		out.speed[j] = v.speed[i];
+		out.desiredSpeed[j] = v.desiredSpeed[i];
+		out.desiredGap[j] = v.desiredGap[i];
+		out.id[j] = v.id[i];
+		out.trips[j] = v.trips[i];
+	}
+	swap(this->vehicles, this->sorted);
+
+	// Vehicles that just turned in may be out of order with those already there; insertion sort, as
+	// the lanes are nearly sorted
+	VehicleStreams& s = this->vehicles;
+	for (int lane = 0; lane < lanes; lane++) {
+		for (int i = first[lane] + 1; i < first[lane + 1]; i++) {
+			for (int j = i; j > first[lane] && s.position[j] < s.position[j - 1]; j--) {
+				swap(s.nextLane[j], s.nextLane[j - 1]);
+				swap(s.position[j], s.position[j - 1]);
+				swap(s.speed[j], s.speed[j - 1]);
+				swap(s.desiredSpeed[j], s.desiredSpeed[j - 1]);
+				swap(s.desiredGap[j], s.desiredGap[j - 1]);
+				swap(s.id[j], s.id[j - 1]);
+				swap(s.trips[j], s.trips[j - 1]);
+			}
+		}
+	}
+}
+
+void Traffic::place(int first, int last) {
+	const RoadNetwork& roads = this->roads;
+	const VehicleStreams& v = this->vehicles;
+	PlacementStreams& p = this->placements;
+	for (int i = first; i < last; i++) {
+		int lane = v.lane[i];
+		glm::vec2 direction = roads.laneDirection[lane];
+		glm::vec2 point = roads.laneStart[lane] + direction * v.position[i];
+		p.x[i] = point.x;
+		p.y[i] = roads.laneHeight(lane, v.position[i]) + this->groundClearance;
+		p.z[i] = point.y;
+		// The car model faces +z
+		p.yaw[i] = atan2(direction.x, direction.y);
+	}
+}
+
+void Traffic::step(float dt, JobSystem* jobs) {
+	int count = (int)this->vehicles.size();
+	if (count == 0 || dt <= 0.0f) {
+		return;
+	}
+	int lanes = this->roads.laneCount();
+	int substeps = max(1, (int)ceil(dt / this->maxStep));
+	float h = dt / substeps;
+	for (int s = 0; s < substeps; s++) {
+		// Every phase reads what the previous one wrote, so each is its own set of tasks
+		runChunks(lanes, this->lanesPerTask, jobs, [this](int first, int last) { this->accelerate(first, last); });
+		runChunks(count, this->vehiclesPerTask, jobs, [this, h](int first, int last) { this->integrate(first, last, h); });
+		sortByLane();
+		this->clock += h;
+	}
+	runChunks(count, this->vehiclesPerTask, jobs, [this](int first, int last) { this->place(first, last); });
+}
+
+int Traffic::vehicleCount() const {
+	return (int)this->vehicles.size();
+}
+
+float Traffic::time() const {
+	return this->clock;
+}
+
+float Traffic::averageSpeed() const {
+	double sum = 0.0;
+	for (size_t i = 0; i < this->vehicles.size(); i++) {
+		sum += this->vehicles.speed[i];
+	}
+	return this->vehicles.size() > 0 ? (float)(sum / this->vehicles.size()) : 0.0f;
+}
@@ -0,0 +1,77 @@
+#ifndef TRAFFIC_H
+#define TRAFFIC_H
+
+#include <stdint.h>
+#include <vector>
+
+#include "scene/placement.h"
+#include "scene/road_network.h"
+
+class JobSystem;
+
+// Vehicle state as structure-of-arrays streams, kept sorted by lane and
+// then by position along the lane so a vehicle's leader is the next entry
+struct VehicleStreams {
+    std::vector<int> lane;
+    std::vector<int> nextLane;          // taken at the end of the current lane
+    std::vector<float> position;        // of the vehicle's centre along its lane
+    std::vector<float> speed;
+    std::vector<float> desiredSpeed;
+    std::vector<float> desiredGap;      // bumper to bumper when stopped
+    std::vector<uint32_t> id;           // stable across the sorts; seeds route choices
+    std::vector<uint32_t> trips;        // lanes driven so far
+
+    void resize(size_t count);
+    size_t size() const;
+};
+
+// Vehicles driving a RoadNetwork with the Intelligent Driver Model: each
+// accelerates towards its desired speed and brakes for the vehicle ahead,
+// which may be the last one on the lane it turns into, and for red or
+// amber signals. A step runs in phases over chunks of lanes or vehicles on
+// the worker threads: accelerations, integration and lane changes at
+// intersections, a counting sort back into lane order, and the placement
+// streams the caller composes into an instance buffer.
+class Traffic {
+    public:
+    RoadNetwork roads;
+    VehicleStreams vehicles;
+    PlacementStreams placements;        // vehicle i's transform, in vehicles' order
+    float vehicleLength;
+    float maxAcceleration;
+    float comfortDeceleration;
+    float timeHeadway;                  // seconds of following distance
+    float maxStep;                      // longer steps are split
+    float scale;                        // of the vehicle model
+    float groundClearance;
+    int lanesPerTask;
+    int vehiclesPerTask;
+    uint64_t seed;
+
+    Traffic(uint64_t seed = 1234);
+
+    // Spread count vehicles evenly over the lanes with random speeds and gaps; fewer if the lanes are full
+    int populate(int count);
+    // Advance by dt seconds and refresh the placements; with jobs the phases are split into chunks
+    void step(float dt, JobSystem* jobs = nullptr);
+    int vehicleCount() const;
+    float time() const;
+    float averageSpeed() const;
+
+    private:
+    float clock;
+    std::vector<float> acceleration;
+    std::vector<int> laneFirst;         // vehicles of lane l are [laneFirst[l], laneFirst[l + 1])
+    VehicleStreams sorted;              // scratch for the counting sort
+    std::vector<int> cursor;
+
+    int chooseNext(int lane, uint32_t id, uint32_t trip) const;
+    // Free length at the start of a lane, before its last vehicle
+    float entryRoom(int lane) const;
+    void accelerate(int firstLane, int lastLane);
+    void integrate(int first, int last, float dt);
+    void sortByLane();
+    void place(int first, int last);
+};
+
+#endif
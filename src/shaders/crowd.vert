@@ -0,0 +1,57 @@
+#version 330 core
+layout (location = 2) in vec2 aTexCoords;
+layout (location = 6) in vec2 aAnimation;  // clip, time offset in seconds
+
+out vec3 FragPos;
+out vec3 Normal;
+out vec2 TexCoords;
+
+uniform mat4 VP;
+uniform float time;
+uniform sampler2D positionMap;
+uniform sampler2D normalMap;
+
+// Shared by the pre-pass and lighting programs, whose positions must agree bit for bit
+invariant gl_Position;
+
+// Crowd::DrawData
+#define CUSTOM_DRAW_DATA
+layout (std140) uniform DrawData {
+    mat4 model;
+    mat4 normalModel;
+    vec4 animation;     // vertex count, texture width
+    vec4 clips[16];     // first frame, frame count, frames per second, 1 if looping
+};
+
+#include "include/instance.glsl"
+
+// Texel of vertex gl_VertexID in a baked frame; frames are stored back to back in row-major order
+ivec2 frameTexel(int frame)
+{
+    int index = frame * int(animation.x) + gl_VertexID;
+    int width = int(animation.y);
+    return ivec2(index % width, index / width);
+}
+
+void main()
+{
+    vec4 clip = clips[int(aAnimation.x)];
+    float frame = (time + aAnimation.y) * clip.z;
+    float last = clip.y - 1.0;
+    frame = clip.w > 0.5 ? mod(frame, clip.y) : clamp(frame, 0.0, last);
+    float first = floor(frame);
+    float blend = frame - first;
+    // A looping clip's last frame blends back into its first
+    int next = int(first + 1.0 > last ? (clip.w > 0.5 ? 0.0 : last) : first + 1.0);
+
+    ivec2 a = frameTexel(int(clip.x + first));
+    ivec2 b = frameTexel(int(clip.x) + next);
+    vec3 position = mix(texelFetch(positionMap, a, 0).xyz, texelFetch(positionMap, b, 0).xyz, blend);
+    vec3 normal = mix(texelFetch(normalMap, a, 0).xyz, texelFetch(normalMap, b, 0).xyz, blend);
+
+    vec3 worldPos = instanceWorldPosition(position);
+    FragPos = worldPos;
+    Normal = instanceWorldNormal(normal);
+    TexCoords = aTexCoords;
+    gl_Position = VP * vec4(worldPos, 1.0);
+}
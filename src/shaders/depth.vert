@@ -2,11 +2,10 @@
 layout (location = 0) in vec3 aPos;
 layout (location = 1) in vec3 aNormal;
 layout (location = 2) in vec2 aTexCoords;
-layout (location = 3) in mat4 aInstanceMat;
 
-uniform mat4 model;
+#include "include/instance.glsl"
 
 void main()
 {
-    gl_Position = aInstanceMat * model * vec4(aPos, 1.0);
-}
\ No newline at end of file
+    gl_Position = vec4(instanceWorldPosition(aPos), 1.0);
+}
@@ -0,0 +1,37 @@
+#version 330 core
+out vec4 FragColor;
+
+in vec3 FragPos;
+in vec3 Normal;
+in vec2 TexCoords;
+in float Tip;
+in float Fade;
+in float Shade;
+
+uniform sampler2D diffuseTexture;
+
+uniform vec3 lightPos;
+uniform vec3 lightIntensity;
+
+#ifdef SHADOWS
+#include "include/shadow.glsl"
+#endif
+
+void main()
+{
+    // Darker at the root, lighter at the tip; far blades take the colour of the ground under them
+    vec3 blade = mix(vec3(0.10, 0.28, 0.05), vec3(0.42, 0.62, 0.20), Tip) * Shade;
+    vec3 ground = texture(diffuseTexture, TexCoords).rgb;
+    vec3 color = mix(blade, ground, Fade);
+    vec3 normal = normalize(Normal);
+    vec3 lightColor = vec3(1.0, 0.8, 0.6);
+    vec3 ambient = 0.2 * lightColor;
+    vec3 lightDir = normalize(lightPos - FragPos);
+    vec3 diffuse = max(dot(lightDir, normal), 0.0) * lightColor * lightIntensity;
+#ifdef SHADOWS
+    float shadow = ShadowCalculation(FragPos, lightPos);
+#else
+    float shadow = 0.0;
+#endif
+    FragColor = vec4((ambient + (1.0 - shadow) * diffuse) * color, 1.0);
+}
@@ -0,0 +1,89 @@
+#version 330 core
+layout (location = 0) in vec2 aBlade;
+
+out vec3 FragPos;
+out vec3 Normal;
+out vec2 TexCoords;
+out float Tip;
+out float Fade;
+out float Shade;
+
+uniform mat4 VP;
+uniform vec3 viewPos;
+uniform float time;
+uniform sampler2D heightMap;
+
+// Shared by the pre-pass and lighting programs, whose positions must agree bit for bit
+invariant gl_Position;
+
+// Grass::TileData
+layout (std140) uniform DrawData
+{
+    vec4 tile;          // corner x, corner z, size, seed
+    vec4 blades;        // count, fade start, fade end, blade height
+    vec4 heightTile;    // height map uv = xz * heightTile.x + heightTile.yz
+    vec4 heights;       // height = heights.x + sample * heights.y; heights.z is 1 / texture span, heights.w the blade width
+};
+
+uint hash(uint x)
+{
+    x ^= x >> 16;
+    x *= 0x7feb352dU;
+    x ^= x >> 15;
+    x *= 0x846ca68bU;
+    x ^= x >> 16;
+    return x;
+}
+
+float unitFloat(uint x)
+{
+    return float(x >> 8) * (1.0 / 16777216.0);
+}
+
+void main()
+{
+    uint seed = uint(tile.w);
+    uint id = uint(gl_InstanceID);
+    uint h0 = hash(id ^ hash(seed));
+    uint h1 = hash(h0);
+    uint h2 = hash(h1);
+
+    // R2 low-discrepancy sequence in 32-bit fixed point: the first N blades cover the tile evenly
+    // for any N. The tile's own shift keeps neighbouring tiles from lining up.
+    uvec2 r2 = uvec2(id * 3242174889U, id * 2447445414U) + uvec2(hash(seed + 1U), hash(seed + 2U));
+    vec2 cell = vec2(r2 >> 8U) * (1.0 / 16777216.0);
+    vec2 xz = tile.xy + cell * tile.z;
+    vec3 root = vec3(xz.x, heights.x + textureLod(heightMap, xz * heightTile.x + heightTile.yz, 0.0).r * heights.y, xz.y);
+
+    vec3 toCamera = viewPos - root;
+    float cameraDistance = length(toCamera);
+    Fade = smoothstep(blades.y, blades.z, cameraDistance);
+
+    // Face the camera within +-35 degrees so the front face is always the one drawn
+    vec2 facing = length(toCamera.xz) > 0.001 ? normalize(toCamera.xz) : vec2(0.0, 1.0);
+    float yaw = (unitFloat(h0) - 0.5) * 1.2;
+    facing = vec2(cos(yaw) * facing.x - sin(yaw) * facing.y, sin(yaw) * facing.x + cos(yaw) * facing.y);
+    vec3 front = vec3(facing.x, 0.0, facing.y);
+    vec3 side = vec3(front.z, 0.0, -front.x);
+
+    float height = blades.w * (0.6 + 0.8 * unitFloat(h1)) * (1.0 - Fade);
+    float t = aBlade.y;
+
+    // Static lean plus wind gusts travelling across the field
+    float angle = unitFloat(h2) * 6.2831853;
+    vec2 lean = vec2(cos(angle), sin(angle)) * 0.3;
+    float gust = sin(time * 1.3 + dot(xz, vec2(0.035, 0.02))) * 0.5 + 0.5;
+    float flutter = sin(time * 4.1 + angle * 3.0) * 0.15;
+    vec2 bend = lean + vec2(0.8, 0.45) * (gust * 0.6 + flutter);
+    vec3 offset = vec3(bend.x, 0.0, bend.y) * (t * t) * height;
+
+    vec3 position = root + side * (aBlade.x * heights.w * (1.0 - t)) + vec3(0.0, t * height, 0.0) + offset;
+
+    // Mostly up so lighting follows the ground; a little of the blade's facing for variation
+    Normal = normalize(mix(front, vec3(0.0, 1.0, 0.0), 0.6));
+    FragPos = position;
+    TexCoords = position.xz * heights.z + 0.5;
+    Tip = t;
+    Shade = 0.75 + 0.5 * unitFloat(hash(h2));
+    gl_Position = VP * vec4(position, 1.0);
+}
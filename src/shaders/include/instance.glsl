@@ -0,0 +1,39 @@
+// Packed instance transform: the top three rows of an affine matrix, translation in w
+layout (location = 3) in vec4 aInstanceRow0;
+layout (location = 4) in vec4 aInstanceRow1;
+layout (location = 5) in vec4 aInstanceRow2;
+
+// Per-draw data, bound by CommandQueue from the recorded uniform stream. Shaders that
+// need more define CUSTOM_DRAW_DATA and declare a block starting with these two members.
+#ifndef CUSTOM_DRAW_DATA
+// Added to the draw's first material; 0 unless the renderable varies its instances' materials.
+// Location 6 is left to the custom draw data shaders' own per-instance inputs.
+layout (location = 7) in uint aInstanceMaterial;
+
+layout (std140) uniform DrawData {
+    mat4 model;
+    mat4 normalModel;   // cofactor of model's 3x3, computed on the CPU
+    ivec4 material;     // x: the draw's first material in the MaterialLibrary
+};
+
+int instanceMaterial()
+{
+    return material.x + int(aInstanceMaterial);
+}
+#endif
+
+vec3 instanceWorldPosition(vec3 position)
+{
+    vec4 local = model * vec4(position, 1.0);
+    return vec3(dot(aInstanceRow0, local), dot(aInstanceRow1, local), dot(aInstanceRow2, local));
+}
+
+// The cofactor matrix is the inverse transpose scaled by the determinant, which
+// the fragment shader's normalize removes; only the determinant's sign matters.
+vec3 instanceWorldNormal(vec3 normal)
+{
+    mat3 linear = transpose(mat3(aInstanceRow0.xyz, aInstanceRow1.xyz, aInstanceRow2.xyz));
+    mat3 cofactor = mat3(cross(linear[1], linear[2]), cross(linear[2], linear[0]), cross(linear[0], linear[1]));
+    float orientation = dot(linear[0], cofactor[0]) < 0.0 ? -1.0 : 1.0;
+    return orientation * (cofactor * (mat3(normalModel) * normal));
+}
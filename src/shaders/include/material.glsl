@@ -0,0 +1,26 @@
+// Materials of the MaterialLibrary: base colour layers and two texels of parameters per material
+uniform sampler2DArray materialTextures;
+uniform samplerBuffer materialBuffer;
+
+struct Material {
+    vec4 baseColorFactor;
+    float layer;        // -1: the factor alone
+    float roughness;
+};
+
+Material loadMaterial(int id)
+{
+    Material material;
+    material.baseColorFactor = texelFetch(materialBuffer, 2 * id);
+    vec4 params = texelFetch(materialBuffer, 2 * id + 1);
+    material.layer = params.x;
+    material.roughness = params.y;
+    return material;
+}
+
+// Sampled for every material, so the mip level's derivatives stay in uniform control flow
+vec4 materialBaseColor(Material material, vec2 uv)
+{
+    vec4 texel = texture(materialTextures, vec3(uv, max(material.layer, 0.0)));
+    return material.baseColorFactor * (material.layer < 0.0 ? vec4(1.0) : texel);
+}
@@ -0,0 +1,22 @@
+// Omnidirectional shadow lookup against the light's depth cubemap
+uniform samplerCube depthMap;
+uniform float far_plane;
+
+float ShadowCalculation(vec3 fragPos, vec3 lightPos)
+{
+    // get vector between fragment position and light position
+    vec3 fragToLight = fragPos - lightPos;
+    // ise the fragment to light vector to sample from the depth map    
+    float closestDepth = texture(depthMap, fragToLight).r;
+    // it is currently in linear range between [0,1], let's re-transform it back to original depth value
+    closestDepth *= far_plane;
+    // now get current linear depth as the length between the fragment and light position
+    float currentDepth = length(fragToLight);
+    // test for shadows
+    // float bias = max(0.05 * (1.0 - dot(normal, lightDir)), 0.005); // Angle-dependent bias
+    float bias = 0.05;
+
+    float shadow = currentDepth -  bias > closestDepth ? 1.0 : 0.0;  
+
+    return shadow;
+}
@@ -5,42 +5,35 @@ in vec3 FragPos;
 in vec3 Normal;
 in vec2 TexCoords;
 
+#ifdef MATERIALS
+flat in int MaterialID;
+#include "include/material.glsl"
+#else
 uniform sampler2D diffuseTexture;
-uniform samplerCube depthMap;
+#endif
 
 uniform vec3 lightPos;
 uniform vec3 viewPos;
 
-uniform float far_plane;
-uniform bool shadows;
-
 uniform vec3 lightIntensity;
 
-float ShadowCalculation(vec3 fragPos)
-{
-    // get vector between fragment position and light position
-    vec3 fragToLight = fragPos - lightPos;
-    // ise the fragment to light vector to sample from the depth map    
-    float closestDepth = texture(depthMap, fragToLight).r;
-    // it is currently in linear range between [0,1], let's re-transform it back to original depth value
-    closestDepth *= far_plane;
-    // now get current linear depth as the length between the fragment and light position
-    float currentDepth = length(fragToLight);
-    // test for shadows
-    // float bias = max(0.05 * (1.0 - dot(normal, lightDir)), 0.005); // Angle-dependent bias
-    float bias = 0.05;
-
-    float shadow = currentDepth -  bias > closestDepth ? 1.0 : 0.0;  
-
-    // display closestDepth as debug (to visualize depth cubemap) / Displays depthMap as grayscale
-    // FragColor = vec4(vec3(closestDepth / far_plane), 1.0);
-        
-    return shadow;
-}
+#ifdef SHADOWS
+#include "include/shadow.glsl"
+#endif
 
 void main()
 {           
+#ifdef MATERIALS
+    Material material = loadMaterial(MaterialID);
+    vec3 color = materialBaseColor(material, TexCoords).rgb;
+    // Roughness 0.5, the default, keeps the fixed highlight; rougher surfaces spread and dim it
+    float shininess = exp2(12.0 * (1.0 - material.roughness));
+    float specularWeight = clamp(2.0 * (1.0 - material.roughness), 0.0, 1.0);
+#else
     vec3 color = texture(diffuseTexture, TexCoords).rgb;
+    float shininess = 64.0;
+    float specularWeight = 1.0;
+#endif
     vec3 normal = normalize(Normal);
     vec3 lightColor = vec3(1.0, 0.8, 0.6);
     // ambient
@@ -54,10 +47,14 @@ void main()
     vec3 reflectDir = reflect(-lightDir, normal);
     float spec = 0.0;
     vec3 halfwayDir = normalize(lightDir + viewDir);  
-    spec = pow(max(dot(normal, halfwayDir), 0.0), 64.0);
-    vec3 specular = spec * lightColor;    
+    spec = pow(max(dot(normal, halfwayDir), 0.0), shininess);
+    vec3 specular = specularWeight * spec * lightColor;
     // calculate shadow
-    float shadow = shadows ? ShadowCalculation(FragPos) : 0.0;                      
+#ifdef SHADOWS
+    float shadow = ShadowCalculation(FragPos, lightPos);
+#else
+    float shadow = 0.0;
+#endif
     vec3 lighting = (ambient + (1.0 - shadow) * (diffuse + specular)) * color;    
     
     // Comment out when using depthMap as debug
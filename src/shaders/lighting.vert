@@ -2,25 +2,36 @@
 layout (location = 0) in vec3 aPos;
 layout (location = 1) in vec3 aNormal;
 layout (location = 2) in vec2 aTexCoords;
-layout (location = 3) in mat4 aInstanceMat;
 
 out vec3 FragPos;
 out vec3 Normal;
 out vec2 TexCoords;
+#ifdef MATERIALS
+flat out int MaterialID;
+#endif
 
 uniform mat4 VP;
-uniform mat4 model;
 
-uniform bool reverse_normals;
+// Positions must match prepass.vert bit for bit for the pre-pass's GL_EQUAL test
+invariant gl_Position;
+
+#include "include/instance.glsl"
 
 void main()
 {
-    FragPos = vec3((aInstanceMat * model) * vec4(aPos, 1.0));
+    vec3 worldPos = instanceWorldPosition(aPos);
+    FragPos = worldPos;
 
-    mat3 normalMatrix = transpose(inverse(mat3(aInstanceMat * model)));
-    Normal = reverse_normals ? normalMatrix * (-aNormal) : normalMatrix * aNormal;
+#ifdef REVERSE_NORMALS
+    Normal = instanceWorldNormal(-aNormal);
+#else
+    Normal = instanceWorldNormal(aNormal);
+#endif
 
 
     TexCoords = aTexCoords;
-    gl_Position = (VP * (aInstanceMat * model)) * vec4(aPos, 1.0);
+#ifdef MATERIALS
+    MaterialID = instanceMaterial();
+#endif
+    gl_Position = VP * vec4(worldPos, 1.0);
 }
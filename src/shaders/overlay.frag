@@ -0,0 +1,10 @@
+#version 330 core
+
+in vec3 color;
+
+out vec3 finalColor;
+
+void main()
+{
+	finalColor = color;
+}
@@ -0,0 +1,14 @@
+#version 330 core
+layout (location = 0) in vec3 aPos;
+
+uniform mat4 VP;
+
+// Same expression as lighting.vert; invariant so each fragment finds its own depth under GL_EQUAL
+invariant gl_Position;
+
+#include "include/instance.glsl"
+
+void main()
+{
+    gl_Position = VP * vec4(instanceWorldPosition(aPos), 1.0);
+}
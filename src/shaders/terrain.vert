@@ -0,0 +1,48 @@
+#version 330 core
+layout (location = 0) in vec2 aGrid;
+
+out vec3 FragPos;
+out vec3 Normal;
+out vec2 TexCoords;
+
+uniform mat4 VP;
+uniform vec3 viewPos;
+uniform sampler2D heightMap;
+
+// Shared by the pre-pass and lighting programs, whose positions must agree bit for bit
+invariant gl_Position;
+
+// Terrain::NodeData
+layout (std140) uniform DrawData
+{
+    vec4 node;      // corner x, corner z, size, grid quads per side
+    vec4 morph;     // morph start and end distance
+    vec4 tile;      // uv = xz * tile.x + tile.yz; tile.w is the sample spacing
+    vec4 heights;   // height = heights.x + sample * heights.y; heights.z is 1 / texture span
+};
+
+float terrainHeight(vec2 xz)
+{
+    return heights.x + textureLod(heightMap, xz * tile.x + tile.yz, 0.0).r * heights.y;
+}
+
+void main()
+{
+    vec2 grid = aGrid * node.w;
+    vec2 xz = node.xy + aGrid * node.z;
+
+    // Slide odd vertices onto the parent's grid as the node nears the end of its range
+    float cameraDistance = length(viewPos - vec3(xz.x, terrainHeight(xz), xz.y));
+    float k = clamp((cameraDistance - morph.x) / (morph.y - morph.x), 0.0, 1.0);
+    vec2 offset = fract(grid * 0.5) * 2.0;
+    xz = node.xy + (grid - offset * k) / node.w * node.z;
+
+    float spacing = tile.w;
+    float hx = terrainHeight(xz + vec2(spacing, 0.0)) - terrainHeight(xz - vec2(spacing, 0.0));
+    float hz = terrainHeight(xz + vec2(0.0, spacing)) - terrainHeight(xz - vec2(0.0, spacing));
+    Normal = normalize(vec3(-hx, 2.0 * spacing, -hz));
+
+    FragPos = vec3(xz.x, terrainHeight(xz), xz.y);
+    TexCoords = xz * heights.z + 0.5;
+    gl_Position = VP * vec4(FragPos, 1.0);
+}
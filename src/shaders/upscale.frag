@@ -0,0 +1,28 @@
+#version 330 core
+
+in vec2 uv;
+
+out vec4 finalColor;
+
+uniform sampler2D sceneTexture;
+uniform vec2 uvScale;       // part of the texture the scene was rendered into
+uniform vec2 texelSize;
+uniform float sharpness;
+
+void main()
+{
+    // Keep the bilinear taps inside the rendered region
+    vec2 limit = uvScale - 0.5 * texelSize;
+    vec2 coord = min(uv * uvScale, limit);
+    vec3 center = texture(sceneTexture, coord).rgb;
+    vec3 north = texture(sceneTexture, min(coord + vec2(0.0, texelSize.y), limit)).rgb;
+    vec3 south = texture(sceneTexture, max(coord - vec2(0.0, texelSize.y), 0.5 * texelSize)).rgb;
+    vec3 east = texture(sceneTexture, min(coord + vec2(texelSize.x, 0.0), limit)).rgb;
+    vec3 west = texture(sceneTexture, max(coord - vec2(texelSize.x, 0.0), 0.5 * texelSize)).rgb;
+
+    // Unsharp mask, clamped to the neighbourhood so edges don't ring
+    vec3 sharpened = center + sharpness * (4.0 * center - north - south - east - west);
+    vec3 low = min(center, min(min(north, south), min(east, west)));
+    vec3 high = max(center, max(max(north, south), max(east, west)));
+    finalColor = vec4(clamp(sharpened, low, high), 1.0);
+}
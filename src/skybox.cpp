@@ -1,5 +1,7 @@
 #include "skybox.h"
 #include "stb_image.h"
+#include "core/startup_trace.h"
+#include "core/frame_profiler.h"
 
 Skybox::Skybox(glm::vec3 position, glm::vec3 scale, Shader& shader) 
 	: shader(shader) {
@@ -13,14 +15,17 @@ Skybox::Skybox(glm::vec3 position, glm::vec3 scale, Shader& shader)
 	glGenBuffers(1, &this->vertexBufferID);
 	glBindBuffer(GL_ARRAY_BUFFER, this->vertexBufferID);
 	glBufferData(GL_ARRAY_BUFFER, sizeof(this->vertex_buffer_data), this->vertex_buffer_data, GL_STATIC_DRAW);
+	StartupTrace::instance().addBytesUploaded(sizeof(this->vertex_buffer_data));
 	// TODO: Create a vertex buffer object to store the UV data
 	glGenBuffers(1, &this->uvBufferID);
 	glBindBuffer(GL_ARRAY_BUFFER, this->uvBufferID);	
 	glBufferData(GL_ARRAY_BUFFER, sizeof(this->uv_buffer_data), this->uv_buffer_data, GL_STATIC_DRAW);
+	StartupTrace::instance().addBytesUploaded(sizeof(this->uv_buffer_data));
 	// Create an index buffer object to store the index data that defines triangle faces
 	glGenBuffers(1, &this->indexBufferID);
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, this->indexBufferID);
 	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(this->index_buffer_data), this->index_buffer_data, GL_STATIC_DRAW);
+	StartupTrace::instance().addBytesUploaded(sizeof(this->index_buffer_data));
 	// Create and compile our GLSL program from the shaders
 	this->shader = shader;
 	// Get a handle for our "MVP" uniform
@@ -28,6 +33,8 @@ Skybox::Skybox(glm::vec3 position, glm::vec3 scale, Shader& shader)
 }
 
 GLuint Skybox::LoadSkyboxTexture(const char *texture_file_path) {
+	StartupScope scope(texture_file_path, "texture");
+	StartupTrace::instance().addBytesRead(StartupTrace::fileSize(texture_file_path));
 	int w, h, channels;
 	uint8_t* img = stbi_load(texture_file_path, &w, &h, &channels, 3);
 	GLuint texture;
@@ -41,6 +48,7 @@ GLuint Skybox::LoadSkyboxTexture(const char *texture_file_path) {
 
 	if (img) {
 		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, w, h, 0, GL_RGB, GL_UNSIGNED_BYTE, img);
+		StartupTrace::instance().addBytesUploaded((uint64_t)w * h * 3);
 		glGenerateMipmap(GL_TEXTURE_2D);
 	} else {
 		std::cout << "Failed to load texture " << texture_file_path << std::endl;
@@ -81,6 +89,7 @@ void Skybox::render(glm::mat4 cameraMatrix) {
 		GL_UNSIGNED_INT,   // type
 		(void*)0           // element array buffer offset
 	);
+	FrameProfiler::instance().countDraw(12, 1);
 	glDisableVertexAttribArray(0);
 	glDisableVertexAttribArray(1);
     glDisableVertexAttribArray(2);
@@ -4,20 +4,65 @@
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 
 #include "static_model.h"
+#include "core/startup_trace.h"
+#include "render/command_buffer.h"
+#include "render/material_library.h"
 
 StaticModel::StaticModel(const char* modelPath, glm::mat4* modelMatrices, int amount) {
+	StartupScope scope(modelPath, "asset");
+	this->foldedMesh = -1;
+	this->animated = false;
+	this->defaultMaterial = -1;
     // Load the model
 	if (!loadModel(modelPath)) {
 		return;
 	}
-	this->modelMatrices = modelMatrices;
-	this->amount = amount;
-
-	// Prepare buffers for rendering
+	// Prepare buffers for rendering; all primitives share one transform buffer
+	StartupScope upload("upload", "upload");
+	foldNodeTransform();
+	createInstanceBuffer(modelMatrices, amount);
 	bindModel(model);
 }
 
+StaticModel::StaticModel() {
+	this->foldedMesh = -1;
+	this->animated = false;
+	this->defaultMaterial = -1;
+}
+
+void StaticModel::foldNodeTransform() {
+	this->foldedMesh = -1;
+	// Animated node transforms change every frame, so they stay per node
+	if (this->animated) {
+		return;
+	}
+	int meshNode = -1;
+	for (size_t i = 0; i < this->nodes.size(); i++) {
+		if (this->nodes.mesh[i] >= 0) {
+			if (meshNode >= 0) {
+				return;
+			}
+			meshNode = (int)i;
+		}
+	}
+	// With a single drawn node its transform goes into the instance buffer once, not into every vertex
+	if (meshNode >= 0) {
+		this->foldedMesh = this->nodes.mesh[meshNode];
+		this->instanceBase = this->restGlobals[meshNode];
+		this->inverseInstanceBase = glm::inverse(this->instanceBase);
+	}
+}
+
+void StaticModel::animate(float dt, JobSystem* jobs) {
+	if (!this->animated) {
+		return;
+	}
+	this->animation.advance(dt);
+	this->animation.evaluate(jobs);
+}
+
 bool StaticModel::loadModel(const char *filename) {
+	StartupScope scope("parse + decode", "parse");
 	tinygltf::TinyGLTF loader;
 	bool res;
 	string err;
@@ -39,6 +84,35 @@ bool StaticModel::loadModel(const char *filename) {
 		cout << "Failed to load glTF: " << filename << endl;
 	else
 		cout << "Loaded glTF: " << filename << endl;
+
+	// Account for the glTF itself and any external buffers and images it referenced
+	StartupTrace& trace = StartupTrace::instance();
+	trace.addBytesRead(StartupTrace::fileSize(filename));
+	string directory = filename;
+	size_t slash = directory.find_last_of("/\\");
+	directory = slash == string::npos ? "" : directory.substr(0, slash + 1);
+	for (size_t i = 0; i < this->model.buffers.size(); i++) {
+		if (!this->model.buffers[i].uri.empty()) {
+			trace.addBytesRead(this->model.buffers[i].data.size());
+		}
+	}
+	for (size_t i = 0; i < this->model.images.size(); i++) {
+		if (!this->model.images[i].uri.empty()) {
+			trace.addBytesRead(StartupTrace::fileSize((directory + this->model.images[i].uri).c_str()));
+		}
+	}
+
+	// Flatten the node tree once; drawing walks the arrays instead of the glTF nodes
+	this->nodes.load(this->model);
+	this->restGlobals.resize(this->nodes.size());
+	this->nodes.computeGlobals(this->nodes.rest, 0, this->restGlobals.data());
+	this->animated = this->animation.load(this->model);
+	if (this->animated) {
+		// One shared pose, playing the first clip on a loop
+		this->animation.resize(1);
+		this->animation.play(0, 0);
+		this->animation.evaluate();
+	}
 	return res;
 }
 
@@ -71,179 +145,128 @@ void StaticModel::bindPrimitive(tinygltf::Model &model, StaticModel::Primitive &
 	glGenBuffers(1, &primitive.positionVBO);
 	glBindBuffer(GL_ARRAY_BUFFER, primitive.positionVBO);
 	glBufferData(GL_ARRAY_BUFFER, positionBufferView.byteLength, &model.buffers[positionBufferView.buffer].data.at(0) +positionBufferView.byteOffset, GL_STATIC_DRAW);
+	StartupTrace::instance().addBytesUploaded(positionBufferView.byteLength);
 	// Bind normal data
 	tinygltf::Accessor normalAccessor = model.accessors[prim_gltf.attributes["NORMAL"]];
 	tinygltf::BufferView normalBufferView = model.bufferViews[normalAccessor.bufferView];
 	glGenBuffers(1, &primitive.normalVBO);
 	glBindBuffer(GL_ARRAY_BUFFER, primitive.normalVBO);
 	glBufferData(GL_ARRAY_BUFFER, normalBufferView.byteLength, &model.buffers[normalBufferView.buffer].data.at(0) +normalBufferView.byteOffset, GL_STATIC_DRAW);
+	StartupTrace::instance().addBytesUploaded(normalBufferView.byteLength);
 	// Bind texture coordinate data
 	tinygltf::Accessor texCoordAccessor = model.accessors[prim_gltf.attributes["TEXCOORD_0"]];
 	tinygltf::BufferView texCoordBufferView = model.bufferViews[texCoordAccessor.bufferView];
 	glGenBuffers(1, &primitive.texcoordVBO);
 	glBindBuffer(GL_ARRAY_BUFFER, primitive.texcoordVBO);
 	glBufferData(GL_ARRAY_BUFFER, texCoordBufferView.byteLength, &model.buffers[texCoordBufferView.buffer].data.at(0) +texCoordBufferView.byteOffset, GL_STATIC_DRAW);
+	StartupTrace::instance().addBytesUploaded(texCoordBufferView.byteLength);
 	// Bind index data
 	tinygltf::Accessor indexAccessor = model.accessors[prim_gltf.indices];
 	tinygltf::BufferView indexBufferView = model.bufferViews[indexAccessor.bufferView];
 	glGenBuffers(1, &primitive.indexVBO);
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, primitive.indexVBO);
 	glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexBufferView.byteLength, &model.buffers[indexBufferView.buffer].data.at(0) +indexBufferView.byteOffset, GL_STATIC_DRAW);
-	// Bind transform data
-	glGenBuffers(1, &primitive.transformVBO);
-	glBindBuffer(GL_ARRAY_BUFFER, primitive.transformVBO);
-	glBufferData(GL_ARRAY_BUFFER, this->amount * sizeof(glm::mat4), &this->modelMatrices[0], GL_STATIC_DRAW);
-	// Bind texture
-	if (model.textures.size() > 0) {
-      	// fixme: Use material's baseColor
-	  	tinygltf::Material &material = model.materials[prim_gltf.material];
-      	tinygltf::Parameter parameter = material.values["baseColorTexture"];
-      	tinygltf::Texture &tex = model.textures[parameter.TextureIndex()];
-      	if (tex.source > -1) {
-      	  	glGenTextures(1, &primitive.texID);
-      	  	tinygltf::Image &image = model.images[tex.source];
-      	  	glBindTexture(GL_TEXTURE_2D, primitive.texID);
-      	  	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
-      	  	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_LINEAR);
-      		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-      		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-      		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-      	  	GLenum format = GL_RGBA;
-      	  	if (image.component == 1) {
-      	  	  format = GL_RED;
-      	  	} else if (image.component == 2) {
-      	  	  format = GL_RG;
-      	  	} else if (image.component == 3) {
-      	  	  format = GL_RGB;
-      	  	} else {
-      	  	  // ???
-      	  	}
-      	  	GLenum type = GL_UNSIGNED_BYTE;
-      	  	if (image.bits == 8) {
-      	  	  // ok
-      	  	} else if (image.bits == 16) {
-      	  	  type = GL_UNSIGNED_SHORT;
-      	  	} else {
-      	  	  // ???
-      	  	}
-      	  	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, image.width, image.height, 0, format, type, &image.image.at(0));
-			glGenerateMipmap(GL_TEXTURE_2D);
-      	}
-    } else if (model.materials[prim_gltf.material].values.find("baseColorFactor") != model.materials[prim_gltf.material].values.end()) {
-        // Fallback: Use baseColorFactor as texture
-        tinygltf::Parameter parameter = model.materials[prim_gltf.material].values["baseColorFactor"];
-        glm::vec4 baseColorFactor = glm::make_vec4(parameter.ColorFactor().data());
-        GLubyte data[4] = {
-            static_cast<GLubyte>(baseColorFactor.r * 255),
-            static_cast<GLubyte>(baseColorFactor.g * 255),
-            static_cast<GLubyte>(baseColorFactor.b * 255),
-            static_cast<GLubyte>(baseColorFactor.a * 255)};
-        
-        glGenTextures(1, &primitive.texID);
-        glBindTexture(GL_TEXTURE_2D, primitive.texID);
-        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, data);
-    } else {
-        // Handle case where neither texture nor baseColorFactor is provided
-        glGenTextures(1, &primitive.texID);
-        glBindTexture(GL_TEXTURE_2D, primitive.texID);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
-    }
+	StartupTrace::instance().addBytesUploaded(indexBufferView.byteLength);
+	primitive.indexCount = (GLsizei)indexAccessor.count;
+	primitive.indexType = indexAccessor.componentType;
+	primitive.indexOffset = indexAccessor.byteOffset;
+	// The vertex array keeps the full attribute layout, so drawing only has to bind it
+	glBindBuffer(positionBufferView.target, primitive.positionVBO);
+	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(0, positionAccessor.type, positionAccessor.componentType, positionAccessor.normalized ? GL_TRUE :GL_FALSE, positionBufferView.byteStride, BUFFER_OFFSET(positionAccessor.byteOffset));
+	glBindBuffer(normalBufferView.target, primitive.normalVBO);
+	glEnableVertexAttribArray(1);
+	glVertexAttribPointer(1, normalAccessor.type, normalAccessor.componentType, normalAccessor.normalized ? GL_TRUE :GL_FALSE, normalBufferView.byteStride, BUFFER_OFFSET(normalAccessor.byteOffset));
+	glBindBuffer(texCoordBufferView.target, primitive.texcoordVBO);
+	glEnableVertexAttribArray(2);
+	glVertexAttribPointer(2, texCoordAccessor.type, texCoordAccessor.componentType, texCoordAccessor.normalized ? GL_TRUE :GL_FALSE, texCoordBufferView.byteStride, BUFFER_OFFSET(texCoordAccessor.byteOffset));
+	attachVertexArray(primitive.vao);
+	glBindVertexArray(0);
+	// Base colour and roughness live in the material library; the model binds no textures of its own
+	primitive.material = bindMaterial(model, prim_gltf.material);
+}
+
+int StaticModel::bindMaterial(tinygltf::Model &model, int material) {
+	MaterialLibrary& library = MaterialLibrary::instance();
+	if (material < 0 || material >= (int)model.materials.size()) {
+		// glTF's default material: white and fully rough
+		if (this->defaultMaterial < 0) {
+			this->defaultMaterial = library.addMaterial(glm::vec4(1.0f), -1, 1.0f);
+		}
+		return this->defaultMaterial;
+	}
+	this->materialIds.resize(model.materials.size(), -1);
+	if (this->materialIds[material] >= 0) {
+		return this->materialIds[material];
+	}
+	const tinygltf::PbrMetallicRoughness& pbr = model.materials[material].pbrMetallicRoughness;
+	int layer = -1;
+	int texture = pbr.baseColorTexture.index;
+	if (texture >= 0 && texture < (int)model.textures.size()) {
+		int source = model.textures[texture].source;
+		if (source >= 0 && source < (int)model.images.size()) {
+			// Materials sharing an image share its layer
+			this->imageLayers.resize(model.images.size(), -1);
+			if (this->imageLayers[source] < 0) {
+				tinygltf::Image &image = model.images[source];
+				this->imageLayers[source] = library.addTexture(image.image.empty() ? nullptr : &image.image[0], image.width, image.height, image.component, image.bits);
+			}
+			layer = this->imageLayers[source];
+		}
+	}
+	glm::vec4 factor(1.0f);
+	if (pbr.baseColorFactor.size() == 4) {
+		factor = glm::vec4(pbr.baseColorFactor[0], pbr.baseColorFactor[1], pbr.baseColorFactor[2], pbr.baseColorFactor[3]);
+	}
+	this->materialIds[material] = library.addMaterial(factor, layer, (float)pbr.roughnessFactor);
+	return this->materialIds[material];
 }
 
 void StaticModel::bindMesh(tinygltf::Model &model, tinygltf::Mesh &mesh, vector<StaticModel::Primitive> &primitives) {
+	// Bound in place; copying the glTF primitives would copy their attribute maps
+	primitives.resize(mesh.primitives.size());
 	for (size_t i = 0; i < mesh.primitives.size(); i++) {
-		StaticModel::Primitive primitive;
-		tinygltf::Primitive prim_gltf = mesh.primitives[i];
-		bindPrimitive(model, primitive, prim_gltf);
-		primitives.push_back(primitive);
+		bindPrimitive(model, primitives[i], mesh.primitives[i]);
 	}
 }
 void StaticModel::bindModel(tinygltf::Model &model) {
+	this->primitiveObjects.resize(model.meshes.size());
 	for (size_t i = 0; i < model.meshes.size(); i++) {
-		vector<StaticModel::Primitive> primitives;
-		tinygltf::Mesh mesh = model.meshes[i];
-		bindMesh(model, mesh, primitives);
-		this->primitiveObjects.push_back(primitives);
+		bindMesh(model, model.meshes[i], this->primitiveObjects[i]);
 	}
 }
-void StaticModel::drawPrimitives(vector<StaticModel::Primitive> &primitives, tinygltf::Model &model, tinygltf::Mesh &mesh) {
-	for (size_t i = 0; i < mesh.primitives.size(); i++) 
-	{
-		glBindVertexArray(primitives[i].vao);
-		// Bind vertex data
-		tinygltf::Accessor positionAccessor = model.accessors[mesh.primitives[i].attributes["POSITION"]];
-		tinygltf::BufferView positionBufferView = model.bufferViews[positionAccessor.bufferView];
-		glEnableVertexAttribArray(0);
-		glBindBuffer(positionBufferView.target, primitives[i].positionVBO);
-		glVertexAttribPointer(0, positionAccessor.type, positionAccessor.componentType, positionAccessor.normalized ? GL_TRUE :GL_FALSE, positionBufferView.byteStride, BUFFER_OFFSET(positionAccessor.byteOffset));
-		// Bind normal data
-		tinygltf::Accessor normalAccessor = model.accessors[mesh.primitives[i].attributes["NORMAL"]];
-		tinygltf::BufferView normalBufferView = model.bufferViews[normalAccessor.bufferView];
-		glEnableVertexAttribArray(1);
-		glBindBuffer(normalBufferView.target, primitives[i].normalVBO);
-		glVertexAttribPointer(1, normalAccessor.type, normalAccessor.componentType, normalAccessor.normalized ? GL_TRUE :GL_FALSE, normalBufferView.byteStride, BUFFER_OFFSET(normalAccessor.byteOffset));
-		// Bind texture coordinate data	
-		tinygltf::Accessor texCoordAccessor = model.accessors[mesh.primitives[i].attributes["TEXCOORD_0"]];
-		tinygltf::BufferView texCoordBufferView = model.bufferViews[texCoordAccessor.bufferView];
-		glEnableVertexAttribArray(2);
-		glBindBuffer(texCoordBufferView.target, primitives[i].texcoordVBO);
-		glVertexAttribPointer(2, texCoordAccessor.type, texCoordAccessor.componentType, texCoordAccessor.normalized ? GL_TRUE :GL_FALSE, texCoordBufferView.byteStride, BUFFER_OFFSET(texCoordAccessor.byteOffset));
-		// Bind index data
-		tinygltf::Accessor indexAccessor = model.accessors[mesh.primitives[i].indices];
-		tinygltf::BufferView indexBufferView = model.bufferViews[indexAccessor.bufferView];
-		glBindBuffer(indexBufferView.target, primitives[i].indexVBO);
-		// Bind transform data
-		glBindBuffer(GL_ARRAY_BUFFER, primitives[i].transformVBO);
-		glEnableVertexAttribArray(3);
-		glVertexAttribPointer(3, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4), (void*)0);
-		glEnableVertexAttribArray(4);
-		glVertexAttribPointer(4, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4), (void*)(sizeof(glm::vec4)));
-		glEnableVertexAttribArray(5);
-		glVertexAttribPointer(5, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4), (void*)(2 * sizeof(glm::vec4)));
-		glEnableVertexAttribArray(6);
-		glVertexAttribPointer(6, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4), (void*)(3 * sizeof(glm::vec4)));
-		glVertexAttribDivisor(3, 1);
-		glVertexAttribDivisor(4, 1);
-		glVertexAttribDivisor(5, 1);
-		glVertexAttribDivisor(6, 1);
-		// Bind texture
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, primitives[i].texID);
-		// Draw the primitive
-		glDrawElementsInstanced(GL_TRIANGLES, indexAccessor.count, indexAccessor.componentType, BUFFER_OFFSET(indexAccessor.byteOffset), this->amount);
-		glDisableVertexAttribArray(0);
-		glDisableVertexAttribArray(1);
-		glDisableVertexAttribArray(2);
-		glDisableVertexAttribArray(3);
-		glDisableVertexAttribArray(4);
-		glDisableVertexAttribArray(5);
-		glDisableVertexAttribArray(6);
-		glBindVertexArray(0);
+void StaticModel::recordPrimitives(CommandBuffer& commands, vector<StaticModel::Primitive> &primitives, const glm::mat4& transform) {
+	// The draw data carries the material, so it is only set again when that changes
+	DrawData data = DrawData::fromModel(transform);
+	int material = -1;
+	for (size_t i = 0; i < primitives.size(); i++) {
+		if (primitives[i].material != material) {
+			material = primitives[i].material;
+			data.material.x = material;
+			commands.setDrawData(&data, sizeof(data));
+		}
+		commands.bindVertexArray(primitives[i].vao);
+		commands.drawElementsInstanced(primitives[i].indexCount, primitives[i].indexType, primitives[i].indexOffset, this->amount);
 	}
 }
 
-void StaticModel::drawModelNodes(tinygltf::Model &model, tinygltf::Node &node, glm::mat4 vp, glm::mat4 parentTransform, Shader& shader) {
-	glm::mat4 globalTransform = parentTransform * getNodeTransform(node);
-	if (node.mesh >= 0 && node.mesh < model.meshes.size()) {
-		shader.setMat4("model", globalTransform);
-		drawPrimitives(this->primitiveObjects[node.mesh], model, model.meshes[node.mesh]);
+
+void StaticModel::record(CommandBuffer& commands, GLuint program, glm::mat4 transform) {
+	if (this->amount <= 0) {
+		return;
 	}
-	for (size_t i = 0; i < node.children.size(); i++) {
-		drawModelNodes(model, model.nodes[node.children[i]], vp, globalTransform, shader);
+	commands.bindProgram(program);
+	if (this->foldedMesh >= 0) {
+		// instance * base * (base^-1 * transform * base) == instance * transform * base
+		glm::mat4 drawTransform = transform == glm::mat4(1.0f) ? transform : this->inverseInstanceBase * transform * this->instanceBase;
+		recordPrimitives(commands, this->primitiveObjects[this->foldedMesh], drawTransform);
+		return;
 	}
-}
-
-void StaticModel::render(glm::mat4 vp, Shader& shader, glm::mat4 transform) {
-	const tinygltf::Scene &scene = model.scenes[model.defaultScene];
-	for (size_t i = 0; i < scene.nodes.size(); i++) {
-		tinygltf::Node &node = model.nodes[scene.nodes[i]];
-		drawModelNodes(model, node, vp, transform, shader);
+	const glm::mat4* globals = this->animated ? this->animation.globals(0) : this->restGlobals.data();
+	for (size_t i = 0; i < this->nodes.size(); i++) {
+		if (this->nodes.mesh[i] < 0) {
+			continue;
+		}
+		recordPrimitives(commands, this->primitiveObjects[this->nodes.mesh[i]], transform * globals[i]);
 	}
 }
\ No newline at end of file
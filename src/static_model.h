@@ -12,15 +12,14 @@
 #include <iostream>
 #include "tiny_gltf.h"
 #include <render/shader.h>
+#include <render/instance_set.h>
+#include <render/command_buffer.h>
+#include <scene/animation.h>
 
 using namespace std;
 
-class StaticModel {
+class StaticModel : public InstanceSet {
     public:
-        // Shader variable IDs
-        glm::mat4* modelMatrices;
-        int amount;
-
         // Model data
         tinygltf::Model model;
 
@@ -34,21 +33,42 @@ class StaticModel {
             GLuint normalVBO;
             GLuint indexVBO;
             GLuint texcoordVBO;
-            GLuint texID;
-            GLuint transformVBO;
+            int material;           // in the MaterialLibrary
+            GLsizei indexCount;
+            GLenum indexType;
+            size_t indexOffset;
         };
         vector<vector<Primitive>> primitiveObjects;
+        // Library materials of the glTF materials and layers of its images, -1 until first used
+        vector<int> materialIds;
+        vector<int> imageLayers;
+        int defaultMaterial;
+        // Mesh of the only drawn node when its transform is folded into instanceBase, else -1
+        int foldedMesh;
+        glm::mat4 inverseInstanceBase;
+        // Flattened node tree and its rest pose globals
+        NodeHierarchy nodes;
+        vector<glm::mat4> restGlobals;
+        // Node animations from the glTF; all instances share one pose
+        Animator animation;
+        bool animated;
 
         StaticModel(const char* modelPath, glm::mat4* modelMatrices, int amount);
+        // No GL objects; for tools that only parse the asset with loadModel
+        StaticModel();
         bool loadModel(const char *filename);
         glm::mat4 getNodeTransform(const tinygltf::Node& node);
+        void foldNodeTransform();
+        // Advance and evaluate the node animations, if the model has any; before recording
+        void animate(float dt, JobSystem* jobs = nullptr);
         void bindPrimitive(tinygltf::Model &model, Primitive &primitive, tinygltf::Primitive &prim_gltf);
+        // Add a glTF material and its base colour image to the MaterialLibrary, once; returns its id
+        int bindMaterial(tinygltf::Model &model, int material);
         void bindMesh(tinygltf::Model &model, tinygltf::Mesh &mesh, vector<Primitive> &primitives);
         void bindModel(tinygltf::Model &model);
-        void drawPrimitives(vector<Primitive> &primitives, tinygltf::Model &model, tinygltf::Mesh &mesh);
-        void drawDepthPrimitives(vector<Primitive> &primitives, tinygltf::Model &model, tinygltf::Mesh &mesh);
-        void drawModelNodes(tinygltf::Model &model, tinygltf::Node &node, glm::mat4 vp, glm::mat4 parentTransform, Shader& shader);
-        void render(glm::mat4 cameraMatrix, Shader& shader, glm::mat4 transform = glm::mat4(1.0f));
+        void recordPrimitives(CommandBuffer& commands, vector<Primitive> &primitives, const glm::mat4& transform);
+        // Record every node's draws; safe on a worker thread
+        void record(CommandBuffer& commands, GLuint program, glm::mat4 transform = glm::mat4(1.0f));
         void cleanup();
 };
 
@@ -1,10 +1,10 @@
 #include "surface.h"
 #include "stb_image.h"
+#include "core/startup_trace.h"
+#include "render/material_library.h"
 
 Surface::Surface(glm::mat4* modelMatrices, int amount) {
     // Define scale of the building geometry
-    this->modelMatrices = modelMatrices;
-    this->amount = amount;
     // Create a vertex array object
     glGenVertexArrays(1, &this->vertexArrayID);
     glBindVertexArray(this->vertexArrayID);
@@ -12,26 +12,42 @@ Surface::Surface(glm::mat4* modelMatrices, int amount) {
     glGenBuffers(1, &this->vertexBufferID);
     glBindBuffer(GL_ARRAY_BUFFER, this->vertexBufferID);
     glBufferData(GL_ARRAY_BUFFER, sizeof(this->vertex_buffer_data), this->vertex_buffer_data, GL_STATIC_DRAW);
+    StartupTrace::instance().addBytesUploaded(sizeof(this->vertex_buffer_data));
     // Create an index buffer object to store the index data that defines triangle faces
     glGenBuffers(1, &this->indexBufferID);
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, this->indexBufferID);
     glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(this->index_buffer_data), this->index_buffer_data, GL_STATIC_DRAW);
+    StartupTrace::instance().addBytesUploaded(sizeof(this->index_buffer_data));
     // Create a UV buffer object to store the UV data
     glGenBuffers(1, &this->uvBufferID);
     glBindBuffer(GL_ARRAY_BUFFER, this->uvBufferID);
     glBufferData(GL_ARRAY_BUFFER, sizeof(this->uv_buffer_data), this->uv_buffer_data, GL_STATIC_DRAW);
+    StartupTrace::instance().addBytesUploaded(sizeof(this->uv_buffer_data));
     // Create a normal buffer object to store the normal data
     glGenBuffers(1, &this->normalBufferID);
     glBindBuffer(GL_ARRAY_BUFFER, this->normalBufferID);
     glBufferData(GL_ARRAY_BUFFER, sizeof(this->normal_buffer_data), this->normal_buffer_data, GL_STATIC_DRAW);
+    StartupTrace::instance().addBytesUploaded(sizeof(this->normal_buffer_data));
     // Create a transform buffer object to store the model matrices
-    glGenBuffers(1, &this->transformBufferID);
-    glBindBuffer(GL_ARRAY_BUFFER, this->transformBufferID);
-    glBufferData(GL_ARRAY_BUFFER, this->amount * sizeof(glm::mat4), &this->modelMatrices[0], GL_STATIC_DRAW);
+    createInstanceBuffer(modelMatrices, amount);
+    // The vertex array keeps the full attribute layout, so drawing only has to bind it
+    glBindBuffer(GL_ARRAY_BUFFER, this->vertexBufferID);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, 0);
+    glBindBuffer(GL_ARRAY_BUFFER, this->normalBufferID);
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 0, 0);
+    glBindBuffer(GL_ARRAY_BUFFER, this->uvBufferID);
+    glEnableVertexAttribArray(2);
+    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 0, 0);
+    attachVertexArray(this->vertexArrayID);
+    glBindVertexArray(0);
     this->textureID = LoadTextureTileBox("../src/assets/textures/surface.jpg");
 }
 
 GLuint Surface::LoadTextureTileBox(const char *texture_file_path) {
+    StartupScope scope(texture_file_path, "texture");
+    StartupTrace::instance().addBytesRead(StartupTrace::fileSize(texture_file_path));
     int w, h, channels;
     uint8_t* img = stbi_load(texture_file_path, &w, &h, &channels, 3);
     GLuint texture;
@@ -46,65 +62,31 @@ GLuint Surface::LoadTextureTileBox(const char *texture_file_path) {
 
     if (img) {
         glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, w, h, 0, GL_RGB, GL_UNSIGNED_BYTE, img);
+        StartupTrace::instance().addBytesUploaded((uint64_t)w * h * 3);
         glGenerateMipmap(GL_TEXTURE_2D);
     } else {
         std::cout << "Failed to load texture " << texture_file_path << std::endl;
     }
+    // The same pixels, without decoding them again
+    MaterialLibrary& library = MaterialLibrary::instance();
+    this->material = library.addMaterial(glm::vec4(1.0f), img ? library.addTexture(img, w, h, 3) : -1, 0.5f);
     stbi_image_free(img);
 
     return texture;
 }
 
-void Surface::render(glm::mat4 cameraMatrix, Shader& shader) {
-    glBindVertexArray(this->vertexArrayID);
-
-	glEnableVertexAttribArray(0);
-	glBindBuffer(GL_ARRAY_BUFFER, this->vertexBufferID);
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, 0);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, this->indexBufferID);
-	// TODO: Model transform 
-	// -----------------------
-    shader.setMat4("model", glm::mat4(1.0f));
-    glEnableVertexAttribArray(1);
-    glBindBuffer(GL_ARRAY_BUFFER, this->normalBufferID);
-    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 0, 0);
-	// TODO: Enable UV buffer and texture sampler
-	glEnableVertexAttribArray(2);
-	glBindBuffer(GL_ARRAY_BUFFER, this->uvBufferID);
-	glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 0, 0);
-    // Bind transform data
-    glBindBuffer(GL_ARRAY_BUFFER, this->transformBufferID);
-    glEnableVertexAttribArray(3);
-    glVertexAttribPointer(3, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4), (void*)0);
-    glEnableVertexAttribArray(4);
-    glVertexAttribPointer(4, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4), (void*)(sizeof(glm::vec4)));
-    glEnableVertexAttribArray(5);
-    glVertexAttribPointer(5, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4), (void*)(2 * sizeof(glm::vec4)));
-    glEnableVertexAttribArray(6);
-    glVertexAttribPointer(6, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4), (void*)(3 * sizeof(glm::vec4)));
-    glVertexAttribDivisor(3, 1);
-    glVertexAttribDivisor(4, 1);
-    glVertexAttribDivisor(5, 1);
-    glVertexAttribDivisor(6, 1);
-	// Set textureSampler to use texture unit 0
-	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D, this->textureID); 
-	// Draw the box
-	glDrawElementsInstanced(
-		GL_TRIANGLES,      // mode
-		6,    			   // number of indices
-		GL_UNSIGNED_INT,   // type
-		(void*)0,           // element array buffer offset
-        this->amount
-	);
-	glDisableVertexAttribArray(0);
-	glDisableVertexAttribArray(1);
-    glDisableVertexAttribArray(2);
-    glDisableVertexAttribArray(3);
-    glDisableVertexAttribArray(4);
-    glDisableVertexAttribArray(5);
-    glDisableVertexAttribArray(6);
-    glBindVertexArray(0);
+void Surface::record(CommandBuffer& commands, GLuint program) {
+    if (this->amount <= 0) {
+        return;
+    }
+    DrawData data = DrawData::fromModel(glm::mat4(1.0f), this->material);
+    commands.bindProgram(program);
+    commands.bindVertexArray(this->vertexArrayID);
+    commands.setDrawData(&data, sizeof(data));
+    // Like the terrain, behind what stands on it so ties do not depend on draw order
+    commands.polygonOffset(1.0f, 4.0f);
+    commands.drawElementsInstanced(6, GL_UNSIGNED_INT, 0, this->amount);
+    commands.polygonOffset(0.0f, 0.0f);
 }
 
 void Surface::cleanup() {
@@ -113,6 +95,7 @@ void Surface::cleanup() {
     glDeleteVertexArrays(1, &vertexArrayID);
     glDeleteBuffers(1, &uvBufferID);
     glDeleteTextures(1, &textureID);
+    cleanupInstances();
 }
 
 
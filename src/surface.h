@@ -9,19 +9,19 @@
 #include "glm/gtx/transform.hpp"
 
 #include "render/shader.h"
+#include "render/instance_set.h"
+#include "render/command_buffer.h"
 
-class Surface {
+class Surface : public InstanceSet {
     public:
-    glm::mat4* modelMatrices;
-    int amount;
     // OpenGL buffers
 	GLuint vertexArrayID; 
 	GLuint vertexBufferID; 
 	GLuint indexBufferID; 
 	GLuint uvBufferID;
-	GLuint textureID;
+	GLuint textureID;           // also the terrain's and the grass's ground
+    int material;               // the same image in the MaterialLibrary, for the surface's own draws
     GLuint normalBufferID;
-    GLuint transformBufferID;
 
     GLfloat vertex_buffer_data[12] = {
         -1.0f, 1.0f, 1.0f, 
@@ -53,7 +53,8 @@ class Surface {
     };
 
     Surface(glm::mat4* modelMatrices, int amount);
-    void render(glm::mat4 cameraMatrix, Shader& shader);
+    // Record the instanced draw; safe on a worker thread
+    void record(CommandBuffer& commands, GLuint program);
     void cleanup();
 
     private:
@@ -0,0 +1,281 @@
+#include "terrain.h"
+#include "core/startup_trace.h"
+
+#include <algorithm>
+#include <cmath>
+
+using namespace std;
+
+// Tile levels needed so the finest tiles have twice the finest vertex spacing
+static int tileLevelsFor(float worldSize, float leafSize) {
+	float finestSpacing = leafSize / Terrain::GRID * 2.0f;
+	int levels = 1;
+	while (worldSize / (float)(1 << (levels - 1)) / TerrainTiles::RESOLUTION > finestSpacing * 1.5f && levels < 16) {
+		levels++;
+	}
+	return levels;
+}
+
+Terrain::Terrain(const HeightField& field, GLuint groundTexture, const char* tileDirectory, int workerCount, float worldSize, float leafSize)
+	: tiles(field, tileDirectory, -worldSize * 0.5f, worldSize, tileLevelsFor(worldSize, leafSize), workerCount), field(field) {
+	this->worldSize = worldSize;
+	this->leafSize = leafSize;
+	this->levels = 1;
+	while (leafSize * (float)(1 << (this->levels - 1)) < worldSize && this->levels < 20) {
+		this->levels++;
+	}
+	// A level's nodes must end well inside the next level's morph band; 3 leaves leaves room for the diagonal
+	this->lodDistance = leafSize * 3.0f;
+	this->morphStart = 0.66f;
+	// One repeat over the 20000 unit square the Surface quad stretched its texture across
+	this->textureSpan = 20000.0f;
+	this->groundTexture = groundTexture;
+	this->camera = glm::vec3(0.0f);
+	this->vertexArrayID = 0;
+	this->vertexBufferID = 0;
+	this->indexBufferID = 0;
+	this->quadrantIndices = 0;
+}
+
+bool Terrain::init() {
+	StartupScope scope("terrain", "asset");
+	this->ranges.resize(this->levels);
+	this->tileLevels.resize(this->levels);
+	for (int level = 0; level < this->levels; level++) {
+		this->ranges[level] = this->lodDistance * (float)(1 << level);
+		float vertexSpacing = this->leafSize * (float)(1 << level) / GRID;
+		int tileLevel = 0;
+		while (tileLevel < this->tiles.topLevel() && this->tiles.tileSize(tileLevel) / TerrainTiles::RESOLUTION < vertexSpacing) {
+			tileLevel++;
+		}
+		this->tileLevels[level] = tileLevel;
+	}
+	createPatch();
+	buildBounds();
+	return this->tiles.init();
+}
+
+void Terrain::createPatch() {
+	// (GRID + 1)^2 vertices in [0, 1]; indices grouped by quadrant so part of a node can be drawn alone
+	vector<glm::vec2> vertices;
+	for (int j = 0; j <= GRID; j++) {
+		for (int i = 0; i <= GRID; i++) {
+			vertices.push_back(glm::vec2((float)i / GRID, (float)j / GRID));
+		}
+	}
+	vector<GLushort> indices;
+	int half = GRID / 2;
+	for (int quadrant = 0; quadrant < 4; quadrant++) {
+		int i0 = (quadrant & 1) * half, j0 = (quadrant >> 1) * half;
+		for (int j = j0; j < j0 + half; j++) {
+			for (int i = i0; i < i0 + half; i++) {
+				GLushort a = (GLushort)(j * (GRID + 1) + i), b = (GLushort)(a + 1);
+				GLushort d = (GLushort)(a + GRID + 1), c = (GLushort)(d + 1);
+				// Counter-clockwise seen from above
+				GLushort quad[6] = { a, d, c, a, c, b };
+				indices.insert(indices.end(), quad, quad + 6);
+			}
+		}
+	}
+	this->quadrantIndices = half * half * 6;
+
+	glGenVertexArrays(1, &this->vertexArrayID);
+	glBindVertexArray(this->vertexArrayID);
+	glGenBuffers(1, &this->vertexBufferID);
+	glBindBuffer(GL_ARRAY_BUFFER, this->vertexBufferID);
+	glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(glm::vec2), vertices.data(), GL_STATIC_DRAW);
+	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, 0);
+	glGenBuffers(1, &this->indexBufferID);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, this->indexBufferID);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLushort), indices.data(), GL_STATIC_DRAW);
+	glBindVertexArray(0);
+	StartupTrace::instance().addBytesUploaded(vertices.size() * sizeof(glm::vec2) + indices.size() * sizeof(GLushort));
+}
+
+int Terrain::nodesPerSide(int level) const {
+	return 1 << (this->levels - 1 - level);
+}
+
+void Terrain::buildBounds() {
+	// Leaf bounds from the field at the leaf corners, padded for peaks between samples
+	int leaves = nodesPerSide(0);
+	float worldMin = -this->worldSize * 0.5f;
+	vector<float> corners((leaves + 1) * (leaves + 1));
+	for (int j = 0; j <= leaves; j++) {
+		for (int i = 0; i <= leaves; i++) {
+			corners[j * (leaves + 1) + i] = this->field.height(worldMin + i * this->leafSize, worldMin + j * this->leafSize);
+		}
+	}
+	float margin = this->field.amplitude * 0.05f;
+	this->bounds.assign(this->levels, vector<glm::vec2>());
+	this->bounds[0].resize(leaves * leaves);
+	for (int j = 0; j < leaves; j++) {
+		for (int i = 0; i < leaves; i++) {
+			const float* row = &corners[j * (leaves + 1) + i];
+			const float* next = row + leaves + 1;
+			float low = min(min(row[0], row[1]), min(next[0], next[1]));
+			float high = max(max(row[0], row[1]), max(next[0], next[1]));
+			this->bounds[0][j * leaves + i] = glm::vec2(max(low - margin, this->field.minHeight()), min(high + margin, this->field.maxHeight()));
+		}
+	}
+	// Each parent spans its four children
+	for (int level = 1; level < this->levels; level++) {
+		int count = nodesPerSide(level), child = nodesPerSide(level - 1);
+		this->bounds[level].resize(count * count);
+		for (int j = 0; j < count; j++) {
+			for (int i = 0; i < count; i++) {
+				const vector<glm::vec2>& below = this->bounds[level - 1];
+				glm::vec2 a = below[(2 * j) * child + 2 * i], b = below[(2 * j) * child + 2 * i + 1];
+				glm::vec2 c = below[(2 * j + 1) * child + 2 * i], d = below[(2 * j + 1) * child + 2 * i + 1];
+				this->bounds[level][j * count + i] = glm::vec2(min(min(a.x, b.x), min(c.x, d.x)), max(max(a.y, b.y), max(c.y, d.y)));
+			}
+		}
+	}
+}
+
+void Terrain::update(const glm::vec3& camera, const glm::mat4& viewProjection) {
+	this->camera = camera;
+	this->frustum.extract(viewProjection);
+
+	this->tiles.update();
+	selectAll();
+	// Synchronous runs draw with the tiles this frame asked for, not their fallbacks
+	if (this->tiles.synchronous && this->tiles.update()) {
+		selectAll();
+	}
+}
+
+void Terrain::selectAll() {
+	this->selected.clear();
+	if (!selectNode(this->levels - 1, 0, 0)) {
+		addNode(this->levels - 1, 0, 0, 15);
+	}
+}
+
+float Terrain::distanceTo(const glm::vec3& low, const glm::vec3& high) const {
+	glm::vec3 nearest = glm::clamp(this->camera, low, high);
+	return glm::length(nearest - this->camera);
+}
+
+bool Terrain::selectNode(int level, int x, int z) {
+	float size = this->leafSize * (float)(1 << level);
+	float worldMin = -this->worldSize * 0.5f;
+	glm::vec2 height = this->bounds[level][z * nodesPerSide(level) + x];
+	glm::vec3 low(worldMin + x * size, height.x, worldMin + z * size);
+	glm::vec3 high(low.x + size, height.y, low.z + size);
+
+	float distance = distanceTo(low, high);
+	if (distance > this->ranges[level]) {
+		return false;
+	}
+	if (!this->frustum.intersects(low, high)) {
+		return true;
+	}
+	if (level == 0 || distance > this->ranges[level - 1]) {
+		addNode(level, x, z, 15);
+		return true;
+	}
+	// Children in range draw themselves; this node covers the quadrants of the rest
+	int quadrants = 0;
+	for (int quadrant = 0; quadrant < 4; quadrant++) {
+		if (!selectNode(level - 1, 2 * x + (quadrant & 1), 2 * z + (quadrant >> 1))) {
+			quadrants |= 1 << quadrant;
+		}
+	}
+	if (quadrants != 0) {
+		addNode(level, x, z, quadrants);
+	}
+	return true;
+}
+
+void Terrain::addNode(int level, int x, int z, int quadrants) {
+	float size = this->leafSize * (float)(1 << level);
+	float worldMin = -this->worldSize * 0.5f;
+	glm::vec2 corner(worldMin + x * size, worldMin + z * size);
+
+	// The tile containing the node at the level matching its vertex spacing
+	Selected node;
+	const TerrainTile* tile = acquireTile(this->tileLevels[level], corner + glm::vec2(size * 0.5f), node.data.tile);
+	if (tile == nullptr) {
+		return;
+	}
+	node.texture = tile->texture;
+	node.quadrants = quadrants;
+	float previous = level > 0 ? this->ranges[level - 1] : 0.0f;
+	node.data.node = glm::vec4(corner.x, corner.y, size, (float)GRID);
+	node.data.morph = glm::vec4(previous + (this->ranges[level] - previous) * this->morphStart, this->ranges[level], 0.0f, 0.0f);
+	node.data.heights = heightScale();
+	this->selected.push_back(node);
+}
+
+const TerrainTile* Terrain::acquireTile(int tileLevel, const glm::vec2& point, glm::vec4& uvTransform) {
+	float worldMin = -this->worldSize * 0.5f;
+	float tileSize = this->tiles.tileSize(tileLevel);
+	int tileX = (int)floor((point.x - worldMin) / tileSize);
+	int tileZ = (int)floor((point.y - worldMin) / tileSize);
+	float priority = glm::length(glm::vec2(this->camera.x, this->camera.z) - point);
+	const TerrainTile* tile = this->tiles.acquire(tileLevel, tileX, tileZ, priority);
+	if (tile == nullptr) {
+		return nullptr;
+	}
+	// Sample i of the tile sits at origin + (i - 1) * spacing, at texel centre (i + 0.5) / SAMPLES
+	float scale = 1.0f / (tile->spacing * TerrainTiles::SAMPLES);
+	uvTransform = glm::vec4(scale, (1.5f - tile->originX / tile->spacing) / TerrainTiles::SAMPLES,
+	                        (1.5f - tile->originZ / tile->spacing) / TerrainTiles::SAMPLES, tile->spacing);
+	return tile;
+}
+
+const TerrainTile* Terrain::heightTile(float x, float z, glm::vec4& uvTransform) {
+	return acquireTile(this->tileLevels[0], glm::vec2(x, z), uvTransform);
+}
+
+glm::vec4 Terrain::heightScale() const {
+	return glm::vec4(this->field.minHeight(), this->field.maxHeight() - this->field.minHeight(), 1.0f / this->textureSpan, 0.0f);
+}
+
+glm::vec2 Terrain::groundBounds(float x, float z) const {
+	int leaves = nodesPerSide(0);
+	int i = min(max((int)floor((x + this->worldSize * 0.5f) / this->leafSize), 0), leaves - 1);
+	int j = min(max((int)floor((z + this->worldSize * 0.5f) / this->leafSize), 0), leaves - 1);
+	return this->bounds[0][j * leaves + i];
+}
+
+void Terrain::record(CommandBuffer& commands, GLuint program) {
+	if (program == 0 || this->selected.empty()) {
+		return;
+	}
+	commands.bindProgram(program);
+	commands.bindVertexArray(this->vertexArrayID);
+	commands.bindTexture(0, GL_TEXTURE_2D, this->groundTexture);
+	// Pushed back so whatever stands on the ground wins depth ties at the contact. Without
+	// it the winner depends on draw order, which GL_LESS and the pre-pass's GL_EQUAL resolve
+	// oppositely; grass is offset less, so it stays in front of the terrain
+	commands.polygonOffset(1.0f, 4.0f);
+	for (size_t i = 0; i < this->selected.size(); i++) {
+		const Selected& node = this->selected[i];
+		commands.bindTexture(TERRAIN_HEIGHT_UNIT, GL_TEXTURE_2D, node.texture);
+		commands.setDrawData(&node.data, sizeof(node.data));
+		if (node.quadrants == 15) {
+			commands.drawElementsInstanced(4 * this->quadrantIndices, GL_UNSIGNED_SHORT, 0, 1);
+			continue;
+		}
+		for (int quadrant = 0; quadrant < 4; quadrant++) {
+			if (node.quadrants & (1 << quadrant)) {
+				commands.drawElementsInstanced(this->quadrantIndices, GL_UNSIGNED_SHORT, quadrant * this->quadrantIndices * sizeof(GLushort), 1);
+			}
+		}
+	}
+	commands.polygonOffset(0.0f, 0.0f);
+}
+
+int Terrain::selectedNodes() const {
+	return (int)this->selected.size();
+}
+
+void Terrain::cleanup() {
+	glDeleteBuffers(1, &this->vertexBufferID);
+	glDeleteBuffers(1, &this->indexBufferID);
+	glDeleteVertexArrays(1, &this->vertexArrayID);
+	this->tiles.cleanup();
+}
@@ -0,0 +1,94 @@
+#ifndef TERRAIN_CLASS_H
+#define TERRAIN_CLASS_H
+
+#include <glad/gl.h>
+#include <glm/glm.hpp>
+#include <vector>
+
+#include "render/command_buffer.h"
+#include "render/frustum.h"
+#include "scene/height_field.h"
+#include "scene/terrain_tiles.h"
+
+// Texture unit the terrain binds its height map tiles to
+#define TERRAIN_HEIGHT_UNIT 2
+
+// Heightmap terrain drawn with continuous distance-dependent LOD (CDLOD).
+// A quadtree over the world picks, each frame, nodes whose size grows with
+// their distance from the camera, so the triangle count near the camera is
+// the same wherever it is. Every node draws the same grid patch, displaced
+// in the vertex shader from a streamed heightmap tile; vertices morph onto
+// the parent's grid as they approach the next LOD range, so there are no
+// seams or pops between levels. Nodes outside the view frustum are skipped
+// together with their subtrees.
+class Terrain {
+    public:
+    enum { GRID = 32 };         // patch quads per side
+
+    float worldSize;            // the world is [-worldSize / 2, worldSize / 2] on x and z
+    float leafSize;             // size of the finest nodes
+    int levels;                 // LOD levels; the root node is at levels - 1
+    float lodDistance;          // range of the finest level; each level doubles it
+    float morphStart;           // fraction of a level's range band after which vertices morph
+    float textureSpan;          // distance one repeat of the ground texture covers
+    GLuint groundTexture;
+    TerrainTiles tiles;
+
+    Terrain(const HeightField& field, GLuint groundTexture, const char* tileDirectory, int workerCount,
+            float worldSize = 65536.0f, float leafSize = 128.0f);
+
+    // Build the patch and the node height bounds and load the top tile; needs a current context
+    bool init();
+    // Stream tiles and select this frame's nodes; GL thread, before any pass records the terrain
+    void update(const glm::vec3& camera, const glm::mat4& viewProjection);
+    // Record the selected nodes; safe on a worker thread. The program must read the
+    // height map from texture unit TERRAIN_HEIGHT_UNIT.
+    void record(CommandBuffer& commands, GLuint program);
+    int selectedNodes() const;
+    // Finest wanted height tile under (x, z), or its resident fallback, with the uv transform
+    // terrain.vert uses for NodeData::tile; GL thread, after update()
+    const TerrainTile* heightTile(float x, float z, glm::vec4& uvTransform);
+    // NodeData::heights: minimum height, height range, 1 / textureSpan
+    glm::vec4 heightScale() const;
+    // Minimum and maximum height of the finest node containing (x, z)
+    glm::vec2 groundBounds(float x, float z) const;
+    void cleanup();
+
+    private:
+    // std140 DrawData block of terrain.vert
+    struct NodeData {
+        glm::vec4 node;         // corner x, corner z, size, grid quads per side
+        glm::vec4 morph;        // distances where morphing onto the parent grid starts and ends
+        glm::vec4 tile;         // height map uv = xz * tile.x + tile.yz; tile.w is the sample spacing
+        glm::vec4 heights;      // height = heights.x + sample * heights.y; heights.z is 1 / textureSpan
+    };
+    struct Selected {
+        NodeData data;
+        GLuint texture;
+        int quadrants;          // bit per child quadrant to draw; 15 is the whole node
+    };
+
+    const HeightField& field;
+    std::vector<float> ranges;                  // per level
+    std::vector<int> tileLevels;                // per level, the tile level whose spacing matches the vertices
+    std::vector<std::vector<glm::vec2> > bounds;    // per level and node, min and max height
+    std::vector<Selected> selected;
+    Frustum frustum;
+    glm::vec3 camera;
+    GLuint vertexArrayID;
+    GLuint vertexBufferID;
+    GLuint indexBufferID;
+    int quadrantIndices;
+
+    void createPatch();
+    void buildBounds();
+    void selectAll();
+    // False if the node is out of its level's range and its parent has to cover it
+    bool selectNode(int level, int x, int z);
+    void addNode(int level, int x, int z, int quadrants);
+    const TerrainTile* acquireTile(int tileLevel, const glm::vec2& point, glm::vec4& uvTransform);
+    float distanceTo(const glm::vec3& low, const glm::vec3& high) const;
+    int nodesPerSide(int level) const;
+};
+
+#endif
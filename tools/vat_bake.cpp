@@ -0,0 +1,283 @@
+// Bakes a glTF character's animations into a vertex animation for Crowd:
+// every clip is sampled at a fixed rate and the skinned (or node-animated)
+// position and normal of every vertex is stored for every frame.
+#include "static_model.h"
+#include "core/startup_trace.h"
+#include "render/vat_file.h"
+#include "scene/animation.h"
+#include "stb_image_write.h"
+
+#include <glm/gtc/type_ptr.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+using namespace std;
+
+// Bind-pose vertex data of every triangle primitive in the scene, merged into one mesh
+struct BakeMesh {
+	vector<glm::vec3> positions;
+	vector<glm::vec3> normals;
+	vector<glm::vec2> uvs;
+	vector<glm::ivec4> joints;      // flattened node indices
+	vector<glm::vec4> weights;
+	vector<int> node;               // flattened index of the node drawing each vertex
+	vector<char> skinned;           // else the vertex follows its node
+	vector<uint32_t> indices;
+	int material;
+	bool mixedMaterials;            // primitives use materials other than the baked one
+};
+
+// Flattened index of a skin's joint, -1 if the skin or the glTF node it names does not exist
+static int jointNode(const tinygltf::Model& model, const NodeHierarchy& nodes, int skinIndex, int joint) {
+	if (skinIndex < 0 || skinIndex >= (int)model.skins.size()) {
+		return -1;
+	}
+	const tinygltf::Skin& skin = model.skins[skinIndex];
+	if (joint < 0 || joint >= (int)skin.joints.size() || skin.joints[joint] < 0 || skin.joints[joint] >= (int)nodes.flatIndex.size()) {
+		return -1;
+	}
+	return nodes.flatIndex[skin.joints[joint]];
+}
+
+static bool gatherPrimitive(const tinygltf::Model& model, const NodeHierarchy& nodes, int flat, const tinygltf::Primitive& primitive, BakeMesh& mesh) {
+	if (primitive.mode != TINYGLTF_MODE_TRIANGLES) {
+		cout << "WARN: Skipping a primitive that is not a triangle list" << endl;
+		return true;
+	}
+	map<string, int>::const_iterator position = primitive.attributes.find("POSITION");
+	vector<float> values;
+	if (position == primitive.attributes.end() || !readGltfAccessor(model, position->second, 3, values)) {
+		cerr << "ERROR: A primitive has no readable POSITION" << endl;
+		return false;
+	}
+	size_t first = mesh.positions.size();
+	size_t count = values.size() / 3;
+	for (size_t i = 0; i < count; i++) {
+		mesh.positions.push_back(glm::make_vec3(&values[i * 3]));
+	}
+	mesh.normals.resize(first + count, glm::vec3(0.0f, 1.0f, 0.0f));
+	mesh.uvs.resize(first + count, glm::vec2(0.0f));
+	mesh.joints.resize(first + count, glm::ivec4(-1));
+	mesh.weights.resize(first + count, glm::vec4(1.0f, 0.0f, 0.0f, 0.0f));
+	mesh.node.resize(first + count, flat);
+	mesh.skinned.resize(first + count, 0);
+
+	map<string, int>::const_iterator attribute = primitive.attributes.find("NORMAL");
+	if (attribute != primitive.attributes.end() && readGltfAccessor(model, attribute->second, 3, values) && values.size() == count * 3) {
+		for (size_t i = 0; i < count; i++) {
+			mesh.normals[first + i] = glm::make_vec3(&values[i * 3]);
+		}
+	}
+	attribute = primitive.attributes.find("TEXCOORD_0");
+	if (attribute != primitive.attributes.end() && readGltfAccessor(model, attribute->second, 2, values) && values.size() == count * 2) {
+		for (size_t i = 0; i < count; i++) {
+			mesh.uvs[first + i] = glm::make_vec2(&values[i * 2]);
+		}
+	}
+
+	// Skinned vertices blend up to four joints; the rest follow their node
+	int skinIndex = model.nodes[nodes.source[flat]].skin;
+	attribute = primitive.attributes.find("JOINTS_0");
+	map<string, int>::const_iterator weightAttribute = primitive.attributes.find("WEIGHTS_0");
+	vector<float> weights;
+	if (skinIndex >= 0 && skinIndex < (int)model.skins.size() && attribute != primitive.attributes.end() && weightAttribute != primitive.attributes.end() &&
+	    readGltfAccessor(model, attribute->second, 4, values) && readGltfAccessor(model, weightAttribute->second, 4, weights) &&
+	    values.size() == count * 4 && weights.size() == count * 4) {
+		for (size_t i = 0; i < count; i++) {
+			glm::vec4 weight = glm::make_vec4(&weights[i * 4]);
+			float sum = weight.x + weight.y + weight.z + weight.w;
+			mesh.weights[first + i] = sum > 0.0f ? weight / sum : glm::vec4(1.0f, 0.0f, 0.0f, 0.0f);
+			mesh.skinned[first + i] = 1;
+			for (int j = 0; j < 4; j++) {
+				int node = jointNode(model, nodes, skinIndex, (int)values[i * 4 + j]);
+				mesh.joints[first + i][j] = node;
+				if (node < 0) {
+					mesh.weights[first + i][j] = 0.0f;
+				}
+			}
+		}
+	}
+
+	if (primitive.indices >= 0) {
+		if (!readGltfAccessor(model, primitive.indices, 1, values)) {
+			cerr << "ERROR: A primitive has unreadable indices" << endl;
+			return false;
+		}
+		for (size_t i = 0; i < values.size(); i++) {
+			mesh.indices.push_back((uint32_t)(first + (size_t)values[i]));
+		}
+	} else {
+		for (size_t i = 0; i < count; i++) {
+			mesh.indices.push_back((uint32_t)(first + i));
+		}
+	}
+	if (mesh.material < 0) {
+		mesh.material = primitive.material;
+	} else if (primitive.material != mesh.material) {
+		mesh.mixedMaterials = true;
+	}
+	return true;
+}
+
+// Inverse bind matrices of every skinned node, keyed by the joint's flattened index
+static void readInverseBinds(const tinygltf::Model& model, const NodeHierarchy& nodes, vector<glm::mat4>& inverseBind) {
+	inverseBind.assign(nodes.size(), glm::mat4(1.0f));
+	for (size_t s = 0; s < model.skins.size(); s++) {
+		const tinygltf::Skin& skin = model.skins[s];
+		vector<float> values;
+		bool hasMatrices = readGltfAccessor(model, skin.inverseBindMatrices, 16, values) && values.size() >= skin.joints.size() * 16;
+		for (size_t j = 0; j < skin.joints.size(); j++) {
+			int node = jointNode(model, nodes, (int)s, (int)j);
+			if (node >= 0 && hasMatrices) {
+				inverseBind[node] = glm::make_mat4(&values[j * 16]);
+			}
+		}
+	}
+}
+
+static void bakeFrame(const BakeMesh& mesh, const glm::mat4* globals, const vector<glm::mat4>& inverseBind, glm::vec3* positions, glm::vec3* normals) {
+	for (size_t v = 0; v < mesh.positions.size(); v++) {
+		glm::mat4 transform = globals[mesh.node[v]];
+		if (mesh.skinned[v]) {
+			// glTF ignores the skinned node's own transform; joints carry the whole placement
+			const glm::ivec4& joints = mesh.joints[v];
+			const glm::vec4& weights = mesh.weights[v];
+			transform = glm::mat4(0.0f);
+			for (int j = 0; j < 4; j++) {
+				if (joints[j] >= 0 && weights[j] > 0.0f) {
+					transform += weights[j] * (globals[joints[j]] * inverseBind[joints[j]]);
+				}
+			}
+		}
+		positions[v] = glm::vec3(transform * glm::vec4(mesh.positions[v], 1.0f));
+		glm::vec3 normal = glm::transpose(glm::inverse(glm::mat3(transform))) * mesh.normals[v];
+		float length = glm::length(normal);
+		normals[v] = length > 0.0f ? normal / length : glm::vec3(0.0f, 1.0f, 0.0f);
+	}
+}
+
+static bool writeBaseColor(const tinygltf::Model& model, int material, const string& path) {
+	vector<unsigned char> pixels(4, 255);
+	int width = 1, height = 1;
+	if (material >= 0 && material < (int)model.materials.size()) {
+		const tinygltf::PbrMetallicRoughness& pbr = model.materials[material].pbrMetallicRoughness;
+		int texture = pbr.baseColorTexture.index;
+		int source = texture >= 0 && texture < (int)model.textures.size() ? model.textures[texture].source : -1;
+		if (source >= 0 && source < (int)model.images.size() && !model.images[source].image.empty() &&
+		    model.images[source].component == 4 && model.images[source].bits == 8) {
+			const tinygltf::Image& image = model.images[source];
+			pixels = image.image;
+			width = image.width;
+			height = image.height;
+		} else {
+			for (int c = 0; c < 4 && c < (int)pbr.baseColorFactor.size(); c++) {
+				pixels[c] = (unsigned char)(min(max(pbr.baseColorFactor[c], 0.0), 1.0) * 255.0 + 0.5);
+			}
+		}
+	}
+	if (!stbi_write_png(path.c_str(), width, height, 4, pixels.data(), width * 4)) {
+		cerr << "ERROR: Could not write " << path << endl;
+		return false;
+	}
+	return true;
+}
+
+int main(int argc, char* argv[]) {
+	const char* inputPath = nullptr;
+	const char* outputPath = nullptr;
+	float fps = 30.0f;
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--fps") == 0 && i + 1 < argc) {
+			fps = max(1.0f, (float)atof(argv[++i]));
+		} else if (inputPath == nullptr && argv[i][0] != '-') {
+			inputPath = argv[i];
+		} else if (outputPath == nullptr && argv[i][0] != '-') {
+			outputPath = argv[i];
+		} else {
+			inputPath = nullptr;
+			break;
+		}
+	}
+	if (inputPath == nullptr || outputPath == nullptr) {
+		cout << "Usage: emerald_vat_bake <input.gltf|glb> <output.vat> [--fps <frames per second>]" << endl;
+		return 1;
+	}
+	StartupTrace::instance().active = false;
+
+	StaticModel asset;
+	if (!asset.loadModel(inputPath)) {
+		return 1;
+	}
+	const tinygltf::Model& model = asset.model;
+	Animator animator;
+	if (!animator.load(model)) {
+		cout << "WARN: " << inputPath << " has no animations; baking its rest pose" << endl;
+	}
+	const NodeHierarchy& nodes = animator.hierarchy;
+
+	BakeMesh mesh;
+	mesh.material = -1;
+	mesh.mixedMaterials = false;
+	for (size_t i = 0; i < nodes.size(); i++) {
+		if (nodes.mesh[i] < 0) {
+			continue;
+		}
+		const tinygltf::Mesh& gltfMesh = model.meshes[nodes.mesh[i]];
+		for (size_t p = 0; p < gltfMesh.primitives.size(); p++) {
+			if (!gatherPrimitive(model, nodes, (int)i, gltfMesh.primitives[p], mesh)) {
+				return 1;
+			}
+		}
+	}
+	if (mesh.positions.empty()) {
+		cerr << "ERROR: " << inputPath << " has no triangles to bake" << endl;
+		return 1;
+	}
+	if (mesh.mixedMaterials) {
+		cout << "WARN: " << inputPath << " uses several materials; only the first one's base colour is baked" << endl;
+	}
+	vector<glm::mat4> inverseBind;
+	readInverseBinds(model, nodes, inverseBind);
+
+	VatData vat;
+	vat.vertexCount = (uint32_t)mesh.positions.size();
+	vat.uvs = mesh.uvs;
+	vat.indices = mesh.indices;
+	vat.frameCount = 0;
+	// Looping clips are sampled over [0, duration): the last frame blends back into the first
+	for (int c = 0; c < max((int)animator.clips.size(), 1); c++) {
+		VatClip clip;
+		clip.name = animator.clips.empty() ? "rest" : animator.clips[c].name;
+		float duration = animator.clips.empty() ? 0.0f : animator.clips[c].duration;
+		clip.firstFrame = vat.frameCount;
+		clip.frameCount = duration > 0.0f ? (uint32_t)max(1.0f, floor(duration * fps + 0.5f)) : 1;
+		clip.fps = duration > 0.0f ? clip.frameCount / duration : fps;
+		clip.loop = true;
+		vat.clips.push_back(clip);
+		vat.frameCount += clip.frameCount;
+	}
+	vat.positions.resize((size_t)vat.vertexCount * vat.frameCount);
+	vat.normals.resize(vat.positions.size());
+
+	animator.resize(1);
+	for (size_t c = 0; c < vat.clips.size(); c++) {
+		const VatClip& clip = vat.clips[c];
+		for (uint32_t f = 0; f < clip.frameCount; f++) {
+			animator.play(0, animator.clips.empty() ? -1 : (int)c, f / clip.fps, 1.0f, false);
+			animator.evaluate();
+			size_t offset = (size_t)(clip.firstFrame + f) * vat.vertexCount;
+			bakeFrame(mesh, animator.globals(0), inverseBind, &vat.positions[offset], &vat.normals[offset]);
+		}
+		cout << "Baked '" << clip.name << "': " << clip.frameCount << " frames at " << clip.fps << " fps" << endl;
+	}
+
+	if (!vat.write(outputPath) || !writeBaseColor(model, mesh.material, string(outputPath) + ".png")) {
+		return 1;
+	}
+	cout << "Wrote " << outputPath << ": " << vat.vertexCount << " vertices, " << vat.indices.size() / 3 << " triangles, "
+	     << vat.frameCount << " frames (" << (uint64_t)vat.vertexCount * vat.frameCount * 12 / 1024 << " KiB on the GPU)" << endl;
+	return 0;
+}